@@ -39,6 +39,14 @@ internal static unsafe partial class FriedApiInternal
     [return: MarshalAs(UnmanagedType.Bool)]
     public static partial bool LoadFRIED(byte* data, int size, out int xout, out int yout, out int outSize, out byte* dataout);
     
+    [LibraryImport(Name)]
+    [return: MarshalAs(UnmanagedType.Bool)]
+    public static partial bool FRIED_GetInfo(byte* data, int size, int scale, out int xout, out int yout, out int bytesPerPixel);
+
+    [LibraryImport(Name)]
+    [return: MarshalAs(UnmanagedType.Bool)]
+    public static partial bool LoadFRIEDInto(byte* data, int size, byte* dst, int dstPitch, long dstCapacity, [MarshalAs(UnmanagedType.U1)] bool bottomUp, void* decodeParams, out int xout, out int yout);
+    
     [LibraryImport(Name)]
     public static partial byte* SaveFRIED(byte* image, int xsize, int ysize, int flags, byte quality, ref int outsize);
     
@@ -6,4 +6,7 @@ public enum FriedFlags
     FRIED_DEFAULT =         0x0000,
     FRIED_GRAYSCALE =       0x0001,
     FRIED_SAVEALPHA =       0x0002,
+    FRIED_CHROMASUBSAMPLE = 0x0004,
+    FRIED_LOSSLESS =        0x0008,
+    FRIED_PROGRESSIVE =     0x0010,
 }
\ No newline at end of file
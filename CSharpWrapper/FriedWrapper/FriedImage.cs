@@ -39,6 +39,26 @@ public unsafe class FriedImage : IDisposable
         return new DeFriedImage(xsize, ysize, outSize,dataout);
     }
     
+    // size of the decoded image, for the buffer of DeFryInto
+    public bool GetInfo(out int xsize, out int ysize, out int bytesPerPixel)
+    {
+        return FriedApiInternal.FRIED_GetInfo(GetFriedImagePointer(), _outSize, 1, out xsize, out ysize, out bytesPerPixel);
+    }
+
+    // decodes straight into destination, rows pitch bytes apart (0 = tightly packed)
+    public bool DeFryInto(Span<byte> destination, int pitch, bool bottomUp, out int xsize, out int ysize)
+    {
+        fixed (byte* dst = &destination.GetPinnableReference())
+            return FriedApiInternal.LoadFRIEDInto(GetFriedImagePointer(), _outSize, dst, pitch, destination.Length, bottomUp, null, out xsize, out ysize);
+    }
+
+    private byte* GetFriedImagePointer()
+    {
+        return _friedImage == null
+            ? throw new ObjectDisposedException(nameof(FriedImage))
+            : _friedImage;
+    }
+
     [MethodImpl(MethodImplOptions.AggressiveInlining)]
     public Span<byte> GetFriedImageData()
     {
@@ -7,81 +7,78 @@
 #ifndef __BITBUFFER_HPP__
 #define __BITBUFFER_HPP__
 
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
 namespace FRIED
 {
-  // encoder
+  // encoder. bits are collected msb first in a 64-bit accumulator and
+  // written 32 at a time. output past the end of the buffer is dropped,
+  // so a full buffer holds a prefix of the complete stream.
   class BitEncoder
   {
-	  uint8_t *bp;
-	  int32_t length;
-	  int32_t acck;
-	  int32_t accb;
-	  int32_t nbytes;
+    uint8_t *Bytes;
+    uint8_t *BytePtr;
+    uint8_t *ByteEnd;
+    uint64_t Bits;
+    int32_t BitFill;
 
-  public:
-    void Init(uint8_t *bytes,int32_t len)
+    void PutTail(uint32_t word,int32_t nBytes)
     {
-      bp = bytes;
-      length = len;
-      nbytes = 0;
-      acck = 0;
-      accb = 0;
+      while(nBytes-- > 0 && BytePtr < ByteEnd)
+      {
+        *BytePtr++ = uint8_t(word >> 24);
+        word <<= 8;
+      }
     }
 
-    void Flush()
+  public:
+    void Init(uint8_t *bytes,int32_t len)
     {
-      if(acck)
-        PutBits(0,8-acck);
-
-      acck = 0;
-      accb = 0;
+      Bytes = bytes;
+      BytePtr = bytes;
+      ByteEnd = bytes + (len > 0 ? len : 0);
+      Bits = 0;
+      BitFill = 0;
     }
 
-    void PutByte(int32_t code)
+    void Flush()
     {
-      static const int32_t mask[8] = { 0,1,3,7,15,31,63,127 };
+      // pad with zeros to a full byte
+      PutTail(uint32_t(Bits << (32 - BitFill)),(BitFill + 7) >> 3);
 
-      if(nbytes < length)
-      {
-        code &= 0xff;
-        *bp++ = (accb << (8 - acck)) | (code >> acck);
-        accb = code & mask[acck];
-        nbytes++;
-      }
+      Bits = 0;
+      BitFill = 0;
     }
 
-    void PutBits(int32_t code,int32_t nb)
+    // writes the low nb bits of code, nb <= 32
+    inline void PutBits(uint32_t code,int32_t nb)
     {
-      static const int32_t mask[8] = { 0,1,3,7,15,31,63,127 };
+      Bits = (Bits << nb) | (code & ((uint64_t(1) << nb) - 1));
+      BitFill += nb;
 
-      if(nbytes < length)
+      if(BitFill >= 32)
       {
-        while(nb >= 8)
-        {
-          nb -= 8;
-          PutByte(code >> nb);
-        }
+        BitFill -= 32;
+        uint32_t word = uint32_t(Bits >> BitFill);
 
-        if(nb)
+        if(ByteEnd - BytePtr >= 4)
         {
-          code &= mask[nb];
-          acck += nb;
-          accb = (accb << nb) | code;
-
-          if(acck >= 8)
-          {
-            acck -= 8;
-            *bp++ = accb >> acck;
-            accb &= mask[acck];
-            nbytes++;
-          }
+          BytePtr[0] = uint8_t(word >> 24);
+          BytePtr[1] = uint8_t(word >> 16);
+          BytePtr[2] = uint8_t(word >>  8);
+          BytePtr[3] = uint8_t(word);
+          BytePtr += 4;
         }
+        else
+          PutTail(word,4);
       }
     }
 
     int32_t BytesWritten() const
     {
-      return nbytes;
+      return int32_t(BytePtr - Bytes);
     }
   };
 
@@ -138,40 +135,72 @@ namespace FRIED
   };
 #endif
 
-  // decoder.
+  // number of leading zero bits, x != 0
+  static inline int32_t countLeadingZeros64(uint64_t x)
+  {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+    unsigned long index;
+    _BitScanReverse64(&index,x);
+    return 63 - int32_t(index);
+#elif defined(_MSC_VER)
+    unsigned long index;
+    if(_BitScanReverse(&index,uint32_t(x >> 32)))
+      return 31 - int32_t(index);
+    _BitScanReverse(&index,uint32_t(x));
+    return 63 - int32_t(index);
+#else
+    return __builtin_clzll(x);
+#endif
+  }
+
+  // decoder. the 64-bit buffer is refilled to 56..63 bits once it drops
+  // below 32, so there are always at least 32 bits to read after a
+  // Refill(). past the end of the input it reads zeros instead of memory.
   class BitDecoder
   {
     const uint8_t *Bytes;
-    const uint8_t *BytePtr;
-    const uint8_t *ByteEnd;
-    uint32_t Bits;
+    int32_t BytePos;
+    int32_t Length;
+    uint64_t Bits;
     int32_t BitFill;
 
-    uint32_t Mask[25];
-
-    inline void Refill()
-    {
-      while(BitFill <= 24)
-      {
-        Bits = (Bits << 8) | *BytePtr;
-        BytePtr++;
-        BitFill += 8;
-      }
-    }
-
   public:
     void Init(const uint8_t *bytes,int32_t length)
     {
       Bytes = bytes;
-      BytePtr = Bytes;
-      ByteEnd = Bytes + length;
+      BytePos = 0;
+      Length = length > 0 ? length : 0;
 
       Bits = 0;
       BitFill = 0;
       Refill();
+    }
 
-      for(int32_t i=0;i<=24;i++)
-        Mask[i] = (1 << i) - 1;
+    inline void Refill()
+    {
+      if(BitFill >= 32)
+        return;
+
+      if(Length - BytePos >= 8)
+      {
+        const uint8_t *p = Bytes + BytePos;
+        uint64_t word = (uint64_t(p[0]) << 56) | (uint64_t(p[1]) << 48) | (uint64_t(p[2]) << 40) | (uint64_t(p[3]) << 32)
+          | (uint64_t(p[4]) << 24) | (uint64_t(p[5]) << 16) | (uint64_t(p[6]) << 8) | uint64_t(p[7]);
+        int32_t n = (63 - BitFill) >> 3;
+
+        Bits = (Bits << (n * 8)) | (word >> (64 - n * 8));
+        BytePos += n;
+        BitFill += n * 8;
+      }
+      else
+      {
+        while(BitFill < 56)
+        {
+          Bits = (Bits << 8) | (BytePos < Length ? Bytes[BytePos] : 0);
+          BytePos++;
+          BitFill += 8;
+        }
+      }
     }
 
     inline void SkipBitsNoCheck(int32_t nBits)
@@ -187,17 +216,44 @@ namespace FRIED
 
     inline uint32_t PeekBits(int32_t nBits)
     {
-      return (Bits >> (BitFill - nBits)) & Mask[nBits];
+      return uint32_t(Bits >> (BitFill - nBits)) & ((1u << nBits) - 1);
+    }
+
+    // the buffered bits, msb aligned (zeros below)
+    inline uint64_t PeekTop() const
+    {
+      return Bits << (64 - BitFill);
+    }
+
+    // number of 1 (0) bits before the next 0 (1) bit. only buffered bits
+    // are counted: a result of BitsBuffered() means the run may go on.
+    inline int32_t LeadingOnes()
+    {
+      // the bits below the buffered ones are shifted-in zeros, so there
+      // always is a 0 bit
+      return countLeadingZeros64(~(Bits << (64 - BitFill)));
+    }
+
+    inline int32_t LeadingZeros()
+    {
+      uint64_t top = Bits << (64 - BitFill);
+      int32_t n = top ? countLeadingZeros64(top) : 64;
+      return n < BitFill ? n : BitFill;
+    }
+
+    inline int32_t BitsBuffered() const
+    {
+      return BitFill;
     }
 
     inline uint32_t GetBitsNoCheck(int32_t nBits)
     {
-      return (Bits >> (BitFill -= nBits)) & Mask[nBits];
+      return uint32_t(Bits >> (BitFill -= nBits)) & ((1u << nBits) - 1);
     }
 
     inline uint32_t GetBits(int32_t nBits)
     {
-      uint32_t val = (Bits >> (BitFill -= nBits)) & Mask[nBits];
+      uint32_t val = GetBitsNoCheck(nBits);
       Refill();
 
       return val;
@@ -205,7 +261,7 @@ namespace FRIED
 
     int32_t BytesRead() const
     {
-      return int32_t(BytePtr - Bytes) - (BitFill >> 3);
+      return BytePos - (BitFill >> 3);
     }
   };
 }
@@ -4,160 +4,185 @@
 // decoding functions.
 #include "fried.hpp"
 #include "fried_internal.hpp"
+#include "simd.hpp"
+#include "workerpool.hpp"
 
 //#include <crtdbg.h>
 
 namespace FRIED
 {
-  static void writeBitmapRow(DecodeContext &ctx,int32_t row,int16_t *srp)
+  static void convertRow(DecodeContext &ctx,int32_t cols,int32_t colsPad,const int16_t *src,uint8_t *dst)
   {
-    if(row < 0 || row >= ctx.FH.YRes)
-      return;
+    FRIED_STAT(double t = statsTime(ctx.Stats));
 
-    int32_t cols = ctx.FH.XRes;
-    int32_t colsPad = ctx.XResPadded;
-    uint8_t *dst = ctx.Image;
-
-    if(ctx.ChannelSetup < 2) // grayscale
+    if(ctx.Lossless)
+      lossless_convert_inv(cols,colsPad,src,dst,ctx.ChannelSetup >= 2,(ctx.ChannelSetup & 1) != 0);
+    else if(ctx.ChannelSetup < 2) // grayscale
     {
-      dst += row * 2 * cols;
-
       if(ctx.ChannelSetup == 0)
-        gray_x_convert_inv(cols,colsPad,srp,dst);
+        gray_x_convert_inv(cols,colsPad,src,dst);
       else
-        gray_alpha_convert_inv(cols,colsPad,srp,dst);
+        gray_alpha_convert_inv(cols,colsPad,src,dst);
     }
     else
     {
-      dst += row * 4 * cols;
-
       if(ctx.ChannelSetup == 2)
-        color_x_convert_inv(cols,colsPad,srp,dst);
+        color_x_convert_inv(cols,colsPad,src,dst);
       else if(ctx.ChannelSetup == 3)
-        color_alpha_convert_inv(cols,colsPad,srp,dst);
+        color_alpha_convert_inv(cols,colsPad,src,dst);
     }
 
-    // TODO: write the corresponding row using the correct innerloop
+    FRIED_STAT(addTime(ctx.Stats,&FRIED_Stats::ColorTime,t));
   }
 
+  // where row y of the output rectangle goes in ctx.Image (0 if there's no
+  // image, as for the chroma plane)
+  static uint8_t *imageRow(const DecodeContext &ctx,int32_t y)
+  {
+    intptr_t pitch = ctx.ImagePitch ? ctx.ImagePitch : intptr_t(ctx.ChannelSetup < 2 ? 2 : 4) * ctx.OutW;
+    return ctx.Image ? ctx.Image + y * pitch : 0;
+  }
 
-// Simulate MMX registers (each holding 4 int16_t values)
-    typedef struct {
-        int16_t w[4];
-    } MMXReg;
-
-/**
- * Emulates the MMX load operations from the original macro
- * Loads 4 registers (64 bits each) from 4 source pointers with an offset
- */
-    static void mm_load4(MMXReg *reg0, MMXReg *reg1, MMXReg *reg2, MMXReg *reg3,
-                         int16_t *c0, int16_t *c1, int16_t *c2, int16_t *c3, int offset) {
-        // Convert byte offset to 16-bit element offset
-        int elemOffset = offset / sizeof(int16_t);
-
-        // Load 4 consecutive int16_t values (64 bits) from each source
-        memcpy(reg0->w, c0 + elemOffset, sizeof(MMXReg));
-        memcpy(reg1->w, c1 + elemOffset, sizeof(MMXReg));
-        memcpy(reg2->w, c2 + elemOffset, sizeof(MMXReg));
-        memcpy(reg3->w, c3 + elemOffset, sizeof(MMXReg));
-    }
+  // row r of chroma channel ch (0=Co, 1=Cg) of the decoded chroma
+  static const int16_t *chromaRow(const DecodeContext &ctx,int32_t r,int32_t ch)
+  {
+    return ctx.Chroma + intptr_t((r - ctx.ChromaY) % ctx.ChromaRows * 2 + ch) * ctx.ChromaW;
+  }
 
-/**
- * Emulates the MMX store operations from the original macro
- * Stores 4 registers to calculated destination addresses
- */
-    static void mm_store4(MMXReg *reg0, MMXReg *reg1, MMXReg *reg2, MMXReg *reg3,
-                          int16_t **dest, int32_t xOffs, uint8_t rc0, uint8_t rc1, uint8_t rc2, uint8_t rc3) {
-        // Calculate destination pointers as in the original macro
-        int16_t *dst0 = dest[(rc0 >> 4)] + xOffs + (rc0 & 0xf);
-        int16_t *dst1 = dest[(rc1 >> 4)] + xOffs + (rc1 & 0xf);
-        int16_t *dst2 = dest[(rc2 >> 4)] + xOffs + (rc2 & 0xf);
-        int16_t *dst3 = dest[(rc3 >> 4)] + xOffs + (rc3 & 0xf);
+  // outputs row row (output coordinates) from the channels in src, cols
+  // values from column OutX on, colsPad apart. the chroma plane keeps its
+  // rows in Plane; the main plane of a subsampled file merges them in,
+  // upsampled, before the color conversion to dst.
+  static void outputRow(DecodeContext &ctx,int32_t row,int32_t cols,int32_t colsPad,const int16_t *src,uint8_t *dst)
+  {
+    if(ctx.Plane)
+    {
+      int16_t *out = ctx.Plane + intptr_t(row - ctx.OutY) * 2 * cols;
 
-        // Store 4 consecutive int16_t values (64 bits) to each destination
-        memcpy(dst0, reg0->w, sizeof(MMXReg));
-        memcpy(dst1, reg1->w, sizeof(MMXReg));
-        memcpy(dst2, reg2->w, sizeof(MMXReg));
-        memcpy(dst3, reg3->w, sizeof(MMXReg));
+      sCopyMem(out,src,cols * sizeof(int16_t));
+      sCopyMem(out + cols,src + colsPad,cols * sizeof(int16_t));
+      return;
     }
 
-/**
- * Emulates the MMX transpose operations from the original macro
- * Transposes a 4x4 matrix of 16-bit values stored in 4 MMX registers
- */
-    static void mm_transpose(MMXReg *reg0, MMXReg *reg1, MMXReg *reg2, MMXReg *reg3,
-                             MMXReg *reg4, MMXReg *) {
-        // Temporary registers to hold intermediate values
-        MMXReg tmp0, tmp1, tmp2, tmp3, tmp4, tmp5;
+    if(ctx.Subsampled)
+    {
+      int16_t *line = ctx.Line;
+      int32_t near = sMin(row >> 1,ctx.ChromaYRes - 1);
+      int32_t far = sMin(sMax((row & 1) ? near + 1 : near - 1,0),ctx.ChromaYRes - 1);
+
+      FRIED_STAT(double t = statsTime(ctx.Stats));
+      sCopyMem(line,src,cols * sizeof(int16_t));
+      if(ctx.FH.Channels > 1) // alpha
+        sCopyMem(line + 3 * cols,src + colsPad,cols * sizeof(int16_t));
 
-        // Copy values to preserve originals as needed
-        memcpy(&tmp4, reg0, sizeof(MMXReg));
-        memcpy(&tmp5, reg2, sizeof(MMXReg));
+      for(int32_t ch=0;ch<2;ch++)
+        chroma_upsample(ctx.OutX,cols,ctx.ChromaXRes,chromaRow(ctx,near,ch),chromaRow(ctx,far,ch),ctx.ChromaX,line + (ch + 1) * cols);
+      FRIED_STAT(addTime(ctx.Stats,&FRIED_Stats::ColorTime,t));
 
-        // punpcklwd - unpack and interleave low words
-        tmp0.w[0] = reg0->w[0]; tmp0.w[1] = reg1->w[0];
-        tmp0.w[2] = reg0->w[1]; tmp0.w[3] = reg1->w[1];
+      src = line;
+      colsPad = cols;
+    }
+
+    convertRow(ctx,cols,colsPad,src,dst);
+  }
 
-        // punpckhwd - unpack and interleave high words
-        tmp4.w[0] = reg0->w[2]; tmp4.w[1] = reg1->w[2];
-        tmp4.w[2] = reg0->w[3]; tmp4.w[3] = reg1->w[3];
+  static void writeBitmapRow(DecodeContext &ctx,int32_t row,int16_t *srp)
+  {
+    if(row < ctx.OutY || row >= ctx.OutY + ctx.OutH)
+      return;
 
-        // punpcklwd for reg2/reg3
-        tmp2.w[0] = reg2->w[0]; tmp2.w[1] = reg3->w[0];
-        tmp2.w[2] = reg2->w[1]; tmp2.w[3] = reg3->w[1];
+    // only the output rectangle gets written
+    int32_t cols = ctx.OutW;
+    int32_t colsPad = ctx.ColEnd - ctx.ColFirst;
 
-        // punpckhwd for reg2/reg3 (using tmp5 which was set to reg2)
-        tmp5.w[0] = reg2->w[2]; tmp5.w[1] = reg3->w[2];
-        tmp5.w[2] = reg2->w[3]; tmp5.w[3] = reg3->w[3];
+    outputRow(ctx,row,cols,colsPad,srp + ctx.OutX - ctx.ColFirst,imageRow(ctx,row - ctx.OutY));
 
-        // Copy tmp0 and tmp4
-        memcpy(&tmp1, &tmp0, sizeof(MMXReg));
-        memcpy(&tmp3, &tmp4, sizeof(MMXReg));
+    // TODO: write the corresponding row using the correct innerloop
+  }
 
-        // punpckldq - unpack and interleave low double words
-        reg0->w[0] = tmp0.w[0]; reg0->w[1] = tmp0.w[1];
-        reg0->w[2] = tmp2.w[0]; reg0->w[3] = tmp2.w[1];
 
-        // punpckhdq - unpack and interleave high double words
-        reg1->w[0] = tmp1.w[2]; reg1->w[1] = tmp1.w[3];
-        reg1->w[2] = tmp2.w[2]; reg1->w[3] = tmp2.w[3];
+  // where the 4 coefficients of one block row go: element n of c0..c3 is
+  // stored to row psd[n] >> 4, column psd[n] & 15 of the macroblock.
+  static const uint8_t psd[16] = {
+    0x00,0x04,0x44,0x40,0x80,0xc0,0xc4,0x84,
+    0x88,0xc8,0xcc,0x8c,0x4c,0x48,0x08,0x0c,
+  };
 
-        // punpckldq for tmp4/tmp5
-        reg4->w[0] = tmp4.w[0]; reg4->w[1] = tmp4.w[1];
-        reg4->w[2] = tmp5.w[0]; reg4->w[3] = tmp5.w[1];
+  static void shuffle4x16(int16_t **dest,int32_t xOffs,const int16_t *c0,const int16_t *c1,const int16_t *c2,const int16_t *c3)
+  {
+    for(int32_t n=0;n<16;n++)
+    {
+      int16_t *d = dest[psd[n] >> 4] + xOffs + (psd[n] & 15);
 
-        // punpckhdq for tmp4/tmp5
-        reg3->w[0] = tmp3.w[2]; reg3->w[1] = tmp3.w[3];
-        reg3->w[2] = tmp5.w[2]; reg3->w[3] = tmp5.w[3];
+      d[0] = c0[n];
+      d[1] = c1[n];
+      d[2] = c2[n];
+      d[3] = c3[n];
     }
+  }
 
-/**
- * Main function that shuffles 4 arrays of 16-bit integers
- */
-    void shuffle4x16(int16_t **dest, int32_t xOffs, int16_t *c0, int16_t *c1, int16_t *c2, int16_t *c3) {
-        // MMX registers
-        MMXReg mm0, mm1, mm2, mm3, mm4, mm5, mm6, mm7;
+  // simd versions of the inv_reorder loops. both return the number of
+  // columns done; the dc one only does groups of 8 macroblocks.
+  static int32_t inv_reorder_dc_simd(int16_t **dest,int32_t xOffs,const int16_t *g0,const int16_t *g1,const int16_t *g2,const int16_t *g3,int32_t cwidth)
+  {
+    int32_t features = CpuFeatures();
+
+    (void) features;
+#if defined(FRIED_SIMD_AVX2)
+    if(features & CPU_AVX2)
+      return inv_reorder_dc_avx2(dest,xOffs,g0,g1,g2,g3,cwidth);
+#endif
+#if defined(FRIED_SIMD_SSE2)
+    if(features & CPU_SSE2)
+      return inv_reorder_dc_sse2(dest,xOffs,g0,g1,g2,g3,cwidth);
+#endif
+
+    return 0;
+  }
 
-        // First set of operations
-        mm_load4(&mm0, &mm1, &mm2, &mm3, c0, c1, c2, c3, 0);
-        mm_transpose(&mm0, &mm1, &mm2, &mm3, &mm4, &mm5);
-
-        mm_load4(&mm2, &mm5, &mm6, &mm7, c0, c1, c2, c3, 8);
-        mm_store4(&mm0, &mm1, &mm4, &mm3, dest, xOffs, 0x00, 0x04, 0x44, 0x40);
-
-        mm_transpose(&mm2, &mm5, &mm6, &mm7, &mm0, &mm1);
-        mm_load4(&mm1, &mm3, &mm4, &mm6, c0, c1, c2, c3, 16);
-        mm_store4(&mm2, &mm5, &mm0, &mm7, dest, xOffs, 0x80, 0xc0, 0xc4, 0x84);
-
-        mm_transpose(&mm1, &mm3, &mm4, &mm6, &mm2, &mm5);
-        mm_load4(&mm0, &mm4, &mm5, &mm7, c0, c1, c2, c3, 24);
-        mm_store4(&mm1, &mm3, &mm2, &mm6, dest, xOffs, 0x88, 0xc8, 0xcc, 0x8c);
+  static int32_t inv_reorder_ac_simd(int16_t **dest,int32_t xOffs,const int16_t *c0,const int16_t *c1,const int16_t *c2,const int16_t *c3,int32_t cwidth)
+  {
+    int32_t features = CpuFeatures();
+
+    (void) features;
+#if defined(FRIED_SIMD_AVX2)
+    if(features & CPU_AVX2)
+      return inv_reorder_ac_avx2(dest,xOffs,c0,c1,c2,c3,cwidth);
+#endif
+#if defined(FRIED_SIMD_SSE2)
+    if(features & CPU_SSE2)
+      return inv_reorder_ac_sse2(dest,xOffs,c0,c1,c2,c3,cwidth);
+#endif
+
+    return 0;
+  }
 
-        mm_transpose(&mm0, &mm4, &mm5, &mm7, &mm1, &mm3);
-        mm_store4(&mm0, &mm4, &mm1, &mm7, dest, xOffs, 0x4c, 0x48, 0x08, 0x0c);
-    }
+  // gathers the 16 macroblock coefficients of one macroblock. dcs[n] is
+  // the dc of the n-th block in the order the shuffle stores them.
+  static void get_mb_coeffs(int16_t *dcs,const int16_t *gp,int32_t nmb)
+  {
+    dcs[ 0] = *gp; gp += nmb;
+    dcs[ 3] = *gp; gp += nmb;
+    dcs[ 1] = *gp; gp += nmb;
+    dcs[14] = *gp; gp += nmb;
+
+    dcs[ 2] = *gp; gp += nmb;
+    dcs[ 4] = *gp; gp += nmb;
+    dcs[ 5] = *gp; gp += nmb;
+    dcs[ 7] = *gp; gp += nmb;
+
+    dcs[13] = *gp; gp += nmb;
+    dcs[15] = *gp; gp += nmb;
+    dcs[12] = *gp; gp += nmb;
+    dcs[ 8] = *gp; gp += nmb;
+
+    dcs[ 6] = *gp; gp += nmb;
+    dcs[ 9] = *gp; gp += nmb;
+    dcs[11] = *gp; gp += nmb;
+    dcs[10] = *gp;
+  }
 
-  static void inv_reorder(int16_t **dest,int32_t xOffs,int16_t *src,int32_t cwidth)
+  void inv_reorder(int16_t **dest,int32_t xOffs,int16_t *src,int32_t cwidth)
   {
     int32_t nmb = cwidth/16;
     int16_t *g0,*g1,*g2,*g3;
@@ -168,31 +193,13 @@ namespace FRIED
     g1 = src +  2 * cwidth;
     g2 = src +  3 * cwidth;
     g3 = src +  9 * cwidth;
-    for(mb=0;mb<cwidth;mb+=16)
+    mb = inv_reorder_dc_simd(dest+0,xOffs,g0,g1,g2,g3,cwidth);
+    for(g0+=mb/16;mb<cwidth;mb+=16)
     {
       int16_t dcs[16];
-      int16_t *gp = g0;
 
       // get dc coeffs (with reordering)
-      dcs[ 0] = *gp; gp += nmb;
-      dcs[ 3] = *gp; gp += nmb;
-      dcs[ 1] = *gp; gp += nmb;
-      dcs[14] = *gp; gp += nmb;
-
-      dcs[ 2] = *gp; gp += nmb;
-      dcs[ 4] = *gp; gp += nmb;
-      dcs[ 5] = *gp; gp += nmb;
-      dcs[ 7] = *gp; gp += nmb;
-
-      dcs[13] = *gp; gp += nmb;
-      dcs[15] = *gp; gp += nmb;
-      dcs[12] = *gp; gp += nmb;
-      dcs[ 8] = *gp; gp += nmb;
-
-      dcs[ 6] = *gp; gp += nmb;
-      dcs[ 9] = *gp; gp += nmb;
-      dcs[11] = *gp; gp += nmb;
-      dcs[10] = *gp; g0++;
+      get_mb_coeffs(dcs,g0++,nmb);
 
       // shuffle
       shuffle4x16(dest+0,xOffs+mb,dcs,g1+mb,g2+mb,g3+mb);
@@ -203,7 +210,7 @@ namespace FRIED
     g1 = src +  4 * cwidth;
     g2 = src +  8 * cwidth;
     g3 = src + 10 * cwidth;
-    for(mb=0;mb<cwidth;mb+=16)
+    for(mb=inv_reorder_ac_simd(dest+1,xOffs,g0,g1,g2,g3,cwidth);mb<cwidth;mb+=16)
       shuffle4x16(dest+1,xOffs+mb,g0+mb,g1+mb,g2+mb,g3+mb);
 
     // third rows of block AC coeffs
@@ -211,7 +218,7 @@ namespace FRIED
     g1 = src +  7 * cwidth;
     g2 = src + 11 * cwidth;
     g3 = src + 14 * cwidth;
-    for(mb=0;mb<cwidth;mb+=16)
+    for(mb=inv_reorder_ac_simd(dest+2,xOffs,g0,g1,g2,g3,cwidth);mb<cwidth;mb+=16)
       shuffle4x16(dest+2,xOffs+mb,g0+mb,g1+mb,g2+mb,g3+mb);
 
     // fourth rows of block AC coeffs
@@ -219,105 +226,302 @@ namespace FRIED
     g1 = src + 12 * cwidth;
     g2 = src + 13 * cwidth;
     g3 = src + 15 * cwidth;
-    for(mb=0;mb<cwidth;mb+=16)
+    for(mb=inv_reorder_ac_simd(dest+3,xOffs,g0,g1,g2,g3,cwidth);mb<cwidth;mb+=16)
       shuffle4x16(dest+3,xOffs+mb,g0+mb,g1+mb,g2+mb,g3+mb);
   }
 
-  static int32_t decodeStripe(DecodeContext &ctx,int32_t cols,int32_t,const uint8_t *byteStart,int32_t maxbytes,int16_t **srp)
+  // macroblock layer only: puts the block dcs where inv_reorder would,
+  // leaving the block AC positions alone.
+  static void inv_reorder_mb(int16_t **dest,int32_t xOffs,int16_t *src,int32_t cwidth)
   {
-    int32_t cjs[16];
-    int32_t cwidth = ctx.FH.ChunkWidth;
-    int32_t nchunks = (cols + cwidth - 1) / cwidth;
-    int16_t *g0;
-    const uint8_t *bytes,*bytesEnd;
+    int32_t nmb = cwidth/16;
 
-    bytes = byteStart;
-    bytesEnd = bytes + maxbytes;
+    for(int32_t mb=0;mb<cwidth;mb+=16)
+    {
+      int16_t dcs[16];
 
-    // clear chunk positions
-    for(int32_t ch=0;ch<ctx.FH.Channels;ch++)
-      cjs[ch] = 0;
+      get_mb_coeffs(dcs,src++,nmb);
+      for(int32_t n=0;n<16;n++)
+        dest[psd[n] >> 4][xOffs + mb + (psd[n] & 15)] = dcs[n];
+    }
+  }
 
-    // process this stripe chunk by chunk
-    for(int32_t chunk=0,ncc=0;chunk<nchunks;chunk++,ncc+=cwidth)
+  // decodes all channels of one chunk (without its length field) into
+  // columns [cx,cx+cwidth) of the lower stripe half. ck is the chunk
+  // scratch buffer to use, stats the statistics to add to; returns the
+  // number of bytes consumed. progressive files have the block AC streams
+  // in acStart to acEnd (see nextAcChunk), which must be used up.
+  static int32_t decodeChunk(DecodeContext &ctx,int16_t *ck,int32_t cx,int32_t cwidth,const uint8_t *byteStart,const uint8_t *bytesEnd,const uint8_t *acStart,const uint8_t *acEnd,int16_t **srp,FRIED_Stats *stats)
+  {
+    int32_t encsizes[16];
+    FRIED_STAT(int32_t chanBytes[16] = {});
+    (void) stats;
+    int32_t chans = ctx.FH.Channels;
+    int32_t cksize = cwidth * 16;
+    bool acLast = ctx.Version >= VERSION_FRIED003;
+    bool layered = ctx.FH.Layers > 1;
+    int16_t *g0;
+    const uint8_t *bytes = byteStart;
+
+    // process channels
+    for(int32_t ch=0;ch<chans;ch++)
     {
-      // adjust width for last chunk
-      if(chunk == nchunks-1)
-        cwidth = cols - ncc;
+      int32_t qs = ctx.Chans[ch].Quantizer;
 
-      // read chunk length
-      if(bytes + 2 > bytesEnd)
-        return -1;
+      // read number of encoded coeffs
+      int32_t encsize;
 
-      const uint8_t *bytesChunkEnd = bytes + (bytes[0] + (bytes[1] << 8));
-      bytes += 2;
+      if(bytes >= bytesEnd)
+        return -1;
 
-      // process channels
-      for(int32_t ch=0;ch<ctx.FH.Channels;ch++)
+      if(*bytes & 1) // long code
       {
-        int32_t so = ctx.Chans[ch].StripeOffset;
-        int32_t co = ctx.Chans[ch].ChunkOffset;
-        int32_t qs = ctx.Chans[ch].Quantizer;
-        int32_t cksize = cwidth * 16;
+        if(bytes + 1 >= bytesEnd)
+          return -1;
+
+        encsize = ((bytes[0] + (bytes[1] << 8)) & ~1) * 4;
+        bytes += 2;
+      }
+      else // short code
+        encsize = *bytes++ * 4;
+
+      encsizes[ch] = encsize;
 
-        // read number of encoded coeffs
-        int32_t encsize;
+      // decode coefficients (scaled decodes only use the macroblock part)
+      g0 = ck + ctx.Chans[ch].ChunkOffset;
+      sSetMem(g0,0,(ctx.ScaleShift ? cwidth : cksize) * sizeof(int16_t));
 
-        if(bytes >= bytesEnd)
+      if(encsize)
+      {
+        int32_t xminit,nbs;
+
+        FRIED_STAT(double t = statsTime(stats); const uint8_t *chanStart = bytes);
+        xminit = mbXMinInit(qs);
+        nbs = rlgrdec(bytes,bytesEnd - bytes,g0,sMin(encsize,cwidth),xminit);
+        if(nbs < 0)
           return -1;
+        else
+          bytes += nbs;
 
-        if(*bytes & 1) // long code
+        // in FRIED002 files, the block AC coeffs follow right away
+        if(!acLast && encsize > cwidth)
         {
-          if(bytes + 1 >= bytesEnd)
+          xminit = acXMinInit(qs);
+          nbs = rlgrdec(bytes,bytesEnd - bytes,g0+cwidth,encsize-cwidth,xminit);
+          if(nbs < 0)
             return -1;
-
-          encsize = ((bytes[0] + (bytes[1] << 8)) & ~1) * 4;
-          bytes += 2;
+          else
+            bytes += nbs;
         }
-        else // short code
-          encsize = *bytes++ * 4;
 
-        // decode coefficients
-        g0 = ctx.CK + co;
-        sSetMem(g0,0,cksize * sizeof(int16_t));
+        FRIED_STAT(addTime(stats,&FRIED_Stats::EntropyTime,t); chanBytes[ch] = bytes - chanStart);
+      }
+    }
+
+    // block AC coeffs of all channels (not needed for scaled decoding).
+    // without them (progressive previews), they stay zero.
+    if(acLast && ctx.ScaleShift)
+      bytes = bytesEnd;
+    else if(acLast)
+    {
+      const uint8_t *ac = layered ? acStart : bytes;
+      const uint8_t *acStop = layered ? acEnd : bytesEnd;
 
-        if(encsize)
+      for(int32_t ch=0;ac && ch<chans;ch++)
+      {
+        if(encsizes[ch] > cwidth)
         {
-          int32_t xminit,nbs;
+          int32_t xminit = acXMinInit(ctx.Chans[ch].Quantizer);
+          int32_t nbs;
 
-          xminit = 625 >> (qs >> 3);
-          nbs = rlgrdec(bytes,bytesEnd - bytes,g0,sMin(encsize,cwidth),xminit);
+          FRIED_STAT(double t = statsTime(stats));
+          g0 = ck + ctx.Chans[ch].ChunkOffset;
+          nbs = rlgrdec(ac,acStop - ac,g0+cwidth,encsizes[ch]-cwidth,xminit);
+          FRIED_STAT(addTime(stats,&FRIED_Stats::EntropyTime,t); chanBytes[ch] += nbs);
           if(nbs < 0)
             return -1;
           else
-            bytes += nbs;
-
-          if(encsize > cwidth)
-          {
-            xminit = 94 >> (qs >> 3);
-            nbs = rlgrdec(bytes,bytesEnd - bytes,g0+cwidth,encsize-cwidth,xminit);
-            if(nbs < 0)
-              return -1;
-            else
-              bytes += nbs;
-          }
+            ac += nbs;
         }
+      }
+
+      if(!layered)
+        bytes = ac;
+      else if(ac != acStop)
+        return -1;
+    }
+
+    for(int32_t ch=0;ch<chans;ch++)
+    {
+      int32_t so = ctx.Chans[ch].StripeOffset;
+      int32_t qs = ctx.Chans[ch].Quantizer;
+      int32_t encsize = encsizes[ch];
+
+      g0 = ck + ctx.Chans[ch].ChunkOffset;
 
-        // un-delta dc coefficients
-        int32_t nmb = sMin(encsize,cwidth/16);
+      // un-delta dc coefficients
+      FRIED_STAT(double t = statsTime(stats));
+      int32_t nmb = sMin(encsize,cwidth/16);
 
-        int32_t n = 0;
-        while(++n < nmb)
-          g0[n] += g0[n-1];
+      int32_t n = 0;
+      while(++n < nmb)
+        g0[n] += g0[n-1];
 
-        // dequantize, undo reordering
+      FRIED_STAT(int32_t nonzero = stats ? countNonzero(g0,ctx.ScaleShift ? sMin(encsize,cwidth) : encsize) : 0);
+
+      // dequantize, undo reordering
+      if(ctx.ScaleShift)
+      {
+        newDequantize(qs,g0,sMin(encsize,cwidth),cwidth);
+        FRIED_STAT(addTime(stats,&FRIED_Stats::QuantizeTime,t); t = statsTime(stats));
+        inv_reorder_mb(srp+16,so + cx,g0,cwidth);
+      }
+      else
+      {
         newDequantize(qs,g0,encsize,cwidth);
-        inv_reorder(srp+16,so + cjs[ch],g0,cwidth);
+        FRIED_STAT(addTime(stats,&FRIED_Stats::QuantizeTime,t); t = statsTime(stats));
+        inv_reorder(srp+16,so + cx,g0,cwidth);
+      }
+
+      FRIED_STAT(addTime(stats,&FRIED_Stats::ReorderTime,t));
+      FRIED_STAT(addChunkStats(stats,ctx.FileChannel[ch],encsize,cksize,nonzero,chanBytes[ch]));
+    }
+
+    return bytes - byteStart;
+  }
+
+  // progressive files: finds the block AC chunk at ac (the data ends at
+  // acEnd), returns its streams in start to end and moves ac past it.
+  // previews that don't have all of it get none (start = end = 0), nor any
+  // of the chunks after it. returns false for broken or, without Preview,
+  // missing data.
+  static bool nextAcChunk(const DecodeContext &ctx,const uint8_t *&ac,const uint8_t *acEnd,const uint8_t *&start,const uint8_t *&end)
+  {
+    start = end = 0;
+
+    if(ac && ac + 2 <= acEnd)
+    {
+      const uint8_t *next = ac + (ac[0] + (ac[1] << 8));
+      if(next < ac + 2)
+        return false;
+
+      if(next <= acEnd)
+      {
+        start = ac + 2;
+        end = next;
+        ac = next;
+        return true;
+      }
+    }
+
+    ac = acEnd;
+    return ctx.Preview;
+  }
+
+  // parallel version of the chunk loop: since every chunk starts with its
+  // length, we can find all of them up front and hand them to the workers.
+  // chunks write to disjoint columns, so only the scratch buffers are per-worker.
+  static int32_t decodeStripeParallel(DecodeContext &ctx,int32_t cols,int32_t nchunks,const uint8_t *byteStart,const uint8_t *bytesEnd,const uint8_t *&ac,const uint8_t *acEnd,int16_t **srp)
+  {
+    const uint8_t **pos = ctx.ChunkPos;
+    const uint8_t **acPos = pos + nchunks + 1;
+    const uint8_t *bytes = byteStart;
+    bool layered = ctx.FH.Layers > 1 && !ctx.ScaleShift;
+    FRIED_STAT(static std::mutex statsLock);
+    int32_t cksize = ctx.FH.Channels * ctx.FH.ChunkWidth * 16;
+    int32_t chunkFirst = ctx.ColFirst / ctx.FH.ChunkWidth;
+    int32_t njobs = (ctx.ColEnd + ctx.FH.ChunkWidth - 1) / ctx.FH.ChunkWidth - chunkFirst;
+
+    // scan chunk lengths
+    for(int32_t chunk=0;chunk<nchunks;chunk++)
+    {
+      if(bytes + 2 > bytesEnd)
+        return -1;
+
+      pos[chunk] = bytes;
+      bytes += bytes[0] + (bytes[1] << 8);
+      if(bytes <= pos[chunk] + 2 || bytes > bytesEnd)
+        return -1;
+
+      acPos[2*chunk] = acPos[2*chunk+1] = 0;
+      if(layered && !nextAcChunk(ctx,ac,acEnd,acPos[2*chunk],acPos[2*chunk+1]))
+        return -1;
+    }
+
+    pos[nchunks] = bytes;
+
+    std::atomic<int32_t> errors(0);
+    ctx.Pool->Run(njobs,[&](int32_t job,int32_t worker)
+    {
+      int32_t chunk = chunkFirst + job;
+      int32_t ncc = chunk * ctx.FH.ChunkWidth;
+      int32_t cwidth = (chunk == nchunks-1) ? cols - ncc : ctx.FH.ChunkWidth;
+      const uint8_t *chunkStart = pos[chunk] + 2;
+      const uint8_t *chunkEnd = pos[chunk+1];
+      FRIED_Stats *stats = 0;
+
+      // workers collect their statistics on the side
+      FRIED_STAT(FRIED_Stats part = FRIED_Stats());
+      FRIED_STAT(stats = ctx.Stats ? &part : 0);
+
+      if(decodeChunk(ctx,ctx.CKW + worker * cksize,ncc - ctx.ColFirst,cwidth,chunkStart,chunkEnd,acPos[2*chunk],acPos[2*chunk+1],srp,stats) != chunkEnd - chunkStart)
+        errors++;
+
+      FRIED_STAT(if(stats) { std::lock_guard<std::mutex> guard(statsLock); mergeStats(ctx.Stats,stats); });
+    });
+
+    return errors ? -1 : bytes - byteStart;
+  }
+
+  // decodes a stripe from byteStart (maxbytes at most), returns the number
+  // of bytes consumed. progressive files have its block AC layer at ac
+  // (up to acEnd), which is moved past it.
+  static int32_t decodeStripe(DecodeContext &ctx,int32_t cols,int32_t,const uint8_t *byteStart,int32_t maxbytes,const uint8_t *&ac,const uint8_t *acEnd,int16_t **srp)
+  {
+    int32_t cwidth = ctx.FH.ChunkWidth;
+    int32_t nchunks = (cols + cwidth - 1) / cwidth;
+    bool layered = ctx.FH.Layers > 1 && !ctx.ScaleShift;
+    const uint8_t *bytes,*bytesEnd;
 
-        // this channel is done
-        cjs[ch] += cwidth;
+    bytes = byteStart;
+    bytesEnd = bytes + maxbytes;
+
+    if(ctx.Pool && nchunks > 1)
+      return decodeStripeParallel(ctx,cols,nchunks,bytes,bytesEnd,ac,acEnd,srp);
+
+    // process this stripe chunk by chunk
+    for(int32_t chunk=0,ncc=0;chunk<nchunks;chunk++,ncc+=cwidth)
+    {
+      // adjust width for last chunk
+      if(chunk == nchunks-1)
+        cwidth = cols - ncc;
+
+      // read chunk length
+      if(bytes + 2 > bytesEnd)
+        return -1;
+
+      const uint8_t *bytesChunkEnd = bytes + (bytes[0] + (bytes[1] << 8));
+      bytes += 2;
+
+      if(bytesChunkEnd < bytes || bytesChunkEnd > bytesEnd)
+        return -1;
+
+      const uint8_t *acChunk = 0,*acChunkEnd = 0;
+      if(layered && !nextAcChunk(ctx,ac,acEnd,acChunk,acChunkEnd))
+        return -1;
+
+      // chunks outside the decoded columns are skipped
+      if(ncc + cwidth <= ctx.ColFirst || ncc >= ctx.ColEnd)
+      {
+        bytes = bytesChunkEnd;
+        continue;
       }
 
+      int32_t sizeChunk = decodeChunk(ctx,ctx.CK,ncc - ctx.ColFirst,cwidth,bytes,bytesChunkEnd,acChunk,acChunkEnd,srp,ctx.Stats);
+      if(sizeChunk < 0)
+        return -1;
+
+      bytes += sizeChunk;
       if(bytes != bytesChunkEnd)
         return -1;
     }
@@ -325,7 +529,7 @@ namespace FRIED
     return bytes - byteStart;
   }
 
-  static void ihlbt_group1(int32_t swidth,int32_t so,int16_t **srp)
+  static void ihlbt_group1(int32_t swidth,int32_t so,int16_t **srp,bool lossless)
   {
     int16_t *p0,*p1,*p2,*p3;
     int32_t col;
@@ -344,7 +548,15 @@ namespace FRIED
     p1 = srp[17] + so;
     p2 = srp[18] + so;
     p3 = srp[19] + so;
-    indct42D(p0,p1,p2,p3);
+
+    // lossless: block transforms only, no postfilter
+    if(lossless)
+    {
+      indct42D_lossless_row(p0,p1,p2,p3,swidth);
+      return;
+    }
+
+    indct42D_row(p0,p1,p2,p3,swidth);
 
     // rescale top left 2x2 pixels
     p0[0] <<= 2;
@@ -353,10 +565,7 @@ namespace FRIED
     p1[1] <<= 2;
 
     for(int32_t col=4;col<swidth;col+=4)
-    {
-      indct42D(p0+col,p1+col,p2+col,p3+col);
       lbt4post2x4(p0+col-2,p1+col-2);
-    }
 
     // rescale top right 2x2 pixels
     p0[swidth-2] <<= 2;
@@ -380,7 +589,7 @@ namespace FRIED
       indct42D_MB(p0+col,p1+col,p2+col,p3+col);
   }
 
-  static void ihlbt_group3(int32_t swidth,int32_t so,int32_t ib,int16_t **srp,bool fbot)
+  static void ihlbt_group3(int32_t swidth,int32_t so,int32_t ib,int16_t **srp,bool fbot,bool lossless)
   {
     // normal rows only
     int16_t *pa,*pb,*p0,*p1,*p2,*p3;
@@ -393,7 +602,15 @@ namespace FRIED
     p2 = srp[ib+4] + so;
     p3 = srp[ib+5] + so;
 
-    indct42D(p0,p1,p2,p3);
+    if(lossless)
+    {
+      indct42D_lossless_row(p0,p1,p2,p3,swidth);
+      return;
+    }
+
+    // the block transforms and the filters between blocks touch disjoint
+    // columns, so each of them can run over the whole row
+    indct42D_row(p0,p1,p2,p3,swidth);
     lbt4post4x2(pa,pb,p0,p1);
 
     if(fbot) // rescale bottom left 2x2 pixels
@@ -404,16 +621,15 @@ namespace FRIED
       p3[1] <<= 2;
     }
 
-    for(col=4;col<swidth;col+=4)
-    {
-      indct42D(p0+col,p1+col,p2+col,p3+col);
-      lbt4post4x4(pa+col-2,pb+col-2,p0+col-2,p1+col-2);
+    lbt4post4x4_row(pa+2,pb+2,p0+2,p1+2,swidth-4);
 
-      if(fbot)
+    if(fbot)
+    {
+      for(col=4;col<swidth;col+=4)
         lbt4post2x4(p2+col-2,p3+col-2);
     }
 
-    lbt4post4x2(pa+col-2,pb+col-2,p0+col-2,p1+col-2);
+    lbt4post4x2(pa+swidth-2,pb+swidth-2,p0+swidth-2,p1+swidth-2);
 
     // rescale bottom right 2x2 pixels
     if(fbot)
@@ -434,167 +650,1293 @@ namespace FRIED
     return fr;
   }
 
-  static int32_t PerformDecode(DecodeContext &ctx,const uint8_t *bitsStart,int32_t nbytes)
+  // inverse dct of the last block row in the lower stripe half. used to
+  // seed a band: the serial loop did this as part of ihlbt_group3.
+  static void ihlbt_seed(int32_t swidth,int32_t so,int16_t **srp,bool lossless)
   {
-    int16_t *srp[32];
-    int32_t fr,ib,k;
-    const uint8_t *bits,*bitsEnd;
-    int32_t cols,rows,chans;
-    int32_t stsize;
-
-    cols = ctx.XResPadded;
-    rows = ctx.YResPadded;
-    chans = ctx.FH.Channels;
-    stsize = chans * cols;
+    int16_t *p0,*p1,*p2,*p3;
 
-    bits = bitsStart;
-    bitsEnd = bits + nbytes;
+    p0 = srp[28] + so;
+    p1 = srp[29] + so;
+    p2 = srp[30] + so;
+    p3 = srp[31] + so;
 
-    // actual decoding loop
-    fr = updatebp(srp,ctx.SB,0,stsize,1);
-    ib = 16;
-    k = 2;
+    if(lossless)
+      indct42D_lossless_row(p0,p1,p2,p3,swidth);
+    else
+      indct42D_row(p0,p1,p2,p3,swidth);
+  }
 
-    for(int32_t row=0;row<rows;row++,k++,ib++)
+  // state of the row loop: the stripe buffer ring, the next row and the
+  // stripe data still to decode.
+  struct RowLoop
+  {
+    int16_t *srp[32];
+    int32_t fr,ib,k;
+    int32_t Row;                       // next row (padded coordinates)
+    const uint8_t *Bits;               // next stripe
+    const uint8_t *BitsEnd;            // end of stripe data
+    const uint8_t *Ac;                 // progressive files: next stripe's block AC layer
+    const uint8_t *AcEnd;              // end of the block AC layer (as far as it's there)
+  };
+
+  // sets up the row loop at the top of stripe first. bits (and ac) must
+  // point to stripe first-1 (or stripe 0 for the first band): rows at a band
+  // seam are post-filtered across the seam, so a band re-decodes the stripe
+  // above it and starts two rows early with the ring buffer in the same
+  // state the serial loop would have. returns false on broken stripe data.
+  static bool startRowLoop(DecodeContext &ctx,RowLoop &loop,const uint8_t *bitsStart,const uint8_t *bitsEnd,const uint8_t *acStart,const uint8_t *acEnd,int32_t first)
+  {
+    int16_t **srp = loop.srp;
+    int32_t cols = ctx.ColEnd - ctx.ColFirst;
+    int32_t chans = ctx.FH.Channels;
+    int32_t stsize = chans * cols;
+
+    loop.Bits = bitsStart;
+    loop.BitsEnd = bitsEnd;
+    loop.Ac = acStart;
+    loop.AcEnd = acEnd;
+
+    loop.fr = updatebp(srp,ctx.SB,0,stsize,1);
+    loop.ib = 16;
+    loop.k = 2;
+    loop.Row = 0;
+
+    if(first)
     {
-      if(row == 0)
+      // the band above counts these two stripes
+      FRIED_Stats *stats = ctx.Stats;
+      ctx.Stats = 0;
+
+      for(int32_t i=0;i<2;i++)
       {
-        int32_t sizeStripe = decodeStripe(ctx,cols,chans,bits,bitsEnd - bits,srp);
+        int32_t sizeStripe = decodeStripe(ctx,ctx.XResPadded,chans,loop.Bits,bitsEnd - loop.Bits,loop.Ac,acEnd,srp);
         if(sizeStripe < 0)
-          return -1;
+        {
+          ctx.Stats = stats;
+          return false;
+        }
+
+        loop.Bits += sizeStripe;
 
-        bits += sizeStripe;
-        
         for(int32_t ch=0;ch<chans;ch++)
-          ihlbt_group1(cols,ctx.Chans[ch].StripeOffset,srp);
+        {
+          ihlbt_group2(cols,ctx.Chans[ch].StripeOffset,srp,false);
+          if(!i)
+            ihlbt_seed(cols,ctx.Chans[ch].StripeOffset,srp,ctx.Lossless);
+        }
+
+        if(!i)
+          loop.fr = updatebp(srp,ctx.SB,loop.fr,stsize,0);
       }
 
-      if(ib == 16)
-      {
-        fr = updatebp(srp,ctx.SB,fr,stsize,0);
-        ib = 0;
+      ctx.Stats = stats;
+      loop.Row = first * 16 - 2;
+      loop.ib = 14;
+      loop.k = 4;
+    }
 
-        if(row != rows - 16)
-        {
-          bool bot = (row == rows - 32);
-          int32_t sizeStripe = decodeStripe(ctx,cols,chans,bits,bitsEnd - bits,srp);
-          if(sizeStripe < 0)
-            return -1;
+    return true;
+  }
 
-          bits += sizeStripe;
+  // reconstructs row loop.Row. returns it in the stripe buffer (valid until
+  // the next call), or 0 on broken stripe data.
+  static int16_t *decodeRow(DecodeContext &ctx,RowLoop &loop)
+  {
+    int16_t **srp = loop.srp;
+    int32_t cols = ctx.ColEnd - ctx.ColFirst;
+    int32_t rows = ctx.YResPadded;
+    int32_t chans = ctx.FH.Channels;
+    int32_t row = loop.Row++;
 
-          for(int32_t ch=0;ch<chans;ch++)
-            ihlbt_group2(cols,ctx.Chans[ch].StripeOffset,srp,bot);
-        }
-      }
+    if(row == 0)
+    {
+      int32_t sizeStripe = decodeStripe(ctx,ctx.XResPadded,chans,loop.Bits,loop.BitsEnd - loop.Bits,loop.Ac,loop.AcEnd,srp);
+      if(sizeStripe < 0)
+        return 0;
+
+      loop.Bits += sizeStripe;
+
+      FRIED_STAT(double t = statsTime(ctx.Stats));
+      for(int32_t ch=0;ch<chans;ch++)
+        ihlbt_group1(cols,ctx.Chans[ch].StripeOffset,srp,ctx.Lossless);
+      FRIED_STAT(addTime(ctx.Stats,&FRIED_Stats::TransformTime,t));
+    }
+
+    if(loop.ib == 16)
+    {
+      loop.fr = updatebp(srp,ctx.SB,loop.fr,chans * cols,0);
+      loop.ib = 0;
 
-      if(k == 4 && row != rows - 2)
+      if(row != rows - 16)
       {
-        bool bot = (row == rows - 6);
+        bool bot = (row == rows - 32);
+        int32_t sizeStripe = decodeStripe(ctx,ctx.XResPadded,chans,loop.Bits,loop.BitsEnd - loop.Bits,loop.Ac,loop.AcEnd,srp);
+        if(sizeStripe < 0)
+          return 0;
 
-        for(int32_t ch=0;ch<chans;ch++)
-          ihlbt_group3(cols,ctx.Chans[ch].StripeOffset,ib,srp,bot);
+        loop.Bits += sizeStripe;
 
-        k = 0;
+        FRIED_STAT(double t = statsTime(ctx.Stats));
+        for(int32_t ch=0;ch<chans;ch++)
+          ihlbt_group2(cols,ctx.Chans[ch].StripeOffset,srp,bot);
+        FRIED_STAT(addTime(ctx.Stats,&FRIED_Stats::TransformTime,t));
       }
+    }
+
+    if(loop.k == 4 && row != rows - 2)
+    {
+      bool bot = (row == rows - 6);
+
+      FRIED_STAT(double t = statsTime(ctx.Stats));
+      for(int32_t ch=0;ch<chans;ch++)
+        ihlbt_group3(cols,ctx.Chans[ch].StripeOffset,loop.ib,srp,bot,ctx.Lossless);
+      FRIED_STAT(addTime(ctx.Stats,&FRIED_Stats::TransformTime,t));
 
-      writeBitmapRow(ctx,row,srp[ib]);
+      loop.k = 0;
     }
 
-    return bitsEnd - bits;
+    loop.k++;
+    return srp[loop.ib++];
   }
-}
 
-using namespace FRIED;
+  // decodes the rows of stripes [first,end), see startRowLoop. the two rows
+  // above the band are left to the band above.
+  static int32_t DecodeBand(DecodeContext &ctx,const uint8_t *bitsStart,const uint8_t *bitsEnd,const uint8_t *acStart,const uint8_t *acEnd,int32_t first,int32_t end)
+  {
+    RowLoop loop;
 
-[[maybe_unused]] const char* getSupportedFileVersion()
-{
-    return FRIED_FILE_VERSION;
-}
-void FreeFRIED(const uint8_t* allocated)
-{
-    delete[] allocated;
-}
-bool LoadFRIED(const uint8_t *data,int32_t size,int32_t &xout,int32_t &yout, int32_t &outSize, uint8_t *&dataout)
-{
-  DecodeContext ctx;
-  const uint8_t *dataEnd = data + size;
+    if(!startRowLoop(ctx,loop,bitsStart,bitsEnd,acStart,acEnd,first))
+      return -1;
 
-  // check file format
-  if(static_cast<size_t>(size) < sizeof(FileHeader))
-    return false;
+    while(loop.Row < end * 16)
+    {
+      int32_t row = loop.Row;
+      int16_t *line = decodeRow(ctx,loop);
+      if(!line)
+        return -1;
 
-  // check signature
-  if(sCmpMem(data,FRIED_FILE_VERSION,8))
-    return false;
+      if(row >= first * 16)
+        writeBitmapRow(ctx,row,line);
+    }
 
-  // copy header over
-  sCopyMem(&ctx.FH,data,sizeof(FileHeader));
-  data += sizeof(FileHeader);
+    return loop.BitsEnd - loop.Bits;
+  }
 
-  // check number of channels and copy channel headers over
-  if(ctx.FH.Channels > 16)
-    return false;
+  // where a plane's stripe data is (see readHeaders). the offsets in its
+  // stripe indexes count from the start of the file's stripe data.
+  struct PlaneLayout
+  {
+    const uint8_t *Index;              // stripe index (0=none)
+    const uint8_t *Bits;               // stripe data (progressive files: macroblock layer)
+    const uint8_t *BitsEnd;            // its end
+    int32_t Base;                      // offset of Bits
+    const uint8_t *AcIndex;            // progressive files: block AC layer index (0=none)
+    const uint8_t *Ac;                 // block AC layer (0=none)
+    const uint8_t *AcEnd;              // its end, or the end of the file if that's earlier
+    int32_t AcBase;                    // offset of the block AC layer
+  };
+
+  static int32_t PerformDecode(DecodeContext &ctx,const PlaneLayout &plane)
+  {
+    return DecodeBand(ctx,plane.Bits,plane.BitsEnd,plane.Ac,plane.AcEnd,0,ctx.YResPadded / 16);
+  }
 
-  sCopyMem(ctx.Chans,data,ctx.FH.Channels * sizeof(ChannelHeader));
-  data += ctx.FH.Channels * sizeof(ChannelHeader);
+  // writes the output rows of one stripe for scaled decoding: every block
+  // (1/4) or macroblock (1/16) becomes one pixel. block dcs are already in
+  // pixel range (the block transform loses a factor 4 that the postfilter
+  // gains back), macroblock dcs are 4 times larger. lossless files have
+  // no postfilter, so their block dcs are 4 times the pixels.
+  static void writeScaledRows(DecodeContext &ctx,int32_t stripe,int16_t *line,int16_t **srp)
+  {
+    int32_t shift = ctx.ScaleShift;
+    int32_t dcShift = ctx.Lossless ? shift : shift - 2;
+    int32_t cols = ctx.OutW;
 
-  // calculate some important constants
-  int32_t chans = ctx.FH.Channels;
+    for(int32_t i=0;i<(16 >> shift);i++)
+    {
+      int32_t row = (stripe << (4 - shift)) + i;
+      if(row >= ctx.OutH)
+        break;
 
-  ctx.XResPadded = (ctx.FH.XRes + 31) & ~31;
-  ctx.YResPadded = (ctx.FH.YRes + 31) & ~31;
-  int32_t sbw = chans * ctx.XResPadded;
-  int32_t cbw = chans * ctx.FH.ChunkWidth;
+      for(int32_t ch=0;ch<ctx.FH.Channels;ch++)
+      {
+        const int16_t *src = srp[16 + (i << shift)] + ctx.Chans[ch].StripeOffset;
+        int16_t *dst = line + ch * cols;
 
-  ctx.SB = new int16_t[sbw * 32];
-  ctx.QB = new int32_t[cbw * 16];
-  ctx.CK = new int16_t[cbw * 16];
+        for(int32_t x=0;x<cols;x++)
+          dst[x] = (src[x << shift] + (dcShift ? 1 << (dcShift - 1) : 0)) >> dcShift;
+      }
 
-  // determine channel setup (rather faked at the moment)
-  if(chans <= 1 || ctx.Chans[0].Type != CHANNEL_Y)
-    return false;
+      outputRow(ctx,row,cols,cols,line,imageRow(ctx,row));
+    }
+  }
 
-  if(chans == 1)
-    ctx.ChannelSetup = 0; // gray w/out alpha
-  else if(chans == 2 && ctx.Chans[1].Type == CHANNEL_ALPHA)
-    ctx.ChannelSetup = 1; // gray w/ alpha
-  else if(chans >= 3 && ctx.Chans[1].Type == CHANNEL_CO && ctx.Chans[2].Type == CHANNEL_CG)
+  // scaled decoding uses the macroblock layer only. there's no block
+  // transform and no postfilter, so stripes don't overlap.
+  static int32_t PerformDecodeScaled(DecodeContext &ctx,const PlaneLayout &plane)
   {
-    if(chans == 3)
-      ctx.ChannelSetup = 2; // color w/out alpha
-    else if(chans == 4 && ctx.Chans[3].Type == CHANNEL_ALPHA)
-      ctx.ChannelSetup = 3; // color w/ alpha
-    else
-      return false;
-  }
-  else
-    return false;
+    int16_t *srp[32];
+    const uint8_t *bits = plane.Bits;
+    const uint8_t *bitsEnd = plane.BitsEnd;
+    const uint8_t *ac = 0;
+    int32_t cols = ctx.XResPadded;
+    int32_t chans = ctx.FH.Channels;
+    int16_t *line = new int16_t[chans * ctx.OutW];
+    int32_t result = 0;
 
-  outSize = ctx.FH.XRes * ctx.FH.YRes * (ctx.ChannelSetup >= 2 ? 4 : 2);
-  // allocate image
-  ctx.Image = new uint8_t[outSize];
+    updatebp(srp,ctx.SB,0,chans * cols,1);
 
-  // decode
-  if(PerformDecode(ctx,data,dataEnd - data) >= 0)
-  {
-    xout = ctx.FH.XRes;
-    yout = ctx.FH.YRes;
-    dataout = ctx.Image;
-  }
-  else
-  {
-    xout = 0;
-    yout = 0;
-    dataout = nullptr;
-    outSize = 0;
-    delete[] ctx.Image;
-  }
+    for(int32_t stripe=0;stripe<ctx.YResPadded/16;stripe++)
+    {
+      int32_t sizeStripe = decodeStripe(ctx,cols,chans,bits,bitsEnd - bits,ac,0,srp);
+      if(sizeStripe < 0)
+      {
+        result = -1;
+        break;
+      }
 
-  // free everything
-  delete[] ctx.SB;
-  delete[] ctx.QB;
-  delete[] ctx.CK;
+      bits += sizeStripe;
+
+      // block dcs from the macroblock transform (1/16 just uses the macroblock dcs)
+      if(ctx.ScaleShift == 2)
+      {
+        FRIED_STAT(double t = statsTime(ctx.Stats));
+        for(int32_t ch=0;ch<chans;ch++)
+          ihlbt_group2(cols,ctx.Chans[ch].StripeOffset,srp,false);
+        FRIED_STAT(addTime(ctx.Stats,&FRIED_Stats::TransformTime,t));
+      }
+
+      writeScaledRows(ctx,stripe,line,srp);
+    }
+
+    delete[] line;
+    return result;
+  }
+
+  // reads and validates the stripe index of a plane whose nbytes of stripe
+  // data start base bytes into the file's. offsets are made relative to the
+  // plane's data; returns false if they aren't increasing inside it.
+  static bool readStripeIndex(const uint8_t *index,int32_t nstripes,int32_t base,int32_t nbytes,int32_t *offsets)
+  {
+    for(int32_t stripe=0;stripe<nstripes;stripe++)
+    {
+      int32_t offset;
+      memcpy(&offset,index + stripe * sizeof(int32_t),sizeof(int32_t));
+
+      if(offset < base)
+        return false;
+
+      offsets[stripe] = offset - base;
+      if(stripe ? offsets[stripe] <= offsets[stripe-1] : offsets[stripe] != 0)
+        return false;
+    }
+
+    return offsets[nstripes-1] < nbytes;
+  }
+
+  // reads the stripe indexes of plane (see readStripeIndex). the block AC
+  // layer of progressive files may not all be there yet, so its offsets
+  // aren't checked against the data; bandStart clamps them.
+  static bool readPlaneIndex(const PlaneLayout &plane,int32_t nstripes,int32_t *offsets,int32_t *acOffsets)
+  {
+    if(!plane.Index || !readStripeIndex(plane.Index,nstripes,plane.Base,plane.BitsEnd - plane.Bits,offsets))
+      return false;
+
+    return !plane.AcIndex || readStripeIndex(plane.AcIndex,nstripes,plane.AcBase,0x7fffffff,acOffsets);
+  }
+
+  // where a band starting at stripe first starts decoding (see startRowLoop)
+  static void bandStart(const PlaneLayout &plane,const int32_t *offsets,const int32_t *acOffsets,int32_t first,const uint8_t *&bits,const uint8_t *&ac)
+  {
+    int32_t stripe = first ? first - 1 : 0;
+
+    bits = plane.Bits + offsets[stripe];
+    ac = plane.Ac ? plane.Ac + sMin<intptr_t>(acOffsets[stripe],plane.AcEnd - plane.Ac) : 0;
+  }
+
+  // decodes bands of stripes on a worker pool. every band gets its own
+  // stripe and chunk buffers and writes a disjoint set of output rows.
+  static int32_t PerformDecodeBands(DecodeContext &ctx,const PlaneLayout &plane,const int32_t *offsets,const int32_t *acOffsets,int32_t nbands)
+  {
+    int32_t nstripes = ctx.YResPadded / 16;
+    int32_t sbSize = ctx.FH.Channels * ctx.XResPadded * 32;
+    int32_t ckSize = ctx.FH.Channels * ctx.FH.ChunkWidth * 16;
+    int32_t lineSize = ctx.Subsampled ? 4 * ctx.OutW : 0;
+
+    int16_t *scratch = new int16_t[nbands * (sbSize + ckSize + lineSize)];
+    std::atomic<int32_t> errors(0);
+    FRIED_STAT(FRIED_Stats *bandStats = ctx.Stats ? new FRIED_Stats[nbands]() : 0);
+
+    WorkerPool pool(nbands);
+    pool.Run(nbands,[&](int32_t band,int32_t)
+    {
+      DecodeContext bctx = ctx;
+      bctx.SB = scratch + band * (sbSize + ckSize + lineSize);
+      bctx.CK = bctx.SB + sbSize;
+      bctx.Line = lineSize ? bctx.CK + ckSize : 0;
+      bctx.Pool = 0;
+      FRIED_STAT(bctx.Stats = bandStats ? &bandStats[band] : 0);
+
+      int32_t first = band * nstripes / nbands;
+      int32_t end = (band + 1) * nstripes / nbands;
+      const uint8_t *bits,*ac;
+
+      bandStart(plane,offsets,acOffsets,first,bits,ac);
+      if(DecodeBand(bctx,bits,plane.BitsEnd,ac,plane.AcEnd,first,end) < 0)
+        errors++;
+    });
+
+    FRIED_STAT(for(int32_t band=0;bandStats && band<nbands;band++) mergeStats(ctx.Stats,&bandStats[band]));
+    FRIED_STAT(delete[] bandStats);
+    delete[] scratch;
+    return errors ? -1 : 0;
+  }
+
+  // sets the range of columns to decode. the stripe buffer only holds
+  // those, so the channel planes in it are laid out accordingly.
+  static void setDecodeColumns(DecodeContext &ctx,int32_t colFirst,int32_t colEnd)
+  {
+    ctx.ColFirst = colFirst;
+    ctx.ColEnd = colEnd;
+
+    for(int32_t ch=0;ch<ctx.FH.Channels;ch++)
+    {
+      ctx.Chans[ch].StripeOffset = ch * (colEnd - colFirst);
+      ctx.Chans[ch].ChunkOffset = ch * ctx.FH.ChunkWidth * 16;
+    }
+  }
+
+  // defaults: the full plane, serial decoding, output to pixels
+  static void resetDecode(DecodeContext &ctx,int32_t version)
+  {
+    ctx.Version = version;
+    ctx.ScaleShift = 0;
+    ctx.Lossless = false;
+    ctx.Preview = false;
+    setDecodeColumns(ctx,0,ctx.XResPadded);
+    ctx.OutX = 0;
+    ctx.OutY = 0;
+    ctx.OutW = ctx.FH.XRes;
+    ctx.OutH = ctx.FH.YRes;
+
+    ctx.Image = 0;
+    ctx.ImagePitch = 0;
+    ctx.Pool = 0;
+    ctx.CKW = 0;
+    ctx.ChunkPos = 0;
+    ctx.Stats = 0;
+
+    ctx.Subsampled = false;
+    ctx.Plane = 0;
+    ctx.Chroma = 0;
+    ctx.Line = 0;
+  }
+
+  // where the parts of a file are (see readHeaders)
+  struct FileLayout
+  {
+    PlaneLayout Main;                  // the full-size channels
+    PlaneLayout Chroma;                // chroma plane of subsampled files
+    const uint8_t *Data;               // stripe data
+    const uint8_t *End;                // end of the file
+    ChannelHeader Chans[16];           // all channel headers, in file order
+    int32_t Channels;
+  };
+
+  // takes the stripe index of nstripes stripes at data
+  static bool takeIndex(const uint8_t *&data,const uint8_t *dataEnd,int32_t nstripes,const uint8_t *&index)
+  {
+    if(dataEnd - data < nstripes * int32_t(sizeof(int32_t)))
+      return false;
+
+    index = data;
+    data += nstripes * sizeof(int32_t);
+    return true;
+  }
+
+  // parses file and channel headers and the stripe indexes, and sets ctx up
+  // to decode the full image. for subsampled files, ctx gets the full-size
+  // channels and chroma the chroma plane. the stripe data is left to
+  // setPlanes. returns false if the file can't be decoded.
+  static bool parseHeaders(DecodeContext &ctx,DecodeContext &chroma,const uint8_t *data,int32_t size,FileLayout &file)
+  {
+    const uint8_t *dataEnd = data + size;
+
+    // check file format. FRIED002 file headers end before the Layers field.
+    if(static_cast<size_t>(size) < offsetof(FileHeader,Layers))
+      return false;
+
+    // check signature
+    int32_t version;
+
+    if(!sCmpMem(data,FRIED_FILE_VERSION,8))
+      version = VERSION_FRIED003;
+    else if(!sCmpMem(data,"FRIED002",8))
+      version = VERSION_FRIED002;
+    else
+      return false;
+
+    // copy header over
+    int32_t headerSize = (version >= VERSION_FRIED003) ? sizeof(FileHeader) : offsetof(FileHeader,Layers);
+    if(size < headerSize)
+      return false;
+
+    sCopyMem(&ctx.FH,data,headerSize);
+    data += headerSize;
+
+    if(version < VERSION_FRIED003)
+      ctx.FH.Layers = 1;
+
+    if(ctx.FH.XRes <= 0 || ctx.FH.YRes <= 0 || ctx.FH.ChunkWidth <= 0 || (ctx.FH.ChunkWidth & 15))
+      return false;
+
+    if(ctx.FH.Layers != 1 && ctx.FH.Layers != 2)
+      return false;
+
+    // check number of channels and copy channel headers over. in FRIED002
+    // files, they end before the Subsample field.
+    int32_t chans = ctx.FH.Channels;
+    int32_t chanSize = (version >= VERSION_FRIED003) ? sizeof(ChannelHeader) : offsetof(ChannelHeader,Subsample);
+
+    if(chans > 16 || dataEnd - data < chans * chanSize)
+      return false;
+
+    for(int32_t ch=0;ch<chans;ch++)
+    {
+      sSetMem(&file.Chans[ch],0,sizeof(ChannelHeader));
+      sCopyMem(&file.Chans[ch],data,chanSize);
+      data += chanSize;
+    }
+
+    file.Channels = chans;
+
+    // calculate some important constants
+    ctx.XResPadded = (ctx.FH.XRes + 31) & ~31;
+    ctx.YResPadded = (ctx.FH.YRes + 31) & ~31;
+
+    // determine channel setup (rather faked at the moment)
+    if(chans < 1 || file.Chans[0].Type != CHANNEL_Y)
+      return false;
+
+    if(chans == 1)
+      ctx.ChannelSetup = 0; // gray w/out alpha
+    else if(chans == 2 && file.Chans[1].Type == CHANNEL_ALPHA)
+      ctx.ChannelSetup = 1; // gray w/ alpha
+    else if(chans >= 3 && file.Chans[1].Type == CHANNEL_CO && file.Chans[2].Type == CHANNEL_CG)
+    {
+      if(chans == 3)
+        ctx.ChannelSetup = 2; // color w/out alpha
+      else if(chans == 4 && file.Chans[3].Type == CHANNEL_ALPHA)
+        ctx.ChannelSetup = 3; // color w/ alpha
+      else
+        return false;
+    }
+    else
+      return false;
+
+    // only Co and Cg can be subsampled, both of them by 2
+    bool subsampled = ctx.ChannelSetup >= 2 && file.Chans[1].Subsample;
+
+    for(int32_t ch=0;ch<chans;ch++)
+    {
+      if(file.Chans[ch].Subsample != ((subsampled && (ch == 1 || ch == 2)) ? 1 : 0))
+        return false;
+    }
+
+    // lossless files: all channels or none, and nothing subsampled
+    bool lossless = version >= VERSION_FRIED003 && file.Chans[0].Quantizer == QUANTIZER_LOSSLESS;
+
+    for(int32_t ch=0;ch<chans;ch++)
+    {
+      if((file.Chans[ch].Quantizer == QUANTIZER_LOSSLESS) != lossless)
+        return false;
+    }
+
+    if(lossless && subsampled)
+      return false;
+
+    // the full-size channels
+    int32_t nplane = 0;
+
+    for(int32_t ch=0;ch<chans;ch++)
+    {
+      if(!file.Chans[ch].Subsample)
+      {
+        ctx.Chans[nplane] = file.Chans[ch];
+        ctx.FileChannel[nplane++] = ch;
+      }
+    }
+
+    ctx.FH.Channels = (uint8_t) nplane;
+
+    // the chroma plane has its own size, chunks and stripe index. its
+    // chunks are as wide as the main plane's unless the plane is narrower.
+    if(subsampled)
+    {
+      chroma.FH = ctx.FH;
+      chroma.FH.XRes = chromaSize(ctx.FH.XRes);
+      chroma.FH.YRes = chromaSize(ctx.FH.YRes);
+      chroma.FH.Channels = 2;
+      chroma.XResPadded = (chroma.FH.XRes + 31) & ~31;
+      chroma.YResPadded = (chroma.FH.YRes + 31) & ~31;
+      chroma.FH.ChunkWidth = sMin(chroma.XResPadded,ctx.FH.ChunkWidth);
+      chroma.ChannelSetup = 4;
+
+      for(int32_t ch=0;ch<2;ch++)
+      {
+        chroma.Chans[ch] = file.Chans[1 + ch];
+        chroma.FileChannel[ch] = 1 + ch;
+      }
+
+      resetDecode(chroma,version);
+    }
+
+    // skip over the stripe indexes: main plane, chroma plane, and for
+    // progressive files the same again for the block AC layer
+    int32_t nstripes = ctx.YResPadded / 16;
+    int32_t cstripes = subsampled ? chroma.YResPadded / 16 : 0;
+    bool layered = ctx.FH.Layers > 1;
+
+    sSetMem(&file.Main,0,sizeof(PlaneLayout));
+    sSetMem(&file.Chroma,0,sizeof(PlaneLayout));
+
+    if(version >= VERSION_FRIED003 && !takeIndex(data,dataEnd,nstripes,file.Main.Index))
+      return false;
+    if(subsampled && !takeIndex(data,dataEnd,cstripes,file.Chroma.Index))
+      return false;
+    if(layered && !takeIndex(data,dataEnd,nstripes,file.Main.AcIndex))
+      return false;
+    if(layered && subsampled && !takeIndex(data,dataEnd,cstripes,file.Chroma.AcIndex))
+      return false;
+
+    // the planes and layers start where the first stripe of their index
+    // does, in file order
+    if(subsampled)
+      memcpy(&file.Chroma.Base,file.Chroma.Index,sizeof(int32_t));
+    if(layered)
+      memcpy(&file.Main.AcBase,file.Main.AcIndex,sizeof(int32_t));
+    if(layered && subsampled)
+      memcpy(&file.Chroma.AcBase,file.Chroma.AcIndex,sizeof(int32_t));
+
+    if(subsampled && file.Chroma.Base <= 0)
+      return false;
+    if(layered && file.Main.AcBase <= file.Chroma.Base)
+      return false;
+    if(layered && subsampled && file.Chroma.AcBase <= file.Main.AcBase)
+      return false;
+
+    file.Data = data;
+    file.End = dataEnd;
+
+    // default to the full image, serial decoding
+    resetDecode(ctx,version);
+    ctx.Subsampled = subsampled;
+    ctx.Lossless = lossless;
+    return true;
+  }
+
+  // points the planes of file at their stripe data. all of the macroblock
+  // layer has to be there; the block AC layer of progressive files ends
+  // where the file does.
+  static bool setPlanes(FileLayout &file)
+  {
+    PlaneLayout &main = file.Main;
+    PlaneLayout &chroma = file.Chroma;
+    int32_t avail = file.End - file.Data;
+    int32_t mbEnd = main.AcIndex ? main.AcBase : avail;
+
+    if(mbEnd > avail || (chroma.Index && chroma.Base >= mbEnd))
+      return false;
+
+    main.Bits = file.Data;
+    main.BitsEnd = file.Data + (chroma.Index ? chroma.Base : mbEnd);
+
+    if(chroma.Index)
+    {
+      chroma.Bits = file.Data + chroma.Base;
+      chroma.BitsEnd = file.Data + mbEnd;
+    }
+
+    if(main.AcIndex)
+    {
+      main.Ac = file.Data + main.AcBase;
+      main.AcEnd = chroma.AcIndex ? file.Data + sMin(chroma.AcBase,avail) : file.End;
+    }
+
+    if(chroma.AcIndex)
+    {
+      chroma.Ac = main.AcEnd;
+      chroma.AcEnd = file.End;
+    }
+
+    return true;
+  }
+
+  // parses the headers of a file and finds its stripe data (see
+  // parseHeaders and setPlanes)
+  static bool readHeaders(DecodeContext &ctx,DecodeContext &chroma,const uint8_t *data,int32_t size,FileLayout &file)
+  {
+    return parseHeaders(ctx,chroma,data,size,file) && setPlanes(file);
+  }
+
+  // lets ctx upsample from the chroma cctx decoded to its Plane. the whole
+  // chroma plane is xres x yres.
+  static void setChroma(DecodeContext &ctx,const DecodeContext &cctx,int32_t xres,int32_t yres)
+  {
+    ctx.Chroma = cctx.Plane;
+    ctx.ChromaX = cctx.OutX;
+    ctx.ChromaY = cctx.OutY;
+    ctx.ChromaW = cctx.OutW;
+    ctx.ChromaRows = cctx.OutH;
+    ctx.ChromaXRes = xres;
+    ctx.ChromaYRes = yres;
+  }
+
+  // work buffers of one plane
+  struct DecodeBuffers
+  {
+    GrowBuffer<int16_t> SB,CK;
+    GrowBuffer<int32_t> QB;
+    GrowBuffer<int32_t> Offsets;       // stripe index
+    GrowBuffer<int32_t> AcOffsets;     // block AC layer index of progressive files
+  };
+
+  static void allocBuffers(DecodeContext &ctx,DecodeBuffers &buf)
+  {
+    int32_t sbw = ctx.FH.Channels * (ctx.ColEnd - ctx.ColFirst);
+    int32_t cbw = ctx.FH.Channels * ctx.FH.ChunkWidth;
+
+    ctx.SB = buf.SB.Get(sbw * 32);
+    ctx.QB = buf.QB.Get(cbw * 16);
+    ctx.CK = buf.CK.Get(cbw * 16);
+  }
+
+  // decodes the rectangle (x,y,w,h) of a plane
+  static bool decodeRegion(DecodeContext &ctx,DecodeBuffers &buf,const PlaneLayout &plane,int32_t x,int32_t y,int32_t w,int32_t h)
+  {
+    // columns: whole chunks covering the rectangle plus the two pixels on
+    // either side that the lbt postfilter reaches across. columns at the
+    // edge of that range get filtered as if they were at the image border,
+    // but they're never written.
+    int32_t cw = ctx.FH.ChunkWidth;
+    int32_t colFirst = sMax(x - 2,0) / cw * cw;
+    int32_t colEnd = sMin((x + w + 2 + cw - 1) / cw * cw,ctx.XResPadded);
+
+    setDecodeColumns(ctx,colFirst,colEnd);
+    ctx.OutX = x;
+    ctx.OutY = y;
+    ctx.OutW = w;
+    ctx.OutH = h;
+
+    // rows: the stripes covering the rectangle. with a stripe index, we can
+    // start right above them, otherwise everything above has to be decoded.
+    int32_t nstripes = ctx.YResPadded / 16;
+    int32_t first = y / 16;
+    int32_t end = (y + h - 1) / 16 + 1;
+    int32_t *offsets = buf.Offsets.Get(nstripes);
+    int32_t *acOffsets = buf.AcOffsets.Get(nstripes);
+    const uint8_t *start = plane.Bits;
+    const uint8_t *ac = plane.Ac;
+
+    if(readPlaneIndex(plane,nstripes,offsets,acOffsets))
+      bandStart(plane,offsets,acOffsets,first,start,ac);
+    else
+      first = 0;
+
+    allocBuffers(ctx,buf);
+    return DecodeBand(ctx,start,plane.BitsEnd,ac,plane.AcEnd,first,end) >= 0;
+  }
+
+}
+
+using namespace FRIED;
+
+// decoder state: work buffers that are kept for the next image, and the
+// state of a streaming decode
+struct FRIED_Decoder
+{
+  DecodeContext Ctx;
+  DecodeContext Chroma;                // chroma plane of subsampled files
+  DecodeBuffers Buf,ChromaBuf;
+  GrowBuffer<int16_t> CKW;
+  GrowBuffer<const uint8_t *> ChunkPos;
+  GrowBuffer<int16_t> Plane;           // decoded chroma plane (rows of it when streaming)
+  GrowBuffer<int16_t> Line;            // merged output row
+  GrowBuffer<uint8_t> Image;           // output of FRIED_DecoderLoad
+  WorkerPool *Pool;                    // chunk decode workers
+  int32_t PoolThreads;
+
+  RowLoop Loop,ChromaLoop;
+  int32_t RowsRead;
+  int32_t ChromaRead;                  // chroma plane rows decoded so far
+  bool Failed;
+
+  FRIED_Decoder()
+  {
+    Pool = 0;
+    PoolThreads = 0;
+    Failed = true;
+  }
+
+  ~FRIED_Decoder()
+  {
+    delete Pool;
+  }
+};
+
+// sets up chunk-parallel entropy decoding (only pays off with several
+// chunks per stripe). the pool is kept as long as the thread count stays.
+// the chroma plane shares it: it has no more chunks than the main plane,
+// and the chunk buffers are sized for all channels.
+static void startChunkPool(FRIED_Decoder *dec,int32_t threads)
+{
+  DecodeContext &ctx = dec->Ctx;
+  int32_t nchunks = (ctx.XResPadded + ctx.FH.ChunkWidth - 1) / ctx.FH.ChunkWidth;
+  int32_t chans = ctx.FH.Channels + (ctx.Subsampled ? dec->Chroma.FH.Channels : 0);
+  threads = sMin(threads,nchunks);
+
+  if(threads <= 1)
+    return;
+
+  if(dec->PoolThreads != threads)
+  {
+    delete dec->Pool;
+    dec->Pool = new WorkerPool(threads);
+    dec->PoolThreads = threads;
+  }
+
+  ctx.Pool = dec->Pool;
+  ctx.CKW = dec->CKW.Get(threads * chans * ctx.FH.ChunkWidth * 16);
+  ctx.ChunkPos = dec->ChunkPos.Get(3 * nchunks + 1);
+
+  if(ctx.Subsampled)
+  {
+    dec->Chroma.Pool = ctx.Pool;
+    dec->Chroma.CKW = ctx.CKW;
+    dec->Chroma.ChunkPos = ctx.ChunkPos;
+  }
+}
+
+#if defined(FRIED_STATS)
+// stripe sizes straight from the stripe indexes (both layers of
+// progressive files), the chroma plane's follow the main plane's
+static void statsStripeBytes(FRIED_Decoder *dec,const FileLayout &file)
+{
+  int32_t first = 0;
+
+  for(int32_t p=0;p<(dec->Ctx.Subsampled ? 2 : 1);p++)
+  {
+    const PlaneLayout &plane = p ? file.Chroma : file.Main;
+    DecodeBuffers &buf = p ? dec->ChromaBuf : dec->Buf;
+    int32_t nstripes = (p ? dec->Chroma : dec->Ctx).YResPadded / 16;
+    int32_t nbytes = plane.BitsEnd - plane.Bits;
+    int32_t acBytes = plane.AcEnd - plane.Ac;
+    int32_t *offsets = buf.Offsets.Get(nstripes);
+    int32_t *acOffsets = buf.AcOffsets.Get(nstripes);
+
+    if(!readPlaneIndex(plane,nstripes,offsets,acOffsets))
+      return;
+
+    for(int32_t stripe=0;stripe<nstripes;stripe++)
+    {
+      int32_t bytes = (stripe < nstripes-1 ? offsets[stripe+1] : nbytes) - offsets[stripe];
+      if(plane.AcIndex)
+        bytes += sMin(stripe < nstripes-1 ? acOffsets[stripe+1] : acBytes,acBytes) - sMin(acOffsets[stripe],acBytes);
+
+      setStripeBytes(dec->Ctx.Stats,first + stripe,bytes);
+    }
+
+    first += nstripes;
+  }
+}
+#endif
+
+// output size for scaled decoding
+static void setScale(DecodeContext &ctx,int32_t scaleShift)
+{
+  ctx.ScaleShift = scaleShift;
+  ctx.OutW = (ctx.FH.XRes + (1 << scaleShift) - 1) >> scaleShift;
+  ctx.OutH = (ctx.FH.YRes + (1 << scaleShift) - 1) >> scaleShift;
+}
+
+// scale divisors 4 and 16 only decode the macroblock layer. returns -1 for
+// other divisors than 1, 4 and 16.
+static int32_t ScaleShift(int32_t scale)
+{
+  return (scale == 1) ? 0 : (scale == 4) ? 2 : (scale == 16) ? 4 : -1;
+}
+
+// parses the headers and sets dec up to decode the image at params->Scale.
+// returns false if the file can't be decoded.
+static bool startDecode(FRIED_Decoder *dec,const uint8_t *data,int32_t size,const FRIED_DecodeParams *params,FileLayout &file)
+{
+  DecodeContext &ctx = dec->Ctx;
+  DecodeContext &cctx = dec->Chroma;
+
+  dec->Failed = true; // cancels a streaming decode
+
+  int32_t scaleShift = ScaleShift(params->Scale);
+  if(scaleShift < 0)
+    return false;
+
+  if(!readHeaders(ctx,cctx,data,size,file))
+    return false;
+
+  allocBuffers(ctx,dec->Buf);
+  if(scaleShift)
+    setScale(ctx,scaleShift);
+
+  if(ctx.Subsampled)
+  {
+    allocBuffers(cctx,dec->ChromaBuf);
+    if(scaleShift)
+      setScale(cctx,scaleShift);
+
+    ctx.Line = dec->Line.Get(4 * ctx.OutW);
+    cctx.Stats = params->Stats;
+  }
+
+  ctx.Stats = params->Stats;
+  ctx.Preview = cctx.Preview = params->Preview;
+  startStats(ctx.Stats,file.Chans,file.Channels,ctx.YResPadded / 16 + (ctx.Subsampled ? cctx.YResPadded / 16 : 0));
+  FRIED_STAT(if(ctx.Stats && file.Main.Index) statsStripeBytes(dec,file));
+
+  return true;
+}
+
+// progressive files: the rows at the top of a plane that decode as from
+// the complete file, judging by the block AC chunks that are there. stripes
+// are post-filtered across their lower edge, so the last two rows of a
+// complete stripe wait for the next one.
+static int32_t completeRows(const DecodeContext &ctx,const PlaneLayout &plane,DecodeBuffers &buf)
+{
+  int32_t nstripes = ctx.YResPadded / 16;
+  int32_t nchunks = (ctx.XResPadded + ctx.FH.ChunkWidth - 1) / ctx.FH.ChunkWidth;
+  int32_t *offsets = buf.Offsets.Get(nstripes);
+  int32_t *acOffsets = buf.AcOffsets.Get(nstripes);
+  int32_t stripe;
+
+  if(!readPlaneIndex(plane,nstripes,offsets,acOffsets))
+    return 0;
+
+  for(stripe=0;stripe<nstripes;stripe++)
+  {
+    const uint8_t *ac = plane.Ac + sMin<intptr_t>(acOffsets[stripe],plane.AcEnd - plane.Ac);
+
+    for(int32_t chunk=0;chunk<nchunks && ac;chunk++)
+    {
+      if(plane.AcEnd - ac < 2 || plane.AcEnd - ac < ac[0] + (ac[1] << 8))
+        ac = 0;
+      else
+        ac += ac[0] + (ac[1] << 8);
+    }
+
+    if(!ac)
+      break;
+  }
+
+  return (stripe == nstripes) ? ctx.FH.YRes : sMin(sMax(stripe * 16 - 2,0),ctx.FH.YRes);
+}
+
+// decodes a whole plane
+static bool decodePlane(FRIED_Decoder *dec,DecodeContext &ctx,DecodeBuffers &buf,const PlaneLayout &plane,int32_t threads)
+{
+  int32_t nstripes = ctx.YResPadded / 16;
+  int32_t *offsets = 0;
+  int32_t *acOffsets = 0;
+  int32_t result;
+
+  // decode. with a usable stripe index, do bands of stripes in parallel
+  if(!ctx.ScaleShift && threads > 1 && nstripes > 1)
+  {
+    offsets = buf.Offsets.Get(nstripes);
+    acOffsets = buf.AcOffsets.Get(nstripes);
+    if(!readPlaneIndex(plane,nstripes,offsets,acOffsets))
+      offsets = 0;
+  }
+
+  if(ctx.ScaleShift) // macroblock layer only, cheap enough to do serially
+    result = PerformDecodeScaled(ctx,plane);
+  else if(offsets)
+    result = PerformDecodeBands(ctx,plane,offsets,acOffsets,sMin(threads,nstripes));
+  else
+  {
+    // otherwise, chunk-parallel entropy decoding
+    startChunkPool(dec,threads);
+    result = PerformDecode(ctx,plane);
+  }
+
+  return result >= 0;
+}
+
+// decodes the whole image to ctx.Image. the chroma plane of a subsampled
+// file goes first, the main plane upsamples from it.
+static bool DecodeImage(FRIED_Decoder *dec,const FileLayout &file,const FRIED_DecodeParams *params)
+{
+  DecodeContext &ctx = dec->Ctx;
+  int32_t threads = ResolveThreads(params->Threads);
+
+  if(ctx.Subsampled)
+  {
+    DecodeContext &cctx = dec->Chroma;
+
+    cctx.Plane = dec->Plane.Get(2 * cctx.OutW * cctx.OutH);
+    if(!decodePlane(dec,cctx,dec->ChromaBuf,file.Chroma,threads))
+      return false;
+
+    setChroma(ctx,cctx,cctx.OutW,cctx.OutH);
+  }
+
+  return decodePlane(dec,ctx,dec->Buf,file.Main,threads);
+}
+
+[[maybe_unused]] const char* getSupportedFileVersion()
+{
+    return FRIED_FILE_VERSION;
+}
+void FreeFRIED(const uint8_t* allocated)
+{
+    delete[] allocated;
+}
+void FRIED_InitDecodeParams(FRIED_DecodeParams *params)
+{
+  params->Threads = 1;
+  params->Scale = 1;
+  params->Stats = 0;
+  params->Preview = false;
+}
+
+bool LoadFRIED(const uint8_t *data,int32_t size,int32_t &xout,int32_t &yout, int32_t &outSize, uint8_t *&dataout)
+{
+  FRIED_DecodeParams params;
+  FRIED_InitDecodeParams(&params);
+
+  return LoadFRIEDEx(data,size,&params,xout,yout,outSize,dataout);
+}
+
+bool LoadFRIEDEx(const uint8_t *data,int32_t size,const FRIED_DecodeParams *params,int32_t &xout,int32_t &yout, int32_t &outSize, uint8_t *&dataout)
+{
+  FRIED_Decoder dec;
+  DecodeContext &ctx = dec.Ctx;
+  FileLayout file;
+
+  xout = 0;
+  yout = 0;
+  outSize = 0;
+  dataout = nullptr;
+
+  if(!startDecode(&dec,data,size,params,file))
+    return false;
+
+  // allocate image
+  int32_t imageSize = ctx.OutW * ctx.OutH * (ctx.ChannelSetup >= 2 ? 4 : 2);
+  ctx.Image = new uint8_t[imageSize];
+
+  if(!DecodeImage(&dec,file,params))
+  {
+    delete[] ctx.Image;
+    return false;
+  }
+
+  xout = ctx.OutW;
+  yout = ctx.OutH;
+  outSize = imageSize;
+  dataout = ctx.Image;
+  return true;
+}
+
+bool FRIED_GetInfo(const uint8_t *data,int32_t size,int32_t scale,int32_t &xout,int32_t &yout,int32_t &bytesPerPixel)
+{
+  FRIED_Decoder dec;
+  DecodeContext &ctx = dec.Ctx;
+  FileLayout file;
+  int32_t scaleShift = ScaleShift(scale);
+
+  xout = 0;
+  yout = 0;
+  bytesPerPixel = 0;
+
+  if(scaleShift < 0 || !readHeaders(ctx,dec.Chroma,data,size,file))
+    return false;
+
+  setScale(ctx,scaleShift);
+  xout = ctx.OutW;
+  yout = ctx.OutH;
+  bytesPerPixel = ctx.ChannelSetup < 2 ? 2 : 4;
+  return true;
+}
+
+bool FRIED_GetProgress(const uint8_t *data,int32_t size,int32_t &previewBytes,int32_t &fullRows)
+{
+  FRIED_Decoder dec;
+  DecodeContext &ctx = dec.Ctx;
+  FileLayout file;
+
+  previewBytes = 0;
+  fullRows = 0;
+
+  if(!parseHeaders(ctx,dec.Chroma,data,size,file) || !file.Main.AcIndex)
+    return false;
+
+  // nothing to show before the macroblock layer is complete
+  previewBytes = int32_t(file.Data - data) + file.Main.AcBase;
+  if(!setPlanes(file))
+    return true;
+
+  // subsampled files: rows are upsampled from the chroma row below too
+  fullRows = completeRows(ctx,file.Main,dec.Buf);
+  if(ctx.Subsampled)
+  {
+    int32_t chromaRows = completeRows(dec.Chroma,file.Chroma,dec.ChromaBuf);
+    if(chromaRows < dec.Chroma.FH.YRes)
+      fullRows = sMin(fullRows,sMax(2 * (chromaRows - 1),0));
+  }
+
+  return true;
+}
+
+bool LoadFRIEDInto(const uint8_t *data,int32_t size,uint8_t *dst,int32_t dstPitch,int64_t dstCapacity,bool bottomUp,const FRIED_DecodeParams *params,int32_t &xout,int32_t &yout)
+{
+  FRIED_Decoder dec;
+
+  return FRIED_DecoderLoadInto(&dec,data,size,dst,dstPitch,dstCapacity,bottomUp,params,xout,yout);
+}
+
+bool LoadFRIEDRegion(const uint8_t *data,int32_t size,int32_t x,int32_t y,int32_t w,int32_t h,int32_t &outSize,uint8_t *&dataout)
+{
+  FRIED_Decoder dec;
+  DecodeContext &ctx = dec.Ctx;
+  FileLayout file;
+  bool ok = true;
+
+  outSize = 0;
+  dataout = nullptr;
+
+  if(!readHeaders(ctx,dec.Chroma,data,size,file))
+    return false;
+
+  if(x < 0 || y < 0 || w <= 0 || h <= 0 || x > ctx.FH.XRes - w || y > ctx.FH.YRes - h)
+    return false;
+
+  outSize = w * h * (ctx.ChannelSetup >= 2 ? 4 : 2);
+  ctx.Image = new uint8_t[outSize];
+
+  // the chroma samples the upsampling needs: the ones under the rectangle
+  // and their neighbours
+  if(ctx.Subsampled)
+  {
+    DecodeContext &cctx = dec.Chroma;
+    int32_t cx = sMax((x >> 1) - 1,0);
+    int32_t cy = sMax((y >> 1) - 1,0);
+    int32_t cw = sMin(((x + w - 1) >> 1) + 2,cctx.FH.XRes) - cx;
+    int32_t ch = sMin(((y + h - 1) >> 1) + 2,cctx.FH.YRes) - cy;
+
+    cctx.Plane = dec.Plane.Get(2 * cw * ch);
+    ok = decodeRegion(cctx,dec.ChromaBuf,file.Chroma,cx,cy,cw,ch);
+    setChroma(ctx,cctx,cctx.FH.XRes,cctx.FH.YRes);
+    ctx.Line = dec.Line.Get(4 * w);
+  }
+
+  if(ok && decodeRegion(ctx,dec.Buf,file.Main,x,y,w,h))
+    dataout = ctx.Image;
+  else
+  {
+    outSize = 0;
+    delete[] ctx.Image;
+  }
 
   return dataout != nullptr;
 }
+
+FRIED_Decoder *FRIED_NewDecoder()
+{
+  return new FRIED_Decoder;
+}
+
+const uint8_t *FRIED_DecoderLoad(FRIED_Decoder *dec,const uint8_t *data,int32_t size,const FRIED_DecodeParams *params,int32_t &xout,int32_t &yout,int32_t &outSize)
+{
+  DecodeContext &ctx = dec->Ctx;
+  FileLayout file;
+
+  xout = 0;
+  yout = 0;
+  outSize = 0;
+
+  if(!startDecode(dec,data,size,params,file))
+    return 0;
+
+  int32_t imageSize = ctx.OutW * ctx.OutH * (ctx.ChannelSetup >= 2 ? 4 : 2);
+  ctx.Image = dec->Image.Get(imageSize);
+
+  if(!DecodeImage(dec,file,params))
+    return 0;
+
+  xout = ctx.OutW;
+  yout = ctx.OutH;
+  outSize = imageSize;
+  return ctx.Image;
+}
+
+bool FRIED_DecoderLoadInto(FRIED_Decoder *dec,const uint8_t *data,int32_t size,uint8_t *dst,int32_t dstPitch,int64_t dstCapacity,bool bottomUp,const FRIED_DecodeParams *params,int32_t &xout,int32_t &yout)
+{
+  DecodeContext &ctx = dec->Ctx;
+  FRIED_DecodeParams defaults;
+  FileLayout file;
+
+  xout = 0;
+  yout = 0;
+
+  if(!params)
+  {
+    FRIED_InitDecodeParams(&defaults);
+    params = &defaults;
+  }
+
+  if(!dst || !startDecode(dec,data,size,params,file))
+    return false;
+
+  // the rows have to fit, without overlapping
+  int32_t rowBytes = ctx.OutW * (ctx.ChannelSetup >= 2 ? 4 : 2);
+  if(!dstPitch)
+    dstPitch = rowBytes;
+
+  if(dstPitch < rowBytes || int64_t(ctx.OutH - 1) * dstPitch + rowBytes > dstCapacity)
+    return false;
+
+  // bottom-up: row 0 goes to the last row of the buffer
+  ctx.Image = bottomUp ? dst + intptr_t(ctx.OutH - 1) * dstPitch : dst;
+  ctx.ImagePitch = bottomUp ? -dstPitch : dstPitch;
+
+  bool ok = DecodeImage(dec,file,params);
+  ctx.Image = 0; // not ours
+
+  if(!ok)
+    return false;
+
+  xout = ctx.OutW;
+  yout = ctx.OutH;
+  return true;
+}
+
+bool FRIED_DecoderBegin(FRIED_Decoder *dec,const uint8_t *data,int32_t size,const FRIED_DecodeParams *params,int32_t &xout,int32_t &yout,int32_t &bytesPerPixel)
+{
+  DecodeContext &ctx = dec->Ctx;
+  FileLayout file;
+
+  xout = 0;
+  yout = 0;
+  bytesPerPixel = 0;
+
+  // streaming is full size only
+  if(params->Scale != 1 || !startDecode(dec,data,size,params,file))
+    return false;
+
+  startChunkPool(dec,ResolveThreads(params->Threads));
+  dec->RowsRead = 0;
+  dec->Failed = !startRowLoop(ctx,dec->Loop,file.Main.Bits,file.Main.BitsEnd,file.Main.Ac,file.Main.AcEnd,0);
+
+  // the chroma plane is decoded along with the image. the rows the
+  // upsampling needs are kept in a ring of 4.
+  if(ctx.Subsampled)
+  {
+    DecodeContext &cctx = dec->Chroma;
+
+    dec->ChromaRead = 0;
+    dec->Failed = dec->Failed || !startRowLoop(cctx,dec->ChromaLoop,file.Chroma.Bits,file.Chroma.BitsEnd,file.Chroma.Ac,file.Chroma.AcEnd,0);
+
+    cctx.Plane = dec->Plane.Get(4 * 2 * cctx.OutW);
+    setChroma(ctx,cctx,cctx.FH.XRes,cctx.FH.YRes);
+    ctx.ChromaRows = 4;
+    cctx.Plane = 0;
+  }
+
+  xout = ctx.FH.XRes;
+  yout = ctx.FH.YRes;
+  bytesPerPixel = ctx.ChannelSetup < 2 ? 2 : 4;
+  return true;
+}
+
+FRIED_Decoder *FRIED_CreateDecoder(const uint8_t *data,int32_t size,const FRIED_DecodeParams *params,int32_t &xout,int32_t &yout,int32_t &bytesPerPixel)
+{
+  FRIED_Decoder *dec = new FRIED_Decoder;
+
+  if(!FRIED_DecoderBegin(dec,data,size,params,xout,yout,bytesPerPixel))
+    sDelete(dec);
+
+  return dec;
+}
+
+int32_t FRIED_DecoderReadRows(FRIED_Decoder *dec,uint8_t *dst,int32_t nrows,int32_t pitch)
+{
+  DecodeContext &ctx = dec->Ctx;
+  int32_t bpp = ctx.ChannelSetup < 2 ? 2 : 4;
+
+  if(dec->Failed || nrows < 0)
+    return -1;
+
+  if(!pitch)
+    pitch = ctx.FH.XRes * bpp;
+
+  nrows = sMin(nrows,ctx.FH.YRes - dec->RowsRead);
+
+  for(int32_t i=0;i<nrows;i++)
+  {
+    int32_t row = dec->RowsRead + i;
+    int16_t *line = decodeRow(ctx,dec->Loop);
+    if(!line)
+    {
+      dec->Failed = true;
+      return -1;
+    }
+
+    // chroma rows up to the one below this row's
+    if(ctx.Subsampled)
+    {
+      DecodeContext &cctx = dec->Chroma;
+      int32_t need = sMin((row >> 1) + 1,cctx.FH.YRes - 1);
+
+      while(dec->ChromaRead <= need)
+      {
+        int16_t *cline = decodeRow(cctx,dec->ChromaLoop);
+        if(!cline)
+        {
+          dec->Failed = true;
+          return -1;
+        }
+
+        int16_t *out = dec->Plane.Data + (dec->ChromaRead++ % 4) * 2 * cctx.OutW;
+        sCopyMem(out,cline,cctx.OutW * sizeof(int16_t));
+        sCopyMem(out + cctx.OutW,cline + cctx.Chans[1].StripeOffset,cctx.OutW * sizeof(int16_t));
+      }
+    }
+
+    outputRow(ctx,row,ctx.FH.XRes,ctx.XResPadded,line,dst + intptr_t(i) * pitch);
+  }
+
+  dec->RowsRead += nrows;
+  return nrows;
+}
+
+void FRIED_DestroyDecoder(FRIED_Decoder *dec)
+{
+  delete dec;
+}
+
+bool FRIED_DecodeRows(const uint8_t *data,int32_t size,const FRIED_DecodeParams *params,FRIED_RowFunc func,void *user)
+{
+  FRIED_Decoder dec;
+  int32_t xres,yres,bpp;
+
+  if(!FRIED_DecoderBegin(&dec,data,size,params,xres,yres,bpp))
+    return false;
+
+  uint8_t *line = new uint8_t[xres * bpp];
+  bool ok = true;
+
+  for(int32_t row=0;row<yres && ok;row++)
+    ok = FRIED_DecoderReadRows(&dec,line,1,0) == 1 && func(user,row,line);
+
+  delete[] line;
+  return ok;
+}
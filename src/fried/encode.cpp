@@ -4,24 +4,58 @@
 // encoding functions.
 #include "fried.hpp"
 #include "fried_internal.hpp"
+#include "workerpool.hpp"
 
 namespace FRIED
 {
-  static void read_bitmap_row(EncodeContext &ctx,int32_t row,int32_t *srp)
+  // source row, rows outside the image repeat the nearest edge row
+  static const uint8_t *source_row(const EncodeContext &ctx,int32_t row)
   {
     if(row < 0)
       row = 0;
     else if(row >= ctx.FH.YRes)
       row = ctx.FH.YRes - 1;
 
+    return ctx.Image + intptr_t(row) * ctx.Pitch;
+  }
+
+  // source row src in the coding layout: as it is, or converted to dst
+  static const uint8_t *coding_row(const EncodeContext &ctx,const uint8_t *src,uint8_t *dst)
+  {
+    if(!ctx.Convert)
+      return src;
+
+    if(ctx.Flags & FRIED_GRAYSCALE)
+      layout_convert_gray(ctx.Convert,ctx.FH.XRes,src,dst);
+    else
+      layout_convert_bgra(ctx.Convert,ctx.FH.XRes,src,dst);
+
+    return dst;
+  }
+
+  // converts a source row to the channels of ctx's plane. the chroma plane
+  // takes two source rows (src and below) per row. rows in other layouts
+  // than the coding one are converted to ctx.Rows first.
+  static void read_bitmap_row(EncodeContext &ctx,const uint8_t *src,const uint8_t *below,int32_t *srp)
+  {
     int32_t cols = ctx.FH.XRes;
     int32_t colsPad = ctx.XResPadded;
-    const uint8_t *src = ctx.Image;
 
-    if(ctx.Flags & FRIED_GRAYSCALE)
-    {
-      src += row * 2 * cols;
+    src = coding_row(ctx,src,ctx.Rows);
 
+    if(ctx.Flags & FRIED_LOSSLESS)
+      lossless_convert_dir(cols,colsPad,src,srp,!(ctx.Flags & FRIED_GRAYSCALE),(ctx.Flags & FRIED_SAVEALPHA) != 0);
+    else if(ctx.Subsample)
+      chroma_convert_dir(cols,colsPad,src,coding_row(ctx,below,ctx.Rows + cols * 4),srp);
+    else if(ctx.Chroma)
+    {
+      if(ctx.Flags & FRIED_SAVEALPHA)
+        luma_alpha_convert_dir(cols,colsPad,src,srp);
+      else
+        luma_x_convert_dir(cols,colsPad,src,srp);
+    }
+    else if(ctx.Flags & FRIED_GRAYSCALE)
+    {
       if(ctx.Flags & FRIED_SAVEALPHA)
         gray_alpha_convert_dir(cols,colsPad,src,srp);
       else
@@ -29,8 +63,6 @@ namespace FRIED
     }
     else
     {
-      src += row * 4 * cols;
-
       if(ctx.Flags & FRIED_SAVEALPHA)
         color_alpha_convert_dir(cols,colsPad,src,srp);
       else
@@ -38,7 +70,50 @@ namespace FRIED
     }
   }
 
-  static void reorder(int32_t *dest_chunk,int32_t *src_chunk,int32_t cwidth)
+  // largest chunk the encoder writes: 3 bytes per coefficient plus the
+  // length fields, but no more than the 16-bit chunk length can describe.
+  // progressive files have a chunk per layer (0=macroblock, 1=block AC)
+  // with the coefficients of that layer.
+  static int32_t maxChunkSize(int32_t cwidth,int32_t chans,int32_t layers,int32_t layer)
+  {
+    if(layers == 1)
+      return sMin(2 + chans * (2 + cwidth * 16 * 3),65535);
+
+    return sMin(layer ? 2 + chans * cwidth * 15 * 3 : 2 + chans * (2 + cwidth * 3),65535);
+  }
+
+  // largest stripe the encoder writes
+  static int32_t maxStripeSize(int32_t cols,int32_t cwidth,int32_t chans,int32_t layers)
+  {
+    int32_t size = 0;
+
+    for(int32_t ncc=0;ncc<cols;ncc+=cwidth)
+    {
+      for(int32_t layer=0;layer<layers;layer++)
+        size += maxChunkSize(sMin(cwidth,cols - ncc),chans,layers,layer);
+    }
+
+    return size;
+  }
+
+  // progressive files: size of the macroblock layer of a coded stripe
+  static int32_t macroblockLayerSize(const EncodeContext &ctx,const uint8_t *stripe)
+  {
+    int32_t nchunks = (ctx.XResPadded + ctx.FH.ChunkWidth - 1) / ctx.FH.ChunkWidth;
+    int32_t size = 0;
+
+    for(int32_t chunk=0;chunk<nchunks;chunk++)
+    {
+      int32_t mbSize = stripe[0] + (stripe[1] << 8);
+      stripe += mbSize;
+      size += mbSize;
+      stripe += stripe[0] + (stripe[1] << 8);
+    }
+
+    return size;
+  }
+
+  void reorder(int32_t *dest_chunk,int32_t *src_chunk,int32_t cwidth)
   {
 	  static const uint8_t psd[16] = {
 		  0x00,0x04,0x44,0x40,
@@ -110,11 +185,46 @@ namespace FRIED
     }
   }
 
-  static int32_t encodeStripe(EncodeContext &ctx,int32_t cols,int32_t, uint8_t *bytes,int32_t maxbytes,int32_t **srp)
+  // number of coefficients a stripe has in the coefficient cache
+  static int32_t stripeCoeffs(const EncodeContext &ctx)
+  {
+    return ctx.FH.Channels * ctx.XResPadded * 16;
+  }
+
+  // stores the reordered coefficients of a stripe in coeffs: chunk by
+  // chunk, each chunk channel by channel
+  static void cacheStripe(EncodeContext &ctx,int32_t cols,int32_t *coeffs,int32_t **srp)
+  {
+    int32_t cwidth = ctx.FH.ChunkWidth;
+    int32_t chans = ctx.FH.Channels;
+
+    for(int32_t ncc=0;ncc<cols;ncc+=cwidth)
+    {
+      cwidth = sMin(cwidth,cols - ncc);
+
+      for(int32_t ch=0;ch<chans;ch++)
+      {
+        int32_t so = ctx.Chans[ch].StripeOffset;
+
+        for(int32_t n=0;n<16;n++)
+          sCopyMem(&ctx.QB[n*cwidth],srp[n] + so + ncc,cwidth * sizeof(int32_t));
+
+        FRIED_STAT(double t = statsTime(ctx.Stats));
+        reorder(coeffs + ncc * 16 * chans + ch * cwidth * 16,ctx.QB,cwidth);
+        FRIED_STAT(addTime(ctx.Stats,&FRIED_Stats::ReorderTime,t));
+      }
+    }
+  }
+
+  // encodes a stripe from the stripe buffer, or, with coeffs, from its
+  // cached coefficients (see cacheStripe)
+  static int32_t encodeStripe(EncodeContext &ctx,int32_t cols,int32_t, uint8_t *bytes,int32_t maxbytes,int32_t **srp,const int32_t *coeffs)
   {
-    int32_t cjs[16];
+    int32_t cjs[16],encsizes[16];
+    FRIED_STAT(int32_t nonzeros[16],mbBytes[16]);
     int32_t cwidth = ctx.FH.ChunkWidth;
     int32_t nchunks = (cols + cwidth - 1) / cwidth;
+    int32_t layers = ctx.FH.Layers;
     int32_t *g0,n;
     uint8_t *byteStart = bytes;
     uint8_t *byteEnd = bytes + maxbytes;
@@ -130,8 +240,13 @@ namespace FRIED
       if(chunk == nchunks-1)
         cwidth = cols - ncc;
 
-      // leave space for chunk length field
+      // leave space for chunk length field. a stream that fills up the
+      // rest of the chunk may have been cut, so that's an error too.
       uint8_t *chunkSizePtr = (uint8_t *) bytes;
+      uint8_t *chunkEnd = bytes + sMin<intptr_t>(maxChunkSize(cwidth,ctx.FH.Channels,layers,0),byteEnd - bytes);
+      if(chunkEnd - bytes < 2)
+        return -1;
+
       bytes += 2;
 
       // process channels
@@ -142,18 +257,28 @@ namespace FRIED
         int32_t qs = ctx.Chans[ch].Quantizer;
         int32_t cksize = cwidth * 16;
 
-        // copy data over from stripe buffer to quantization buffer
-        for(n=0;n<16;n++)
-          sCopyMem(&ctx.QB[n*cwidth],srp[n] + so + cjs[ch],cwidth * sizeof(int32_t));
+        FRIED_STAT(double t = statsTime(ctx.Stats));
+        if(coeffs)
+          sCopyMem(ctx.CK + co,coeffs + ncc * 16 * ctx.FH.Channels + ch * cksize,cksize * sizeof(int32_t));
+        else
+        {
+          // copy data over from stripe buffer to quantization buffer
+          for(n=0;n<16;n++)
+            sCopyMem(&ctx.QB[n*cwidth],srp[n] + so + cjs[ch],cwidth * sizeof(int32_t));
 
-        // reorder and quantize
-        reorder(ctx.CK + co,ctx.QB,cwidth);
+          // reorder
+          reorder(ctx.CK + co,ctx.QB,cwidth);
+        }
+        FRIED_STAT(addTime(ctx.Stats,&FRIED_Stats::ReorderTime,t); t = statsTime(ctx.Stats));
 
+        // quantize
         g0 = ctx.CK + co;
         int32_t encsize = newQuantize(qs,g0,cksize,cwidth);
+        FRIED_STAT(nonzeros[ch] = ctx.Stats ? countNonzero(g0,encsize) : 0);
 
-        // delta encode dc coefficients
-        n = sMin(encsize,cwidth/16);
+        // delta encode dc coefficients, as many as the decoder un-deltas:
+        // the written encsize is rounded up to 8
+        n = sMin((encsize + 7) & ~7,cwidth/16);
 
         while(--n > 0)
         {
@@ -164,8 +289,14 @@ namespace FRIED
         /*while(--n > 0)
           g0[n] -= g0[n-1];*/
 
+        FRIED_STAT(addTime(ctx.Stats,&FRIED_Stats::QuantizeTime,t));
+
         // write number of encoded coeffs
         encsize = (encsize + 7) & ~7;
+        encsizes[ch] = encsize;
+
+        if(chunkEnd - bytes < 2)
+          return -1;
 
         if(encsize < 127 * 8)
           *bytes++ = encsize >> 2;
@@ -176,36 +307,68 @@ namespace FRIED
           *bytes++ = temp >> 8;
         }
 
-        // encode the coeffs themselves
+        // encode the macroblock coeffs
+        FRIED_STAT(mbBytes[ch] = 0);
         if(encsize)
         {
           int32_t xminit,nbs;
 
-          xminit = 625 >> (qs >> 3);
-          nbs = rlgrenc(bytes,byteEnd - bytes,g0,sMin(encsize,cwidth),xminit);
-          if(nbs < 0)
+          FRIED_STAT(t = statsTime(ctx.Stats));
+          xminit = mbXMinInit(qs);
+          nbs = rlgrenc(bytes,chunkEnd - bytes,g0,sMin(encsize,cwidth),xminit);
+          FRIED_STAT(addTime(ctx.Stats,&FRIED_Stats::EntropyTime,t); mbBytes[ch] = nbs);
+          if(nbs < 0 || nbs == chunkEnd - bytes)
             return -1;
           else
             bytes += nbs;
-
-          if(encsize > cwidth)
-          {
-            xminit = 94 >> (qs >> 3);
-            nbs = rlgrenc(bytes,byteEnd - bytes,g0+cwidth,encsize-cwidth,xminit);
-            if(nbs < 0)
-              return -1;
-            else
-              bytes += nbs;
-          }
         }
 
         // this channel is done
         cjs[ch] += cwidth;
       }
 
+      // progressive files: the block AC coeffs start a chunk of their own
+      if(layers > 1)
+      {
+        int32_t mbSize = bytes - chunkSizePtr;
+
+        chunkSizePtr[0] = mbSize & 0xff;
+        chunkSizePtr[1] = mbSize >> 8;
+
+        chunkSizePtr = bytes;
+        chunkEnd = bytes + sMin<intptr_t>(maxChunkSize(cwidth,ctx.FH.Channels,layers,1),byteEnd - bytes);
+        if(chunkEnd - bytes < 2)
+          return -1;
+
+        bytes += 2;
+      }
+
+      // block AC coeffs of all channels go last, so scaled decodes
+      // can skip them using the chunk size
+      for(int32_t ch=0;ch<ctx.FH.Channels;ch++)
+      {
+        FRIED_STAT(int32_t acBytes = 0);
+        if(encsizes[ch] > cwidth)
+        {
+          int32_t qs = ctx.Chans[ch].Quantizer;
+          int32_t xminit,nbs;
+
+          FRIED_STAT(double t = statsTime(ctx.Stats));
+          g0 = ctx.CK + ctx.Chans[ch].ChunkOffset;
+          xminit = acXMinInit(qs);
+          nbs = rlgrenc(bytes,chunkEnd - bytes,g0+cwidth,encsizes[ch]-cwidth,xminit);
+          FRIED_STAT(addTime(ctx.Stats,&FRIED_Stats::EntropyTime,t); acBytes = nbs);
+          if(nbs < 0 || nbs == chunkEnd - bytes)
+            return -1;
+          else
+            bytes += nbs;
+        }
+
+        FRIED_STAT(addChunkStats(ctx.Stats,ctx.FileChannel[ch],encsizes[ch],cwidth * 16,nonzeros[ch],mbBytes[ch] + acBytes));
+      }
+
       // write the chunk size
       int32_t chunkSize = bytes - chunkSizePtr;
-      //sVERIFY(chunkSize < 65536);
 
       chunkSizePtr[0] = chunkSize & 0xff;
       chunkSizePtr[1] = chunkSize >> 8;
@@ -214,7 +377,7 @@ namespace FRIED
     return bytes - byteStart;
   }
 
-  static void hlbt_group1(int32_t swidth,int32_t so,int32_t ib,int32_t **srp,bool ftop)
+  static void hlbt_group1(int32_t swidth,int32_t so,int32_t ib,int32_t **srp,bool ftop,bool lossless)
   {
     int32_t *pa,*pb,*p0,*p1,*p2,*p3;
     int32_t col;
@@ -226,6 +389,16 @@ namespace FRIED
     p1 = srp[ib-2] + so;
     p2 = srp[ib-1] + so;
     p3 = srp[ib-0] + so;
+
+    // lossless: block transforms only, no prefilter
+    if(lossless)
+    {
+      for(col=0;col<swidth;col+=4)
+        ndct42D(pa+col,pb+col,p0+col,p1+col);
+
+      return;
+    }
+
     lbt4pre4x2(p0,p1,p2,p3);
 
     for(col=0;col<swidth-4;col+=4)
@@ -256,7 +429,7 @@ namespace FRIED
       ndct42D_MB(pa+col,pb+col,p0+col,p1+col);
   }
 
-  static void hlbt_group3(int32_t swidth,int32_t so,int32_t ib,int32_t **srp)
+  static void hlbt_group3(int32_t swidth,int32_t so,int32_t ib,int32_t **srp,bool lossless)
   {
     int32_t *pa,*pb,*p0,*p1;
     int32_t col;
@@ -269,7 +442,9 @@ namespace FRIED
 
     for(col=0;col<swidth-4;col+=4)
     {
-      lbt4pre2x4(p0+col+2,p1+col+2);
+      if(!lossless)
+        lbt4pre2x4(p0+col+2,p1+col+2);
+
       ndct42D(pa+col,pb+col,p0+col,p1+col);
     }
 
@@ -294,163 +469,1429 @@ namespace FRIED
 	  return fr;
   }
 
-  static int32_t PerformEncode(EncodeContext &ctx)
+  // state of the row loop: the stripe buffer ring, the next source row and
+  // where finished stripes go.
+  struct RowLoop
   {
     int32_t *srp[32];
     int32_t fr,ib,k;
-    uint8_t *bits,*bitsEnd;
-    int32_t cols,rows,chans;
-    int32_t stsize;
-    
-    cols = ctx.XResPadded;
-    rows = ctx.YResPadded;
-    chans = ctx.FH.Channels;
-    stsize = chans * cols;
-
-    bits = ctx.Bits;
-    bitsEnd = ctx.Bits + ctx.BitsLength;
-
-    // copy over frame and channel headers
-    memcpy(bits,&ctx.FH,sizeof(FileHeader));
-    bits += sizeof(FileHeader);
+    int32_t Row;                       // next source row (padded coordinates)
+    int32_t First,End;                 // stripes to encode
+    uint8_t *Bits;                     // output position
+    uint8_t *BitsEnd;                  // end of output buffer
+  };
+
+  // sets up the ring buffer state as the serial loop would have it at the
+  // first row of stripe first. a band that doesn't start at the top of the
+  // image starts reading two rows above its first stripe, so the lbt
+  // prefilter across the seam sees exactly the rows the serial encoder
+  // would have, and the band output is identical to the serial output.
+  static void startRowLoop(EncodeContext &ctx,RowLoop &loop,int32_t first,int32_t end)
+  {
+    loop.fr = updatebp(loop.srp,ctx.SB,0,ctx.FH.Channels * ctx.XResPadded,1);
+    loop.Row = first ? first * 16 - 2 : 0;
+    loop.ib = (loop.Row < 32) ? loop.Row : 16 + (loop.Row & 15);
+    loop.k = (loop.Row - 2) % 4 + 1;
+    loop.First = first;
+    loop.End = end;
+  }
 
-    for(int32_t ch=0;ch<chans;ch++)
-    {
-      memcpy(bits,&ctx.Chans[ch],sizeof(ChannelHeader));
-      bits += sizeof(ChannelHeader);
-    }
+  // codes a finished stripe to loop.Bits, or with a coefficient cache,
+  // only caches its coefficients. returns false on error.
+  static bool finishStripe(EncodeContext &ctx,RowLoop &loop,int32_t stripe,int32_t **srp)
+  {
+    int32_t cols = ctx.XResPadded;
+    int32_t sizeStripe = 0;
+
+    if(ctx.Coeffs)
+      cacheStripe(ctx,cols,ctx.Coeffs + intptr_t(stripe) * stripeCoeffs(ctx),srp);
+    else
+      sizeStripe = encodeStripe(ctx,cols,ctx.FH.Channels,loop.Bits,loop.BitsEnd - loop.Bits,srp,0);
+
+    if(sizeStripe < 0)
+      return false;
+
+    ctx.StripeSizes[stripe] = sizeStripe;
+    if(ctx.FH.Layers > 1)
+      ctx.LayerSizes[stripe] = sizeStripe ? macroblockLayerSize(ctx,loop.Bits) : 0;
 
-    // actual encoding loop
-    fr = updatebp(srp,ctx.SB,0,stsize,1);
-    ib = 0;
-    k = -1;
+    loop.Bits += sizeStripe;
+    return true;
+  }
 
-    for(int32_t row=0;row<rows;row++,k++,ib++)
+  // feeds source row loop.Row through the transforms (below is the image
+  // row under src, only used by the chroma plane). finished stripes are
+  // written to loop.Bits and their sizes recorded. returns 1 once stripe
+  // End-1 is done, 0 if more rows are needed and -1 on error.
+  static int32_t encodeRow(EncodeContext &ctx,RowLoop &loop,const uint8_t *src,const uint8_t *below)
+  {
+    int32_t **srp = loop.srp;
+    int32_t cols = ctx.XResPadded;
+    int32_t rows = ctx.YResPadded;
+    int32_t chans = ctx.FH.Channels;
+    int32_t row = loop.Row++;
+    int32_t ib = loop.ib++;
+    bool lossless = (ctx.Flags & FRIED_LOSSLESS) != 0;
+
+    FRIED_STAT(double t = statsTime(ctx.Stats));
+    read_bitmap_row(ctx,src,below,srp[ib]);
+    FRIED_STAT(addTime(ctx.Stats,&FRIED_Stats::ColorTime,t));
+
+    if(loop.k++ == 4)
     {
-      read_bitmap_row(ctx,row,srp[ib]);
+      bool top = row == 5;
+      FRIED_STAT(t = statsTime(ctx.Stats));
+      for(int32_t ch=0;ch<chans;ch++)
+        hlbt_group1(cols,ctx.Chans[ch].StripeOffset,ib,srp,top,lossless);
 
-      if(k == 4)
-      {
-        bool top = row == 5;
-        for(int32_t ch=0;ch<chans;ch++)
-          hlbt_group1(cols,ctx.Chans[ch].StripeOffset,ib,srp,top);
+      FRIED_STAT(addTime(ctx.Stats,&FRIED_Stats::TransformTime,t));
+      loop.k = 1;
+    }
 
-        k = 0;
-      }
+    if(ib == 31)
+    {
+      int32_t stripe = (row - 31) >> 4;
 
-      if(ib == 31)
+      if(stripe >= loop.First) // stripes above the band are only there for the overlap
       {
         bool top = row == 31;
+        FRIED_STAT(t = statsTime(ctx.Stats));
         for(int32_t ch=0;ch<chans;ch++)
           hlbt_group2(cols,ctx.Chans[ch].StripeOffset,srp,top);
 
-        int32_t sizeStripe = encodeStripe(ctx,cols,chans,bits,bitsEnd - bits,srp);
-        if(sizeStripe < 0)
+        FRIED_STAT(addTime(ctx.Stats,&FRIED_Stats::TransformTime,t));
+
+        if(!finishStripe(ctx,loop,stripe,srp))
           return -1;
 
-        bits += sizeStripe;
-        fr = updatebp(srp,ctx.SB,fr,stsize,0);
-        ib = 15;
+        if(stripe == loop.End - 1)
+          return 1;
       }
 
-      if(row == rows - 1)
+      loop.fr = updatebp(srp,ctx.SB,loop.fr,cols * chans,0);
+      ib = 15;
+      loop.ib = 16;
+    }
+
+    if(row == rows - 1)
+    {
+      FRIED_STAT(t = statsTime(ctx.Stats));
+      for(int32_t ch=0;ch<chans;ch++)
+        hlbt_group3(cols,ctx.Chans[ch].StripeOffset,ib,srp,lossless);
+
+      FRIED_STAT(addTime(ctx.Stats,&FRIED_Stats::TransformTime,t));
+
+      return finishStripe(ctx,loop,rows/16 - 1,srp) ? 1 : -1;
+    }
+
+    return 0;
+  }
+
+  // encoder output: a growable buffer, or a fixed one supplied by the caller
+  struct EncodeOutput
+  {
+    uint8_t *Data;
+    int32_t Size;
+    int32_t Alloc;
+    bool Fixed;
+  };
+
+  static bool appendOutput(EncodeOutput &out,const uint8_t *data,int32_t size)
+  {
+    if(size > out.Alloc - out.Size)
+    {
+      int64_t alloc = sMax(out.Alloc,65536);
+
+      while(alloc - out.Size < size)
+        alloc *= 2;
+
+      if(out.Fixed || int64_t(out.Size) + size > 0x7fffffff)
+        return false;
+
+      uint8_t *grown = new uint8_t[sMin<int64_t>(alloc,0x7fffffff)];
+      if(out.Size)
+        memcpy(grown,out.Data,out.Size);
+      delete[] out.Data;
+
+      out.Data = grown;
+      out.Alloc = int32_t(sMin<int64_t>(alloc,0x7fffffff));
+    }
+
+    if(size)
+      memcpy(out.Data + out.Size,data,size);
+    out.Size += size;
+    return true;
+  }
+
+  // progressive files: takes the block AC chunks out of the coded stripes
+  // in [bits,bits+size) and appends them to ac, moving the macroblock
+  // chunks together at bits. returns their size, -1 if ac is full.
+  static int32_t splitLayers(uint8_t *bits,int32_t size,EncodeOutput &ac)
+  {
+    const uint8_t *src = bits;
+    const uint8_t *end = bits + size;
+    uint8_t *mb = bits;
+
+    while(src < end)
+    {
+      int32_t mbSize = src[0] + (src[1] << 8);
+      memmove(mb,src,mbSize);
+      mb += mbSize;
+      src += mbSize;
+
+      int32_t acSize = src[0] + (src[1] << 8);
+      if(!appendOutput(ac,src,acSize))
+        return -1;
+
+      src += acSize;
+    }
+
+    return int32_t(mb - bits);
+  }
+
+  // progressive files: reorders the stripe data of all planes into the
+  // macroblock layer followed by the block AC layer
+  static bool layerStripes(uint8_t *bits,int32_t size)
+  {
+    EncodeOutput ac = { 0,0,0,false };
+    int32_t mbSize = splitLayers(bits,size,ac);
+
+    if(mbSize >= 0 && ac.Size)
+      memcpy(bits + mbSize,ac.Data,ac.Size);
+
+    delete[] ac.Data;
+    return mbSize >= 0;
+  }
+
+  // encodes stripes [first,end) and appends them to out. stripes are
+  // encoded to ctx.Bits first.
+  static bool EncodeBand(EncodeContext &ctx,int32_t first,int32_t end,EncodeOutput &out)
+  {
+    RowLoop loop;
+    int32_t done;
+
+    startRowLoop(ctx,loop,first,end);
+    loop.Bits = ctx.Bits;
+    loop.BitsEnd = ctx.Bits + ctx.BitsLength;
+
+    do
+    {
+      int32_t row = loop.Row << ctx.Subsample;
+
+      done = encodeRow(ctx,loop,source_row(ctx,row),source_row(ctx,row + ctx.Subsample));
+
+      if(done >= 0 && loop.Bits != ctx.Bits)
       {
-        for(int32_t ch=0;ch<chans;ch++)
-          hlbt_group3(cols,ctx.Chans[ch].StripeOffset,ib,srp);
+        if(!appendOutput(out,ctx.Bits,loop.Bits - ctx.Bits))
+          done = -1;
 
-        int32_t sizeStripe = encodeStripe(ctx,cols,chans,bits,bitsEnd - bits,srp);
-        if(sizeStripe < 0)
-          return -1;
+        loop.Bits = ctx.Bits;
+      }
+    }
+    while(!done);
+
+    return done > 0;
+  }
+
+  // number of stripes in the file (both planes)
+  static int32_t fileStripes(const EncodeContext &ctx)
+  {
+    return ctx.YResPadded / 16 + (ctx.Chroma ? ctx.Chroma->YResPadded / 16 : 0);
+  }
+
+  // fills in the stripe index from the recorded stripe sizes: the stripes of
+  // the chroma plane follow those of the main plane. progressive files have
+  // the index of the macroblock layer, then that of the block AC layer.
+  static void writeStripeIndex(EncodeContext &ctx,uint8_t *index)
+  {
+    bool layered = ctx.FH.Layers > 1;
+    int32_t offset = 0;
+    int32_t stripe = 0;
 
-        bits += sizeStripe;
+    for(EncodeContext *plane=&ctx;plane;plane=plane->Chroma)
+    {
+      for(int32_t i=0;i<plane->YResPadded/16;i++,stripe++)
+      {
+        memcpy(index + stripe * sizeof(int32_t),&offset,sizeof(int32_t));
+        offset += layered ? plane->LayerSizes[i] : plane->StripeSizes[i];
+        FRIED_STAT(setStripeBytes(ctx.Stats,stripe,plane->StripeSizes[i]));
       }
     }
 
-    return bits - ctx.Bits;
+    for(EncodeContext *plane=&ctx;layered && plane;plane=plane->Chroma)
+    {
+      for(int32_t i=0;i<plane->YResPadded/16;i++,stripe++)
+      {
+        memcpy(index + stripe * sizeof(int32_t),&offset,sizeof(int32_t));
+        offset += plane->StripeSizes[i] - plane->LayerSizes[i];
+      }
+    }
   }
-}
 
-using namespace FRIED;
+  // channel headers of the file (in file order), returns the channel count
+  static int32_t fileChannels(const EncodeContext &ctx,ChannelHeader *chans)
+  {
+    int32_t count = 0;
 
-static void PrepareChannel(EncodeContext &ctx, int32_t num, ChannelType type, uint8_t quantize)
-{
-  ctx.Chans[num].Type = type;
-  ctx.Chans[num].Quantizer = quantize;
-  ctx.Chans[num].StripeOffset = num * ctx.XResPadded;
-  ctx.Chans[num].ChunkOffset = num * ctx.FH.ChunkWidth * 16;
-}
+    for(const EncodeContext *plane=&ctx;plane;plane=plane->Chroma)
+    {
+      for(int32_t ch=0;ch<plane->FH.Channels;ch++)
+        chans[plane->FileChannel[ch]] = plane->Chans[ch];
 
+      count += plane->FH.Channels;
+    }
 
+    return count;
+  }
 
-uint8_t *SaveFRIED(const uint8_t *image,int32_t xsize,int32_t ysize,int32_t flags,uint8_t quality,int32_t &outsize)
-{
-  EncodeContext ctx;
+  // copies over frame and channel headers, returns where the stripe index goes
+  static uint8_t *writeHeaders(const EncodeContext &ctx,uint8_t *bits)
+  {
+    ChannelHeader chans[16];
+    FileHeader fh = ctx.FH;
 
-  // fill out file header
-  sCopyMem(ctx.FH.Signature, FRIED_FILE_VERSION, 8);
-  ctx.FH.XRes = xsize;
-  ctx.FH.YRes = ysize;
+    fh.Channels = fileChannels(ctx,chans);
+    memcpy(bits,&fh,sizeof(FileHeader));
+    bits += sizeof(FileHeader);
 
-  // calculate number of channels to use
-  ctx.FH.Channels = (flags & FRIED_GRAYSCALE) ? 1 : 3;
-  if(flags & FRIED_SAVEALPHA)
-    ctx.FH.Channels++;
+    for(int32_t ch=0;ch<fh.Channels;ch++)
+    {
+      memcpy(bits,&chans[ch],sizeof(ChannelHeader));
+      bits += sizeof(ChannelHeader);
+    }
 
-  // calculate virtual x resolution
-  ctx.XResPadded = (xsize + 31) & ~31;
-  ctx.YResPadded = (ysize + 31) & ~31;
-  ctx.FH.ChunkWidth = sMin(ctx.XResPadded,512);
-//  ctx.FH.VirtualXRes = ctx.XResPadded * ctx.FH.Channels;
+    return bits;
+  }
 
-  // prepare encode context and buffers
-  int32_t sbw = ctx.FH.Channels * ctx.XResPadded;
-  int32_t cbw = ctx.FH.Channels * ctx.FH.ChunkWidth;
+  // size of the headers and the stripe index (one per layer)
+  static int32_t headerSize(int32_t chans,int32_t nstripes,int32_t layers)
+  {
+    return sizeof(FileHeader) + chans * sizeof(ChannelHeader) + nstripes * layers * sizeof(int32_t);
+  }
 
-  ctx.SB = new int32_t[sbw * 32];
-  ctx.QB = new int32_t[cbw * 16];
-  ctx.CK = new int32_t[cbw * 16];
+  static int32_t headerSize(const EncodeContext &ctx)
+  {
+    ChannelHeader chans[16];
+    return headerSize(fileChannels(ctx,chans),fileStripes(ctx),ctx.FH.Layers);
+  }
 
-  ctx.BitsLength = sizeof(FileHeader) +
-    ctx.FH.Channels * sizeof(ChannelHeader) +
-    ctx.XResPadded * ctx.YResPadded * ctx.FH.Channels * 3 +
-    1048576;
-  ctx.Bits = new uint8_t[ctx.BitsLength];
+  // the stripe index in headers from writeHeaders
+  static uint8_t *stripeIndex(const EncodeContext &ctx,uint8_t *header)
+  {
+    return header + headerSize(ctx) - fileStripes(ctx) * ctx.FH.Layers * sizeof(int32_t);
+  }
 
-  // prepare channel setup
-  int32_t chanNum = 0;
+  // encodes all stripes of ctx's plane and appends them to out
+  static bool encodeStripes(EncodeContext &ctx,int32_t threads,EncodeOutput &out)
+  {
+    int32_t chans = ctx.FH.Channels;
+    int32_t nstripes = ctx.YResPadded / 16;
+    int32_t nbands = sMin(threads,nstripes);
+    bool ok = true;
+
+    if(nbands <= 1)
+      return EncodeBand(ctx,0,nstripes,out);
+
+    // band-parallel encoding. every band gets its own scratch buffers and
+    // output buffer; the outputs are joined afterwards.
+    int32_t sbw = chans * ctx.XResPadded;
+    int32_t cbw = chans * ctx.FH.ChunkWidth;
+    int32_t sbSize = sbw * 32;
+    int32_t ckSize = cbw * 16;
+
+    int32_t rowsSize = ctx.Convert ? 2 * 4 * ctx.FH.XRes : 0;
+
+    int32_t *scratch = new int32_t[nbands * (sbSize + 2 * ckSize)]();
+    uint8_t *stripeBits = new uint8_t[nbands * ctx.BitsLength];
+    uint8_t *rows = new uint8_t[nbands * rowsSize];
+    EncodeOutput *bandOut = new EncodeOutput[nbands];
+    bool *bandOk = new bool[nbands];
+    FRIED_STAT(FRIED_Stats *bandStats = new FRIED_Stats[nbands]());
+
+    WorkerPool pool(nbands);
+    pool.Run(nbands,[&](int32_t band,int32_t)
+    {
+      EncodeContext bctx = ctx;
+      bctx.SB = scratch + band * (sbSize + 2 * ckSize);
+      bctx.QB = bctx.SB + sbSize;
+      bctx.CK = bctx.QB + ckSize;
+      bctx.Bits = stripeBits + band * ctx.BitsLength;
+      bctx.Rows = rows + band * rowsSize;
+      FRIED_STAT(bctx.Stats = ctx.Stats ? &bandStats[band] : 0);
+
+      EncodeOutput &bout = bandOut[band];
+      bout.Data = 0;
+      bout.Size = 0;
+      bout.Alloc = 0;
+      bout.Fixed = false;
+
+      bandOk[band] = EncodeBand(bctx,band * nstripes / nbands,(band + 1) * nstripes / nbands,bout);
+    });
+
+    // join band outputs
+    for(int32_t band=0;band<nbands;band++)
+    {
+      ok = ok && bandOk[band] && appendOutput(out,bandOut[band].Data,bandOut[band].Size);
+      delete[] bandOut[band].Data;
+      FRIED_STAT(mergeStats(ctx.Stats,&bandStats[band]));
+    }
 
-  if(flags & FRIED_GRAYSCALE)
-    PrepareChannel(ctx,chanNum++,CHANNEL_Y,quality);
-  else
+    FRIED_STAT(delete[] bandStats);
+    delete[] scratch;
+    delete[] stripeBits;
+    delete[] rows;
+    delete[] bandOut;
+    delete[] bandOk;
+    return ok;
+  }
+
+  static bool PerformEncode(EncodeContext &ctx,int32_t threads,EncodeOutput &out)
   {
-    PrepareChannel(ctx,chanNum++,CHANNEL_Y,quality);
-    PrepareChannel(ctx,chanNum++,CHANNEL_CO,quality);
-    PrepareChannel(ctx,chanNum++,CHANNEL_CG,quality);
+    int32_t headerSize = FRIED::headerSize(ctx);
+    bool ok;
+
+    // headers go first, the stripe index is filled in at the end
+    uint8_t *header = new uint8_t[headerSize]();
+    uint8_t *index = writeHeaders(ctx,header);
+
+    ok = appendOutput(out,header,headerSize) && encodeStripes(ctx,threads,out);
+    if(ok && ctx.Chroma)
+      ok = encodeStripes(*ctx.Chroma,threads,out);
+    if(ok && ctx.FH.Layers > 1)
+      ok = layerStripes(out.Data + headerSize,out.Size - headerSize);
+
+    if(ok)
+    {
+      writeStripeIndex(ctx,index);
+      memcpy(out.Data,header,headerSize);
+    }
+
+    delete[] header;
+    return ok;
   }
 
-  if(flags & FRIED_SAVEALPHA)
-    PrepareChannel(ctx,chanNum++,CHANNEL_ALPHA,quality);
+  // sets the Y quantizer, the other channels (of both planes) keep their
+  // distance to it
+  static void setQuantizer(EncodeContext &ctx,uint8_t quantizer)
+  {
+    for(EncodeContext *plane=&ctx;plane;plane=plane->Chroma)
+    {
+      for(int32_t ch=0;ch<plane->FH.Channels;ch++)
+        plane->Chans[ch].Quantizer = (uint8_t) sMin(sMax(quantizer + plane->QuantizerDelta[ch],0),127);
+    }
+  }
 
-  //sVERIFY(chanNum == ctx.FH.Channels);
+  // codes stripes 0,step,2*step,... from the coefficient cache, band by
+  // band on the pool. with out (step 1), the stripes are appended to it
+  // and their sizes recorded. returns the total size of the stripes, or -1
+  // on error.
+  static int64_t codeCachedStripes(EncodeContext &ctx,WorkerPool &pool,int32_t step,EncodeOutput *out)
+  {
+    int32_t nstripes = ctx.YResPadded / 16;
+    int32_t nsel = (nstripes + step - 1) / step;
+    int32_t nbands = sMin(pool.Workers(),nsel);
+    int32_t stripeMax = maxStripeSize(ctx.XResPadded,ctx.FH.ChunkWidth,ctx.FH.Channels,ctx.FH.Layers);
+    int32_t ckSize = ctx.FH.Channels * ctx.FH.ChunkWidth * 16;
+
+    int32_t *scratch = new int32_t[nbands * ckSize];
+    uint8_t *stripeBits = new uint8_t[intptr_t(nbands) * stripeMax];
+    EncodeOutput *bandOut = new EncodeOutput[nbands]();
+    int64_t *bandSize = new int64_t[nbands]();
+    FRIED_STAT(FRIED_Stats *bandStats = new FRIED_Stats[nbands]());
+
+    pool.Run(nbands,[&](int32_t band,int32_t)
+    {
+      EncodeContext bctx = ctx;
+      uint8_t *bits = stripeBits + intptr_t(band) * stripeMax;
+      bctx.CK = scratch + band * ckSize;
+      FRIED_STAT(bctx.Stats = ctx.Stats ? &bandStats[band] : 0);
 
-  // image setup
-  ctx.Image = image;
-  ctx.Flags = flags;
+      for(int32_t i=band * nsel / nbands;i<(band + 1) * nsel / nbands;i++)
+      {
+        int32_t stripe = i * step;
+        int32_t size = encodeStripe(bctx,ctx.XResPadded,ctx.FH.Channels,bits,stripeMax,0,ctx.Coeffs + intptr_t(stripe) * stripeCoeffs(ctx));
 
-  // perform actual encoding
-  outsize = PerformEncode(ctx);
+        if(size < 0 || (out && !appendOutput(bandOut[band],bits,size)))
+        {
+          bandSize[band] = -1;
+          break;
+        }
+
+        ctx.StripeSizes[stripe] = size;
+        if(ctx.FH.Layers > 1)
+          ctx.LayerSizes[stripe] = macroblockLayerSize(ctx,bits);
+
+        bandSize[band] += size;
+      }
+    });
+
+    // join band outputs
+    int64_t total = 0;
+
+    for(int32_t band=0;band<nbands;band++)
+    {
+      if(total < 0 || bandSize[band] < 0 || (out && !appendOutput(*out,bandOut[band].Data,bandOut[band].Size)))
+        total = -1;
+      else
+        total += bandSize[band];
+
+      delete[] bandOut[band].Data;
+      FRIED_STAT(mergeStats(ctx.Stats,&bandStats[band]));
+    }
 
-  // free everything
-  delete[] ctx.SB;
-  delete[] ctx.QB;
-  delete[] ctx.CK;
+    FRIED_STAT(delete[] bandStats);
+    delete[] scratch;
+    delete[] stripeBits;
+    delete[] bandOut;
+    delete[] bandSize;
+    return total;
+  }
 
-  if(outsize < 0)
+  // adds the quantization error of stripes 0,step,2*step,... at the channel
+  // quantizers to error, and the number of coefficients to count
+  static void cachedQuantizeError(const EncodeContext &ctx,int32_t step,double &error,int64_t &count)
   {
-    delete[] ctx.Bits;
-    ctx.Bits = 0;
+    int32_t chans = ctx.FH.Channels;
+    int32_t cols = ctx.XResPadded;
+
+    for(int32_t stripe=0;stripe<ctx.YResPadded/16;stripe+=step)
+    {
+      const int32_t *coeffs = ctx.Coeffs + intptr_t(stripe) * stripeCoeffs(ctx);
+
+      for(int32_t ncc=0;ncc<cols;ncc+=ctx.FH.ChunkWidth)
+      {
+        int32_t cwidth = sMin(ctx.FH.ChunkWidth,cols - ncc);
+
+        for(int32_t ch=0;ch<chans;ch++)
+          error += quantizeError(ctx.Chans[ch].Quantizer,coeffs + ncc * 16 * chans + ch * cwidth * 16,cwidth);
+
+        count += chans * cwidth * 16;
+      }
+    }
   }
+}
 
-  // return the packed data
-  return ctx.Bits;
+using namespace FRIED;
+
+static void PrepareChannel(EncodeContext &ctx, int32_t num, ChannelType type, uint8_t quantize)
+{
+  ctx.Chans[num].Type = type;
+  ctx.Chans[num].Quantizer = quantize;
+  ctx.QuantizerDelta[num] = quantize - ctx.Chans[0].Quantizer;
+  ctx.Chans[num].StripeOffset = num * ctx.XResPadded;
+  ctx.Chans[num].ChunkOffset = num * ctx.FH.ChunkWidth * 16;
+  ctx.Chans[num].Subsample = (uint8_t) ctx.Subsample;
+  ctx.FileChannel[num] = num;
+}
+
+
+
+void FRIED_InitEncodeParams(FRIED_EncodeParams *params,int32_t flags,uint8_t quality)
+{
+  params->Flags = flags;
+  params->Quality = quality;
+  params->ChromaQuality = -1;
+  params->AlphaQuality = -1;
+  params->Threads = 1;
+  params->Stats = 0;
+  params->TargetSize = 0;
+  params->TargetPSNR = 0.0;
+  params->Layout = FRIED_PIXEL_DEFAULT;
+  params->Pitch = 0;
+}
+
+uint8_t *SaveFRIED(const uint8_t *image,int32_t xsize,int32_t ysize,int32_t flags,uint8_t quality,int32_t &outsize)
+{
+  FRIED_EncodeParams params;
+  FRIED_InitEncodeParams(&params,flags,quality);
+
+  return SaveFRIEDEx(image,xsize,ysize,&params,outsize);
+}
+
+// work buffers of one plane
+struct EncodeBuffers
+{
+  GrowBuffer<int32_t> SB,QB,CK;
+  GrowBuffer<int32_t> StripeSizes;
+  GrowBuffer<int32_t> LayerSizes;      // progressive files
+  GrowBuffer<uint8_t> Bits;
+  GrowBuffer<int32_t> Coeffs;          // rate control coefficient cache
+};
+
+// encoder state: work buffers that are kept for the next image, and the
+// state of a streaming encode
+struct FRIED_Encoder
+{
+  EncodeContext Ctx;
+  EncodeContext ChromaCtx;             // chroma plane (FRIED_CHROMASUBSAMPLE)
+  EncodeBuffers Buf,ChromaBuf;
+  EncodeOutput Out;                    // output of FRIED_EncoderSave
+
+  RowLoop Loop,ChromaLoop;
+  GrowBuffer<uint8_t> Header;          // headers and stripe index
+  int32_t HeaderSize;
+  GrowBuffer<uint8_t> Rows;            // source rows converted to the coding layout (both planes)
+  GrowBuffer<uint8_t> LastRow;         // last image row, repeated for the padding rows
+  GrowBuffer<uint8_t> PrevRow;         // even image row, waiting for the odd one (chroma plane)
+  EncodeOutput ChromaOut;              // chroma plane stripes, written at the end
+  EncodeOutput AcOut,ChromaAcOut;      // block AC layer of progressive files, written at the end
+  int32_t RowBytes;                    // bytes per source row
+  int32_t RowsPushed;
+  int32_t Offset;                      // bytes written so far
+  int32_t Limit;                       // largest file size (see SetStreamOutputLimit)
+  int32_t State;                       // 0=encoding, 1=all stripes done, -1=failed/idle
+  int32_t ChromaState;                 // 0=encoding, 1=all chroma stripes done
+  FRIED_WriteFunc Write;
+  void *User;
+
+  FRIED_Encoder()
+  {
+    Out.Data = 0;
+    Out.Size = 0;
+    Out.Alloc = 0;
+    Out.Fixed = false;
+    ChromaOut = AcOut = ChromaAcOut = Out;
+    Limit = 0x7fffffff;
+    State = -1;
+  }
+
+  ~FRIED_Encoder()
+  {
+    delete[] Out.Data;
+    delete[] ChromaOut.Data;
+    delete[] AcOut.Data;
+    delete[] ChromaAcOut.Data;
+  }
+};
+
+// sets up the size of ctx's plane (for ctx.FH.Channels channels and
+// ctx.FH.Layers layers) and its work buffers
+static void SetupPlane(EncodeContext &ctx,EncodeBuffers &buf,int32_t xsize,int32_t ysize,int32_t chunkWidth)
+{
+  // calculate virtual x resolution
+  ctx.XResPadded = (xsize + 31) & ~31;
+  ctx.YResPadded = (ysize + 31) & ~31;
+  ctx.FH.ChunkWidth = sMin(ctx.XResPadded,chunkWidth);
+//  ctx.FH.VirtualXRes = ctx.XResPadded * ctx.FH.Channels;
+
+  // prepare encode context and buffers
+  int32_t sbw = ctx.FH.Channels * ctx.XResPadded;
+  int32_t cbw = ctx.FH.Channels * ctx.FH.ChunkWidth;
+
+  ctx.SB = buf.SB.Get(sbw * 32);
+  ctx.QB = buf.QB.Get(cbw * 16);
+  ctx.CK = buf.CK.Get(cbw * 16);
+
+  ctx.StripeSizes = buf.StripeSizes.Get(ctx.YResPadded / 16);
+  ctx.LayerSizes = buf.LayerSizes.Get(ctx.YResPadded / 16);
+
+  // stripe output, with room for the two stripes the last row can finish
+  ctx.BitsLength = 2 * maxStripeSize(ctx.XResPadded,ctx.FH.ChunkWidth,ctx.FH.Channels,ctx.FH.Layers);
+  ctx.Bits = buf.Bits.Get(ctx.BitsLength);
+}
+
+// chunk width for the flags. lossless chunks are narrower: their
+// coefficients take more bits, and 3 bytes each must still fit into the
+// 16-bit chunk length.
+static int32_t chunkWidth(int32_t flags)
+{
+  return (flags & FRIED_LOSSLESS) ? 256 : 512;
+}
+
+// the FRIED_PIXEL_* layout of the source pixels
+static int32_t SourceLayout(const FRIED_EncodeParams *params)
+{
+  if(params->Layout == FRIED_PIXEL_DEFAULT)
+    return (params->Flags & FRIED_GRAYSCALE) ? FRIED_PIXEL_YA8 : FRIED_PIXEL_BGRA;
+
+  return params->Layout;
+}
+
+// fills out the file and channel headers and sets up the work buffers.
+// returns false for unknown source layouts.
+static bool SetupContext(FRIED_Encoder *enc,int32_t xsize,int32_t ysize,const FRIED_EncodeParams *params)
+{
+  EncodeContext &ctx = enc->Ctx;
+  int32_t flags = params->Flags;
+  int32_t layout = SourceLayout(params);
+  uint8_t quality = (uint8_t) sMin<int32_t>(params->Quality,127); // 255 would read as lossless
+  uint8_t chroma = params->ChromaQuality >= 0 ? (uint8_t) sMin(params->ChromaQuality,127) : quality;
+  uint8_t alpha = params->AlphaQuality >= 0 ? (uint8_t) sMin(params->AlphaQuality,127) : quality;
+
+  if(!layout_bytes(layout))
+    return false;
+
+  // there's no chroma to subsample in grayscale images (or losslessly),
+  // and no alpha to save from sources without it
+  if(flags & (FRIED_GRAYSCALE | FRIED_LOSSLESS))
+    flags &= ~FRIED_CHROMASUBSAMPLE;
+  if(!layout_alpha(layout))
+    flags &= ~FRIED_SAVEALPHA;
+
+  // rows in the coding layout are used as they are (bgrx is bgra without
+  // alpha), others are converted row by row
+  int32_t coding = (flags & FRIED_GRAYSCALE) ? FRIED_PIXEL_YA8 : FRIED_PIXEL_BGRA;
+  bool asIs = layout == coding || (layout == FRIED_PIXEL_BGRX && coding == FRIED_PIXEL_BGRA);
+
+  bool subsample = (flags & FRIED_CHROMASUBSAMPLE) != 0;
+
+  // lossless channels aren't quantized at all
+  if(flags & FRIED_LOSSLESS)
+    quality = chroma = alpha = QUANTIZER_LOSSLESS;
+
+  // fill out file header
+  sCopyMem(ctx.FH.Signature, FRIED_FILE_VERSION, 8);
+  ctx.FH.XRes = xsize;
+  ctx.FH.YRes = ysize;
+  ctx.FH.Layers = (flags & FRIED_PROGRESSIVE) ? 2 : 1;
+
+  // calculate number of channels to use (subsampled Co/Cg have their own plane)
+  ctx.FH.Channels = ((flags & FRIED_GRAYSCALE) || subsample) ? 1 : 3;
+  if(flags & FRIED_SAVEALPHA)
+    ctx.FH.Channels++;
+
+  ctx.Subsample = 0;
+  ctx.Chroma = subsample ? &enc->ChromaCtx : 0;
+  SetupPlane(ctx,enc->Buf,xsize,ysize,chunkWidth(flags));
+
+  // prepare channel setup
+  int32_t chanNum = 0;
+
+  if((flags & FRIED_GRAYSCALE) || subsample)
+    PrepareChannel(ctx,chanNum++,CHANNEL_Y,quality);
+  else
+  {
+    PrepareChannel(ctx,chanNum++,CHANNEL_Y,quality);
+    PrepareChannel(ctx,chanNum++,CHANNEL_CO,chroma);
+    PrepareChannel(ctx,chanNum++,CHANNEL_CG,chroma);
+  }
+
+  if(flags & FRIED_SAVEALPHA)
+    PrepareChannel(ctx,chanNum++,CHANNEL_ALPHA,alpha);
+
+  //sVERIFY(chanNum == ctx.FH.Channels);
+
+  // the chroma plane: Co and Cg at half size. in the file, they're between
+  // Y and alpha as usual.
+  if(subsample)
+  {
+    EncodeContext &cctx = enc->ChromaCtx;
+
+    cctx.FH = ctx.FH;
+    cctx.FH.Channels = 2;
+    cctx.Subsample = 1;
+    cctx.Chroma = 0;
+    SetupPlane(cctx,enc->ChromaBuf,chromaSize(xsize),chromaSize(ysize),ctx.FH.ChunkWidth);
+
+    PrepareChannel(cctx,0,CHANNEL_CO,chroma);
+    PrepareChannel(cctx,1,CHANNEL_CG,chroma);
+    cctx.QuantizerDelta[0] = cctx.QuantizerDelta[1] = chroma - quality;
+    cctx.FileChannel[0] = 1;
+    cctx.FileChannel[1] = 2;
+    ctx.FileChannel[1] = 3;
+  }
+
+  for(EncodeContext *plane=&ctx;plane;plane=plane->Chroma)
+  {
+    plane->Flags = flags;
+    plane->Image = 0;
+    plane->Pitch = params->Pitch ? params->Pitch : xsize * layout_bytes(layout);
+    plane->Convert = asIs ? 0 : layout;
+    plane->Rows = asIs ? 0 : enc->Rows.Get(2 * 4 * xsize);
+    plane->Coeffs = 0;
+    plane->Stats = params->Stats;
+  }
+
+  ChannelHeader chans[16];
+  int32_t nchans = fileChannels(ctx,chans);
+  startStats(ctx.Stats,chans,nchans,fileStripes(ctx));
+  return true;
+}
+
+// PSNR of the decoded image over the channels the encoder saved
+static double imagePSNR(const EncodeContext &ctx,const uint8_t *decoded)
+{
+  int32_t flags = ctx.Flags;
+  int32_t bpp = (flags & FRIED_GRAYSCALE) ? 2 : 4;
+  int32_t used = ((flags & FRIED_GRAYSCALE) ? 1 : 3) + ((flags & FRIED_SAVEALPHA) ? 1 : 0);
+  int32_t xsize = ctx.FH.XRes;
+  int64_t pixels = int64_t(xsize) * ctx.FH.YRes;
+  double error = 0.0;
+
+  for(int32_t y=0;y<ctx.FH.YRes;y++)
+  {
+    const uint8_t *image = coding_row(ctx,source_row(ctx,y),ctx.Rows);
+    const uint8_t *out = decoded + intptr_t(y) * xsize * bpp;
+
+    for(int32_t i=0;i<xsize;i++)
+    {
+      for(int32_t c=0;c<used;c++)
+      {
+        double d = image[i * bpp + c] - out[i * bpp + c];
+        error += d * d;
+      }
+    }
+  }
+
+  if(error == 0.0)
+    return 1e9;
+
+  return 10.0 * log10(255.0 * 255.0 * pixels * used / error);
+}
+
+// state of the rate control search. a trial codes the whole image at one
+// quantizer into Work; trials that meet a target move to Kept.
+struct RateControl
+{
+  FRIED_Encoder *Enc;
+  WorkerPool *Pool;
+  int32_t Threads;
+  int32_t Step;                        // estimates look at every Step-th stripe
+  double Estimate[2][128];             // per quantizer and target (<0: not known yet)
+  EncodeOutput Work,Kept[2];           // [0] size target, [1] PSNR target
+  int32_t WorkQ,KeptQ[2];              // quantizer of the output (-1=none)
+  double WorkPSNR;                     // PSNR of Work (<0: not measured)
+};
+
+// codes the image at quantizer q into rc.Work, and with measure, decodes it
+// again to get its PSNR. returns false on error.
+static bool rcTrial(RateControl &rc,int32_t q,bool measure)
+{
+  EncodeContext &ctx = rc.Enc->Ctx;
+  int32_t nstripes = fileStripes(ctx);
+  int32_t size = headerSize(ctx);
+
+  if(rc.WorkQ != q)
+  {
+    uint8_t *header = rc.Enc->Header.Get(size);
+
+    setQuantizer(ctx,q);
+    memset(writeHeaders(ctx,header),0,nstripes * ctx.FH.Layers * sizeof(int32_t));
+
+    rc.WorkQ = -1;
+    rc.Work.Size = 0;
+    if(!appendOutput(rc.Work,header,size))
+      return false;
+
+    for(EncodeContext *plane=&ctx;plane;plane=plane->Chroma)
+    {
+      if(codeCachedStripes(*plane,*rc.Pool,1,&rc.Work) < 0)
+        return false;
+    }
+
+    if(ctx.FH.Layers > 1 && !layerStripes(rc.Work.Data + size,rc.Work.Size - size))
+      return false;
+
+    writeStripeIndex(ctx,stripeIndex(ctx,rc.Work.Data));
+    rc.WorkQ = q;
+    rc.WorkPSNR = -1.0;
+  }
+
+  if(measure && rc.WorkPSNR < 0.0)
+  {
+    FRIED_DecodeParams params;
+    int32_t xout,yout,outSize;
+    uint8_t *decoded;
+
+    FRIED_InitDecodeParams(&params);
+    params.Threads = rc.Threads;
+    if(!LoadFRIEDEx(rc.Work.Data,rc.Work.Size,&params,xout,yout,outSize,decoded))
+      return false;
+
+    rc.WorkPSNR = imagePSNR(ctx,decoded);
+    FreeFRIED(decoded);
+  }
+
+  return true;
+}
+
+// estimated file size (target 0) or squared error (target 1) at quantizer
+// q, up to a factor. -1 on error.
+static double rcEstimate(RateControl &rc,int32_t target,int32_t q)
+{
+  EncodeContext &ctx = rc.Enc->Ctx;
+  double &estimate = rc.Estimate[target][q];
+
+  if(estimate < 0.0)
+  {
+    double error = 0.0,chromaError = 0.0;
+    int64_t count = 0,chromaCount = 0;
+    double size = headerSize(ctx);
+
+    setQuantizer(ctx,q);
+    if(target)
+    {
+      // a chroma plane sample stands for 4 pixels
+      cachedQuantizeError(ctx,rc.Step,error,count);
+      if(ctx.Chroma)
+        cachedQuantizeError(*ctx.Chroma,rc.Step,chromaError,chromaCount);
+
+      estimate = (error + 4.0 * chromaError) / (count + 4.0 * chromaCount);
+    }
+    else
+    {
+      for(EncodeContext *plane=&ctx;plane;plane=plane->Chroma)
+      {
+        int32_t nstripes = plane->YResPadded / 16;
+        int32_t nsel = (nstripes + rc.Step - 1) / rc.Step;
+        int64_t stripes = codeCachedStripes(*plane,*rc.Pool,rc.Step,0);
+        if(stripes < 0)
+          return -1.0;
+
+        size += double(stripes) * nstripes / nsel;
+      }
+
+      estimate = size;
+    }
+  }
+
+  return estimate;
+}
+
+// 1 if the estimate at q times scale meets the limit, 0 if not, -1 on error
+static int32_t rcEstimateMeets(RateControl &rc,int32_t target,double scale,double limit,int32_t q)
+{
+  double estimate = rcEstimate(rc,target,q);
+  if(estimate < 0.0)
+    return -1;
+
+  return estimate * scale <= limit;
+}
+
+// the quantizer in [lo,hi] closest to the limit whose estimate times scale
+// still meets it (or the end of the range). the size shrinks as the
+// quantizer grows, the error grows.
+static int32_t rcGuess(RateControl &rc,int32_t target,double scale,double limit,int32_t lo,int32_t hi)
+{
+  while(lo < hi)
+  {
+    int32_t mid = target ? (lo + hi + 1) / 2 : (lo + hi) / 2;
+    int32_t meets = rcEstimateMeets(rc,target,scale,limit,mid);
+    if(meets < 0)
+      return -1;
+
+    if(meets == target)
+      lo = target ? mid : mid + 1;
+    else
+      hi = target ? mid - 1 : mid;
+  }
+
+  return lo;
+}
+
+// rcGuess for an answer that's likely close to start: looks there first,
+// in growing steps (size estimates get expensive towards small quantizers).
+static int32_t rcGuessFrom(RateControl &rc,int32_t target,double scale,double limit,int32_t start,int32_t lo,int32_t hi)
+{
+  int32_t first = rcEstimateMeets(rc,target,scale,limit,start);
+  if(first < 0)
+    return -1;
+
+  // meeting sizes are above the answer, meeting errors below it
+  int32_t dir = (first == target) ? 1 : -1;
+  int32_t prev = start,step = 1;
+
+  while(prev != (dir > 0 ? hi : lo))
+  {
+    int32_t next = (dir > 0) ? sMin(prev + step,hi) : sMax(prev - step,lo);
+    int32_t meets = rcEstimateMeets(rc,target,scale,limit,next);
+    if(meets < 0)
+      return -1;
+
+    if(meets != first) // the answer is in [prev,next]
+      return rcGuess(rc,target,scale,limit,sMin(prev,next),sMax(prev,next));
+
+    prev = next;
+    step *= 2;
+  }
+
+  return prev;
+}
+
+// finds the quantizer for a target (0=size, 1=PSNR) by trials. between
+// trials, the estimate is scaled to match the last trial, which is close
+// enough for the quantizers around it. returns the quantizer of rc.Kept
+// [target] (or the nearest one if none meets the target), -1 on error.
+static int32_t rcSearch(RateControl &rc,int32_t target,const FRIED_EncodeParams *params)
+{
+  // size: met from some quantizer up, PSNR: up to some quantizer
+  double limit = target ? 255.0 * 255.0 / pow(10.0,params->TargetPSNR / 10.0) : params->TargetSize;
+  int32_t dir = target ? 1 : -1; // towards the limit on the side that meets it
+  int32_t good = -1,bad = -1;    // nearest trials that meet/miss the target
+
+  // the error estimate is typically a few times too large, the size estimate
+  // is about right. the log of either is roughly linear in the quantizer,
+  // so a few secant steps get close to the limit.
+  double scale = target ? 0.1 : 1.0;
+  int32_t qa = 63,qb = 31;
+  double ea = rcEstimate(rc,target,qa);
+
+  for(int32_t i=0;i<3 && ea >= 0.0;i++)
+  {
+    double eb = rcEstimate(rc,target,qb);
+    if(eb <= 0.0 || ea <= 0.0 || ea == eb)
+      break;
+
+    int32_t next = int32_t(sMin(sMax(qb + (qa - qb) * log(limit / scale / eb) / log(ea / eb),0.0),127.0) + 0.5);
+    if(next == qa || next == qb)
+      break;
+
+    qa = qb;
+    ea = eb;
+    qb = next;
+  }
+
+  if(ea < 0.0)
+    return -1;
+
+  int32_t q = rcGuessFrom(rc,target,scale,limit,qb,0,127);
+
+  while(q >= 0)
+  {
+    if(!rcTrial(rc,q,target == 1))
+      return -1;
+
+    double value = target ? 255.0 * 255.0 / pow(10.0,rc.WorkPSNR / 10.0) : rc.Work.Size;
+    bool meets = value <= limit;
+
+    if(meets)
+    {
+      // keep the output
+      EncodeOutput temp = rc.Kept[target];
+      rc.Kept[target] = rc.Work;
+      rc.Work = temp;
+      rc.WorkQ = rc.KeptQ[target];
+      rc.WorkPSNR = -1.0;
+      rc.KeptQ[target] = q;
+      good = q;
+    }
+    else
+      bad = q;
+
+    // the quantizers left to try lie strictly between good and bad
+    int32_t from = (good >= 0) ? good + dir : (dir > 0 ? 0 : 127);
+    int32_t to = (bad >= 0) ? bad - dir : (dir > 0 ? 127 : 0);
+    if((to - from) * dir < 0)
+      break;
+
+    double estimate = rcEstimate(rc,target,q);
+    if(estimate < 0.0)
+      return -1;
+
+    if(estimate > 0.0 && value > 0.0)
+      scale = value / estimate;
+
+    int32_t next = rcGuessFrom(rc,target,scale,limit,meets ? from : to,sMin(from,to),sMax(from,to));
+    if(next < 0)
+      return -1;
+
+    // the estimate says q is as close as it gets: one more step only if it
+    // isn't clearly going to miss. sizes are estimated closer than errors.
+    if(meets && next == from)
+    {
+      double nextEstimate = rcEstimate(rc,target,next);
+      if(nextEstimate < 0.0)
+        return -1;
+      if(nextEstimate * scale > limit * (target ? 1.02 : 1.005))
+        break;
+    }
+
+    q = next;
+  }
+
+  if(q < 0)
+    return -1;
+
+  return (good >= 0) ? good : (target ? 0 : 127);
+}
+
+// rate-controlled encoding. the transforms run once, into the coefficient
+// cache. the quantizer search estimates sizes by coding every Step-th
+// stripe from there and errors by quantizing them; a few full trials check
+// and settle the result.
+static bool EncodeRateControlled(FRIED_Encoder *enc,const FRIED_EncodeParams *params,int32_t threads,EncodeOutput &out)
+{
+  EncodeContext &ctx = enc->Ctx;
+  int32_t nstripes = ctx.YResPadded / 16;
+  FRIED_Stats *stats = ctx.Stats;
+  bool ok;
+
+  for(EncodeContext *plane=&ctx;plane;plane=plane->Chroma)
+  {
+    int64_t cacheSize = int64_t(plane->YResPadded / 16) * stripeCoeffs(*plane);
+    if(cacheSize > 0x7fffffff)
+      return false;
+
+    plane->Coeffs = (plane->Subsample ? enc->ChromaBuf : enc->Buf).Coeffs.Get(int32_t(cacheSize));
+  }
+
+  // transforms
+  EncodeOutput scratch = { 0,0,0,false };
+  ok = PerformEncode(ctx,threads,scratch);
+  delete[] scratch.Data;
+
+  if(!ok)
+    return false;
+
+  RateControl rc;
+  WorkerPool pool(sMin(threads,nstripes));
+  int32_t q[2] = { 0,0 };
+
+  rc.Enc = enc;
+  rc.Pool = &pool;
+  rc.Threads = threads;
+  rc.Step = sMin(sMax(nstripes / 8,1),8); // at least 8 stripes, at most every 8th
+  for(int32_t i=0;i<128;i++)
+    rc.Estimate[0][i] = rc.Estimate[1][i] = -1.0;
+
+  rc.Work.Data = 0;
+  rc.Work.Size = 0;
+  rc.Work.Alloc = 0;
+  rc.Work.Fixed = false;
+  rc.Kept[0] = rc.Kept[1] = rc.Work;
+  rc.WorkQ = rc.KeptQ[0] = rc.KeptQ[1] = -1;
+  rc.WorkPSNR = -1.0;
+
+  // trials aren't counted
+  for(EncodeContext *plane=&ctx;plane;plane=plane->Chroma)
+    plane->Stats = 0;
+
+  if(params->TargetPSNR > 0.0)
+  {
+    q[1] = rcSearch(rc,1,params);
+    ok = q[1] >= 0;
+  }
+
+  // a PSNR result that fits needs no size search
+  if(ok && params->TargetSize > 0 && !(rc.KeptQ[1] >= 0 && rc.Kept[1].Size <= params->TargetSize))
+  {
+    q[0] = rcSearch(rc,0,params);
+    ok = q[0] >= 0;
+  }
+
+  // the smallest file that meets both, or if they conflict, the size
+  int32_t best = sMax(q[0],q[1]);
+  int32_t keptBest = (rc.KeptQ[0] == best) ? 0 : (rc.KeptQ[1] == best) ? 1 : -1;
+
+  if(ok && keptBest < 0)
+    ok = rcTrial(rc,best,false);
+
+  const EncodeOutput &result = (keptBest < 0) ? rc.Work : rc.Kept[keptBest];
+  ok = ok && appendOutput(out,result.Data,result.Size);
+
+  // statistics describe the transforms and the coding of the result
+  for(EncodeContext *plane=&ctx;plane;plane=plane->Chroma)
+    plane->Stats = stats;
+
+#if defined(FRIED_STATS)
+  if(ok && stats)
+  {
+    int32_t stripe = 0;
+
+    setQuantizer(ctx,best);
+    for(EncodeContext *plane=&ctx;plane && ok;plane=plane->Chroma)
+    {
+      ok = codeCachedStripes(*plane,pool,1,0) >= 0;
+
+      for(int32_t i=0;i<plane->YResPadded/16;i++)
+        setStripeBytes(stats,stripe++,plane->StripeSizes[i]);
+    }
+  }
+#endif
+
+  delete[] rc.Work.Data;
+  delete[] rc.Kept[0].Data;
+  delete[] rc.Kept[1].Data;
+  return ok;
+}
+
+static bool EncodeImage(FRIED_Encoder *enc,const uint8_t *image,int32_t xsize,int32_t ysize,const FRIED_EncodeParams *params,EncodeOutput &out)
+{
+  enc->State = -1; // cancels a streaming encode
+  if(!SetupContext(enc,xsize,ysize,params))
+    return false;
+
+  // image setup
+  enc->Ctx.Image = image;
+  enc->ChromaCtx.Image = image;
+
+  // perform actual encoding
+  if((params->TargetSize > 0 || params->TargetPSNR > 0.0) && !(enc->Ctx.Flags & FRIED_LOSSLESS))
+    return EncodeRateControlled(enc,params,ResolveThreads(params->Threads),out);
+
+  return PerformEncode(enc->Ctx,ResolveThreads(params->Threads),out);
+}
+
+uint8_t *SaveFRIEDEx(const uint8_t *image,int32_t xsize,int32_t ysize,const FRIED_EncodeParams *params,int32_t &outsize)
+{
+  FRIED_Encoder enc;
+  EncodeOutput &out = enc.Out;
+
+  // the output grows as needed and is trimmed to size at the end
+  outsize = -1;
+  if(!EncodeImage(&enc,image,xsize,ysize,params,out))
+    return 0;
+
+  uint8_t *data = out.Data;
+  outsize = out.Size;
+
+  if(out.Alloc != out.Size)
+  {
+    data = new uint8_t[out.Size];
+    memcpy(data,out.Data,out.Size);
+  }
+  else
+    out.Data = 0;
+
+  // return the packed data
+  return data;
+}
+
+int32_t SaveFRIEDTo(const uint8_t *image,int32_t xsize,int32_t ysize,const FRIED_EncodeParams *params,uint8_t *out,int32_t outMax)
+{
+  FRIED_Encoder enc;
+  EncodeOutput output = { out,0,sMax(outMax,0),true };
+
+  return EncodeImage(&enc,image,xsize,ysize,params,output) ? output.Size : -1;
+}
+
+int64_t FRIED_MaxEncodedSize(int32_t xsize,int32_t ysize,int32_t flags)
+{
+  bool subsample = (flags & FRIED_CHROMASUBSAMPLE) && !(flags & (FRIED_GRAYSCALE | FRIED_LOSSLESS));
+  int32_t chans = ((flags & FRIED_GRAYSCALE) || subsample ? 1 : 3) + ((flags & FRIED_SAVEALPHA) ? 1 : 0);
+  int32_t xpad = (xsize + 31) & ~31;
+  int32_t ypad = (ysize + 31) & ~31;
+  int32_t cwidth = sMin(xpad,chunkWidth(flags));
+  int32_t layers = (flags & FRIED_PROGRESSIVE) ? 2 : 1;
+
+  if(xsize <= 0 || ysize <= 0)
+    return 0;
+
+  int64_t size = headerSize(chans,ypad / 16,layers) + int64_t(ypad / 16) * maxStripeSize(xpad,cwidth,chans,layers);
+
+  // chroma plane: its channel headers, index and stripes
+  if(subsample)
+  {
+    int32_t cxpad = (chromaSize(xsize) + 31) & ~31;
+    int32_t cypad = (chromaSize(ysize) + 31) & ~31;
+
+    size += 2 * sizeof(ChannelHeader) + cypad / 16 * layers * sizeof(int32_t);
+    size += int64_t(cypad / 16) * maxStripeSize(cxpad,sMin(cxpad,cwidth),2,layers);
+  }
+
+  return size;
+}
+
+FRIED_Encoder *FRIED_NewEncoder()
+{
+  return new FRIED_Encoder;
+}
+
+const uint8_t *FRIED_EncoderSave(FRIED_Encoder *enc,const uint8_t *image,int32_t xsize,int32_t ysize,const FRIED_EncodeParams *params,int32_t &outsize)
+{
+  enc->Out.Size = 0;
+
+  if(!EncodeImage(enc,image,xsize,ysize,params,enc->Out))
+  {
+    outsize = -1;
+    return 0;
+  }
+
+  outsize = enc->Out.Size;
+  return enc->Out.Data;
+}
+
+void FRIED::SetStreamOutputLimit(FRIED_Encoder *enc,int32_t limit)
+{
+  enc->Limit = limit;
+}
+
+// passes size bytes on to the write callback at the current offset. fails
+// if that would take the file past the limit, where offsets would wrap.
+static bool StreamWrite(FRIED_Encoder *enc,const uint8_t *data,int32_t size)
+{
+  if(size > enc->Limit - enc->Offset || !enc->Write(enc->User,enc->Offset,data,size))
+    return false;
+
+  enc->Offset += size;
+  return true;
+}
+
+// runs one row through the row loop of a plane and passes finished stripes
+// on. the chroma plane goes last in the file, so its stripes are kept until
+// the end, as is the block AC layer of progressive files.
+static bool StreamRow(FRIED_Encoder *enc,bool chroma,const uint8_t *src,const uint8_t *below)
+{
+  EncodeContext &ctx = chroma ? enc->ChromaCtx : enc->Ctx;
+  RowLoop &loop = chroma ? enc->ChromaLoop : enc->Loop;
+  int32_t done = encodeRow(ctx,loop,src,below);
+  int32_t size = loop.Bits - ctx.Bits;
+
+  if(done >= 0 && size && ctx.FH.Layers > 1)
+  {
+    size = splitLayers(ctx.Bits,size,chroma ? enc->ChromaAcOut : enc->AcOut);
+    if(size < 0)
+      done = -1;
+  }
+
+  if(done >= 0 && size > 0)
+  {
+    if(chroma)
+    {
+      if(!appendOutput(enc->ChromaOut,ctx.Bits,size))
+        done = -1;
+    }
+    else
+    {
+      if(!StreamWrite(enc,ctx.Bits,size))
+        done = -1;
+    }
+  }
+
+  loop.Bits = ctx.Bits;
+  if(done < 0)
+    enc->State = -1;
+  else if(done)
+    (chroma ? enc->ChromaState : enc->State) = done;
+
+  return done >= 0;
+}
+
+bool FRIED_EncoderBegin(FRIED_Encoder *enc,int32_t xsize,int32_t ysize,const FRIED_EncodeParams *params,FRIED_WriteFunc write,void *user)
+{
+  EncodeContext &ctx = enc->Ctx;
+  int32_t nstripes;
+
+  enc->State = -1;
+  bool targets = (params->TargetSize > 0 || params->TargetPSNR > 0.0) && !(params->Flags & FRIED_LOSSLESS);
+  if(xsize <= 0 || ysize <= 0 || !write || targets)
+    return false;
+
+  if(!SetupContext(enc,xsize,ysize,params))
+    return false;
+
+  nstripes = fileStripes(ctx);
+
+  enc->RowBytes = xsize * layout_bytes(SourceLayout(params));
+  enc->LastRow.Get(enc->RowBytes);
+  enc->RowsPushed = 0;
+  enc->Write = write;
+  enc->User = user;
+
+  enc->AcOut.Size = 0;
+  enc->ChromaAcOut.Size = 0;
+
+  startRowLoop(ctx,enc->Loop,0,ctx.YResPadded / 16);
+  enc->Loop.Bits = ctx.Bits;
+  enc->Loop.BitsEnd = ctx.Bits + ctx.BitsLength;
+
+  if(ctx.Chroma)
+  {
+    EncodeContext &cctx = *ctx.Chroma;
+
+    startRowLoop(cctx,enc->ChromaLoop,0,cctx.YResPadded / 16);
+    enc->ChromaLoop.Bits = cctx.Bits;
+    enc->ChromaLoop.BitsEnd = cctx.Bits + cctx.BitsLength;
+    enc->PrevRow.Get(enc->RowBytes);
+    enc->ChromaOut.Size = 0;
+    enc->ChromaState = 0;
+  }
+
+  // headers go first, the stripe index is filled in by FRIED_FinishEncoder
+  enc->HeaderSize = headerSize(ctx);
+  memset(writeHeaders(ctx,enc->Header.Get(enc->HeaderSize)),0,nstripes * ctx.FH.Layers * sizeof(int32_t));
+
+  enc->Offset = 0;
+  if(!StreamWrite(enc,enc->Header.Data,enc->HeaderSize))
+    return false;
+
+  enc->State = 0;
+  return true;
+}
+
+FRIED_Encoder *FRIED_CreateEncoder(int32_t xsize,int32_t ysize,const FRIED_EncodeParams *params,FRIED_WriteFunc write,void *user)
+{
+  FRIED_Encoder *enc = new FRIED_Encoder;
+
+  if(!FRIED_EncoderBegin(enc,xsize,ysize,params,write,user))
+    sDelete(enc);
+
+  return enc;
+}
+
+bool FRIED_EncoderPushRows(FRIED_Encoder *enc,const uint8_t *rows,int32_t nrows,int32_t pitch)
+{
+  EncodeContext &ctx = enc->Ctx;
+
+  if(enc->State || nrows < 0 || nrows > ctx.FH.YRes - enc->RowsPushed)
+    return false;
+
+  if(!pitch)
+    pitch = enc->RowBytes;
+
+  for(int32_t i=0;i<nrows;i++)
+  {
+    const uint8_t *src = rows + intptr_t(i) * pitch;
+    int32_t row = enc->RowsPushed++;
+
+    if(enc->RowsPushed == ctx.FH.YRes)
+      memcpy(enc->LastRow.Data,src,enc->RowBytes);
+
+    if(!StreamRow(enc,false,src,src))
+      return false;
+
+    // the chroma plane takes pairs of rows, an odd last row pairs up with itself
+    if(ctx.Chroma)
+    {
+      if(!(row & 1) && row < ctx.FH.YRes - 1)
+        memcpy(enc->PrevRow.Data,src,enc->RowBytes);
+      else if(!StreamRow(enc,true,(row & 1) ? enc->PrevRow.Data : src,src))
+        return false;
+    }
+  }
+
+  return true;
+}
+
+int32_t FRIED_FinishEncoder(FRIED_Encoder *enc)
+{
+  EncodeContext &ctx = enc->Ctx;
+
+  if(enc->State < 0 || enc->RowsPushed != ctx.FH.YRes)
+    return -1;
+
+  // padding rows
+  while(!enc->State)
+  {
+    if(!StreamRow(enc,false,enc->LastRow.Data,enc->LastRow.Data))
+      return -1;
+  }
+
+  while(ctx.Chroma && !enc->ChromaState)
+  {
+    if(!StreamRow(enc,true,enc->LastRow.Data,enc->LastRow.Data))
+      return -1;
+  }
+
+  // then the chroma plane and the block AC layers. now that all stripe sizes
+  // are known, write the headers again. the encoder is idle afterwards.
+  const EncodeOutput *tail[3] = { &enc->ChromaOut,&enc->AcOut,&enc->ChromaAcOut };
+
+  enc->State = -1;
+  for(int32_t i=0;i<3;i++)
+  {
+    if(tail[i]->Size && !StreamWrite(enc,tail[i]->Data,tail[i]->Size))
+      return -1;
+  }
+
+  writeStripeIndex(ctx,stripeIndex(ctx,enc->Header.Data));
+  if(!enc->Write(enc->User,0,enc->Header.Data,enc->HeaderSize))
+    return -1;
+
+  return enc->Offset;
+}
+
+void FRIED_DestroyEncoder(FRIED_Encoder *enc)
+{
+  delete enc;
 }
@@ -5,6 +5,11 @@
 // need cleanup
 #include "fried_internal.hpp"
 #include "bitbuffer.hpp"
+#include "simd.hpp"
+
+#if defined(FRIED_SIMD_SSE2)
+#include <emmintrin.h>
+#endif
 
 namespace FRIED
 {
@@ -20,172 +25,87 @@ namespace FRIED
       krp = sMin(krp + sMin(p,24),191);
   }
 
-  static void GRcode(BitEncoder &coder,int32_t &krp,int32_t val)
+  static inline void GRcode(BitEncoder &coder,int32_t &krp,int32_t val)
   {
-    int32_t i,vk;
-
     int32_t kr = krp >> 3;
-    vk = val >> kr;
+    int32_t vk = val >> kr;
+    uint32_t low = val & ((1 << kr) - 1);
 
-    if(vk < 32)
-      coder.PutBits((1 << vk) - 1,vk);
+    if(vk + kr < 32) // vk ones, a zero and kr low bits in one go
+      coder.PutBits((((1u << vk) - 1) << (kr + 1)) | low,vk + 1 + kr);
     else
-      for(i=0;i<vk;i++)
-        coder.PutBits(1,1);
-
-    coder.PutBits(0,1);
-
-    if(kr)
-      coder.PutBits(val & ((1 << kr) - 1),kr);
-
-    GRadpkr(vk,krp);
-  }
-
-  static uint16_t GRlnv0[14],GRlnv1[28],GRlnv2[56],GRlnv3[112],GRlnv4[224],GRlnv5[448];
-  static uint16_t *GRlnv[] = { GRlnv0,GRlnv1,GRlnv2,GRlnv3,GRlnv4,GRlnv5 };
-  static int32_t GRmax[] = { 14,28,56,112,224,448 };
-  static uint8_t GRlow[48];
-  static uint8_t GRkrp[64*3];
-  static uint8_t GRktab[192];
-
-  static void CalcGolombTable(uint16_t *lnvTab,int32_t k)
-  {
-    int32_t kscale = 1 << k;
-    int32_t kmask = kscale - 1;
-    int32_t max = 14 << k;
-    int32_t val,len,kad;
-
-    for(int32_t i=0;i<max;i++)
     {
-      int32_t first4 = i >> k;
+      int32_t ones = vk;
 
-      if(first4 < 0x8) // 0xxx
+      while(ones >= 32)
       {
-        val = (i >> 3) & kmask;
-        len = k + 1;
-        kad = 0;
-      }
-      else if(first4 < 0xc) // 10xx
-      {
-        val = ((i >> 2) & kmask) + kscale;
-        len = k + 2;
-        kad = 1;
-      }
-      else if(first4 < 0xe) // 110x
-      {
-        val = ((i >> 1) & kmask) + 2*kscale;
-        len = k + 3;
-        kad = 2;
+        coder.PutBits(~0u,32);
+        ones -= 32;
       }
 
-      lnvTab[i] = (val << 8) | (kad << 6) | len;
+      coder.PutBits(((1u << ones) - 1) << 1,ones + 1);
+      if(kr)
+        coder.PutBits(low,kr);
     }
+
+    GRadpkr(vk,krp);
   }
 
-  static void CalcGolombTables()
+  // index of the first nonzero x[i] with i >= start, or n
+  static int32_t nextNonzero(const int32_t *x,int32_t start,int32_t n)
   {
-    for(int32_t k=0; k < static_cast<int32_t>(sizeof(GRlnv) / sizeof(*GRlnv)); k++)
-      CalcGolombTable(GRlnv[k], k);
+    int32_t i = start;
 
-    for(int32_t i=0;i<48;i++)
+#if defined(FRIED_SIMD_SSE2)
+    for(;i+4<=n;i+=4)
     {
-      GRlow[i] = (i >> 3) + 4; // sie wuerden es nicht glauben. (german for: you would not belive it)
-      GRkrp[i+  0] = sMax(i-2,0);
-      GRkrp[i+ 64] = i;
-      GRkrp[i+128] = i+2;
+      __m128i zero = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *) (x + i)),_mm_setzero_si128());
+
+      if(_mm_movemask_epi8(zero) != 0xffff)
+        break;
     }
+#endif
+
+    while(i < n && !x[i])
+      i++;
 
-    for(int32_t i=0;i<192;i++)
-      GRktab[i] = i >> 3; // und ich glaub das auch nicht. (german for: and i dont belive it either)
+    return i;
   }
 
-  static int32_t GRdecodereal(BitDecoder &coder,int32_t &krp)
+  // rlgr decoder
+  static inline int32_t GRdecode(BitDecoder &coder,int32_t &krp)
   {
-    // some unrolling for common cases here
-    int32_t lowBits = krp >> 3;
-    int32_t high;
+    // GRadpkr as a table, by the length of the unary part
+    static const int8_t krpDelta[25] = {
+      -2,0,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20,21,22,23,24,
+    };
+    int32_t kr = krp >> 3;
+    uint64_t top = coder.PeekTop();
+    int32_t vk = countLeadingZeros64(~top);
 
-    int32_t peek = coder.PeekBits(3);
-    if(peek < 0x4) // 0xx
-    {
-      krp = sMax(krp-2,0);
-      return coder.GetBits(lowBits+1);
-    }
-    else if(peek < 0x6) // 10x
-    {
-      coder.SkipBitsNoCheck(2);
-      return coder.GetBits(lowBits) + (1 << lowBits);
-    }
-    else if(peek < 0x7) // 110
+    // the whole codeword is buffered unless the unary part is very long
+    if(vk + 1 + kr <= coder.BitsBuffered())
     {
-      coder.SkipBitsNoCheck(3);
-      krp = sMin(krp+2,191);
-      return coder.GetBits(lowBits) + (2 << lowBits);
-    }
-    else // 111
-    {
-      // we assume here we won't have lowBits>17
-      coder.SkipBitsNoCheck(3);
-      high = 3;
-
-      // somewhat unrolled bit-counting loop
-      int32_t bits;
-      do
-      {
-        bits = coder.PeekBits(4);
-        switch(bits)
-        {
-        case 0: case 1: case 2: case 3: case 4: case 5: case 6: case 7:
-          coder.SkipBitsNoCheck(1);
-          break;
-
-        case 8: case 9: case 10: case 11:
-          high++;
-          coder.SkipBitsNoCheck(2);
-          break;
+      uint32_t low = uint32_t(((top << (vk + 1)) >> 1) >> (63 - kr));
 
-        case 12: case 13:
-          high += 2;
-          coder.SkipBitsNoCheck(3);
-          break;
-
-        case 14:
-          high += 3;
-          coder.SkipBitsNoCheck(4);
-          break;
-
-        default:
-          high += 4;
-          coder.SkipBits(4);
-          break;
-        }
-      }
-      while(bits == 15);
-
-      krp = sMin(krp+sMin(high,24),191);
-      return (high << lowBits) | coder.GetBits(lowBits);
+      coder.SkipBits(vk + 1 + kr);
+      krp = sMax(sMin(krp + krpDelta[sMin(vk,24)],191),0);
+      return (vk << kr) | low;
     }
-  }
 
-  static int32_t inline GRdecodenew(BitDecoder &coder,int32_t &krp)
-  {
-    // table-based version for small k (<6), rather fast
-    if(krp < 48)
-    {
-      int32_t lowBits = GRlow[krp];
-      int32_t peek = coder.PeekBits(lowBits);
+    int32_t ones;
 
-      if(peek < GRmax[lowBits-4])
-      {
-        int32_t lnv = GRlnv[lowBits-4][peek];
-        krp = GRkrp[krp + (lnv & 0xc0)];
-        coder.SkipBits(lnv & 0xf);
-
-        return lnv >> 8;
-      }
+    vk = 0;
+    while((ones = coder.LeadingOnes()) == coder.BitsBuffered())
+    {
+      vk += ones;
+      coder.SkipBits(ones);
     }
 
-    return GRdecodereal(coder,krp);
+    vk += ones;
+    coder.SkipBits(ones + 1);
+    GRadpkr(vk,krp);
+    return (vk << kr) | coder.GetBits(kr);
   }
 
   int32_t rlgrenc(uint8_t *bits,int32_t nbmax,int32_t *x,int32_t n,int32_t xminit)
@@ -220,45 +140,57 @@ namespace FRIED
 
     for(int32_t i=0;i<n;i++)
     {
-      if(x[i] >= 0)
-      {
-        xm = x[i];
-        sign = 0;
-      }
-      else
-      {
-        xm = -x[i];
-        sign = 1;
-      }
-
       int32_t k = kp >> 3;
 
       if(k)
       {
-        int32_t runmax = 1 << k;
+        // skip to the next nonzero coefficient, sending a 0 bit for every
+        // full run on the way. k only grows inside a zero run.
+        int32_t next = nextNonzero(x,i,n);
+        int32_t zeros = next - i;
 
-        if(!xm)
+        while(run + zeros >= (1 << k))
         {
-          if(++run == runmax)
-          {
-            coder.PutBits(0,1);
-            run = 0;
-            kp = sMin(kp+4,191);
-          }
+          zeros -= (1 << k) - run;
+          coder.PutBits(0,1);
+          run = 0;
+          kp = sMin(kp+4,191);
+          k = kp >> 3;
         }
-        else
-        {
-          coder.PutBits(1,1);
-          coder.PutBits(run,k);
-          coder.PutBits(sign,1);
-          GRcode(coder,krp,xm-1);
 
-          kp -= 5;
-          run = 0;
+        run += zeros;
+        i = next;
+        if(i == n)
+          break;
+
+        xm = x[i];
+        sign = 0;
+        if(xm < 0)
+        {
+          xm = -xm;
+          sign = 1;
         }
+
+        // 1, run, sign
+        coder.PutBits((1 << (k + 1)) | (run << 1) | sign,k + 2);
+        GRcode(coder,krp,xm-1);
+
+        kp -= 5;
+        run = 0;
       }
       else
       {
+        if(x[i] >= 0)
+        {
+          xm = x[i];
+          sign = 0;
+        }
+        else
+        {
+          xm = -x[i];
+          sign = 1;
+        }
+
         GRcode(coder,krp,xm*2 - sign);
 
         if(!xm)
@@ -280,13 +212,6 @@ namespace FRIED
     int32_t kinit,krinit;
     int32_t u,sign,xm,run;
     BitDecoder coder;
-    static bool tables = false;
-
-    if(!tables)
-    {
-      CalcGolombTables();
-      tables = true;
-    }
 
     coder.Init(bits,nbmax);
 
@@ -319,7 +244,7 @@ namespace FRIED
         // these occur in runs, so save us some unnecessary tests...
         do
         {
-          u = GRdecodenew(coder,krp);
+          u = GRdecode(coder,krp);
 
           if(u)
           {
@@ -338,18 +263,28 @@ namespace FRIED
       }
       else
       {
-        int32_t k = GRktab[kp];
+        int32_t zeros = coder.LeadingZeros();
 
-        if(!coder.GetBits(1)) // long zero run
+        if(zeros) // long zero runs, one 0 bit each
         {
-          yp += 1 << k;
-          kp += 4; // no overflow will happen with <2^23 zeroes in a row
+          int32_t i;
+
+          for(i=0;i<zeros && yp < yend;i++)
+          {
+            yp += 1 << (kp >> 3);
+            kp = sMin(kp+4,191);
+          }
+
+          coder.SkipBits(i);
         }
-        else // normal run
+        else // normal run: 1, run, sign
         {
-          run = coder.GetBits(k);
-          sign = coder.GetBitsNoCheck(1);
-          xm = GRdecodenew(coder,krp) + 1;
+          int32_t k = kp >> 3;
+          uint32_t head = coder.GetBits(k + 2);
+
+          run = (head >> 1) & ((1 << k) - 1);
+          sign = head & 1;
+          xm = GRdecode(coder,krp) + 1;
           yp += run;
 
           if(yp < yend)
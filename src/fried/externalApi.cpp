@@ -1,4 +1,8 @@
 #include "externalApi.h"
+#include "mappedfile.hpp"
+#include "workerpool.hpp"
+#include <algorithm>
+#include <cstring>
 
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wmissing-field-initializers"
@@ -8,66 +12,264 @@
 #include "stb_image_write.h"
 #pragma clang diagnostic pop
 
+// FRIED_WriteFunc for fried_encode
+static bool writeToStream(void *user, int32_t offset, const uint8_t *data, int32_t size) {
+    auto &out = *static_cast<std::ofstream *>(user);
+    if (out.tellp() != offset)
+        out.seekp(offset);
+    out.write(reinterpret_cast<const char *>(data), size);
+    return out.good();
+}
+
+// the source layout for an stb_image image with channels channels, loaded as
+// it is instead of expanded to 4 channels. fried_decode writes the decoded
+// BGRA pixels out as RGBA, so RGB(A) images go in as BGR(A) and keep their
+// byte order through a roundtrip (YCoCg treats R and B alike).
+static int32_t imageLayout(int channels) {
+    static const int32_t layouts[] = {FRIED_PIXEL_Y8, FRIED_PIXEL_YA8, FRIED_PIXEL_BGR24, FRIED_PIXEL_BGRA};
+    return layouts[channels - 1];
+}
+
 bool fried_encode(const char *inputPath, const char *outputPath, uint_fast8_t quality) {
+    FRIED_EncodeParams params;
+    FRIED_InitEncodeParams(&params, FRIED_DEFAULT | FRIED_SAVEALPHA, quality);     // use default settings
+    return fried_encode_ex(inputPath, outputPath, &params);
+}
+
+bool fried_encode_ex(const char *inputPath, const char *outputPath, const FRIED_EncodeParams *params) {
     int width, height, channels;
-    uint8_t *inputImage = stbi_load(inputPath, &width, &height, &channels, 4); // force RGBA
+    uint8_t *inputImage = stbi_load(inputPath, &width, &height, &channels, 0);
     if (!inputImage) {
         std::cerr << "Failed to load image: " << inputPath << "\n";
         return false;
     }
 
-    int32_t outsize = 0;
-    int32_t flags = FRIED_DEFAULT | FRIED_SAVEALPHA;     // use default settings
-    uint8_t *friedData = SaveFRIED(inputImage, width, height, flags, quality, outsize);
+    FRIED_EncodeParams imageParams = *params;
+    imageParams.Layout = imageLayout(channels);
+    imageParams.Pitch = 0;
 
-    stbi_image_free(inputImage);
+    bool ok;
+    FRIED::MappedOutput mapped;
+    int64_t maxSize = FRIED_MaxEncodedSize(width, height, imageParams.Flags);
+    if (maxSize > 0 && maxSize <= INT32_MAX && mapped.create(outputPath, static_cast<size_t>(maxSize))) {
+        // encode straight into the file's pages, then trim it to size
+        int32_t size = SaveFRIEDTo(inputImage, width, height, &imageParams, mapped.data(), static_cast<int32_t>(maxSize));
+        ok = size > 0 && mapped.finish(static_cast<size_t>(size));
+    } else {
+        std::ofstream out(outputPath, std::ios::binary);
+        if (!out) {
+            std::cerr << "Failed to write output: " << outputPath << "\n";
+            stbi_image_free(inputImage);
+            return false;
+        }
 
-    if (!friedData || outsize <= 0) {
-        std::cerr << "FRIED compression failed.\n";
-        return false;
+        if (params->TargetSize > 0 || params->TargetPSNR > 0.0) {
+            // rate control needs the whole image
+            int32_t size = 0;
+            uint8_t *data = SaveFRIEDEx(inputImage, width, height, &imageParams, size);
+            ok = data && out.write(reinterpret_cast<const char *>(data), size).good();
+            FreeFRIED(data);
+        } else {
+            // stripes go straight to the file, no buffer for the whole output
+            FRIED_Encoder *enc = FRIED_CreateEncoder(width, height, &imageParams, writeToStream, &out);
+            ok = enc && FRIED_EncoderPushRows(enc, inputImage, height, 0) && FRIED_FinishEncoder(enc) > 0;
+            FRIED_DestroyEncoder(enc);
+        }
     }
 
-    std::ofstream out(outputPath, std::ios::binary);
-    if (!out) {
-        std::cerr << "Failed to write output: " << outputPath << "\n";
-        delete[] friedData;
+    stbi_image_free(inputImage);
+
+    if (!ok) {
+        std::cerr << "FRIED compression failed.\n";
         return false;
     }
 
-    out.write(reinterpret_cast<const char *>(friedData), outsize);
-    delete[] friedData;
     return true;
 }
 
 bool fried_decode(const char *inputPath, const char *outputPath) {
-    std::ifstream in(inputPath, std::ios::binary | std::ios::ate);
-    if (!in) {
+    // the decoder reads the file's pages directly, without a copy
+    FRIED::MappedFile in;
+    if (!in.open(inputPath)) {
         std::cerr << "Failed to open FRIED file: " << inputPath << "\n";
         return false;
     }
 
-    std::streamsize size = in.tellg();
-    in.seekg(0, std::ios::beg);
-
-    std::vector<uint8_t> friedData(size);
-    if (!in.read(reinterpret_cast<char *>(friedData.data()), size)) {
-        std::cerr << "Failed to read FRIED file\n";
+    if (in.size() > INT32_MAX) {
+        std::cerr << "FRIED file too large: " << inputPath << "\n";
         return false;
     }
 
     int32_t width = 0, height = 0, outsize = 0;
     uint8_t *decodedImage = nullptr;
-    if (!LoadFRIED(friedData.data(), static_cast<int32_t>(size), width, height, outsize, decodedImage)) {
+    if (!LoadFRIED(in.data(), static_cast<int32_t>(in.size()), width, height, outsize, decodedImage)) {
         std::cerr << "FRIED decompression failed.\n";
         return false;
     }
 
-    if (!stbi_write_png(outputPath, width, height, 4, decodedImage, width * 4)) {
+    // 2 bytes per pixel (gray, alpha) for grayscale files, else 4
+    int comp = static_cast<int>(outsize / (static_cast<int64_t>(width) * height));
+    bool ok = stbi_write_png(outputPath, width, height, comp, decodedImage, width * comp) != 0;
+    FreeFRIED(decodedImage);
+
+    if (!ok) {
         std::cerr << "Failed to write PNG\n";
-        free(decodedImage);
         return false;
     }
 
-    free(decodedImage);
     return true;
-}
\ No newline at end of file
+}
+
+// the input of a batch job, from its file (mapped by file) or from memory
+static bool jobInput(const fried_batch_job &job, FRIED::MappedFile &file, const uint8_t *&data, int32_t &size) {
+    if (!job.inputPath) {
+        data = job.inputData;
+        size = job.inputSize;
+        return data != nullptr;
+    }
+
+    if (!file.open(job.inputPath) || file.size() > INT32_MAX)
+        return false;
+
+    data = file.data();
+    size = static_cast<int32_t>(file.size());
+    return true;
+}
+
+// a copy of size bytes that can be freed with FreeFRIED
+static void keepOutput(fried_batch_job &job, const uint8_t *data, size_t size) {
+    job.outputData = new uint8_t[size];
+    job.outputSize = static_cast<int32_t>(size);
+    memcpy(job.outputData, data, size);
+}
+
+// stbi_write_func appending to a std::vector
+static void appendToVector(void *context, void *data, int size) {
+    auto &out = *static_cast<std::vector<uint8_t> *>(context);
+    out.insert(out.end(), static_cast<uint8_t *>(data), static_cast<uint8_t *>(data) + size);
+}
+
+// per-thread state of a batch: the encoder/decoder objects keep their
+// buffers from one image to the next
+struct BatchWorker {
+    FRIED_Encoder *encoder = nullptr;
+    FRIED_Decoder *decoder = nullptr;
+    FRIED::MappedFile input;
+    std::vector<uint8_t> output;
+
+    ~BatchWorker() {
+        FRIED_DestroyEncoder(encoder);
+        FRIED_DestroyDecoder(decoder);
+    }
+};
+
+static bool encodeJob(fried_batch_job &job, BatchWorker &worker, const FRIED_EncodeParams &params) {
+    const uint8_t *input;
+    int32_t inputSize;
+    if (!jobInput(job, worker.input, input, inputSize))
+        return false;
+
+    int width, height, channels;
+    uint8_t *image = stbi_load_from_memory(input, inputSize, &width, &height, &channels, 0);
+    if (!image)
+        return false;
+
+    if (!worker.encoder)
+        worker.encoder = FRIED_NewEncoder();
+
+    FRIED_EncodeParams imageParams = params;
+    imageParams.Layout = imageLayout(channels);
+    imageParams.Pitch = 0;
+
+    int32_t size = 0;
+    const uint8_t *data = FRIED_EncoderSave(worker.encoder, image, width, height, &imageParams, size);
+    stbi_image_free(image);
+    if (!data)
+        return false;
+
+    if (!job.outputPath) {
+        keepOutput(job, data, size);
+        return true;
+    }
+
+    std::ofstream out(job.outputPath, std::ios::binary);
+    out.write(reinterpret_cast<const char *>(data), size);
+    return out.good();
+}
+
+static bool decodeJob(fried_batch_job &job, BatchWorker &worker, const FRIED_DecodeParams &params) {
+    const uint8_t *input;
+    int32_t inputSize;
+    if (!jobInput(job, worker.input, input, inputSize))
+        return false;
+
+    if (!worker.decoder)
+        worker.decoder = FRIED_NewDecoder();
+
+    int32_t width = 0, height = 0, outsize = 0;
+    const uint8_t *image = FRIED_DecoderLoad(worker.decoder, input, inputSize, &params, width, height, outsize);
+    if (!image)
+        return false;
+
+    // 2 bytes per pixel (gray, alpha) for grayscale files, else 4
+    int comp = static_cast<int>(outsize / (static_cast<int64_t>(width) * height));
+    if (job.outputPath)
+        return stbi_write_png(job.outputPath, width, height, comp, image, width * comp) != 0;
+
+    worker.output.clear();
+    if (!stbi_write_png_to_func(appendToVector, &worker.output, width, height, comp, image, width * comp))
+        return false;
+
+    keepOutput(job, worker.output.data(), worker.output.size());
+    return true;
+}
+
+// runs run(job,worker,imageThreads) for all jobs on a pool of threads.
+// with fewer jobs than threads, the images get the spare threads.
+template <class Run>
+static int32_t runBatch(fried_batch_job *jobs, int32_t count, int32_t threads, const Run &run) {
+    if (count <= 0)
+        return 0;
+
+    int32_t resolved = FRIED::ResolveThreads(threads);
+    int32_t workers = std::min(resolved, count);
+    int32_t imageThreads = resolved / workers;
+
+    std::vector<BatchWorker> state(workers);
+    std::atomic<int32_t> succeeded(0);
+    FRIED::WorkerPool pool(workers);
+
+    pool.Run(count, [&](int32_t i, int32_t worker) {
+        fried_batch_job &job = jobs[i];
+        job.outputData = nullptr;
+        job.outputSize = 0;
+        job.ok = run(job, state[worker], imageThreads);
+        if (job.ok)
+            succeeded++;
+    });
+
+    return succeeded;
+}
+
+int32_t fried_encode_batch(fried_batch_job *jobs, int32_t count, uint_fast8_t quality, int32_t threads) {
+    FRIED_EncodeParams params;
+    FRIED_InitEncodeParams(&params, FRIED_DEFAULT | FRIED_SAVEALPHA, quality); // same as fried_encode
+    return fried_encode_batch_ex(jobs, count, &params, threads);
+}
+
+int32_t fried_encode_batch_ex(fried_batch_job *jobs, int32_t count, const FRIED_EncodeParams *params, int32_t threads) {
+    return runBatch(jobs, count, threads, [params](fried_batch_job &job, BatchWorker &worker, int32_t imageThreads) {
+        FRIED_EncodeParams imageParams = *params;
+        imageParams.Threads = imageThreads;
+        return encodeJob(job, worker, imageParams);
+    });
+}
+
+int32_t fried_decode_batch(fried_batch_job *jobs, int32_t count, int32_t threads) {
+    return runBatch(jobs, count, threads, [](fried_batch_job &job, BatchWorker &worker, int32_t imageThreads) {
+        FRIED_DecodeParams params;
+        FRIED_InitDecodeParams(&params);
+        params.Threads = imageThreads;
+        return decodeJob(job, worker, params);
+    });
+}
@@ -14,11 +14,39 @@
 #define exportAttrib
 #endif
 
+// One conversion of fried_encode_batch/fried_decode_batch. The input is read
+// from inputPath or, if that is null, taken from inputData/inputSize (an image
+// file for encoding, a FRIED file for decoding). The output is written to
+// outputPath or, if that is null, returned in outputData/outputSize (a FRIED
+// file or a PNG file, free with FreeFRIED). ok tells whether the job worked.
+struct fried_batch_job {
+    const char* inputPath;
+    const uint8_t* inputData;
+    int32_t inputSize;
+    const char* outputPath;
+    uint8_t* outputData;
+    int32_t outputSize;
+    bool ok;
+};
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 exportAttrib bool fried_encode(const char* inputPath, const char* outputPath, uint_fast8_t quality);
 exportAttrib bool fried_decode(const char* inputPath, const char* outputPath);
+
+// fried_encode with all encoder parameters (per-channel quantizers, threads,
+// rate control, ...); fried_encode uses FRIED_DEFAULT | FRIED_SAVEALPHA.
+exportAttrib bool fried_encode_ex(const char* inputPath, const char* outputPath, const FRIED_EncodeParams* params);
+
+// Run many conversions on one pool of threads (<= 0: one per core). Every
+// thread takes the next job as soon as it is done with its last one, so
+// reading, PNG coding, FRIED coding and writing of different images overlap.
+// Returns the number of jobs that worked.
+exportAttrib int32_t fried_encode_batch(fried_batch_job* jobs, int32_t count, uint_fast8_t quality, int32_t threads);
+// params->Threads is ignored, the images share the batch threads
+exportAttrib int32_t fried_encode_batch_ex(fried_batch_job* jobs, int32_t count, const FRIED_EncodeParams* params, int32_t threads);
+exportAttrib int32_t fried_decode_batch(fried_batch_job* jobs, int32_t count, int32_t threads);
 #ifdef __cplusplus
 }
 #endif
@@ -11,15 +11,159 @@
 #define FRIED_DEFAULT         0x0000
 #define FRIED_GRAYSCALE       0x0001
 #define FRIED_SAVEALPHA       0x0002
-//#define FRIED_CHROMASUBSAMPLE 0x0004 // not implemented yet
+#define FRIED_CHROMASUBSAMPLE 0x0004 // 4:2:0: Co/Cg at half width and height (ignored for grayscale)
+#define FRIED_LOSSLESS        0x0008 // mathematically lossless: decodes to the source pixels bit for bit
+#define FRIED_PROGRESSIVE     0x0010 // macroblock layer of all stripes first: previews from the start of the file
 
-#define FRIED_FILE_VERSION "FRIED002"
+// Source pixel layouts (FRIED_EncodeParams::Layout), in memory byte order.
+// The layout only describes the input; the flags decide what is coded, so
+// any layout can be saved as color or as grayscale (Y = (r+2g+b)/4).
+// Layouts without alpha save no alpha channel, FRIED_SAVEALPHA is ignored.
+enum FRIED_PixelLayout
+{
+  FRIED_PIXEL_DEFAULT = 0,         // BGRA, or gray+alpha with FRIED_GRAYSCALE (the SaveFRIED layout)
+  FRIED_PIXEL_BGRA,
+  FRIED_PIXEL_RGBA,
+  FRIED_PIXEL_BGRX,                // 4 bytes, the 4th is ignored
+  FRIED_PIXEL_RGB24,
+  FRIED_PIXEL_BGR24,
+  FRIED_PIXEL_Y8,                  // gray
+  FRIED_PIXEL_YA8,                 // gray, alpha
+  FRIED_PIXEL_COUNT
+};
+
+#define FRIED_FILE_VERSION "FRIED003"
 #if defined(_WIN32) || defined(WIN32)
 #define exportAttrib __declspec(dllexport)
 #else
 #define exportAttrib
 #endif
 
+// Statistics of one encode or decode (FRIED_EncodeParams::Stats and
+// FRIED_DecodeParams::Stats). Counters and times are only collected when the
+// library is built with FRIED_STATS (cmake -DFRIED_ENABLE_STATS=ON); without
+// it, Collected is false and only the channel and stripe counts are set.
+// Times are in seconds, added up over all threads. Byte and coefficient
+// counts describe the bitstream, so encoding and decoding a file give the
+// same ones (scaled decodes skip the block coefficients and count less).
+struct FRIED_Stats
+{
+  bool Collected;                  // built with FRIED_STATS
+  double ColorTime;                // color conversion
+  double TransformTime;            // lbt and dct, forward or inverse
+  double QuantizeTime;             // (de)quantization, dc deltas
+  double ReorderTime;              // coefficient reordering
+  double EntropyTime;              // rlgr coding
+
+  int32_t Channels;
+  uint8_t ChannelType[16];         // 1=Y, 2=Co, 3=Cg, 4=alpha
+  int64_t ChannelBytes[16];        // rlgr output per channel
+  int64_t ChannelCoeffs[16];       // coefficients per channel
+  int64_t ChannelNonzero[16];      // nonzero quantized coefficients per channel
+
+  // the coefficient counts (encsize) written per channel and chunk: [0] is
+  // for none, [i] for up to i/16 of the chunk's coefficients
+  int64_t EncSizeHistogram[17];
+
+  // bytes per stripe, written to StripeBytes[0..min(Stripes,MaxStripes)) if
+  // the caller supplies an array (decoding only knows them from the stripe
+  // index, so they're 0 for FRIED002 files)
+  int32_t Stripes;
+  int32_t *StripeBytes;
+  int32_t MaxStripes;
+};
+
+// Encoder parameters for SaveFRIEDEx. Use FRIED_InitEncodeParams to fill in
+// the defaults before changing individual fields.
+//
+// Quality is the quantizer of the Y (or gray) channel. Co/Cg and alpha get
+// their own with ChromaQuality and AlphaQuality; coarser chroma and alpha
+// save a good part of the file at little visible cost. -1 uses Quality.
+//
+// FRIED_CHROMASUBSAMPLE codes Co/Cg as a separate plane at half width and
+// height (2x2 pixel averages); decoders upsample it bilinearly. That saves
+// most of the chroma bits for photographic content, but smears sharp color
+// edges (text, pixel art).
+//
+// Layout and Pitch describe the source image: rows of Layout pixels, Pitch
+// bytes apart (0 = tightly packed). A negative pitch reads bottom-up images
+// with image pointing at the top row. Rows in other layouts than the coding
+// one (BGRA for color, gray+alpha for grayscale) are converted one at a
+// time while encoding, so framebuffers and decoder outputs can be encoded
+// without copying them first. SaveFRIEDEx fails on an unknown layout.
+//
+// Rate control: with TargetSize and/or TargetPSNR set, Quality is ignored
+// and the encoder picks the quantizer itself: the best quality whose file
+// fits into TargetSize bytes, or the smallest file that still reaches
+// TargetPSNR dB (over all saved channels). With both, the smallest file
+// that fits and reaches TargetPSNR, or if there's none, the best quality
+// that fits. An unreachable target gets the nearest quantizer (127 for
+// size, 0 for PSNR); check the result. The transforms run once and keep
+// their output (4 bytes per channel and pixel), the quantizer search only
+// redoes quantization and entropy coding. The search is over the Y
+// quantizer; chroma and alpha keep their distance to it (clamped to 0..127).
+// Not available for streaming.
+//
+// FRIED_LOSSLESS codes the saved channels exactly: a reversible color
+// transform (YCoCg-R), reversible block transforms without the lbt
+// filters and no quantization. Full-size decodes give back the source
+// pixels bit for bit (as gray values with FRIED_GRAYSCALE, alpha 255 if
+// it isn't saved). The quantizers, rate control and FRIED_CHROMASUBSAMPLE
+// don't apply and are ignored.
+//
+// FRIED_PROGRESSIVE stores the file in two layers: the macroblock
+// coefficients of all stripes (typically a few percent of the file), then
+// the block AC coefficients of all stripes. A decoder that has only
+// received the first layer can show the whole image at low detail
+// (FRIED_DecodeParams::Preview) and sharpen it top to bottom as the rest
+// arrives. The file is a few bytes per chunk larger; the image is the same.
+struct FRIED_EncodeParams
+{
+  int32_t Flags;                   // FRIED_* save options
+  uint8_t Quality;                 // Y quantizer (0=best, 127=smallest, more is 127)
+  int32_t ChromaQuality;           // Co/Cg quantizer (-1=Quality, more than 127 is 127)
+  int32_t AlphaQuality;            // alpha quantizer (-1=Quality, more than 127 is 127)
+  int32_t Threads;                 // encoder threads (1=serial, <=0: one per core)
+  FRIED_Stats *Stats;              // statistics to fill in (0=none)
+  int32_t TargetSize;              // rate control: largest file size in bytes (0=off)
+  double TargetPSNR;               // rate control: smallest PSNR in dB (0=off)
+  int32_t Layout;                  // FRIED_PIXEL_* layout of the source pixels
+  int32_t Pitch;                   // bytes from one source row to the next (0=tightly packed)
+};
+
+// Decoder parameters for LoadFRIEDEx. Use FRIED_InitDecodeParams to fill in
+// the defaults before changing individual fields.
+//
+// Preview decodes progressive files (FRIED_PROGRESSIVE) that have only
+// partly arrived: size can end anywhere after the first layer (see
+// FRIED_GetProgress). Chunks whose block AC data isn't there yet decode
+// from their macroblock coefficients alone, which gives a smooth, blurry
+// version of them. 1/4 and 1/16 scale decodes only need the first layer
+// anyway. Other files still have to be complete.
+struct FRIED_DecodeParams
+{
+  int32_t Threads;                 // decoder threads (1=serial, <=0: one per core)
+  int32_t Scale;                   // output size divisor: 1, 4 or 16 (thumbnails)
+  FRIED_Stats *Stats;              // statistics to fill in (0=none)
+  bool Preview;                    // progressive files may be incomplete
+};
+
+// Output callback of the streaming encoder: write size bytes at byte offset
+// offset of the file. Data arrives in file order, except that
+// FRIED_FinishEncoder writes the headers at offset 0 a second time, once the
+// stripe index is known. Return false to abort encoding.
+typedef bool (*FRIED_WriteFunc)(void *user, int32_t offset, const uint8_t *data, int32_t size);
+
+// Encoder object (see FRIED_NewEncoder)
+struct FRIED_Encoder;
+
+// Row callback of FRIED_DecodeRows: row is the row number, pixels is only
+// valid during the call. Return false to stop decoding.
+typedef bool (*FRIED_RowFunc)(void *user, int32_t row, const uint8_t *pixels);
+
+// Decoder object (see FRIED_NewDecoder)
+struct FRIED_Decoder;
+
 // Loading/saving
 #ifdef __cplusplus
 extern "C" {
@@ -27,8 +171,84 @@ extern "C" {
 [[maybe_unused]] exportAttrib const char* getSupportedFileVersion();
     // Loading/saving
 exportAttrib bool LoadFRIED(const uint8_t *data,int32_t size,int32_t &xout,int32_t &yout, int32_t &outSize, uint8_t *&dataout);
+exportAttrib void FRIED_InitDecodeParams(FRIED_DecodeParams *params);
+exportAttrib bool LoadFRIEDEx(const uint8_t *data, int32_t size, const FRIED_DecodeParams *params, int32_t &xout, int32_t &yout, int32_t &outSize, uint8_t *&dataout);
+    // Output size and bytes per pixel (2 for grayscale files, else 4) of
+    // the image in data at output scale divisor scale (1, 4 or 16),
+    // without decoding it.
+exportAttrib bool FRIED_GetInfo(const uint8_t *data, int32_t size, int32_t scale, int32_t &xout, int32_t &yout, int32_t &bytesPerPixel);
+    // How much of a progressive file has arrived in its first size bytes:
+    // previewBytes is the size the first layer ends at, from where preview
+    // decodes work, and fullRows the number of rows from the top that
+    // already decode as from the complete file (the image height once it's
+    // all there). Fails for other files and before the headers are in.
+exportAttrib bool FRIED_GetProgress(const uint8_t *data, int32_t size, int32_t &previewBytes, int32_t &fullRows);
+    // LoadFRIEDEx into caller memory: row y goes to dst + y * dstPitch, or
+    // with bottomUp to dst + (yout-1-y) * dstPitch. dstPitch 0 is tightly
+    // packed, smaller pitches than a row fail, and so does a dstCapacity
+    // (bytes from dst on) that can't hold all rows. Nothing is allocated
+    // for the output. params may be 0 for the defaults. On failure, dst
+    // may have been written to.
+exportAttrib bool LoadFRIEDInto(const uint8_t *data, int32_t size, uint8_t *dst, int32_t dstPitch, int64_t dstCapacity, bool bottomUp, const FRIED_DecodeParams *params, int32_t &xout, int32_t &yout);
+exportAttrib bool LoadFRIEDRegion(const uint8_t *data, int32_t size, int32_t x, int32_t y, int32_t w, int32_t h, int32_t &outSize, uint8_t *&dataout);
 exportAttrib uint8_t *SaveFRIED(const uint8_t *image, int32_t xsize, int32_t ysize, int32_t flags, uint8_t quality, int32_t &outsize);
+exportAttrib void FRIED_InitEncodeParams(FRIED_EncodeParams *params, int32_t flags, uint8_t quality);
+exportAttrib uint8_t *SaveFRIEDEx(const uint8_t *image, int32_t xsize, int32_t ysize, const FRIED_EncodeParams *params, int32_t &outsize);
+    // Encodes to a caller-supplied buffer and returns the size, or -1 if
+    // encoding fails or the output doesn't fit. A buffer of
+    // FRIED_MaxEncodedSize bytes always fits.
+exportAttrib int32_t SaveFRIEDTo(const uint8_t *image, int32_t xsize, int32_t ysize, const FRIED_EncodeParams *params, uint8_t *out, int32_t outMax);
+exportAttrib int64_t FRIED_MaxEncodedSize(int32_t xsize, int32_t ysize, int32_t flags);
 exportAttrib void FreeFRIED(const uint8_t* allocated);
+
+    // Encoder/decoder objects keep their work buffers (and output buffer)
+    // from one image to the next and only grow them when an image needs
+    // more, so reusing one for many images avoids most allocations. They
+    // can be used for any number of images of any size, one at a time: use
+    // one per thread. Starting an image cancels a streaming encode/decode
+    // in progress.
+exportAttrib FRIED_Encoder *FRIED_NewEncoder();
+exportAttrib FRIED_Decoder *FRIED_NewDecoder();
+exportAttrib void FRIED_DestroyEncoder(FRIED_Encoder *enc);
+exportAttrib void FRIED_DestroyDecoder(FRIED_Decoder *dec);
+
+    // SaveFRIEDEx/LoadFRIEDEx on an encoder/decoder object. The result is
+    // owned by the object and valid until its next use.
+exportAttrib const uint8_t *FRIED_EncoderSave(FRIED_Encoder *enc, const uint8_t *image, int32_t xsize, int32_t ysize, const FRIED_EncodeParams *params, int32_t &outsize);
+exportAttrib const uint8_t *FRIED_DecoderLoad(FRIED_Decoder *dec, const uint8_t *data, int32_t size, const FRIED_DecodeParams *params, int32_t &xout, int32_t &yout, int32_t &outSize);
+    // LoadFRIEDInto on a decoder object
+exportAttrib bool FRIED_DecoderLoadInto(FRIED_Decoder *dec, const uint8_t *data, int32_t size, uint8_t *dst, int32_t dstPitch, int64_t dstCapacity, bool bottomUp, const FRIED_DecodeParams *params, int32_t &xout, int32_t &yout);
+
+    // Streaming encoding: rows are pushed top to bottom in params->Layout
+    // (the pitch argument replaces params->Pitch, 0 = tightly packed) and
+    // every finished 16-row stripe goes to write right away, so memory use
+    // doesn't depend on the image height. params->Threads is ignored,
+    // streaming encodes are serial, and rate control isn't available
+    // (FRIED_EncoderBegin fails). With FRIED_CHROMASUBSAMPLE, the chroma
+    // plane goes last in the file, so its stripes (typically a small part of
+    // the file) are kept in memory until FRIED_FinishEncoder writes them. So
+    // is the block AC layer of FRIED_PROGRESSIVE files, most of the file. The
+    // output is identical to SaveFRIEDEx. Files are limited to 2GB-1 like
+    // all others: a write that would go past that isn't made and the encode
+    // fails (later FRIED_EncoderPushRows calls too). FRIED_FinishEncoder
+    // returns the file size (-1 on error). FRIED_CreateEncoder is
+    // FRIED_NewEncoder plus FRIED_EncoderBegin, it returns 0 if that fails.
+exportAttrib bool FRIED_EncoderBegin(FRIED_Encoder *enc, int32_t xsize, int32_t ysize, const FRIED_EncodeParams *params, FRIED_WriteFunc write, void *user);
+exportAttrib FRIED_Encoder *FRIED_CreateEncoder(int32_t xsize, int32_t ysize, const FRIED_EncodeParams *params, FRIED_WriteFunc write, void *user);
+exportAttrib bool FRIED_EncoderPushRows(FRIED_Encoder *enc, const uint8_t *rows, int32_t nrows, int32_t pitch);
+exportAttrib int32_t FRIED_FinishEncoder(FRIED_Encoder *enc);
+
+    // Streaming decoding: rows come out top to bottom, in the LoadFRIED pixel
+    // layout, as soon as they're reconstructed, so only the stripe buffers are
+    // allocated. data must stay valid while rows are read. Full size only
+    // (params->Scale must be 1). FRIED_DecoderReadRows decodes the next nrows
+    // rows to dst (pitch 0 = tightly packed) and returns the number of rows
+    // stored, 0 at the end of the image or -1 on error. FRIED_CreateDecoder
+    // is FRIED_NewDecoder plus FRIED_DecoderBegin, it returns 0 if that fails.
+exportAttrib bool FRIED_DecoderBegin(FRIED_Decoder *dec, const uint8_t *data, int32_t size, const FRIED_DecodeParams *params, int32_t &xout, int32_t &yout, int32_t &bytesPerPixel);
+exportAttrib FRIED_Decoder *FRIED_CreateDecoder(const uint8_t *data, int32_t size, const FRIED_DecodeParams *params, int32_t &xout, int32_t &yout, int32_t &bytesPerPixel);
+exportAttrib int32_t FRIED_DecoderReadRows(FRIED_Decoder *dec, uint8_t *dst, int32_t nrows, int32_t pitch);
+exportAttrib bool FRIED_DecodeRows(const uint8_t *data, int32_t size, const FRIED_DecodeParams *params, FRIED_RowFunc func, void *user);
 #ifdef __cplusplus
 }
 #endif
@@ -7,8 +7,22 @@
 #define __FRIED_INTERNAL_HPP__
 #include <cstdint>
 #include "types_updated.h"
+
+struct FRIED_Stats;
+struct FRIED_Encoder;
+
+// statistics code is only compiled in with FRIED_STATS, so without it
+// collecting them costs nothing
+#if defined(FRIED_STATS)
+#define FRIED_STAT(...) __VA_ARGS__
+#else
+#define FRIED_STAT(...)
+#endif
+
 namespace FRIED
 {
+  class WorkerPool;
+
   enum ChannelType : uint8_t
   {
     CHANNEL_NONE  = 0,
@@ -27,6 +41,7 @@ namespace FRIED
     uint8_t Quantizer;                  // quantizer factor
     int32_t StripeOffset;              // offset in stripe data
     int32_t ChunkOffset;               // offset in chunk data
+    uint8_t Subsample;                  // plane size shift (0=full size, 1=half width and height), not in FRIED002
   };
 
 // file header
@@ -38,10 +53,86 @@ namespace FRIED
 //    int32_t VirtualXRes;               // virtual width of image
     int32_t ChunkWidth;            // chunk width
     uint8_t Channels;              // # of channels used (max 16)
+    uint8_t Layers;                // stripe data layers (1=interleaved, 2=progressive), not in FRIED002
   };
 #pragma pack(pop)
 
-  // encode context
+  // file versions. FRIED002 files have no Layers or Subsample fields, no
+  // stripe index and the block AC coeffs of a channel right after its
+  // macroblock coeffs; they can't be lossless.
+  //
+  // in FRIED003 files, the channel headers are followed by a stripe index:
+  // one int32_t per 16-row stripe giving the stripe's byte offset from the
+  // start of the stripe data, so decoders can start at any stripe. a chunk
+  // stores the macroblock coefficient streams of all channels first and the
+  // block AC streams after them, so decoders that only want the macroblock
+  // layer can skip to the end of the chunk. subsampled channels (only Co
+  // and Cg, at half width and height) form the chroma plane, which has
+  // stripes of its own. its stripe index follows the one of the full-size
+  // channels, its stripes follow theirs, and its offsets count from the
+  // start of all stripe data. lossless files have the quantizer
+  // QUANTIZER_LOSSLESS in all channels, YCoCg-R colors, exactly invertible
+  // block transforms, no lbt filters and no chroma plane. progressive files
+  // (2 layers) split every chunk in two, each with its own length: the
+  // macroblock layer (encsizes and macroblock streams) and the block AC
+  // layer (block AC streams). the macroblock layer of all stripes (main,
+  // then chroma plane) comes first, then the block AC layer of all of them.
+  // a second stripe index with the block AC layer offsets (counted the same
+  // way) follows the first.
+  enum FileVersion
+  {
+    VERSION_FRIED002 = 2,              // no stripe index, no Layers/Subsample
+    VERSION_FRIED003 = 3,              // current version
+  };
+
+  // channel quantizer of lossless files: coefficients are coded as they are
+  const uint8_t QUANTIZER_LOSSLESS = 255;
+
+  // rlgr start values of a channel's macroblock and block AC streams.
+  // lossless channels start like the finest quantizer.
+  inline int32_t mbXMinInit(int32_t qs)
+  {
+    return 625 >> ((qs == QUANTIZER_LOSSLESS ? 0 : qs) >> 3);
+  }
+
+  inline int32_t acXMinInit(int32_t qs)
+  {
+    return 94 >> ((qs == QUANTIZER_LOSSLESS ? 0 : qs) >> 3);
+  }
+
+  // size of the chroma plane for an image dimension
+  inline int32_t chromaSize(int32_t size)
+  {
+    return (size + 1) >> 1;
+  }
+
+  // scratch buffer that only ever grows, so contexts that are reused for
+  // many images don't have to allocate for every one of them
+  template<class T> struct GrowBuffer
+  {
+    T *Data;
+    int32_t Alloc;
+
+    GrowBuffer() : Data(0),Alloc(0) {}
+    ~GrowBuffer() { delete[] Data; }
+    GrowBuffer(const GrowBuffer &) = delete;
+    GrowBuffer &operator =(const GrowBuffer &) = delete;
+
+    T *Get(int32_t size)
+    {
+      if(size > Alloc)
+      {
+        delete[] Data;
+        Data = new T[size];
+        Alloc = size;
+      }
+
+      return Data;
+    }
+  };
+
+  // encode context. an image with subsampled chroma has two of them, one
+  // per plane; all channel counts and sizes in a context are the plane's.
   struct EncodeContext
   {
     FileHeader FH;
@@ -52,11 +143,24 @@ namespace FRIED
     int32_t *QB;                       // quantized buffer (16 lines)
     int32_t *CK;                       // chunk (unquantized) buffer
 
-    uint8_t *Bits;                      // packed buffer
-    int32_t BitsLength;                // length of packed buffer
+    uint8_t *Bits;                      // stripe output buffer
+    int32_t BitsLength;                // length of stripe output buffer
 
     const uint8_t *Image;               // source image pointer
+    int32_t Pitch;                     // bytes from one source row to the next
+    int32_t Convert;                   // FRIED_PIXEL_* layout source rows are converted from (0=none, they're in the coding layout)
+    uint8_t *Rows;                     // two converted source rows (with Convert)
     int32_t Flags;                     // encoding flags
+
+    int32_t *StripeSizes;              // encoded size of every stripe
+    int32_t *LayerSizes;               // progressive files: size of every stripe's macroblock layer
+    int32_t *Coeffs;                   // rate control: reordered coefficients of all stripes (0=none)
+    int32_t QuantizerDelta[16];        // rate control: channel quantizer minus the Y quantizer
+    FRIED_Stats *Stats;                // statistics to add to (0=none)
+    int32_t FileChannel[16];           // index of each channel in the file headers
+
+    EncodeContext *Chroma;             // subsampled chroma plane (0=none)
+    int32_t Subsample;                 // 1: this is the chroma plane, source row r is image rows 2r and 2r+1
   };
 
   // decode context
@@ -71,16 +175,69 @@ namespace FRIED
     int16_t *CK;                       // chunk (unquantized) buffer
 
       uint8_t *Image;                     // destination image pointer
+      intptr_t ImagePitch;               // bytes from one output row to the next (0=tightly packed)
     int32_t ChannelSetup;              // channel setup number
+    int32_t Version;                   // file version (VERSION_*)
+    int32_t ScaleShift;                // 0=full size, 2=1/4, 4=1/16 (macroblock layer only)
+    bool Lossless;                     // reversible transforms, no lbt filters
+    bool Preview;                      // progressive files: missing block AC data decodes as zeros
+
+    int32_t ColFirst;                  // first decoded column (chunk aligned)
+    int32_t ColEnd;                    // end of decoded columns
+    int32_t OutX,OutY;                 // top left of output rectangle
+    int32_t OutW,OutH;                 // size of output rectangle
+
+    WorkerPool *Pool;                  // chunk decode workers (0=serial)
+    int16_t *CKW;                      // per-worker chunk buffers
+    const uint8_t **ChunkPos;          // chunk start positions in current stripe, then block AC chunk ranges
+    FRIED_Stats *Stats;                // statistics to add to (0=none)
+    int32_t FileChannel[16];           // index of each channel in the file headers
+
+    // subsampled files: the main plane has the full-size channels and
+    // upsamples Co and Cg from the decoded chroma plane. the chroma plane
+    // (ChannelSetup 4) writes its output rows to Plane instead of pixels.
+    bool Subsampled;                   // Co and Cg are in the chroma plane
+    int16_t *Plane;                    // chroma plane output: rows of Co then Cg, OutW each
+    const int16_t *Chroma;             // decoded chroma to upsample from (same layout)
+    int32_t ChromaX,ChromaY;           // chroma coordinates of the first value in Chroma
+    int32_t ChromaW,ChromaRows;        // values per channel and row, rows (a ring when streaming)
+    int32_t ChromaXRes,ChromaYRes;     // size of the (scaled) chroma plane
+    int16_t *Line;                     // merged output row (4 channels of OutW)
   };
 
+  // statistics (stats.cpp). startStats clears stats for an image with the
+  // given channels and stripes; it's the only part without FRIED_STATS.
+  void startStats(FRIED_Stats *stats,const ChannelHeader *chans,int32_t nchans,int32_t nstripes);
+#if defined(FRIED_STATS)
+  double statsTime(const FRIED_Stats *stats); // seconds (0 if stats is 0)
+  void addTime(FRIED_Stats *stats,double FRIED_Stats::*time,double start);
+  void addChunkStats(FRIED_Stats *stats,int32_t ch,int32_t encsize,int32_t cksize,int32_t nonzero,int32_t bytes);
+  void setStripeBytes(FRIED_Stats *stats,int32_t stripe,int32_t bytes);
+  void mergeStats(FRIED_Stats *stats,const FRIED_Stats *part);
+
+  template<class T> int32_t countNonzero(const T *x,int32_t n)
+  {
+    int32_t count = 0;
+    for(int32_t i=0;i<n;i++)
+      count += x[i] != 0;
+
+    return count;
+  }
+#endif
+
   // entropy coding
   int32_t rlgrenc(uint8_t *bits,int32_t nbmax,int32_t *x,int32_t n,int32_t xminit);
   int32_t rlgrdec(const uint8_t *bits,int32_t nbmax,int16_t *y,int32_t n,int32_t xminit);
 
-  // quantization
+  // quantization (QUANTIZER_LOSSLESS keeps the coefficients as they are)
   int32_t newQuantize(int32_t qs,int32_t *x,int32_t npts,int32_t cwidth);
   void newDequantize(int32_t qs,int16_t *x,int32_t npts,int32_t cwidth);
+  double quantizeError(int32_t qs,const int32_t *x,int32_t cwidth);
+
+  // coefficient reordering: a chunk (16 rows of cwidth) to macroblock-major
+  // order and back. inv_reorder writes columns xOffs+[0,cwidth) of dest[0..15].
+  void reorder(int32_t *dest_chunk,int32_t *src_chunk,int32_t cwidth);
+  void inv_reorder(int16_t **dest,int32_t xOffs,int16_t *src,int32_t cwidth);
 
   // transforms
   void ndct42D(int32_t *x0,int32_t *x1,int32_t *x2,int32_t *x3);
@@ -96,6 +253,14 @@ namespace FRIED
   void lbt4pre4x4(int32_t *x0,int32_t *x1,int32_t *x2,int32_t *x3);
   void lbt4post4x4(int16_t *x0,int16_t *x1,int16_t *x2,int16_t *x3);
 
+  // exact inverse of ndct42D, for lossless files
+  void indct42D_lossless(int16_t *x0,int16_t *x1,int16_t *x2,int16_t *x3);
+
+  // the same on every 4x4 block in [0,width) of four rows (simd if available)
+  void indct42D_row(int16_t *x0,int16_t *x1,int16_t *x2,int16_t *x3,int32_t width);
+  void indct42D_lossless_row(int16_t *x0,int16_t *x1,int16_t *x2,int16_t *x3,int32_t width);
+  void lbt4post4x4_row(int16_t *x0,int16_t *x1,int16_t *x2,int16_t *x3,int32_t width);
+
   // pixel processing
   void gray_alpha_convert_dir(int32_t cols,int32_t colsPad,const uint8_t *src,int32_t *dst);
   void gray_alpha_convert_inv(int32_t cols,int32_t colsPad,const int16_t *src,uint8_t *dst);
@@ -105,6 +270,35 @@ namespace FRIED
   void color_alpha_convert_inv(int32_t cols,int32_t colsPad,const int16_t *src,uint8_t *dst);
   void color_x_convert_dir(int32_t cols,int32_t colsPad,const uint8_t *src,int32_t *dst);
   void color_x_convert_inv(int32_t cols,int32_t colsPad,const int16_t *src,uint8_t *dst);
+
+  // lossless files: YCoCg-R (or gray) and alpha, all centered on 0 but not
+  // scaled, for gray+alpha (color=false) or bgra rows
+  void lossless_convert_dir(int32_t cols,int32_t colsPad,const uint8_t *src,int32_t *dst,bool color,bool alpha);
+  void lossless_convert_inv(int32_t cols,int32_t colsPad,const int16_t *src,uint8_t *dst,bool color,bool alpha);
+
+  // subsampled chroma: the full-size Y (and alpha) of a color row, the Co/Cg
+  // plane row made from image rows src0 and src1 (cols image pixels), and
+  // the upsampling of Co or Cg for the output columns [x0,x0+cols). near
+  // and far are the chroma rows nearest to the output row and the one on
+  // its other side, both starting at chroma column cfirst; cmax is the
+  // width of the chroma plane.
+  void luma_alpha_convert_dir(int32_t cols,int32_t colsPad,const uint8_t *src,int32_t *dst);
+  void luma_x_convert_dir(int32_t cols,int32_t colsPad,const uint8_t *src,int32_t *dst);
+  void chroma_convert_dir(int32_t cols,int32_t colsPad,const uint8_t *src0,const uint8_t *src1,int32_t *dst);
+  void chroma_upsample(int32_t x0,int32_t cols,int32_t cmax,const int16_t *near,const int16_t *far,int32_t cfirst,int16_t *dst);
+
+  // source pixel layouts (FRIED_PIXEL_*): bytes per pixel (0 for unknown
+  // layouts), whether there's alpha, and the conversion of cols pixels to
+  // the coding layouts, bgra (alpha 255 if there's none) or gray+alpha
+  int32_t layout_bytes(int32_t layout);
+  bool layout_alpha(int32_t layout);
+  void layout_convert_bgra(int32_t layout,int32_t cols,const uint8_t *src,uint8_t *dst);
+  void layout_convert_gray(int32_t layout,int32_t cols,const uint8_t *src,uint8_t *dst);
+
+  // largest file a streaming encoder writes (offsets and the stripe index
+  // are int32_t, so 0x7fffffff unless lowered). meant for tests, which
+  // can't write 2GB to reach the real limit.
+  void SetStreamOutputLimit(FRIED_Encoder *enc,int32_t limit);
 }
 
 #endif
@@ -0,0 +1,122 @@
+// This file is distributed under a BSD license. See LICENSE.txt for details.
+
+// FRIED
+// memory-mapped file input and output for the file paths of the external API.
+#include "mappedfile.hpp"
+#include <fstream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define FRIED_HAVE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace FRIED {
+
+bool MappedFile::open(const char *path) {
+    close();
+
+#if FRIED_HAVE_MMAP
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *map = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            // the decoder goes over all of it, start reading ahead
+            posix_madvise(map, static_cast<size_t>(st.st_size), POSIX_MADV_WILLNEED);
+            data_ = static_cast<const uint8_t *>(map);
+            size_ = static_cast<size_t>(st.st_size);
+            mapped_ = true;
+        }
+    }
+
+    ::close(fd); // the mapping stays valid
+    if (mapped_)
+        return true;
+#endif
+
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        return false;
+
+    buffer_.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    if (in.bad())
+        return false;
+
+    data_ = buffer_.data();
+    size_ = buffer_.size();
+    return true;
+}
+
+void MappedFile::close() {
+#if FRIED_HAVE_MMAP
+    if (mapped_)
+        munmap(const_cast<uint8_t *>(data_), size_);
+#endif
+
+    data_ = nullptr;
+    size_ = 0;
+    mapped_ = false;
+    buffer_.clear();
+}
+
+bool MappedOutput::create(const char *path, size_t capacity) {
+    close(0);
+
+#if FRIED_HAVE_MMAP
+    if (!capacity)
+        return false;
+
+    int fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || ftruncate(fd, static_cast<off_t>(capacity)) != 0) {
+        ::close(fd);
+        return false;
+    }
+
+    void *map = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        // the caller falls back to writing the file, which truncates it again
+        ::close(fd);
+        return false;
+    }
+
+    data_ = static_cast<uint8_t *>(map);
+    capacity_ = capacity;
+    fd_ = fd;
+    return true;
+#else
+    (void)path;
+    (void)capacity;
+    return false;
+#endif
+}
+
+bool MappedOutput::close(size_t size) {
+    bool ok = true;
+
+#if FRIED_HAVE_MMAP
+    if (data_) {
+        ok = munmap(data_, capacity_) == 0;
+        ok = ftruncate(fd_, static_cast<off_t>(size)) == 0 && ok;
+        ok = ::close(fd_) == 0 && ok;
+    }
+#else
+    (void)size;
+#endif
+
+    data_ = nullptr;
+    capacity_ = 0;
+    fd_ = -1;
+    return ok;
+}
+
+} // namespace FRIED
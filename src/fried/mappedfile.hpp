@@ -0,0 +1,65 @@
+// This file is distributed under a BSD license. See LICENSE.txt for details.
+
+// FRIED
+// memory-mapped file input and output for the file paths of the external API.
+#pragma once
+#ifndef __MAPPEDFILE_HPP__
+#define __MAPPEDFILE_HPP__
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace FRIED {
+
+// A whole file for reading: mapped where the platform allows it, read into
+// memory where it doesn't (pipes, empty files, no mmap). Opening another file
+// closes the last one, so one object can serve many files.
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    ~MappedFile() { close(); }
+
+    bool open(const char *path);
+    void close();
+
+    const uint8_t *data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    const uint8_t *data_ = nullptr;
+    size_t size_ = 0;
+    bool mapped_ = false;
+    std::vector<uint8_t> buffer_;
+};
+
+// A file written through a writable mapping: create makes it capacity bytes
+// long (sparse where the file system allows it), finish trims it to the bytes
+// actually written. Without finish, the file is left empty. create fails where
+// there's no mmap, or for outputs that can't be mapped (pipes, devices);
+// callers then write it the usual way.
+class MappedOutput {
+public:
+    MappedOutput() = default;
+    MappedOutput(const MappedOutput &) = delete;
+    MappedOutput &operator=(const MappedOutput &) = delete;
+    ~MappedOutput() { close(0); }
+
+    bool create(const char *path, size_t capacity);
+    bool finish(size_t size) { return close(size); }
+
+    uint8_t *data() const { return data_; }
+    size_t capacity() const { return capacity_; }
+
+private:
+    bool close(size_t size);
+
+    uint8_t *data_ = nullptr;
+    size_t capacity_ = 0;
+    int fd_ = -1;
+};
+
+} // namespace FRIED
+
+#endif
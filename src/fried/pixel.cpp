@@ -5,16 +5,81 @@
 // (color conversion and such)
 #include "fried.hpp"
 #include "fried_internal.hpp"
+#include "simd.hpp"
 
 namespace FRIED
 {
+  // simd versions of the loops below; they return the number of pixels
+  // done, the C loops finish the row.
+  static int32_t convert_dir_simd(int32_t cols,int32_t colsPad,const uint8_t *src,int32_t *dst,bool color,bool alpha)
+  {
+    int32_t cpu = CpuFeatures();
+    int32_t bpp = color ? 4 : 2;
+    int32_t i = 0;
+
+    (void) cpu;
+    (void) bpp;
+#if defined(FRIED_SIMD_AVX2)
+    if(cpu & CPU_AVX2)
+      i += convert_dir_avx2(cols - i,colsPad,src + i * bpp,dst + i,color,alpha);
+#endif
+#if defined(FRIED_SIMD_SSE2)
+    if(cpu & CPU_SSE2)
+      i += convert_dir_sse2(cols - i,colsPad,src + i * bpp,dst + i,color,alpha);
+#endif
+
+    return i;
+  }
+
+  static int32_t convert_inv_simd(int32_t cols,int32_t colsPad,const int16_t *src,uint8_t *dst,bool color,bool alpha)
+  {
+    int32_t cpu = CpuFeatures();
+    int32_t bpp = color ? 4 : 2;
+    int32_t i = 0;
+
+    (void) cpu;
+    (void) bpp;
+#if defined(FRIED_SIMD_AVX2)
+    if(cpu & CPU_AVX2)
+      i += convert_inv_avx2(cols - i,colsPad,src + i,dst + i * bpp,color,alpha);
+#endif
+#if defined(FRIED_SIMD_SSE2)
+    if(cpu & CPU_SSE2)
+      i += convert_inv_sse2(cols - i,colsPad,src + i,dst + i * bpp,color,alpha);
+#endif
+
+    return i;
+  }
+
+  static int32_t lossless_convert_inv_simd(int32_t cols,int32_t colsPad,const int16_t *src,uint8_t *dst,bool color,bool alpha)
+  {
+    int32_t cpu = CpuFeatures();
+    int32_t bpp = color ? 4 : 2;
+    int32_t i = 0;
+
+    (void) cpu;
+    (void) bpp;
+#if defined(FRIED_SIMD_AVX2)
+    if(cpu & CPU_AVX2)
+      i += lossless_convert_inv_avx2(cols - i,colsPad,src + i,dst + i * bpp,color,alpha);
+#endif
+#if defined(FRIED_SIMD_SSE2)
+    if(cpu & CPU_SSE2)
+      i += lossless_convert_inv_sse2(cols - i,colsPad,src + i,dst + i * bpp,color,alpha);
+#endif
+
+    return i;
+  }
+
   // forward conversions
   void gray_alpha_convert_dir(int32_t cols,int32_t colsPad,const uint8_t *src,int32_t *dst)
   {
-    int32_t *outY = dst;
-    int32_t *outA = dst + colsPad;
+    int32_t done = convert_dir_simd(cols,colsPad,src,dst,false,true);
+    int32_t *outY = dst + done;
+    int32_t *outA = dst + colsPad + done;
 
-    for(int32_t i=0;i<cols;i++)
+    src += done * 2;
+    for(int32_t i=done;i<cols;i++)
     {
       *outY++ = (*src++ - 128) << 2;
       *outA++ = (*src++ - 128) << 2;
@@ -29,9 +94,11 @@ namespace FRIED
 
   void gray_x_convert_dir(int32_t cols,int32_t colsPad,const uint8_t *src,int32_t *dst)
   {
-    int32_t *outY = dst;
+    int32_t done = convert_dir_simd(cols,colsPad,src,dst,false,false);
+    int32_t *outY = dst + done;
 
-    for(int32_t i=0;i<cols;i++)
+    src += done * 2;
+    for(int32_t i=done;i<cols;i++)
     {
       *outY++ = (*src++ - 128) << 2;
       src++; // skip unused alpha byte
@@ -43,12 +110,14 @@ namespace FRIED
 
   void color_alpha_convert_dir(int32_t cols,int32_t colsPad,const uint8_t *src,int32_t *dst)
   {
-    int32_t *outY = dst;
-    int32_t *outCo = dst + colsPad;
+    int32_t done = convert_dir_simd(cols,colsPad,src,dst,true,true);
+    int32_t *outY = dst + done;
+    int32_t *outCo = outY + colsPad;
     int32_t *outCg = outCo + colsPad;
     int32_t *outA = outCg + colsPad;
 
-    for(int32_t i=0;i<cols;i++)
+    src += done * 4;
+    for(int32_t i=done;i<cols;i++)
     {
       int32_t b = (*src++ - 128) << 2;
       int32_t g = (*src++ - 128) << 2;
@@ -73,11 +142,13 @@ namespace FRIED
 
   void color_x_convert_dir(int32_t cols,int32_t colsPad,const uint8_t *src,int32_t *dst)
   {
-    int32_t *outY = dst;
-    int32_t *outCo = dst + colsPad;
+    int32_t done = convert_dir_simd(cols,colsPad,src,dst,true,false);
+    int32_t *outY = dst + done;
+    int32_t *outCo = outY + colsPad;
     int32_t *outCg = outCo + colsPad;
 
-    for(int32_t i=0;i<cols;i++)
+    src += done * 4;
+    for(int32_t i=done;i<cols;i++)
     {
       int32_t b = (*src++ - 128) << 2;
       int32_t g = (*src++ - 128) << 2;
@@ -99,7 +170,201 @@ namespace FRIED
     }
   }
 
-  // inverse conversions (optimize me!)
+  // lossless files: YCoCg-R, which integer lifting makes exactly
+  // invertible. Y, gray and alpha are centered on 0 like above, but
+  // nothing is scaled, so the transforms have no fractions to keep.
+  void lossless_convert_dir(int32_t cols,int32_t colsPad,const uint8_t *src,int32_t *dst,bool color,bool alpha)
+  {
+    int32_t nchans = (color ? 3 : 1) + (alpha ? 1 : 0);
+    int32_t *outA = dst + (nchans - 1) * colsPad;
+
+    if(color)
+    {
+      int32_t *outY = dst;
+      int32_t *outCo = outY + colsPad;
+      int32_t *outCg = outCo + colsPad;
+
+      for(int32_t i=0;i<cols;i++)
+      {
+        int32_t b = *src++;
+        int32_t g = *src++;
+        int32_t r = *src++;
+        int32_t co = r - b;
+        int32_t t = b + (co >> 1);
+        int32_t cg = g - t;
+
+        *outY++ = t + (cg >> 1) - 128;
+        *outCo++ = co;
+        *outCg++ = cg;
+        if(alpha)
+          *outA++ = *src - 128;
+        src++;
+      }
+    }
+    else
+    {
+      int32_t *outY = dst;
+
+      for(int32_t i=0;i<cols;i++)
+      {
+        *outY++ = *src++ - 128;
+        if(alpha)
+          *outA++ = *src - 128;
+        src++;
+      }
+    }
+
+    for(int32_t ch=0;ch<nchans;ch++)
+      sSetMem(dst + ch * colsPad + cols,0,(colsPad - cols) * sizeof(int32_t));
+  }
+
+  // subsampled chroma: Y (and alpha) only, the rest goes to the chroma plane
+  void luma_alpha_convert_dir(int32_t cols,int32_t colsPad,const uint8_t *src,int32_t *dst)
+  {
+    int32_t *outY = dst;
+    int32_t *outA = dst + colsPad;
+
+    for(int32_t i=0;i<cols;i++)
+    {
+      int32_t b = (*src++ - 128) << 2;
+      int32_t g = (*src++ - 128) << 3;
+      int32_t r = (*src++ - 128) << 2;
+
+      *outY++ = (r + g + b + 2) >> 2;
+      *outA++ = (*src++ - 128) << 2;
+    }
+
+    for(int32_t i=cols;i<colsPad;i++)
+    {
+      *outY++ = 0;
+      *outA++ = 0;
+    }
+  }
+
+  void luma_x_convert_dir(int32_t cols,int32_t colsPad,const uint8_t *src,int32_t *dst)
+  {
+    int32_t *outY = dst;
+
+    for(int32_t i=0;i<cols;i++)
+    {
+      int32_t b = (*src++ - 128) << 2;
+      int32_t g = (*src++ - 128) << 3;
+      int32_t r = (*src++ - 128) << 2;
+      src++; // ignore alpha
+
+      *outY++ = (r + g + b + 2) >> 2;
+    }
+
+    for(int32_t i=cols;i<colsPad;i++)
+      *outY++ = 0;
+  }
+
+  // Co and Cg of 2x2 pixels, averaged. per pixel, they'd be 2*(r-b) and
+  // 2*g-r-b (see color_x_convert_dir); summing first keeps the fraction.
+  // the last column of an odd width is repeated, and so is the last sample
+  // into the padding: zeros there would smear into the edge macroblocks'
+  // dcs, which scaled decoding shows as they are.
+  void chroma_convert_dir(int32_t cols,int32_t colsPad,const uint8_t *src0,const uint8_t *src1,int32_t *dst)
+  {
+    int32_t *outCo = dst;
+    int32_t *outCg = dst + colsPad;
+    int32_t ccols = chromaSize(cols);
+
+    for(int32_t i=0;i<ccols;i++)
+    {
+      int32_t x0 = (i * 2) * 4;
+      int32_t x1 = sMin(i * 2 + 1,cols - 1) * 4;
+      int32_t b = src0[x0+0] + src0[x1+0] + src1[x0+0] + src1[x1+0];
+      int32_t g = src0[x0+1] + src0[x1+1] + src1[x0+1] + src1[x1+1];
+      int32_t r = src0[x0+2] + src0[x1+2] + src1[x0+2] + src1[x1+2];
+
+      *outCo++ = (r - b + 1) >> 1;
+      *outCg++ = (2*g - r - b + 2) >> 2;
+    }
+
+    int32_t co = outCo[-1];
+    int32_t cg = outCg[-1];
+    for(int32_t i=ccols;i<colsPad;i++)
+    {
+      *outCo++ = co;
+      *outCg++ = cg;
+    }
+  }
+
+  // bilinear 2x upsampling: an output pixel is 3/4 of its chroma sample
+  // and 1/4 of the neighbour on its side, in both directions.
+  void chroma_upsample(int32_t x0,int32_t cols,int32_t cmax,const int16_t *near,const int16_t *far,int32_t cfirst,int16_t *dst)
+  {
+    for(int32_t x=x0;x<x0+cols;x++)
+    {
+      int32_t c = sMin(x >> 1,cmax - 1);
+      int32_t n = sMin(sMax((x & 1) ? c + 1 : c - 1,0),cmax - 1);
+      int32_t vc = 3 * near[c - cfirst] + far[c - cfirst];
+      int32_t vn = 3 * near[n - cfirst] + far[n - cfirst];
+
+      *dst++ = (3 * vc + vn + 8) >> 4;
+    }
+  }
+
+  // source layouts: bytes per pixel and the byte offsets of b, g, r and
+  // alpha in a pixel (gray layouts have their gray value as b, g and r;
+  // -1: no alpha). the default layout is resolved by the encoder.
+  struct PixelLayout
+  {
+    int8_t Bytes,B,G,R,A;
+  };
+
+  static const PixelLayout layouts[FRIED_PIXEL_COUNT] =
+  {
+    { 0,0,0,0,-1 },                    // FRIED_PIXEL_DEFAULT
+    { 4,0,1,2, 3 },                    // FRIED_PIXEL_BGRA
+    { 4,2,1,0, 3 },                    // FRIED_PIXEL_RGBA
+    { 4,0,1,2,-1 },                    // FRIED_PIXEL_BGRX
+    { 3,2,1,0,-1 },                    // FRIED_PIXEL_RGB24
+    { 3,0,1,2,-1 },                    // FRIED_PIXEL_BGR24
+    { 1,0,0,0,-1 },                    // FRIED_PIXEL_Y8
+    { 2,0,0,0, 1 },                    // FRIED_PIXEL_YA8
+  };
+
+  int32_t layout_bytes(int32_t layout)
+  {
+    return (layout >= 0 && layout < FRIED_PIXEL_COUNT) ? layouts[layout].Bytes : 0;
+  }
+
+  bool layout_alpha(int32_t layout)
+  {
+    return layout_bytes(layout) && layouts[layout].A >= 0;
+  }
+
+  void layout_convert_bgra(int32_t layout,int32_t cols,const uint8_t *src,uint8_t *dst)
+  {
+    const PixelLayout &pl = layouts[layout];
+
+    for(int32_t i=0;i<cols;i++)
+    {
+      *dst++ = src[pl.B];
+      *dst++ = src[pl.G];
+      *dst++ = src[pl.R];
+      *dst++ = (pl.A >= 0) ? src[pl.A] : 255;
+      src += pl.Bytes;
+    }
+  }
+
+  // color pixels become (r+2g+b)/4, like Y
+  void layout_convert_gray(int32_t layout,int32_t cols,const uint8_t *src,uint8_t *dst)
+  {
+    const PixelLayout &pl = layouts[layout];
+    bool gray = pl.B == pl.R;
+
+    for(int32_t i=0;i<cols;i++)
+    {
+      *dst++ = gray ? src[0] : (src[pl.B] + 2*src[pl.G] + src[pl.R] + 2) >> 2;
+      *dst++ = (pl.A >= 0) ? src[pl.A] : 255;
+      src += pl.Bytes;
+    }
+  }
+
+  // inverse conversions
   static int clampPixel(int32_t a)
   {
     return (a < 0) ? 0 : (a > 255) ? 255 : a;
@@ -107,21 +372,25 @@ namespace FRIED
 
   void gray_alpha_convert_inv(int32_t cols,int32_t colsPad,const int16_t *src,uint8_t *dst)
   {
-    const int16_t *inY = src;
-    const int16_t *inA = src + colsPad;
+    int32_t done = convert_inv_simd(cols,colsPad,src,dst,false,true);
+    const int16_t *inY = src + done;
+    const int16_t *inA = inY + colsPad;
 
-    for(int32_t i=0;i<cols;i++)
+    dst += done * 2;
+    for(int32_t i=done;i<cols;i++)
     {
       *dst++ = clampPixel((*inY++ >> 4) + 128);
       *dst++ = clampPixel((*inA++ >> 4) + 128);
     }
   }
 
-  void gray_x_convert_inv(int32_t cols, int32_t,const int16_t *src,uint8_t *dst)
+  void gray_x_convert_inv(int32_t cols,int32_t colsPad,const int16_t *src,uint8_t *dst)
   {
-    const int16_t *inY = src;
+    int32_t done = convert_inv_simd(cols,colsPad,src,dst,false,false);
+    const int16_t *inY = src + done;
 
-    for(int32_t i=0;i<cols;i++)
+    dst += done * 2;
+    for(int32_t i=done;i<cols;i++)
     {
       *dst++ = clampPixel((*inY++ >> 4) + 128);
       *dst++ = 255;
@@ -130,12 +399,14 @@ namespace FRIED
 
   void color_alpha_convert_inv(int32_t cols,int32_t colsPad,const int16_t *src,uint8_t *dst)
   {
-    const int16_t *inY = src;
-    const int16_t *inCo = src + colsPad;
+    int32_t done = convert_inv_simd(cols,colsPad,src,dst,true,true);
+    const int16_t *inY = src + done;
+    const int16_t *inCo = inY + colsPad;
     const int16_t *inCg = inCo + colsPad;
     const int16_t *inA = inCg + colsPad;
 
-    for(int32_t i=0;i<cols;i++)
+    dst += done * 4;
+    for(int32_t i=done;i<cols;i++)
     {
       int32_t y = *inY++;
       int32_t co = *inCo++;
@@ -156,11 +427,13 @@ namespace FRIED
 
   void color_x_convert_inv(int32_t cols,int32_t colsPad,const int16_t *src,uint8_t *dst)
   {
-    const int16_t *inY = src;
-    const int16_t *inCo = src + colsPad;
+    int32_t done = convert_inv_simd(cols,colsPad,src,dst,true,false);
+    const int16_t *inY = src + done;
+    const int16_t *inCo = inY + colsPad;
     const int16_t *inCg = inCo + colsPad;
 
-    for(int32_t i=0;i<cols;i++)
+    dst += done * 4;
+    for(int32_t i=done;i<cols;i++)
     {
       int32_t y = *inY++;
       int32_t co = *inCo++;
@@ -178,4 +451,45 @@ namespace FRIED
       *dst++ = 255;
     }
   }
+
+  void lossless_convert_inv(int32_t cols,int32_t colsPad,const int16_t *src,uint8_t *dst,bool color,bool alpha)
+  {
+    int32_t done = lossless_convert_inv_simd(cols,colsPad,src,dst,color,alpha);
+    const int16_t *inA = src + (color ? 3 : 1) * colsPad + done;
+
+    if(color)
+    {
+      const int16_t *inY = src + done;
+      const int16_t *inCo = inY + colsPad;
+      const int16_t *inCg = inCo + colsPad;
+
+      dst += done * 4;
+      for(int32_t i=done;i<cols;i++)
+      {
+        int32_t co = *inCo++;
+        int32_t cg = *inCg++;
+        int32_t t = *inY++ + 128 - (cg >> 1);
+        int32_t g = cg + t;
+        int32_t b = t - (co >> 1);
+        int32_t r = b + co;
+
+        // exact at full size; scaled decodes can leave the range
+        *dst++ = clampPixel(b);
+        *dst++ = clampPixel(g);
+        *dst++ = clampPixel(r);
+        *dst++ = alpha ? clampPixel(*inA++ + 128) : 255;
+      }
+    }
+    else
+    {
+      const int16_t *inY = src + done;
+
+      dst += done * 2;
+      for(int32_t i=done;i<cols;i++)
+      {
+        *dst++ = clampPixel(*inY++ + 128);
+        *dst++ = alpha ? clampPixel(*inA++ + 128) : 255;
+      }
+    }
+  }
 }
@@ -7,7 +7,6 @@
 namespace FRIED
 {
   // ---- the quantization tables themselves
-  static bool tablesInitialized = false;
   static int32_t qdescale[8][16];
   static int32_t qrescale[8][16];
 
@@ -45,11 +44,8 @@ namespace FRIED
     return p >> shift;
   }
 
-  static void initQuantTables()
+  static bool buildQuantTables()
   {
-    if(tablesInitialized)
-      return;
-
     for(int32_t level=0;level<8;level++)
     {
       double_t factor = pow(2.0,level / 8.0);
@@ -67,7 +63,15 @@ namespace FRIED
       }
     }
 
-    tablesInitialized = true;
+    return true;
+  }
+
+  static void initQuantTables()
+  {
+    // function-local static, so concurrent encoder/decoder threads
+    // build the tables exactly once.
+    static bool tablesInitialized = buildQuantTables();
+    (void) tablesInitialized;
   }
 
   // ---- actual quantization functions
@@ -76,22 +80,26 @@ namespace FRIED
   {
     int32_t shift,*qtab,bias,i,f,n,*p;
 
-    // prepare quantizer tables
-    initQuantTables();
+    // lossless channels are coded as they are
+    if(qs != QUANTIZER_LOSSLESS)
+    {
+      // prepare quantizer tables
+      initQuantTables();
 
-    shift = qs >> 3;
-    qtab = qdescale[qs & 7];
-    bias = 1024 << shift;
+      shift = qs >> 3;
+      qtab = qdescale[qs & 7];
+      bias = 1024 << shift;
 
-    // quantization by groups
-    p = x;
+      // quantization by groups
+      p = x;
 
-    for(i=0;i<16;i++)
-    {
-      f = qtab[zigzag2[i]];
+      for(i=0;i<16;i++)
+      {
+        f = qtab[zigzag2[i]];
 
-      for(n=0;n<cwidth;n++)
-        *p++ = descale(*p,bias,f,shift);
+        for(n=0;n<cwidth;n++)
+          *p++ = descale(*p,bias,f,shift);
+      }
     }
 
     // now find number of zeroes
@@ -102,6 +110,46 @@ namespace FRIED
     return n+1;
   }
 
+  // squared error that quantizing a chunk (cwidth*16 coefficients, as
+  // reordered) at qs would leave, in units of the transform output
+  double quantizeError(int32_t qs,const int32_t *x,int32_t cwidth)
+  {
+    int32_t shift,*dtab,*rtab,bias,i,n;
+    double error = 0.0;
+
+    // prepare quantizer tables
+    initQuantTables();
+
+    shift = qs >> 3;
+    dtab = qdescale[qs & 7];
+    rtab = qrescale[qs & 7];
+    bias = 1024 << shift;
+
+    for(i=0;i<16;i++)
+    {
+      int32_t zz = zigzag2[i];
+      int32_t fd = dtab[zz];
+      int32_t fr = rtab[zz];
+      double groupError = 0.0;
+
+      for(n=0;n<cwidth;n++)
+      {
+        // same rounding as newQuantize/newDequantize
+        int32_t q = descale(*x,bias,fd,shift);
+        int32_t r = (shift < 4) ? (q * fr) >> (4 - shift) : (q * fr) << (shift - 4);
+        double d = *x++ - r;
+
+        groupError += d * d;
+      }
+
+      // the quantizer steps follow the transform row norms
+      double norm = xformn[zz & 3] * xformn[zz >> 2];
+      error += groupError / (norm * norm);
+    }
+
+    return error;
+  }
+
   static void rescaleLoop(int16_t *x,int32_t count,int32_t f,int32_t shift)
   {
     if(shift < 4)
@@ -124,6 +172,9 @@ namespace FRIED
   {
     int32_t shift,*qtab,i,f,count;
 
+    if(qs == QUANTIZER_LOSSLESS)
+      return;
+
     // prepare quantizer tables
     initQuantTables();
 
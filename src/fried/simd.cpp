@@ -0,0 +1,60 @@
+// This file is distributed under a BSD license. See LICENSE.txt for details.
+
+// FRIED
+// cpu feature detection.
+#include "simd.hpp"
+#include <atomic>
+
+#if defined(FRIED_SIMD_AVX2) && defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+namespace FRIED
+{
+  static std::atomic<int32_t> featureMask(~0);
+
+  static int32_t detectCpuFeatures()
+  {
+    int32_t features = 0;
+
+#if defined(FRIED_SIMD_SSE2)
+    features |= CPU_SSE2;              // compiled in, so the target has it
+#endif
+
+#if defined(FRIED_SIMD_AVX2)
+#if defined(_MSC_VER)
+    int info[4];
+
+    __cpuid(info,0);
+    if(info[0] >= 7)
+    {
+      __cpuid(info,1);
+      bool osxsave = (info[2] & (1 << 27)) != 0;
+      bool avx = (info[2] & (1 << 28)) != 0;
+
+      // the os has to save the ymm registers, too
+      __cpuidex(info,7,0);
+      if(osxsave && avx && (info[1] & (1 << 5)) && (_xgetbv(0) & 6) == 6)
+        features |= CPU_AVX2;
+    }
+#else
+    if(__builtin_cpu_supports("avx2"))
+      features |= CPU_AVX2;
+#endif
+#endif
+
+    return features;
+  }
+
+  int32_t CpuFeatures()
+  {
+    static int32_t detected = detectCpuFeatures();
+    return detected & featureMask.load(std::memory_order_relaxed);
+  }
+
+  void SetCpuFeatureMask(int32_t mask)
+  {
+    featureMask.store(mask,std::memory_order_relaxed);
+  }
+}
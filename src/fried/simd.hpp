@@ -0,0 +1,70 @@
+// This file is distributed under a BSD license. See LICENSE.txt for details.
+
+// FRIED
+// cpu feature detection and the simd kernels selected with it.
+#pragma once
+#ifndef __SIMD_HPP__
+#define __SIMD_HPP__
+#include <cstdint>
+
+// instruction sets compiled in. sse2 is part of x86-64; avx2 needs its own
+// compiler flags, so the build defines FRIED_SIMD_AVX2 when simd_avx2.cpp
+// gets them. other targets use the plain C versions.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FRIED_SIMD_SSE2 1
+#endif
+
+namespace FRIED
+{
+  enum CpuFeature
+  {
+    CPU_SSE2 = 0x0001,
+    CPU_AVX2 = 0x0002,
+  };
+
+  // features the kernels may use: compiled in, supported by the cpu and not
+  // masked out. detection happens once, on first use.
+  int32_t CpuFeatures();
+
+  // restricts CpuFeatures() to mask (0 = plain C only). meant for tests and
+  // benchmarks, not to be called while something is encoding or decoding.
+  void SetCpuFeatureMask(int32_t mask);
+
+  // kernels working on whole rows of 4x4 blocks. each does as many blocks
+  // as fit in its vectors and returns the number of columns it processed;
+  // the plain C versions do the rest.
+  //
+  // the inv_reorder loops in decode.cpp: scatter the coefficients of block
+  // rows from macroblock-major order into 4 pixel rows (dest[0,4,8,12]).
+  // the dc version gathers c0 from the macroblock coefficients at g0 and
+  // does as many groups of 8 macroblocks as fit, the ac version all of them.
+  // both return the number of columns done.
+  //
+  // convert_dir/convert_inv are the color conversions from pixel.cpp for
+  // all four channel setups (gray or color, with or without alpha), and
+  // lossless_convert_inv the one for lossless files. they return the number
+  // of pixels converted.
+#if defined(FRIED_SIMD_SSE2)
+  int32_t indct42D_row_sse2(int16_t *x0,int16_t *x1,int16_t *x2,int16_t *x3,int32_t width);
+  int32_t lbt4post4x4_row_sse2(int16_t *x0,int16_t *x1,int16_t *x2,int16_t *x3,int32_t width);
+  int32_t indct42D_lossless_row_sse2(int16_t *x0,int16_t *x1,int16_t *x2,int16_t *x3,int32_t width);
+  int32_t inv_reorder_dc_sse2(int16_t **dest,int32_t xOffs,const int16_t *g0,const int16_t *g1,const int16_t *g2,const int16_t *g3,int32_t cwidth);
+  int32_t inv_reorder_ac_sse2(int16_t **dest,int32_t xOffs,const int16_t *c0,const int16_t *c1,const int16_t *c2,const int16_t *c3,int32_t cwidth);
+  int32_t convert_dir_sse2(int32_t cols,int32_t colsPad,const uint8_t *src,int32_t *dst,bool color,bool alpha);
+  int32_t convert_inv_sse2(int32_t cols,int32_t colsPad,const int16_t *src,uint8_t *dst,bool color,bool alpha);
+  int32_t lossless_convert_inv_sse2(int32_t cols,int32_t colsPad,const int16_t *src,uint8_t *dst,bool color,bool alpha);
+#endif
+
+#if defined(FRIED_SIMD_AVX2)
+  int32_t indct42D_row_avx2(int16_t *x0,int16_t *x1,int16_t *x2,int16_t *x3,int32_t width);
+  int32_t lbt4post4x4_row_avx2(int16_t *x0,int16_t *x1,int16_t *x2,int16_t *x3,int32_t width);
+  int32_t indct42D_lossless_row_avx2(int16_t *x0,int16_t *x1,int16_t *x2,int16_t *x3,int32_t width);
+  int32_t inv_reorder_dc_avx2(int16_t **dest,int32_t xOffs,const int16_t *g0,const int16_t *g1,const int16_t *g2,const int16_t *g3,int32_t cwidth);
+  int32_t inv_reorder_ac_avx2(int16_t **dest,int32_t xOffs,const int16_t *c0,const int16_t *c1,const int16_t *c2,const int16_t *c3,int32_t cwidth);
+  int32_t convert_dir_avx2(int32_t cols,int32_t colsPad,const uint8_t *src,int32_t *dst,bool color,bool alpha);
+  int32_t convert_inv_avx2(int32_t cols,int32_t colsPad,const int16_t *src,uint8_t *dst,bool color,bool alpha);
+  int32_t lossless_convert_inv_avx2(int32_t cols,int32_t colsPad,const int16_t *src,uint8_t *dst,bool color,bool alpha);
+#endif
+}
+
+#endif
@@ -0,0 +1,389 @@
+// This file is distributed under a BSD license. See LICENSE.txt for details.
+
+// FRIED
+// avx2 kernels (16 blocks per vector). this file is built with avx2 enabled
+// and only called after CpuFeatures() said so; don't include anything here
+// whose inline functions get used elsewhere, too.
+#include "simd.hpp"
+
+#if defined(FRIED_SIMD_AVX2)
+#include <immintrin.h>
+#include "simd_kernels.hpp"
+#include "simd_x86.hpp"
+
+namespace FRIED
+{
+  namespace
+  {
+    struct VecAVX2
+    {
+      __m256i v;
+    };
+
+    inline VecAVX2 operator+(VecAVX2 a,VecAVX2 b)  { return { _mm256_add_epi16(a.v,b.v) }; }
+    inline VecAVX2 operator-(VecAVX2 a,VecAVX2 b)  { return { _mm256_sub_epi16(a.v,b.v) }; }
+    inline VecAVX2 operator>>(VecAVX2 a,int shift) { return { _mm256_srai_epi16(a.v,shift) }; }
+
+    struct OpsAVX2
+    {
+      typedef VecAVX2 V;
+      static const int32_t Blocks = 16;
+
+      // same shuffles as the sse2 version, run in both 128-bit lanes. the
+      // blocks end up in a different lane order, which doesn't matter since
+      // Store4 undoes it.
+      static inline void Load4(const int16_t *src,V *out)
+      {
+        __m256i a = _mm256_loadu_si256((const __m256i *) (src +  0));
+        __m256i b = _mm256_loadu_si256((const __m256i *) (src + 16));
+        __m256i c = _mm256_loadu_si256((const __m256i *) (src + 32));
+        __m256i d = _mm256_loadu_si256((const __m256i *) (src + 48));
+
+        __m256i t0 = _mm256_unpacklo_epi16(a,b);
+        __m256i t1 = _mm256_unpackhi_epi16(a,b);
+        __m256i t2 = _mm256_unpacklo_epi16(c,d);
+        __m256i t3 = _mm256_unpackhi_epi16(c,d);
+
+        __m256i u0 = _mm256_unpacklo_epi16(t0,t1);
+        __m256i u1 = _mm256_unpackhi_epi16(t0,t1);
+        __m256i u2 = _mm256_unpacklo_epi16(t2,t3);
+        __m256i u3 = _mm256_unpackhi_epi16(t2,t3);
+
+        out[0].v = _mm256_unpacklo_epi64(u0,u2);
+        out[1].v = _mm256_unpackhi_epi64(u0,u2);
+        out[2].v = _mm256_unpacklo_epi64(u1,u3);
+        out[3].v = _mm256_unpackhi_epi64(u1,u3);
+      }
+
+      static inline void Store4(int16_t *dst,const V *in)
+      {
+        __m256i u0 = _mm256_unpacklo_epi64(in[0].v,in[1].v);
+        __m256i u2 = _mm256_unpackhi_epi64(in[0].v,in[1].v);
+        __m256i u1 = _mm256_unpacklo_epi64(in[2].v,in[3].v);
+        __m256i u3 = _mm256_unpackhi_epi64(in[2].v,in[3].v);
+
+        __m256i w0 = _mm256_unpacklo_epi16(u0,u1);
+        __m256i w1 = _mm256_unpackhi_epi16(u0,u1);
+        __m256i w2 = _mm256_unpacklo_epi16(u2,u3);
+        __m256i w3 = _mm256_unpackhi_epi16(u2,u3);
+
+        _mm256_storeu_si256((__m256i *) (dst +  0),_mm256_unpacklo_epi16(w0,w1));
+        _mm256_storeu_si256((__m256i *) (dst + 16),_mm256_unpackhi_epi16(w0,w1));
+        _mm256_storeu_si256((__m256i *) (dst + 32),_mm256_unpacklo_epi16(w2,w3));
+        _mm256_storeu_si256((__m256i *) (dst + 48),_mm256_unpackhi_epi16(w2,w3));
+      }
+    };
+
+    // 32-bit lanes for the lossless transform (8 blocks per vector)
+    struct Vec32AVX2
+    {
+      __m256i v;
+    };
+
+    inline Vec32AVX2 operator+(Vec32AVX2 a,Vec32AVX2 b)  { return { _mm256_add_epi32(a.v,b.v) }; }
+    inline Vec32AVX2 operator-(Vec32AVX2 a,Vec32AVX2 b)  { return { _mm256_sub_epi32(a.v,b.v) }; }
+    inline Vec32AVX2 operator>>(Vec32AVX2 a,int shift) { return { _mm256_srai_epi32(a.v,shift) }; }
+    inline Vec32AVX2 wrap16(Vec32AVX2 a)               { return { _mm256_srai_epi32(_mm256_slli_epi32(a.v,16),16) }; }
+
+    struct Ops32AVX2
+    {
+      typedef Vec32AVX2 V;
+      static const int32_t Blocks = 8;
+
+      // the sse2 shuffles again, in both 128-bit lanes
+      static inline void Load4(const int16_t *src,V *out)
+      {
+        __m256i a = _mm256_loadu_si256((const __m256i *) (src +  0));
+        __m256i b = _mm256_loadu_si256((const __m256i *) (src + 16));
+
+        __m256i t0 = _mm256_unpacklo_epi16(a,b);
+        __m256i t1 = _mm256_unpackhi_epi16(a,b);
+        __m256i u0 = _mm256_unpacklo_epi16(t0,t1);
+        __m256i u1 = _mm256_unpackhi_epi16(t0,t1);
+
+        out[0].v = _mm256_srai_epi32(_mm256_unpacklo_epi16(u0,u0),16);
+        out[1].v = _mm256_srai_epi32(_mm256_unpackhi_epi16(u0,u0),16);
+        out[2].v = _mm256_srai_epi32(_mm256_unpacklo_epi16(u1,u1),16);
+        out[3].v = _mm256_srai_epi32(_mm256_unpackhi_epi16(u1,u1),16);
+      }
+
+      static inline void Store4(int16_t *dst,const V *in)
+      {
+        __m256i u0 = _mm256_packs_epi32(in[0].v,in[1].v);
+        __m256i u1 = _mm256_packs_epi32(in[2].v,in[3].v);
+
+        __m256i w0 = _mm256_unpacklo_epi16(u0,u1);
+        __m256i w1 = _mm256_unpackhi_epi16(u0,u1);
+
+        _mm256_storeu_si256((__m256i *) (dst +  0),_mm256_unpacklo_epi16(w0,w1));
+        _mm256_storeu_si256((__m256i *) (dst + 16),_mm256_unpackhi_epi16(w0,w1));
+      }
+    };
+
+    // same output as the sse2 version, but with elements 0..7 in the low
+    // and 8..15 in the high lane, one store per row:
+    //   r01,r89 r23,r1011 r45,r1213 r67,r1415 (low lane, high lane)
+    inline void shuffle_mb(int16_t **dest,int32_t x,__m256i c0,__m256i c1,__m256i c2,__m256i c3)
+    {
+      __m256i t0 = _mm256_unpacklo_epi16(c0,c1);
+      __m256i t1 = _mm256_unpacklo_epi16(c2,c3);
+      __m256i t2 = _mm256_unpackhi_epi16(c0,c1);
+      __m256i t3 = _mm256_unpackhi_epi16(c2,c3);
+
+      __m256i u0 = _mm256_unpacklo_epi32(t0,t1);
+      __m256i u1 = _mm256_unpackhi_epi32(t0,t1);
+      __m256i u2 = _mm256_unpacklo_epi32(t2,t3);
+      __m256i u3 = _mm256_unpackhi_epi32(t2,t3);
+
+      // R4 R5 R8 R9 and R6 R7 R10 R11
+      __m256i v0 = _mm256_blend_epi32(u2,u0,0xf0);
+      __m256i v1 = _mm256_blend_epi32(u3,u1,0xf0);
+
+      _mm256_storeu_si256((__m256i *) (dest[ 0] + x),_mm256_blend_epi32(u0,u3,0xf0));
+      _mm256_storeu_si256((__m256i *) (dest[ 4] + x),_mm256_shuffle_epi32(_mm256_blend_epi32(u1,u2,0xf0),0x4e));
+      _mm256_storeu_si256((__m256i *) (dest[ 8] + x),_mm256_blend_epi32(v0,v1,0xcc));
+      _mm256_storeu_si256((__m256i *) (dest[12] + x),_mm256_alignr_epi8(v1,v0,8));
+    }
+
+    inline __m256i load(const int16_t *p)
+    {
+      return _mm256_loadu_si256((const __m256i *) p);
+    }
+  }
+
+  int32_t indct42D_row_avx2(int16_t *x0,int16_t *x1,int16_t *x2,int16_t *x3,int32_t width)
+  {
+    return transform_row<OpsAVX2,indct42D_vec<VecAVX2> >(x0,x1,x2,x3,width);
+  }
+
+  int32_t lbt4post4x4_row_avx2(int16_t *x0,int16_t *x1,int16_t *x2,int16_t *x3,int32_t width)
+  {
+    return transform_row<OpsAVX2,lbt4post4x4_vec<VecAVX2> >(x0,x1,x2,x3,width);
+  }
+
+  int32_t indct42D_lossless_row_avx2(int16_t *x0,int16_t *x1,int16_t *x2,int16_t *x3,int32_t width)
+  {
+    return transform_row<Ops32AVX2,indct42D_lossless_vec<Vec32AVX2> >(x0,x1,x2,x3,width);
+  }
+
+  int32_t inv_reorder_dc_avx2(int16_t **dest,int32_t xOffs,const int16_t *g0,const int16_t *g1,const int16_t *g2,const int16_t *g3,int32_t cwidth)
+  {
+    int32_t nmb = cwidth / 16;
+    int32_t m;
+
+    for(m=0;m+8<=nmb;m+=8)
+    {
+      __m128i lo[8],hi[8];
+
+      gather_dcs8_sse2(g0 + m,nmb,lo,hi);
+      for(int32_t k=0;k<8;k++)
+      {
+        int32_t mb = (m + k) * 16;
+        __m256i dcs = _mm256_inserti128_si256(_mm256_castsi128_si256(lo[k]),hi[k],1);
+
+        shuffle_mb(dest,xOffs + mb,dcs,load(g1 + mb),load(g2 + mb),load(g3 + mb));
+      }
+    }
+
+    return m * 16;
+  }
+
+  int32_t inv_reorder_ac_avx2(int16_t **dest,int32_t xOffs,const int16_t *c0,const int16_t *c1,const int16_t *c2,const int16_t *c3,int32_t cwidth)
+  {
+    for(int32_t mb=0;mb<cwidth;mb+=16)
+      shuffle_mb(dest,xOffs + mb,load(c0 + mb),load(c1 + mb),load(c2 + mb),load(c3 + mb));
+
+    return cwidth;
+  }
+
+  namespace
+  {
+    // forward: the sse2 code with 8 pixels per step
+    template<bool Color,bool Alpha> int32_t convert_dir(int32_t cols,int32_t colsPad,const uint8_t *src,int32_t *dst)
+    {
+      const __m256i mask = _mm256_set1_epi32(0xff);
+      const __m256i bias = _mm256_set1_epi32(128);
+      const __m256i two = _mm256_set1_epi32(2);
+      int32_t i;
+
+      for(i=0;i+8<=cols;i+=8)
+      {
+        if(Color)
+        {
+          __m256i p = _mm256_loadu_si256((const __m256i *) (src + i * 4));
+          __m256i b = _mm256_slli_epi32(_mm256_sub_epi32(_mm256_and_si256(p,mask),bias),2);
+          __m256i g = _mm256_slli_epi32(_mm256_sub_epi32(_mm256_and_si256(_mm256_srli_epi32(p,8),mask),bias),3);
+          __m256i r = _mm256_slli_epi32(_mm256_sub_epi32(_mm256_and_si256(_mm256_srli_epi32(p,16),mask),bias),2);
+
+          _mm256_storeu_si256((__m256i *) (dst + i),_mm256_srai_epi32(_mm256_add_epi32(_mm256_add_epi32(r,g),_mm256_add_epi32(b,two)),2));
+          _mm256_storeu_si256((__m256i *) (dst + colsPad + i),_mm256_srai_epi32(_mm256_sub_epi32(r,b),1));
+          _mm256_storeu_si256((__m256i *) (dst + colsPad * 2 + i),_mm256_srai_epi32(_mm256_add_epi32(_mm256_sub_epi32(_mm256_sub_epi32(g,r),b),two),2));
+          if(Alpha)
+            _mm256_storeu_si256((__m256i *) (dst + colsPad * 3 + i),_mm256_slli_epi32(_mm256_sub_epi32(_mm256_srli_epi32(p,24),bias),2));
+        }
+        else
+        {
+          __m256i p = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *) (src + i * 2)));
+
+          _mm256_storeu_si256((__m256i *) (dst + i),_mm256_slli_epi32(_mm256_sub_epi32(_mm256_and_si256(p,mask),bias),2));
+          if(Alpha)
+            _mm256_storeu_si256((__m256i *) (dst + colsPad + i),_mm256_slli_epi32(_mm256_sub_epi32(_mm256_srli_epi32(p,8),bias),2));
+        }
+      }
+
+      return i;
+    }
+
+    inline __m256i widen(const int16_t *p)
+    {
+      return _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *) p));
+    }
+
+    // inverse: 8 color or 16 gray pixels per step. the packs work on each
+    // 128-bit lane, so the byte shuffle at the end only has to interleave
+    // within lanes.
+    template<bool Color,bool Alpha> int32_t convert_inv(int32_t cols,int32_t colsPad,const int16_t *src,uint8_t *dst)
+    {
+      int32_t i;
+
+      if(Color)
+      {
+        // lane bytes: b0-3 r0-3 g0-3 a0-3 -> b0 g0 r0 a0 b1 ...
+        const __m256i order = _mm256_setr_epi8(
+          0,8,4,12,1,9,5,13,2,10,6,14,3,11,7,15,
+          0,8,4,12,1,9,5,13,2,10,6,14,3,11,7,15);
+        const __m256i bias = _mm256_set1_epi16(128);
+
+        for(i=0;i+8<=cols;i+=8)
+        {
+          __m256i y = widen(src + i);
+          __m256i co = widen(src + colsPad + i);
+          __m256i cg = widen(src + colsPad * 2 + i);
+          __m256i a;
+
+          __m256i g = _mm256_srai_epi32(_mm256_add_epi32(y,cg),4);
+          __m256i t = _mm256_sub_epi32(y,cg);
+          __m256i r = _mm256_srai_epi32(_mm256_add_epi32(t,co),4);
+          __m256i b = _mm256_srai_epi32(_mm256_sub_epi32(t,co),4);
+
+          if(Alpha)
+            a = _mm256_srai_epi32(widen(src + colsPad * 3 + i),4);
+          else
+            a = _mm256_set1_epi32(255 - 128);
+
+          __m256i br = _mm256_add_epi16(_mm256_packs_epi32(b,r),bias);
+          __m256i ga = _mm256_add_epi16(_mm256_packs_epi32(g,a),bias);
+
+          _mm256_storeu_si256((__m256i *) (dst + i * 4),_mm256_shuffle_epi8(_mm256_packus_epi16(br,ga),order));
+        }
+      }
+      else
+      {
+        // lane bytes: y0-7 a0-7 -> y0 a0 y1 a1 ...
+        const __m256i order = _mm256_setr_epi8(
+          0,8,1,9,2,10,3,11,4,12,5,13,6,14,7,15,
+          0,8,1,9,2,10,3,11,4,12,5,13,6,14,7,15);
+        const __m256i bias = _mm256_set1_epi16(128);
+
+        for(i=0;i+16<=cols;i+=16)
+        {
+          __m256i y = _mm256_add_epi16(_mm256_srai_epi16(_mm256_loadu_si256((const __m256i *) (src + i)),4),bias);
+          __m256i a;
+
+          if(Alpha)
+            a = _mm256_add_epi16(_mm256_srai_epi16(_mm256_loadu_si256((const __m256i *) (src + colsPad + i)),4),bias);
+          else
+            a = _mm256_set1_epi16(255);
+
+          _mm256_storeu_si256((__m256i *) (dst + i * 2),_mm256_shuffle_epi8(_mm256_packus_epi16(y,a),order));
+        }
+      }
+
+      return i;
+    }
+
+    // lossless inverse: the sse2 code with the lane order of convert_inv
+    template<bool Color,bool Alpha> int32_t lossless_convert_inv(int32_t cols,int32_t colsPad,const int16_t *src,uint8_t *dst)
+    {
+      int32_t i;
+
+      if(Color)
+      {
+        const __m256i order = _mm256_setr_epi8(
+          0,8,4,12,1,9,5,13,2,10,6,14,3,11,7,15,
+          0,8,4,12,1,9,5,13,2,10,6,14,3,11,7,15);
+        const __m256i bias = _mm256_set1_epi32(128);
+
+        for(i=0;i+8<=cols;i+=8)
+        {
+          __m256i co = widen(src + colsPad + i);
+          __m256i cg = widen(src + colsPad * 2 + i);
+          __m256i a;
+
+          __m256i t = _mm256_sub_epi32(_mm256_add_epi32(widen(src + i),bias),_mm256_srai_epi32(cg,1));
+          __m256i g = _mm256_add_epi32(cg,t);
+          __m256i b = _mm256_sub_epi32(t,_mm256_srai_epi32(co,1));
+          __m256i r = _mm256_add_epi32(b,co);
+
+          if(Alpha)
+            a = _mm256_add_epi32(widen(src + colsPad * 3 + i),bias);
+          else
+            a = _mm256_set1_epi32(255);
+
+          __m256i br = _mm256_packs_epi32(b,r);
+          __m256i ga = _mm256_packs_epi32(g,a);
+
+          _mm256_storeu_si256((__m256i *) (dst + i * 4),_mm256_shuffle_epi8(_mm256_packus_epi16(br,ga),order));
+        }
+      }
+      else
+      {
+        const __m256i order = _mm256_setr_epi8(
+          0,8,1,9,2,10,3,11,4,12,5,13,6,14,7,15,
+          0,8,1,9,2,10,3,11,4,12,5,13,6,14,7,15);
+        const __m256i bias = _mm256_set1_epi16(128);
+
+        for(i=0;i+16<=cols;i+=16)
+        {
+          __m256i y = _mm256_adds_epi16(_mm256_loadu_si256((const __m256i *) (src + i)),bias);
+          __m256i a;
+
+          if(Alpha)
+            a = _mm256_adds_epi16(_mm256_loadu_si256((const __m256i *) (src + colsPad + i)),bias);
+          else
+            a = _mm256_set1_epi16(255);
+
+          _mm256_storeu_si256((__m256i *) (dst + i * 2),_mm256_shuffle_epi8(_mm256_packus_epi16(y,a),order));
+        }
+      }
+
+      return i;
+    }
+  }
+
+  int32_t convert_dir_avx2(int32_t cols,int32_t colsPad,const uint8_t *src,int32_t *dst,bool color,bool alpha)
+  {
+    if(color)
+      return alpha ? convert_dir<true,true>(cols,colsPad,src,dst) : convert_dir<true,false>(cols,colsPad,src,dst);
+    else
+      return alpha ? convert_dir<false,true>(cols,colsPad,src,dst) : convert_dir<false,false>(cols,colsPad,src,dst);
+  }
+
+  int32_t convert_inv_avx2(int32_t cols,int32_t colsPad,const int16_t *src,uint8_t *dst,bool color,bool alpha)
+  {
+    if(color)
+      return alpha ? convert_inv<true,true>(cols,colsPad,src,dst) : convert_inv<true,false>(cols,colsPad,src,dst);
+    else
+      return alpha ? convert_inv<false,true>(cols,colsPad,src,dst) : convert_inv<false,false>(cols,colsPad,src,dst);
+  }
+
+  int32_t lossless_convert_inv_avx2(int32_t cols,int32_t colsPad,const int16_t *src,uint8_t *dst,bool color,bool alpha)
+  {
+    if(color)
+      return alpha ? lossless_convert_inv<true,true>(cols,colsPad,src,dst) : lossless_convert_inv<true,false>(cols,colsPad,src,dst);
+    else
+      return alpha ? lossless_convert_inv<false,true>(cols,colsPad,src,dst) : lossless_convert_inv<false,false>(cols,colsPad,src,dst);
+  }
+}
+
+#endif
@@ -0,0 +1,287 @@
+// This file is distributed under a BSD license. See LICENSE.txt for details.
+
+// FRIED
+// vector versions of the inverse transforms, shared by the simd_*.cpp files.
+//
+// V is a vector of int16_t lanes with wrapping + and -, and an arithmetic
+// >>. every lane runs exactly the plain C code from transforms.cpp (whose
+// intermediates are all int16_t) for a different block, so the results are
+// bit-exact. x[i] holds element i of one block row for all blocks. the
+// lossless transform computes in int32_t, so its V has 32-bit lanes and a
+// wrap16() that truncates to int16_t like the C code's stores do.
+//
+// only include this from the simd_*.cpp files: it must not pull inline
+// functions shared with other files into a translation unit built with
+// different instruction set flags.
+#pragma once
+#ifndef __SIMD_KERNELS_HPP__
+#define __SIMD_KERNELS_HPP__
+#include <cstdint>
+
+namespace FRIED
+{
+  template<class V> static inline void indct42D_vec(V *coeff1,V *coeff2,V *coeff3,V *coeff4)
+  {
+    V in0 = coeff4[0];
+    V in1 = coeff4[1];
+    V in2 = coeff4[2];
+    V in3 = coeff4[3];
+
+    V t0 = (in0 >> 3) + (coeff2[0] - (in0 >> 1));
+    V t1 = (in1 >> 3) + (coeff2[1] - (in1 >> 1));
+    V t2 = (in2 >> 3) + (coeff2[2] - (in2 >> 1));
+    V t3 = (in3 >> 3) + (coeff2[3] - (in3 >> 1));
+
+    V m0 = ((t0 >> 1) + in0) - (t0 >> 3);
+    V m1 = ((t1 >> 1) + in1) - (t1 >> 3);
+    V m2 = ((t2 >> 1) + in2) - (t2 >> 3);
+    V m3 = ((t3 >> 1) + in3) - (t3 >> 3);
+
+    V diff0 = coeff1[0] - coeff3[0];
+    V diff1 = coeff1[1] - coeff3[1];
+    V diff2 = coeff1[2] - coeff3[2];
+    V diff3 = coeff1[3] - coeff3[3];
+
+    V s0 = coeff3[0] - ((m0 - diff0) >> 1);
+    V s1 = coeff3[1] - ((m1 - diff1) >> 1);
+    V s2 = coeff3[2] - ((m2 - diff2) >> 1);
+    V s3 = coeff3[3] - ((m3 - diff3) >> 1);
+
+    V c3 = m3 + s3;
+    V temp = (c3 >> 3) + ((m1 + s1) - (c3 >> 1));
+    V c0 = t3 + diff3;
+
+    V avg1 = (t1 + diff1) >> 1;
+    V d0 = diff3 - (c0 >> 1);
+    V r0 = (diff1 - ((d0 >> 1) + avg1)) + (d0 >> 3);
+    V r1 = (s1 - (s3 >> 1)) + (s3 >> 3);
+    V r2 = (avg1 - (c0 >> 2)) + (c0 >> 4);
+
+    V avg2 = (t0 + diff0) >> 1;
+    V avg3 = (t2 + diff2) >> 1;
+    V d1 = (diff0 - avg2) - (diff2 - avg3);
+
+    V f0 = ((r0 >> 1) + d0) - (r0 >> 3);
+    V f1 = ((r1 >> 1) + s3) - (r1 >> 3);
+    V f2 = ((temp >> 1) + c3) - (temp >> 3);
+
+    V e0 = (diff2 - avg3) - ((f0 - d1) >> 1);
+
+    V c1 = m2 + s2;
+    V d2 = s0 - s2;
+    V e1 = s2 - ((f1 - d2) >> 1);
+
+    V d3 = (m0 + s0) - c1;
+    V e2 = c1 - ((f2 - d3) >> 1);
+
+    V avg4 = (r0 + d1) >> 1;
+    coeff1[0] = d1 - avg4;
+    coeff2[0] = e0;
+    coeff3[0] = e0 + f0;
+    coeff4[0] = avg4;
+
+    V avg5 = (r1 + d2) >> 1;
+    coeff1[1] = d2 - avg5;
+    coeff2[1] = e1;
+    coeff3[1] = e1 + f1;
+    coeff4[1] = avg5;
+
+    V avg6 = (temp + d3) >> 1;
+    coeff1[2] = d3 - avg6;
+    coeff2[2] = e2;
+    coeff3[2] = e2 + f2;
+
+    V d4 = avg2 - avg3;
+    V avg7 = (r2 + d4) >> 1;
+    coeff4[2] = avg6;
+    coeff1[3] = d4 - avg7;
+
+    V f3 = ((r2 >> 1) + (c0 >> 1)) - (r2 >> 3);
+    V e3 = avg3 - ((f3 - d4) >> 1);
+
+    coeff2[3] = e3;
+    coeff3[3] = e3 + f3;
+    coeff4[3] = avg7;
+  }
+
+  template<class V> static inline void lbt4post4x4_vec(V *param_1,V *param_2,V *param_3,V *param_4)
+  {
+    V d0 = param_4[0] - param_1[0];
+    V d1 = param_4[1] - param_1[1];
+    V e0 = param_3[0] - param_2[0];
+    V e1 = param_3[1] - param_2[1];
+
+    V f0 = d0 - (e0 >> 1);
+    V f1 = d1 - (e1 >> 1);
+
+    V d2 = param_4[2] - param_1[2];
+    V e2 = param_3[2] - param_2[2];
+    V f2 = d2 - (e2 >> 1);
+
+    V d3 = param_4[3] - param_1[3];
+    V e3 = param_3[3] - param_2[3];
+    V f3 = d3 - (e3 >> 1);
+
+    V g0 = ((e0 + e0) - f0) >> 2;
+    V g1 = ((e1 + e1) - f1) >> 2;
+    V g2 = ((e2 + e2) - f2) >> 2;
+    V g3 = ((e3 + e3) - f3) >> 2;
+
+    f0 = f0 + g0;
+    f1 = f1 + g1;
+    f2 = f2 + g2;
+    f3 = f3 + g3;
+
+    V h0 = (d0 + (param_1[0] + param_1[0])) - f0;
+    V h1 = (d1 + (param_1[1] + param_1[1])) - f1;
+    V h2 = (d2 + (param_1[2] + param_1[2])) - f2;
+    V h3 = (d3 + (param_1[3] + param_1[3])) - f3;
+
+    V j0 = h0 + (f0 + f0);
+
+    V m0 = h3 - h0;
+    V m1 = h2 - h1;
+    V n0 = m0 - (m1 >> 1);
+
+    V i0 = (e0 + (param_2[0] + param_2[0])) - g0;
+    V i1 = (e1 + (param_2[1] + param_2[1])) - g1;
+    V i2 = (e2 + (param_2[2] + param_2[2])) - g2;
+    V i3 = (e3 + (param_2[3] + param_2[3])) - g3;
+
+    V k0 = i0 + (g0 + g0);
+
+    V m2 = i3 - i0;
+    V m3 = i2 - i1;
+    V n1 = m2 - (m3 >> 1);
+
+    V j1 = h1 + (f1 + f1);
+    V k1 = i1 + (g1 + g1);
+    V k2 = (i3 + (g3 + g3)) - k0;
+    V k3 = (i2 + (g2 + g2)) - k1;
+    V n2 = k2 - (k3 >> 1);
+
+    V l2 = (h3 + (f3 + f3)) - j0;
+    V l3 = (h2 + (f2 + f2)) - j1;
+    V n3 = l2 - (l3 >> 1);
+
+    V p0 = ((m1 + m1) - n0) >> 2;
+    V n0_adj = n0 + p0;
+    V out00 = (m0 + (h0 + h0)) - n0_adj;
+
+    V p1 = ((m3 + m3) - n1) >> 2;
+    V p2 = ((k3 + k3) - n2) >> 2;
+    V p3 = ((l3 + l3) - n3) >> 2;
+
+    V n1_adj = n1 + p1;
+    V n2_adj = n2 + p2;
+    V n3_adj = n3 + p3;
+
+    V out10 = (m2 + (i0 + i0)) - n1_adj;
+    V out20 = (k2 + (k0 + k0)) - n2_adj;
+    V out30 = (l2 + (j0 + j0)) - n3_adj;
+
+    V out01 = (m1 + (h1 + h1)) - p0;
+    V out11 = (m3 + (i1 + i1)) - p1;
+    V out21 = (k3 + (k1 + k1)) - p2;
+    V out31 = (l3 + (j1 + j1)) - p3;
+
+    param_1[0] = out00;
+    param_2[0] = out10;
+    param_3[0] = out20;
+    param_4[0] = out30;
+
+    param_1[1] = out01;
+    param_2[1] = out11;
+    param_3[1] = out21;
+    param_4[1] = out31;
+
+    param_1[2] = out01 + (p0 + p0);
+    param_2[2] = out11 + (p1 + p1);
+    param_3[2] = out21 + (p2 + p2);
+    param_4[2] = out31 + (p3 + p3);
+
+    param_1[3] = out00 + (n0_adj + n0_adj);
+    param_2[3] = out10 + (n1_adj + n1_adj);
+    param_3[3] = out20 + (n2_adj + n2_adj);
+    param_4[3] = out30 + (n3_adj + n3_adj);
+  }
+
+  // exact inverse of ndct4 (see indct4_lossless in transforms.cpp)
+  template<class V> static inline void indct4_lossless_vec(V &ar,V &br,V &cr,V &dr)
+  {
+    V a = ar;
+    V d = br;
+    V b = cr;
+    V c = dr;
+
+    d = d - ((c >> 1) - (c >> 3));
+    c = c + ((d >> 1) - (d >> 3));
+
+    a = a - b;
+    b = b - ((c - a) >> 1);
+
+    d = (d + a) >> 1;
+    c = c + b;
+    a = a - d;
+
+    ar = wrap16(a);
+    br = wrap16(b);
+    cr = wrap16(c);
+    dr = wrap16(d);
+  }
+
+  template<class V> static inline void indct42D_lossless_vec(V *x0,V *x1,V *x2,V *x3)
+  {
+    // vertical
+    for(int32_t i=0;i<4;i++)
+      indct4_lossless_vec(x0[i],x1[i],x2[i],x3[i]);
+
+    // horizontal
+    indct4_lossless_vec(x0[0],x0[1],x0[2],x0[3]);
+    indct4_lossless_vec(x1[0],x1[1],x1[2],x1[3]);
+    indct4_lossless_vec(x2[0],x2[1],x2[2],x2[3]);
+    indct4_lossless_vec(x3[0],x3[1],x3[2],x3[3]);
+
+    // transpose out: the vectors hold whole elements, so that's just
+    // swapping them
+    V t;
+    t = x0[1]; x0[1] = x1[0]; x1[0] = t;
+    t = x0[2]; x0[2] = x2[0]; x2[0] = t;
+    t = x0[3]; x0[3] = x3[0]; x3[0] = t;
+    t = x1[2]; x1[2] = x2[1]; x2[1] = t;
+    t = x1[3]; x1[3] = x3[1]; x3[1] = t;
+    t = x2[3]; x2[3] = x3[2]; x3[2] = t;
+  }
+
+  // row drivers. Ops supplies the vector type V, the number of blocks per
+  // vector (Blocks) and Load4/Store4, which split Blocks consecutive 4-wide
+  // blocks into 4 vectors by element and back.
+  template<class Ops,void (*Kernel)(typename Ops::V *,typename Ops::V *,typename Ops::V *,typename Ops::V *)>
+  static inline int32_t transform_row(int16_t *x0,int16_t *x1,int16_t *x2,int16_t *x3,int32_t width)
+  {
+    typedef typename Ops::V V;
+    const int32_t step = Ops::Blocks * 4;
+    int32_t col;
+
+    for(col=0;col+step<=width;col+=step)
+    {
+      V r0[4],r1[4],r2[4],r3[4];
+
+      Ops::Load4(x0+col,r0);
+      Ops::Load4(x1+col,r1);
+      Ops::Load4(x2+col,r2);
+      Ops::Load4(x3+col,r3);
+
+      Kernel(r0,r1,r2,r3);
+
+      Ops::Store4(x0+col,r0);
+      Ops::Store4(x1+col,r1);
+      Ops::Store4(x2+col,r2);
+      Ops::Store4(x3+col,r3);
+    }
+
+    return col;
+  }
+}
+
+#endif
@@ -0,0 +1,398 @@
+// This file is distributed under a BSD license. See LICENSE.txt for details.
+
+// FRIED
+// sse2 kernels (8 blocks per vector).
+#include "simd.hpp"
+
+#if defined(FRIED_SIMD_SSE2)
+#include <emmintrin.h>
+#include "simd_kernels.hpp"
+#include "simd_x86.hpp"
+
+namespace FRIED
+{
+  namespace
+  {
+    struct VecSSE2
+    {
+      __m128i v;
+    };
+
+    inline VecSSE2 operator+(VecSSE2 a,VecSSE2 b)  { return { _mm_add_epi16(a.v,b.v) }; }
+    inline VecSSE2 operator-(VecSSE2 a,VecSSE2 b)  { return { _mm_sub_epi16(a.v,b.v) }; }
+    inline VecSSE2 operator>>(VecSSE2 a,int shift) { return { _mm_srai_epi16(a.v,shift) }; }
+
+    struct OpsSSE2
+    {
+      typedef VecSSE2 V;
+      static const int32_t Blocks = 8;
+
+      // 4x8 transpose: out[i] = element i of blocks 0..7
+      static inline void Load4(const int16_t *src,V *out)
+      {
+        __m128i a = _mm_loadu_si128((const __m128i *) (src +  0));
+        __m128i b = _mm_loadu_si128((const __m128i *) (src +  8));
+        __m128i c = _mm_loadu_si128((const __m128i *) (src + 16));
+        __m128i d = _mm_loadu_si128((const __m128i *) (src + 24));
+
+        __m128i t0 = _mm_unpacklo_epi16(a,b);
+        __m128i t1 = _mm_unpackhi_epi16(a,b);
+        __m128i t2 = _mm_unpacklo_epi16(c,d);
+        __m128i t3 = _mm_unpackhi_epi16(c,d);
+
+        __m128i u0 = _mm_unpacklo_epi16(t0,t1);
+        __m128i u1 = _mm_unpackhi_epi16(t0,t1);
+        __m128i u2 = _mm_unpacklo_epi16(t2,t3);
+        __m128i u3 = _mm_unpackhi_epi16(t2,t3);
+
+        out[0].v = _mm_unpacklo_epi64(u0,u2);
+        out[1].v = _mm_unpackhi_epi64(u0,u2);
+        out[2].v = _mm_unpacklo_epi64(u1,u3);
+        out[3].v = _mm_unpackhi_epi64(u1,u3);
+      }
+
+      // inverse of Load4
+      static inline void Store4(int16_t *dst,const V *in)
+      {
+        __m128i u0 = _mm_unpacklo_epi64(in[0].v,in[1].v);
+        __m128i u2 = _mm_unpackhi_epi64(in[0].v,in[1].v);
+        __m128i u1 = _mm_unpacklo_epi64(in[2].v,in[3].v);
+        __m128i u3 = _mm_unpackhi_epi64(in[2].v,in[3].v);
+
+        __m128i w0 = _mm_unpacklo_epi16(u0,u1);
+        __m128i w1 = _mm_unpackhi_epi16(u0,u1);
+        __m128i w2 = _mm_unpacklo_epi16(u2,u3);
+        __m128i w3 = _mm_unpackhi_epi16(u2,u3);
+
+        _mm_storeu_si128((__m128i *) (dst +  0),_mm_unpacklo_epi16(w0,w1));
+        _mm_storeu_si128((__m128i *) (dst +  8),_mm_unpackhi_epi16(w0,w1));
+        _mm_storeu_si128((__m128i *) (dst + 16),_mm_unpacklo_epi16(w2,w3));
+        _mm_storeu_si128((__m128i *) (dst + 24),_mm_unpackhi_epi16(w2,w3));
+      }
+    };
+
+    // 32-bit lanes for the lossless transform (4 blocks per vector)
+    struct Vec32SSE2
+    {
+      __m128i v;
+    };
+
+    inline Vec32SSE2 operator+(Vec32SSE2 a,Vec32SSE2 b)  { return { _mm_add_epi32(a.v,b.v) }; }
+    inline Vec32SSE2 operator-(Vec32SSE2 a,Vec32SSE2 b)  { return { _mm_sub_epi32(a.v,b.v) }; }
+    inline Vec32SSE2 operator>>(Vec32SSE2 a,int shift) { return { _mm_srai_epi32(a.v,shift) }; }
+    inline Vec32SSE2 wrap16(Vec32SSE2 a)               { return { _mm_srai_epi32(_mm_slli_epi32(a.v,16),16) }; }
+
+    struct Ops32SSE2
+    {
+      typedef Vec32SSE2 V;
+      static const int32_t Blocks = 4;
+
+      // 4x4 transpose, then sign extension: out[i] = element i of blocks 0..3
+      static inline void Load4(const int16_t *src,V *out)
+      {
+        __m128i a = _mm_loadu_si128((const __m128i *) (src + 0));
+        __m128i b = _mm_loadu_si128((const __m128i *) (src + 8));
+
+        __m128i t0 = _mm_unpacklo_epi16(a,b);
+        __m128i t1 = _mm_unpackhi_epi16(a,b);
+        __m128i u0 = _mm_unpacklo_epi16(t0,t1);
+        __m128i u1 = _mm_unpackhi_epi16(t0,t1);
+
+        out[0].v = _mm_srai_epi32(_mm_unpacklo_epi16(u0,u0),16);
+        out[1].v = _mm_srai_epi32(_mm_unpackhi_epi16(u0,u0),16);
+        out[2].v = _mm_srai_epi32(_mm_unpacklo_epi16(u1,u1),16);
+        out[3].v = _mm_srai_epi32(_mm_unpackhi_epi16(u1,u1),16);
+      }
+
+      // inverse of Load4; the kernel wrapped the values to int16 already
+      static inline void Store4(int16_t *dst,const V *in)
+      {
+        __m128i u0 = _mm_packs_epi32(in[0].v,in[1].v);
+        __m128i u1 = _mm_packs_epi32(in[2].v,in[3].v);
+
+        __m128i w0 = _mm_unpacklo_epi16(u0,u1);
+        __m128i w1 = _mm_unpackhi_epi16(u0,u1);
+
+        _mm_storeu_si128((__m128i *) (dst + 0),_mm_unpacklo_epi16(w0,w1));
+        _mm_storeu_si128((__m128i *) (dst + 8),_mm_unpackhi_epi16(w0,w1));
+      }
+    };
+
+    // R[n] = (c0[n],c1[n],c2[n],c3[n]) of one macroblock goes to 4 pixels
+    // at psd[n] (see decode.cpp), which puts them in these orders:
+    //   row  0: R0  R1  R14 R15
+    //   row  4: R3  R2  R13 R12
+    //   row  8: R4  R7  R8  R11
+    //   row 12: R5  R6  R9  R10
+    // c*lo holds elements 0..7, c*hi elements 8..15.
+    inline void shuffle_mb(int16_t **dest,int32_t x,__m128i c0lo,__m128i c0hi,__m128i c1lo,__m128i c1hi,
+      __m128i c2lo,__m128i c2hi,__m128i c3lo,__m128i c3hi)
+    {
+      __m128i t0 = _mm_unpacklo_epi16(c0lo,c1lo);
+      __m128i t1 = _mm_unpacklo_epi16(c2lo,c3lo);
+      __m128i t2 = _mm_unpackhi_epi16(c0lo,c1lo);
+      __m128i t3 = _mm_unpackhi_epi16(c2lo,c3lo);
+      __m128i t4 = _mm_unpacklo_epi16(c0hi,c1hi);
+      __m128i t5 = _mm_unpacklo_epi16(c2hi,c3hi);
+      __m128i t6 = _mm_unpackhi_epi16(c0hi,c1hi);
+      __m128i t7 = _mm_unpackhi_epi16(c2hi,c3hi);
+
+      __m128i r01 = _mm_unpacklo_epi32(t0,t1);
+      __m128i r23 = _mm_unpackhi_epi32(t0,t1);
+      __m128d r45 = _mm_castsi128_pd(_mm_unpacklo_epi32(t2,t3));
+      __m128d r67 = _mm_castsi128_pd(_mm_unpackhi_epi32(t2,t3));
+      __m128d r89 = _mm_castsi128_pd(_mm_unpacklo_epi32(t4,t5));
+      __m128d r1011 = _mm_castsi128_pd(_mm_unpackhi_epi32(t4,t5));
+      __m128i r1213 = _mm_unpacklo_epi32(t6,t7);
+      __m128i r1415 = _mm_unpackhi_epi32(t6,t7);
+
+      _mm_storeu_si128((__m128i *) (dest[ 0] + x + 0),r01);
+      _mm_storeu_si128((__m128i *) (dest[ 0] + x + 8),r1415);
+      _mm_storeu_si128((__m128i *) (dest[ 4] + x + 0),_mm_shuffle_epi32(r23,0x4e));
+      _mm_storeu_si128((__m128i *) (dest[ 4] + x + 8),_mm_shuffle_epi32(r1213,0x4e));
+      _mm_storeu_si128((__m128i *) (dest[ 8] + x + 0),_mm_castpd_si128(_mm_shuffle_pd(r45,r67,2)));
+      _mm_storeu_si128((__m128i *) (dest[ 8] + x + 8),_mm_castpd_si128(_mm_shuffle_pd(r89,r1011,2)));
+      _mm_storeu_si128((__m128i *) (dest[12] + x + 0),_mm_castpd_si128(_mm_shuffle_pd(r45,r67,1)));
+      _mm_storeu_si128((__m128i *) (dest[12] + x + 8),_mm_castpd_si128(_mm_shuffle_pd(r89,r1011,1)));
+    }
+
+    inline __m128i load(const int16_t *p)
+    {
+      return _mm_loadu_si128((const __m128i *) p);
+    }
+  }
+
+  int32_t indct42D_row_sse2(int16_t *x0,int16_t *x1,int16_t *x2,int16_t *x3,int32_t width)
+  {
+    return transform_row<OpsSSE2,indct42D_vec<VecSSE2> >(x0,x1,x2,x3,width);
+  }
+
+  int32_t lbt4post4x4_row_sse2(int16_t *x0,int16_t *x1,int16_t *x2,int16_t *x3,int32_t width)
+  {
+    return transform_row<OpsSSE2,lbt4post4x4_vec<VecSSE2> >(x0,x1,x2,x3,width);
+  }
+
+  int32_t indct42D_lossless_row_sse2(int16_t *x0,int16_t *x1,int16_t *x2,int16_t *x3,int32_t width)
+  {
+    return transform_row<Ops32SSE2,indct42D_lossless_vec<Vec32SSE2> >(x0,x1,x2,x3,width);
+  }
+
+  int32_t inv_reorder_dc_sse2(int16_t **dest,int32_t xOffs,const int16_t *g0,const int16_t *g1,const int16_t *g2,const int16_t *g3,int32_t cwidth)
+  {
+    int32_t nmb = cwidth / 16;
+    int32_t m;
+
+    for(m=0;m+8<=nmb;m+=8)
+    {
+      __m128i lo[8],hi[8];
+
+      gather_dcs8_sse2(g0 + m,nmb,lo,hi);
+      for(int32_t k=0;k<8;k++)
+      {
+        int32_t mb = (m + k) * 16;
+
+        shuffle_mb(dest,xOffs + mb,lo[k],hi[k],load(g1 + mb),load(g1 + mb + 8),
+          load(g2 + mb),load(g2 + mb + 8),load(g3 + mb),load(g3 + mb + 8));
+      }
+    }
+
+    return m * 16;
+  }
+
+  int32_t inv_reorder_ac_sse2(int16_t **dest,int32_t xOffs,const int16_t *c0,const int16_t *c1,const int16_t *c2,const int16_t *c3,int32_t cwidth)
+  {
+    for(int32_t mb=0;mb<cwidth;mb+=16)
+    {
+      shuffle_mb(dest,xOffs + mb,load(c0 + mb),load(c0 + mb + 8),load(c1 + mb),load(c1 + mb + 8),
+        load(c2 + mb),load(c2 + mb + 8),load(c3 + mb),load(c3 + mb + 8));
+    }
+
+    return cwidth;
+  }
+
+  namespace
+  {
+    // forward: 4 pixels per step in 32-bit lanes, exactly like the C code.
+    // gray input is Y,A byte pairs, color input B,G,R,A.
+    template<bool Color,bool Alpha> int32_t convert_dir(int32_t cols,int32_t colsPad,const uint8_t *src,int32_t *dst)
+    {
+      const __m128i mask = _mm_set1_epi32(0xff);
+      const __m128i bias = _mm_set1_epi32(128);
+      const __m128i two = _mm_set1_epi32(2);
+      int32_t i;
+
+      for(i=0;i+4<=cols;i+=4)
+      {
+        if(Color)
+        {
+          __m128i p = _mm_loadu_si128((const __m128i *) (src + i * 4));
+          __m128i b = _mm_slli_epi32(_mm_sub_epi32(_mm_and_si128(p,mask),bias),2);
+          __m128i g = _mm_slli_epi32(_mm_sub_epi32(_mm_and_si128(_mm_srli_epi32(p,8),mask),bias),3);
+          __m128i r = _mm_slli_epi32(_mm_sub_epi32(_mm_and_si128(_mm_srli_epi32(p,16),mask),bias),2);
+
+          _mm_storeu_si128((__m128i *) (dst + i),_mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(r,g),_mm_add_epi32(b,two)),2));
+          _mm_storeu_si128((__m128i *) (dst + colsPad + i),_mm_srai_epi32(_mm_sub_epi32(r,b),1));
+          _mm_storeu_si128((__m128i *) (dst + colsPad * 2 + i),_mm_srai_epi32(_mm_add_epi32(_mm_sub_epi32(_mm_sub_epi32(g,r),b),two),2));
+          if(Alpha)
+            _mm_storeu_si128((__m128i *) (dst + colsPad * 3 + i),_mm_slli_epi32(_mm_sub_epi32(_mm_srli_epi32(p,24),bias),2));
+        }
+        else
+        {
+          __m128i p = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i *) (src + i * 2)),_mm_setzero_si128());
+
+          _mm_storeu_si128((__m128i *) (dst + i),_mm_slli_epi32(_mm_sub_epi32(_mm_and_si128(p,mask),bias),2));
+          if(Alpha)
+            _mm_storeu_si128((__m128i *) (dst + colsPad + i),_mm_slli_epi32(_mm_sub_epi32(_mm_srli_epi32(p,8),bias),2));
+        }
+      }
+
+      return i;
+    }
+
+    // (x >> 4) + 128 for 8 values in 32-bit lanes, as int16
+    inline __m128i descale(__m128i lo,__m128i hi)
+    {
+      return _mm_add_epi16(_mm_packs_epi32(_mm_srai_epi32(lo,4),_mm_srai_epi32(hi,4)),_mm_set1_epi16(128));
+    }
+
+    inline __m128i widen_lo(__m128i x) { return _mm_srai_epi32(_mm_unpacklo_epi16(x,x),16); }
+    inline __m128i widen_hi(__m128i x) { return _mm_srai_epi32(_mm_unpackhi_epi16(x,x),16); }
+
+    // inverse: 8 pixels per step. the lifting steps can leave the int16
+    // range, so they run in 32-bit lanes; the unsigned saturating pack
+    // does the clamping.
+    template<bool Color,bool Alpha> int32_t convert_inv(int32_t cols,int32_t colsPad,const int16_t *src,uint8_t *dst)
+    {
+      const __m128i bias = _mm_set1_epi16(128);
+      int32_t i;
+
+      for(i=0;i+8<=cols;i+=8)
+      {
+        __m128i a;
+
+        if(Alpha)
+        {
+          __m128i in = _mm_loadu_si128((const __m128i *) (src + colsPad * (Color ? 3 : 1) + i));
+          a = _mm_add_epi16(_mm_srai_epi16(in,4),bias);
+        }
+        else
+          a = _mm_set1_epi16(255);
+
+        if(Color)
+        {
+          __m128i y = _mm_loadu_si128((const __m128i *) (src + i));
+          __m128i co = _mm_loadu_si128((const __m128i *) (src + colsPad + i));
+          __m128i cg = _mm_loadu_si128((const __m128i *) (src + colsPad * 2 + i));
+          __m128i y0 = widen_lo(y),y1 = widen_hi(y);
+          __m128i co0 = widen_lo(co),co1 = widen_hi(co);
+          __m128i cg0 = widen_lo(cg),cg1 = widen_hi(cg);
+
+          __m128i g = descale(_mm_add_epi32(y0,cg0),_mm_add_epi32(y1,cg1));
+          __m128i b0 = _mm_sub_epi32(y0,cg0);
+          __m128i b1 = _mm_sub_epi32(y1,cg1);
+          __m128i r = descale(_mm_add_epi32(b0,co0),_mm_add_epi32(b1,co1));
+          __m128i b = descale(_mm_sub_epi32(b0,co0),_mm_sub_epi32(b1,co1));
+
+          __m128i br = _mm_packus_epi16(b,r);
+          __m128i ga = _mm_packus_epi16(g,a);
+          __m128i bg = _mm_unpacklo_epi8(br,ga);
+          __m128i ra = _mm_unpackhi_epi8(br,ga);
+
+          _mm_storeu_si128((__m128i *) (dst + i * 4 +  0),_mm_unpacklo_epi16(bg,ra));
+          _mm_storeu_si128((__m128i *) (dst + i * 4 + 16),_mm_unpackhi_epi16(bg,ra));
+        }
+        else
+        {
+          __m128i y = _mm_add_epi16(_mm_srai_epi16(_mm_loadu_si128((const __m128i *) (src + i)),4),bias);
+          __m128i ya = _mm_packus_epi16(y,a);
+
+          _mm_storeu_si128((__m128i *) (dst + i * 2),_mm_unpacklo_epi8(ya,_mm_srli_si128(ya,8)));
+        }
+      }
+
+      return i;
+    }
+
+    // lossless inverse: the same with the YCoCg-R lifting, which can leave
+    // the int16 range on corrupt data, too. saturating to int16 first
+    // doesn't change what the unsigned packs clamp to, so they still do
+    // exactly what clampPixel does.
+    template<bool Color,bool Alpha> int32_t lossless_convert_inv(int32_t cols,int32_t colsPad,const int16_t *src,uint8_t *dst)
+    {
+      const __m128i bias = _mm_set1_epi16(128);
+      const __m128i bias32 = _mm_set1_epi32(128);
+      int32_t i;
+
+      for(i=0;i+8<=cols;i+=8)
+      {
+        __m128i a;
+
+        if(Alpha)
+          a = _mm_adds_epi16(_mm_loadu_si128((const __m128i *) (src + colsPad * (Color ? 3 : 1) + i)),bias);
+        else
+          a = _mm_set1_epi16(255);
+
+        if(Color)
+        {
+          __m128i y = _mm_loadu_si128((const __m128i *) (src + i));
+          __m128i co = _mm_loadu_si128((const __m128i *) (src + colsPad + i));
+          __m128i cg = _mm_loadu_si128((const __m128i *) (src + colsPad * 2 + i));
+          __m128i co0 = widen_lo(co),co1 = widen_hi(co);
+          __m128i cg0 = widen_lo(cg),cg1 = widen_hi(cg);
+
+          __m128i t0 = _mm_sub_epi32(_mm_add_epi32(widen_lo(y),bias32),_mm_srai_epi32(cg0,1));
+          __m128i t1 = _mm_sub_epi32(_mm_add_epi32(widen_hi(y),bias32),_mm_srai_epi32(cg1,1));
+          __m128i b0 = _mm_sub_epi32(t0,_mm_srai_epi32(co0,1));
+          __m128i b1 = _mm_sub_epi32(t1,_mm_srai_epi32(co1,1));
+
+          __m128i g = _mm_packs_epi32(_mm_add_epi32(cg0,t0),_mm_add_epi32(cg1,t1));
+          __m128i r = _mm_packs_epi32(_mm_add_epi32(b0,co0),_mm_add_epi32(b1,co1));
+          __m128i b = _mm_packs_epi32(b0,b1);
+
+          __m128i br = _mm_packus_epi16(b,r);
+          __m128i ga = _mm_packus_epi16(g,a);
+          __m128i bg = _mm_unpacklo_epi8(br,ga);
+          __m128i ra = _mm_unpackhi_epi8(br,ga);
+
+          _mm_storeu_si128((__m128i *) (dst + i * 4 +  0),_mm_unpacklo_epi16(bg,ra));
+          _mm_storeu_si128((__m128i *) (dst + i * 4 + 16),_mm_unpackhi_epi16(bg,ra));
+        }
+        else
+        {
+          __m128i y = _mm_adds_epi16(_mm_loadu_si128((const __m128i *) (src + i)),bias);
+          __m128i ya = _mm_packus_epi16(y,a);
+
+          _mm_storeu_si128((__m128i *) (dst + i * 2),_mm_unpacklo_epi8(ya,_mm_srli_si128(ya,8)));
+        }
+      }
+
+      return i;
+    }
+  }
+
+  int32_t convert_dir_sse2(int32_t cols,int32_t colsPad,const uint8_t *src,int32_t *dst,bool color,bool alpha)
+  {
+    if(color)
+      return alpha ? convert_dir<true,true>(cols,colsPad,src,dst) : convert_dir<true,false>(cols,colsPad,src,dst);
+    else
+      return alpha ? convert_dir<false,true>(cols,colsPad,src,dst) : convert_dir<false,false>(cols,colsPad,src,dst);
+  }
+
+  int32_t convert_inv_sse2(int32_t cols,int32_t colsPad,const int16_t *src,uint8_t *dst,bool color,bool alpha)
+  {
+    if(color)
+      return alpha ? convert_inv<true,true>(cols,colsPad,src,dst) : convert_inv<true,false>(cols,colsPad,src,dst);
+    else
+      return alpha ? convert_inv<false,true>(cols,colsPad,src,dst) : convert_inv<false,false>(cols,colsPad,src,dst);
+  }
+
+  int32_t lossless_convert_inv_sse2(int32_t cols,int32_t colsPad,const int16_t *src,uint8_t *dst,bool color,bool alpha)
+  {
+    if(color)
+      return alpha ? lossless_convert_inv<true,true>(cols,colsPad,src,dst) : lossless_convert_inv<true,false>(cols,colsPad,src,dst);
+    else
+      return alpha ? lossless_convert_inv<false,true>(cols,colsPad,src,dst) : lossless_convert_inv<false,false>(cols,colsPad,src,dst);
+  }
+}
+
+#endif
@@ -0,0 +1,65 @@
+// This file is distributed under a BSD license. See LICENSE.txt for details.
+
+// FRIED
+// sse2 helpers shared by simd_sse2.cpp and simd_avx2.cpp. everything here
+// is static, so each of them gets its own copy built for its instruction set.
+#pragma once
+#ifndef __SIMD_X86_HPP__
+#define __SIMD_X86_HPP__
+#include <cstdint>
+#include <emmintrin.h>
+
+namespace FRIED
+{
+  // 8x8 transpose of 16-bit elements
+  static inline void transpose8x8_sse2(__m128i *r)
+  {
+    __m128i a0 = _mm_unpacklo_epi16(r[0],r[1]);
+    __m128i a1 = _mm_unpackhi_epi16(r[0],r[1]);
+    __m128i a2 = _mm_unpacklo_epi16(r[2],r[3]);
+    __m128i a3 = _mm_unpackhi_epi16(r[2],r[3]);
+    __m128i a4 = _mm_unpacklo_epi16(r[4],r[5]);
+    __m128i a5 = _mm_unpackhi_epi16(r[4],r[5]);
+    __m128i a6 = _mm_unpacklo_epi16(r[6],r[7]);
+    __m128i a7 = _mm_unpackhi_epi16(r[6],r[7]);
+
+    __m128i b0 = _mm_unpacklo_epi32(a0,a2);
+    __m128i b1 = _mm_unpackhi_epi32(a0,a2);
+    __m128i b2 = _mm_unpacklo_epi32(a1,a3);
+    __m128i b3 = _mm_unpackhi_epi32(a1,a3);
+    __m128i b4 = _mm_unpacklo_epi32(a4,a6);
+    __m128i b5 = _mm_unpackhi_epi32(a4,a6);
+    __m128i b6 = _mm_unpacklo_epi32(a5,a7);
+    __m128i b7 = _mm_unpackhi_epi32(a5,a7);
+
+    r[0] = _mm_unpacklo_epi64(b0,b4);
+    r[1] = _mm_unpackhi_epi64(b0,b4);
+    r[2] = _mm_unpacklo_epi64(b1,b5);
+    r[3] = _mm_unpackhi_epi64(b1,b5);
+    r[4] = _mm_unpacklo_epi64(b2,b6);
+    r[5] = _mm_unpackhi_epi64(b2,b6);
+    r[6] = _mm_unpacklo_epi64(b3,b7);
+    r[7] = _mm_unpackhi_epi64(b3,b7);
+  }
+
+  // macroblock coefficients of 8 macroblocks, in the order inv_reorder
+  // hands them to the shuffle: dcs[n] of macroblock k ends up in lane n
+  // of lo[k] (n<8) or hi[k] (n>=8). the 16 coefficients of a macroblock
+  // are nmb apart, so every load gets one coefficient of 8 macroblocks.
+  static inline void gather_dcs8_sse2(const int16_t *g0,int32_t nmb,__m128i *lo,__m128i *hi)
+  {
+    // dcs[n] is coefficient src[n] (see get_mb_coeffs in decode.cpp)
+    static const uint8_t src[16] = { 0,2,4,1,5,6,12,7,11,13,15,14,10,8,3,9 };
+
+    for(int32_t n=0;n<8;n++)
+    {
+      lo[n] = _mm_loadu_si128((const __m128i *) (g0 + src[n] * nmb));
+      hi[n] = _mm_loadu_si128((const __m128i *) (g0 + src[n+8] * nmb));
+    }
+
+    transpose8x8_sse2(lo);
+    transpose8x8_sse2(hi);
+  }
+}
+
+#endif
@@ -0,0 +1,91 @@
+// This file is distributed under a BSD license. See LICENSE.txt for details.
+
+// FRIED
+// encoder/decoder statistics.
+#include "fried.hpp"
+#include "fried_internal.hpp"
+
+#if defined(FRIED_STATS)
+#include <chrono>
+#endif
+
+namespace FRIED
+{
+  void startStats(FRIED_Stats *stats,const ChannelHeader *chans,int32_t nchans,int32_t nstripes)
+  {
+    if(!stats)
+      return;
+
+    // the stripe array belongs to the caller
+    int32_t *stripeBytes = stats->StripeBytes;
+    int32_t maxStripes = stats->MaxStripes;
+
+    sSetMem(stats,0,sizeof(FRIED_Stats));
+    stats->StripeBytes = stripeBytes;
+    stats->MaxStripes = maxStripes;
+
+    if(stripeBytes)
+      sSetMem(stripeBytes,0,sMax(maxStripes,0) * sizeof(int32_t));
+
+    FRIED_STAT(stats->Collected = true);
+    stats->Channels = nchans;
+    stats->Stripes = nstripes;
+    for(int32_t ch=0;ch<nchans;ch++)
+      stats->ChannelType[ch] = chans[ch].Type;
+  }
+
+#if defined(FRIED_STATS)
+  double statsTime(const FRIED_Stats *stats)
+  {
+    if(!stats)
+      return 0.0;
+
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  void addTime(FRIED_Stats *stats,double FRIED_Stats::*time,double start)
+  {
+    if(stats)
+      stats->*time += statsTime(stats) - start;
+  }
+
+  void addChunkStats(FRIED_Stats *stats,int32_t ch,int32_t encsize,int32_t cksize,int32_t nonzero,int32_t bytes)
+  {
+    if(!stats)
+      return;
+
+    stats->ChannelBytes[ch] += bytes;
+    stats->ChannelCoeffs[ch] += cksize;
+    stats->ChannelNonzero[ch] += nonzero;
+    stats->EncSizeHistogram[encsize ? 1 + (encsize - 1) * 16 / cksize : 0]++;
+  }
+
+  void setStripeBytes(FRIED_Stats *stats,int32_t stripe,int32_t bytes)
+  {
+    if(stats && stats->StripeBytes && stripe < stats->MaxStripes)
+      stats->StripeBytes[stripe] = bytes;
+  }
+
+  void mergeStats(FRIED_Stats *stats,const FRIED_Stats *part)
+  {
+    if(!stats)
+      return;
+
+    stats->ColorTime += part->ColorTime;
+    stats->TransformTime += part->TransformTime;
+    stats->QuantizeTime += part->QuantizeTime;
+    stats->ReorderTime += part->ReorderTime;
+    stats->EntropyTime += part->EntropyTime;
+
+    for(int32_t ch=0;ch<16;ch++)
+    {
+      stats->ChannelBytes[ch] += part->ChannelBytes[ch];
+      stats->ChannelCoeffs[ch] += part->ChannelCoeffs[ch];
+      stats->ChannelNonzero[ch] += part->ChannelNonzero[ch];
+    }
+
+    for(int32_t i=0;i<17;i++)
+      stats->EncSizeHistogram[i] += part->EncSizeHistogram[i];
+  }
+#endif
+}
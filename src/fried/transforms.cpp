@@ -3,6 +3,7 @@
 // FRIED
 // transform innerloops
 #include "fried_internal.hpp"
+#include "simd.hpp"
 #include <cstdint>
 
 namespace FRIED {
@@ -197,6 +198,57 @@ namespace FRIED {
         coeff4[3] = avg7;
     }
 
+    // exact inverse of ndct4 (lifting steps undone in reverse order),
+    // taking the reordered coefficients ndct4 stores
+    static void indct4_lossless(int16_t &ar, int16_t &br, int16_t &cr, int16_t &dr) {
+        int32_t a, b, c, d;
+
+        a = ar;
+        d = br;
+        b = cr;
+        c = dr;
+
+        // stage 2
+        d -= (c >> 1) - (c >> 3);
+        c += (d >> 1) - (d >> 3);
+
+        a -= b;
+        b -= (c - a) >> 1;
+
+        // stage 1 (d was doubled, so the shift is exact)
+        d += a;
+        d >>= 1;
+        c += b;
+        a -= d;
+
+        ar = a;
+        br = b;
+        cr = c;
+        dr = d;
+    }
+
+    void indct42D_lossless(int16_t *x0, int16_t *x1, int16_t *x2, int16_t *x3) {
+        // vertical
+        indct4_lossless(x0[0], x1[0], x2[0], x3[0]);
+        indct4_lossless(x0[1], x1[1], x2[1], x3[1]);
+        indct4_lossless(x0[2], x1[2], x2[2], x3[2]);
+        indct4_lossless(x0[3], x1[3], x2[3], x3[3]);
+
+        // horizontal
+        indct4_lossless(x0[0], x0[1], x0[2], x0[3]);
+        indct4_lossless(x1[0], x1[1], x1[2], x1[3]);
+        indct4_lossless(x2[0], x2[1], x2[2], x2[3]);
+        indct4_lossless(x3[0], x3[1], x3[2], x3[3]);
+
+        // transpose out
+        sSwap(x0[1], x1[0]);
+        sSwap(x0[2], x2[0]);
+        sSwap(x0[3], x3[0]);
+        sSwap(x1[2], x2[1]);
+        sSwap(x1[3], x3[1]);
+        sSwap(x2[3], x3[2]);
+    }
+
     void ndct42D_MB(int32_t *x0, int32_t *x1, int32_t *x2, int32_t *x3) {
         // horizontal
         wht4(x0[0], x0[4], x0[8], x0[12]);
@@ -501,4 +553,60 @@ namespace FRIED {
         param_3[3] = out20 + n2_adj * 2;
         param_4[3] = out30 + n3_adj * 2;
     }
-}
\ No newline at end of file
+
+    // whole rows of blocks: the widest simd kernels available go first,
+    // narrower ones and the plain C versions finish the row.
+    void indct42D_row(int16_t *x0, int16_t *x1, int16_t *x2, int16_t *x3, int32_t width) {
+        int32_t cpu = CpuFeatures();
+        int32_t col = 0;
+
+        (void) cpu;
+#if defined(FRIED_SIMD_AVX2)
+        if (cpu & CPU_AVX2)
+            col += indct42D_row_avx2(x0 + col, x1 + col, x2 + col, x3 + col, width - col);
+#endif
+#if defined(FRIED_SIMD_SSE2)
+        if (cpu & CPU_SSE2)
+            col += indct42D_row_sse2(x0 + col, x1 + col, x2 + col, x3 + col, width - col);
+#endif
+
+        for (; col < width; col += 4)
+            indct42D(x0 + col, x1 + col, x2 + col, x3 + col);
+    }
+
+    void indct42D_lossless_row(int16_t *x0, int16_t *x1, int16_t *x2, int16_t *x3, int32_t width) {
+        int32_t cpu = CpuFeatures();
+        int32_t col = 0;
+
+        (void) cpu;
+#if defined(FRIED_SIMD_AVX2)
+        if (cpu & CPU_AVX2)
+            col += indct42D_lossless_row_avx2(x0 + col, x1 + col, x2 + col, x3 + col, width - col);
+#endif
+#if defined(FRIED_SIMD_SSE2)
+        if (cpu & CPU_SSE2)
+            col += indct42D_lossless_row_sse2(x0 + col, x1 + col, x2 + col, x3 + col, width - col);
+#endif
+
+        for (; col < width; col += 4)
+            indct42D_lossless(x0 + col, x1 + col, x2 + col, x3 + col);
+    }
+
+    void lbt4post4x4_row(int16_t *x0, int16_t *x1, int16_t *x2, int16_t *x3, int32_t width) {
+        int32_t cpu = CpuFeatures();
+        int32_t col = 0;
+
+        (void) cpu;
+#if defined(FRIED_SIMD_AVX2)
+        if (cpu & CPU_AVX2)
+            col += lbt4post4x4_row_avx2(x0 + col, x1 + col, x2 + col, x3 + col, width - col);
+#endif
+#if defined(FRIED_SIMD_SSE2)
+        if (cpu & CPU_SSE2)
+            col += lbt4post4x4_row_sse2(x0 + col, x1 + col, x2 + col, x3 + col, width - col);
+#endif
+
+        for (; col < width; col += 4)
+            lbt4post4x4(x0 + col, x1 + col, x2 + col, x3 + col);
+    }
+}
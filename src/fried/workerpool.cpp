@@ -0,0 +1,103 @@
+// This file is distributed under a BSD license. See LICENSE.txt for details.
+
+// FRIED
+// worker pool implementation.
+#include "fried_internal.hpp"
+#include "workerpool.hpp"
+
+namespace FRIED
+{
+  int32_t ResolveThreads(int32_t threads)
+  {
+    if(threads > 0)
+      return threads;
+
+    int32_t cores = int32_t(std::thread::hardware_concurrency());
+    return sMax(cores,1);
+  }
+
+  WorkerPool::WorkerPool(int32_t threads)
+  {
+    NumWorkers = ResolveThreads(threads);
+    Current = 0;
+    Count = 0;
+    Next = 0;
+    Pending = 0;
+    Round = 0;
+    Quit = false;
+
+    for(int32_t i=1;i<NumWorkers;i++)
+      Threads.emplace_back(&WorkerPool::WorkerMain,this,i);
+  }
+
+  WorkerPool::~WorkerPool()
+  {
+    {
+      std::lock_guard<std::mutex> guard(Lock);
+      Quit = true;
+    }
+
+    Wake.notify_all();
+    for(std::thread &t : Threads)
+      t.join();
+  }
+
+  void WorkerPool::Drain(int32_t worker)
+  {
+    int32_t i;
+
+    while((i = Next.fetch_add(1)) < Count)
+      (*Current)(i,worker);
+  }
+
+  void WorkerPool::WorkerMain(int32_t worker)
+  {
+    uint32_t seen = 0;
+
+    for(;;)
+    {
+      {
+        std::unique_lock<std::mutex> guard(Lock);
+        Wake.wait(guard,[&] { return Quit || Round != seen; });
+        if(Quit)
+          return;
+
+        seen = Round;
+      }
+
+      Drain(worker);
+
+      std::lock_guard<std::mutex> guard(Lock);
+      if(--Pending == 0)
+        Done.notify_one();
+    }
+  }
+
+  void WorkerPool::Run(int32_t count,const Job &job)
+  {
+    // nothing to distribute? do it inline.
+    if(NumWorkers == 1 || count <= 1)
+    {
+      for(int32_t i=0;i<count;i++)
+        job(i,0);
+
+      return;
+    }
+
+    {
+      std::lock_guard<std::mutex> guard(Lock);
+      Current = &job;
+      Count = count;
+      Next = 0;
+      Pending = NumWorkers - 1;
+      Round++;
+    }
+
+    Wake.notify_all();
+    Drain(0);
+
+    std::unique_lock<std::mutex> guard(Lock);
+    Done.wait(guard,[&] { return Pending == 0; });
+    Current = 0;
+  }
+}
@@ -0,0 +1,54 @@
+// This file is distributed under a BSD license. See LICENSE.txt for details.
+
+// FRIED
+// small fork/join worker pool for the parallel encode/decode paths.
+#pragma once
+#ifndef __WORKERPOOL_HPP__
+#define __WORKERPOOL_HPP__
+#include <cstdint>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace FRIED
+{
+  class WorkerPool
+  {
+  public:
+    typedef std::function<void(int32_t job,int32_t worker)> Job;
+
+    explicit WorkerPool(int32_t threads);
+    ~WorkerPool();
+
+    int32_t Workers() const { return NumWorkers; }
+
+    // calls job(i,worker) for every i in [0,count) and returns once all
+    // of them are done. the calling thread takes part as worker 0, so
+    // per-worker scratch can be indexed with worker in [0,Workers()).
+    void Run(int32_t count,const Job &job);
+
+  private:
+    void WorkerMain(int32_t worker);
+    void Drain(int32_t worker);
+
+    int32_t NumWorkers;
+    std::vector<std::thread> Threads;
+    std::mutex Lock;
+    std::condition_variable Wake;
+    std::condition_variable Done;
+    const Job *Current;
+    int32_t Count;
+    std::atomic<int32_t> Next;
+    int32_t Pending;                   // workers that haven't finished this round
+    uint32_t Round;
+    bool Quit;
+  };
+
+  // number of threads to actually use (<=0 means one per core)
+  int32_t ResolveThreads(int32_t threads);
+}
+
+#endif
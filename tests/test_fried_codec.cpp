@@ -3,6 +3,27 @@
 #include "stb_image.h"
 #include "stb_image_write.h"
 #include "fried/externalApi.h"
+#include "fried/fried_internal.hpp"
+#include "fried/mappedfile.hpp"
+#include "fried/simd.hpp"
+
+// deterministic test pattern (gradients plus some noise), bpp bytes per pixel
+static std::vector<uint8_t> makeTestImage(int width, int height, int bpp) {
+    std::vector<uint8_t> image(static_cast<size_t>(width) * height * bpp);
+    uint32_t seed = 1;
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            for (int c = 0; c < bpp; c++) {
+                seed = seed * 1664525u + 1013904223u;
+                int value = (x * (c + 1) + y * (3 - c)) / 2 + static_cast<int>(seed >> 28);
+                image[(static_cast<size_t>(y) * width + x) * bpp + c] = static_cast<uint8_t>(value & 0xff);
+            }
+        }
+    }
+
+    return image;
+}
 
 TEST_CASE("FRIED encode/decode roundtrip") {
     auto input = "tests/test_image.png";
@@ -99,4 +120,2066 @@ TEST_CASE("FRIED encode all levels roundtrip"){
         stbi_image_free(origData);
         stbi_image_free(decodedData);
     }
-}
\ No newline at end of file
+}
+
+static std::vector<uint8_t> readWholeFile(const char* path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::vector<uint8_t>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+TEST_CASE("FRIED batch encode/decode matches single file calls") {
+    auto input = "tests/test_image.png";
+    REQUIRE(fried_encode(input, "tests/test.fried", 31));
+    REQUIRE(fried_decode("tests/test.fried", "tests/test_result.png"));
+    auto expected = readWholeFile("tests/test.fried");
+    auto png = readWholeFile(input);
+    REQUIRE(!expected.empty());
+
+    // file to file, memory to memory, a missing file, file to memory
+    fried_batch_job enc[4] = {};
+    enc[0].inputPath = input;
+    enc[0].outputPath = "tests/test_batch.fried";
+    enc[1].inputData = png.data();
+    enc[1].inputSize = static_cast<int32_t>(png.size());
+    enc[2].inputPath = "tests/does_not_exist.png";
+    enc[2].outputPath = "tests/test_batch_missing.fried";
+    enc[3].inputPath = input;
+    CHECK(fried_encode_batch(enc, 4, 31, 3) == 3);
+    CHECK(enc[0].ok);
+    CHECK(enc[1].ok);
+    CHECK_FALSE(enc[2].ok);
+    CHECK(enc[3].ok);
+
+    CHECK(readWholeFile("tests/test_batch.fried") == expected);
+    for (int i : {1, 3}) {
+        REQUIRE(enc[i].outputData != nullptr);
+        CHECK(std::vector<uint8_t>(enc[i].outputData, enc[i].outputData + enc[i].outputSize) == expected);
+        FreeFRIED(enc[i].outputData);
+    }
+
+    // decoding: file to file, memory to memory, garbage
+    std::vector<uint8_t> garbage(100, 0x5a);
+    fried_batch_job dec[3] = {};
+    dec[0].inputPath = "tests/test_batch.fried";
+    dec[0].outputPath = "tests/test_batch.png";
+    dec[1].inputData = expected.data();
+    dec[1].inputSize = static_cast<int32_t>(expected.size());
+    dec[2].inputData = garbage.data();
+    dec[2].inputSize = static_cast<int32_t>(garbage.size());
+    CHECK(fried_decode_batch(dec, 3, 0) == 2);
+    CHECK_FALSE(dec[2].ok);
+    REQUIRE(dec[1].outputData != nullptr);
+
+    int w, h, c, bw, bh, bc, mw, mh, mc;
+    unsigned char* single = stbi_load("tests/test_result.png", &w, &h, &c, 4);
+    unsigned char* fromFile = stbi_load("tests/test_batch.png", &bw, &bh, &bc, 4);
+    unsigned char* fromMemory = stbi_load_from_memory(dec[1].outputData, dec[1].outputSize, &mw, &mh, &mc, 4);
+    REQUIRE(single != nullptr);
+    REQUIRE(fromFile != nullptr);
+    REQUIRE(fromMemory != nullptr);
+    REQUIRE((bw == w && bh == h && mw == w && mh == h));
+    CHECK(memcmp(single, fromFile, static_cast<size_t>(w) * h * 4) == 0);
+    CHECK(memcmp(single, fromMemory, static_cast<size_t>(w) * h * 4) == 0);
+    stbi_image_free(single);
+    stbi_image_free(fromFile);
+    stbi_image_free(fromMemory);
+    FreeFRIED(dec[1].outputData);
+}
+
+TEST_CASE("FRIED mapped file input and output") {
+    const char* path = "tests/test_mapped.fried";
+    const uint8_t bytes[] = {1, 2, 3, 4, 5, 6, 7};
+
+    // written through the mapping, trimmed to size, read back through one
+    {
+        FRIED::MappedOutput out;
+        REQUIRE(out.create(path, 4096));
+        REQUIRE(out.capacity() == 4096);
+        memcpy(out.data(), bytes, sizeof(bytes));
+        CHECK(out.finish(sizeof(bytes)));
+    }
+    CHECK(readWholeFile(path) == std::vector<uint8_t>(bytes, bytes + sizeof(bytes)));
+
+    FRIED::MappedFile in;
+    REQUIRE(in.open(path));
+    REQUIRE(in.size() == sizeof(bytes));
+    CHECK(memcmp(in.data(), bytes, sizeof(bytes)) == 0);
+    CHECK_FALSE(in.open("tests/does_not_exist.fried"));
+    CHECK(in.size() == 0);
+
+    // an output that isn't finished is left empty
+    {
+        FRIED::MappedOutput out;
+        REQUIRE(out.create(path, 4096));
+    }
+    CHECK(readWholeFile(path).empty());
+    REQUIRE(in.open(path));
+    CHECK(in.size() == 0);
+
+    // the file entry points (rate control included) match the in-memory encoder
+    int w, h, c;
+    unsigned char* pixels = stbi_load("tests/test_image.png", &w, &h, &c, 4);
+    REQUIRE(pixels != nullptr);
+    FRIED_EncodeParams params;
+    FRIED_InitEncodeParams(&params, FRIED_DEFAULT | FRIED_SAVEALPHA, 31);
+    params.TargetSize = 20000;
+    params.Layout = c == 4 ? FRIED_PIXEL_BGRA : FRIED_PIXEL_BGRX;
+    int32_t size = 0;
+    uint8_t* expected = SaveFRIEDEx(pixels, w, h, &params, size);
+    stbi_image_free(pixels);
+    REQUIRE(expected != nullptr);
+
+    params.Layout = FRIED_PIXEL_DEFAULT;
+    REQUIRE(fried_encode_ex("tests/test_image.png", path, &params));
+    CHECK(readWholeFile(path) == std::vector<uint8_t>(expected, expected + size));
+    FreeFRIED(expected);
+    CHECK(fried_decode(path, "tests/test_result.png"));
+}
+
+TEST_CASE("FRIED threaded encode matches serial encode") {
+    const int width = 333, height = 211;
+    auto image = makeTestImage(width, height, 4);
+
+    int32_t serialSize = 0;
+    uint8_t* serial = SaveFRIED(image.data(), width, height, FRIED_SAVEALPHA, 31, serialSize);
+    REQUIRE(serial != nullptr);
+
+    for (int threads : {2, 3, 8}) {
+        FRIED_EncodeParams params;
+        FRIED_InitEncodeParams(&params, FRIED_SAVEALPHA, 31);
+        params.Threads = threads;
+
+        int32_t size = 0;
+        uint8_t* data = SaveFRIEDEx(image.data(), width, height, &params, size);
+        REQUIRE(data != nullptr);
+        CHECK(size == serialSize);
+        CHECK(memcmp(data, serial, serialSize) == 0);
+        FreeFRIED(data);
+    }
+
+    FreeFRIED(serial);
+}
+
+TEST_CASE("FRIED encode to a caller buffer of FRIED_MaxEncodedSize") {
+    const int width = 333, height = 211;
+    auto image = makeTestImage(width, height, 4);
+
+    for (int threads : {1, 3}) {
+        FRIED_EncodeParams params;
+        FRIED_InitEncodeParams(&params, FRIED_SAVEALPHA, 31);
+        params.Threads = threads;
+
+        int32_t expectedSize = 0;
+        uint8_t* expected = SaveFRIEDEx(image.data(), width, height, &params, expectedSize);
+        REQUIRE(expected != nullptr);
+
+        int64_t maxSize = FRIED_MaxEncodedSize(width, height, FRIED_SAVEALPHA);
+        CHECK(maxSize >= expectedSize);
+
+        std::vector<uint8_t> buf(maxSize);
+        CHECK(SaveFRIEDTo(image.data(), width, height, &params, buf.data(), static_cast<int32_t>(maxSize)) == expectedSize);
+        CHECK(memcmp(buf.data(), expected, expectedSize) == 0);
+
+        // a buffer that is too small fails and isn't written past its end
+        std::vector<uint8_t> small(expectedSize + 16, 0xcd);
+        CHECK(SaveFRIEDTo(image.data(), width, height, &params, small.data(), expectedSize - 1) == -1);
+        CHECK(small[expectedSize - 1] == 0xcd);
+        FreeFRIED(expected);
+    }
+
+    // full-range noise at the best quality still fits the bound
+    std::vector<uint8_t> noise(static_cast<size_t>(width) * height * 4);
+    uint32_t seed = 5;
+    for (auto& v : noise) {
+        seed = seed * 1664525u + 1013904223u;
+        v = static_cast<uint8_t>(seed >> 24);
+    }
+
+    int32_t size = 0;
+    uint8_t* data = SaveFRIED(noise.data(), width, height, FRIED_SAVEALPHA, 0, size);
+    REQUIRE(data != nullptr);
+    CHECK(size <= FRIED_MaxEncodedSize(width, height, FRIED_SAVEALPHA));
+
+    int32_t w = 0, h = 0, outSize = 0;
+    uint8_t* decoded = nullptr;
+    REQUIRE(LoadFRIED(data, size, w, h, outSize, decoded));
+    int maxDiff = 0;
+    for (int32_t i = 0; i < outSize; i++)
+        maxDiff = std::max(maxDiff, std::abs(decoded[i] - noise[i]));
+    CHECK(maxDiff <= 2);
+    FreeFRIED(decoded);
+    FreeFRIED(data);
+}
+
+// FRIED_WriteFunc collecting the file in memory
+static bool writeToVector(void* user, int32_t offset, const uint8_t* data, int32_t size) {
+    auto& file = *static_cast<std::vector<uint8_t>*>(user);
+    if (file.size() < static_cast<size_t>(offset) + size)
+        file.resize(static_cast<size_t>(offset) + size);
+    memcpy(file.data() + offset, data, size);
+    return true;
+}
+
+TEST_CASE("FRIED streaming encode matches SaveFRIED") {
+    struct { int width, height, flags; } cases[] = {
+        { 333, 211, FRIED_SAVEALPHA },
+        { 1100, 64, FRIED_DEFAULT },
+        { 45, 17, FRIED_GRAYSCALE },
+        { 70, 95, FRIED_GRAYSCALE | FRIED_SAVEALPHA },
+    };
+
+    for (auto& c : cases) {
+        int bpp = (c.flags & FRIED_GRAYSCALE) ? 2 : 4;
+        auto image = makeTestImage(c.width, c.height, bpp);
+
+        int32_t expectedSize = 0;
+        uint8_t* expected = SaveFRIED(image.data(), c.width, c.height, c.flags, 31, expectedSize);
+        REQUIRE(expected != nullptr);
+
+        // uneven batches, the last one through a padded copy
+        FRIED_EncodeParams params;
+        FRIED_InitEncodeParams(&params, c.flags, 31);
+        std::vector<uint8_t> file;
+        FRIED_Encoder* enc = FRIED_CreateEncoder(c.width, c.height, &params, writeToVector, &file);
+        REQUIRE(enc != nullptr);
+
+        int row = 0;
+        for (int batch = 1; row < c.height - 5; batch += 6) {
+            int n = std::min(batch, c.height - 5 - row);
+            CHECK(FRIED_EncoderPushRows(enc, image.data() + row * c.width * bpp, n, 0));
+            row += n;
+        }
+
+        int pitch = c.width * bpp + 12;
+        std::vector<uint8_t> tail(5 * pitch);
+        for (int i = 0; i < 5; i++)
+            memcpy(tail.data() + i * pitch, image.data() + (row + i) * c.width * bpp, c.width * bpp);
+        CHECK(FRIED_EncoderPushRows(enc, tail.data(), 5, pitch));
+        CHECK_FALSE(FRIED_EncoderPushRows(enc, tail.data(), 1, pitch)); // too many rows
+
+        int32_t size = FRIED_FinishEncoder(enc);
+        FRIED_DestroyEncoder(enc);
+
+        CHECK(size == expectedSize);
+        REQUIRE(file.size() == static_cast<size_t>(expectedSize));
+        CHECK(memcmp(file.data(), expected, expectedSize) == 0);
+        FreeFRIED(expected);
+    }
+
+    // finishing early fails
+    FRIED_EncodeParams params;
+    FRIED_InitEncodeParams(&params, FRIED_DEFAULT, 31);
+    std::vector<uint8_t> file;
+    FRIED_Encoder* enc = FRIED_CreateEncoder(64, 64, &params, writeToVector, &file);
+    CHECK(FRIED_FinishEncoder(enc) == -1);
+    FRIED_DestroyEncoder(enc);
+}
+
+// write callback that keeps nothing, only the end of the file
+struct DiscardSink {
+    int64_t end = 0;
+    bool negative = false;
+};
+
+static bool writeDiscard(void* user, int32_t offset, const uint8_t*, int32_t size) {
+    DiscardSink* sink = static_cast<DiscardSink*>(user);
+    sink->negative |= offset < 0;
+    sink->end = std::max(sink->end, static_cast<int64_t>(offset) + size);
+    return true;
+}
+
+TEST_CASE("FRIED streaming encode fails at the file size limit") {
+    const int width = 333, height = 211;
+    auto image = makeTestImage(width, height, 4);
+
+    // the chroma plane is written by FRIED_FinishEncoder, so with it the
+    // limit is hit there instead of in FRIED_EncoderPushRows
+    for (int flags : { FRIED_SAVEALPHA, FRIED_CHROMASUBSAMPLE }) {
+        FRIED_EncodeParams params;
+        FRIED_InitEncodeParams(&params, flags, 0);
+
+        DiscardSink full;
+        FRIED_Encoder* enc = FRIED_CreateEncoder(width, height, &params, writeDiscard, &full);
+        REQUIRE(enc != nullptr);
+        CHECK(FRIED_EncoderPushRows(enc, image.data(), height, 0));
+        int32_t size = FRIED_FinishEncoder(enc);
+        FRIED_DestroyEncoder(enc);
+        REQUIRE(size > 0);
+        CHECK(full.end == size);
+
+        // exactly at the limit is fine
+        DiscardSink exact;
+        enc = FRIED_CreateEncoder(width, height, &params, writeDiscard, &exact);
+        REQUIRE(enc != nullptr);
+        FRIED::SetStreamOutputLimit(enc, size);
+        CHECK(FRIED_EncoderPushRows(enc, image.data(), height, 0));
+        CHECK(FRIED_FinishEncoder(enc) == size);
+        FRIED_DestroyEncoder(enc);
+
+        for (int32_t limit : { size / 2, size - 1 }) {
+            DiscardSink sink;
+            enc = FRIED_CreateEncoder(width, height, &params, writeDiscard, &sink);
+            REQUIRE(enc != nullptr);
+            FRIED::SetStreamOutputLimit(enc, limit);
+
+            bool pushed = true;
+            for (int row = 0; row < height && pushed; row += 16)
+                pushed = FRIED_EncoderPushRows(enc, image.data() + row * width * 4, std::min(16, height - row), 0);
+            if (!pushed)
+                CHECK_FALSE(FRIED_EncoderPushRows(enc, image.data(), 1, 0));
+
+            CHECK(FRIED_FinishEncoder(enc) == -1);
+            CHECK(sink.end <= limit);
+            CHECK_FALSE(sink.negative);
+            FRIED_DestroyEncoder(enc);
+        }
+    }
+}
+
+// PSNR over the colour channels of two BGRA images
+static double imagePSNR(const uint8_t* a, const uint8_t* b, size_t pixels) {
+    double sum = 0.0;
+    for (size_t i = 0; i < pixels; i++) {
+        for (int c = 0; c < 3; c++) {
+            double d = static_cast<double>(a[i * 4 + c]) - b[i * 4 + c];
+            sum += d * d;
+        }
+    }
+    double mse = sum / (pixels * 3.0);
+    return mse > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / mse) : 1e9;
+}
+
+TEST_CASE("FRIED rate control meets size and PSNR targets") {
+    const int width = 400, height = 300;
+    const size_t pixels = static_cast<size_t>(width) * height;
+    auto image = makeTestImage(width, height, 4);
+    const size_t quantizerOffset = sizeof(FRIED::FileHeader) + offsetof(FRIED::ChannelHeader, Quantizer);
+
+    auto encodeAt = [&](int q, int32_t& size) {
+        FRIED_EncodeParams params;
+        FRIED_InitEncodeParams(&params, 0, q);
+        return SaveFRIEDEx(image.data(), width, height, &params, size);
+    };
+    auto psnrAt = [&](const uint8_t* data, int32_t size) {
+        int32_t w = 0, h = 0, outSize = 0;
+        uint8_t* decoded = nullptr;
+        REQUIRE(LoadFRIED(data, size, w, h, outSize, decoded));
+        double psnr = imagePSNR(image.data(), decoded, pixels);
+        FreeFRIED(decoded);
+        return psnr;
+    };
+
+    // encodes with the given targets; checks the result is the plain encode at its quantizer
+    auto encodeTarget = [&](int32_t targetSize, double targetPSNR, int threads, int& q, int32_t& size, double& psnr) {
+        FRIED_EncodeParams params;
+        FRIED_InitEncodeParams(&params, 0, 31);
+        params.TargetSize = targetSize;
+        params.TargetPSNR = targetPSNR;
+        params.Threads = threads;
+
+        uint8_t* data = SaveFRIEDEx(image.data(), width, height, &params, size);
+        REQUIRE(data != nullptr);
+        q = data[quantizerOffset];
+        psnr = psnrAt(data, size);
+
+        int32_t plainSize = 0;
+        uint8_t* plain = encodeAt(q, plainSize);
+        REQUIRE(plain != nullptr);
+        CHECK(plainSize == size);
+        CHECK(memcmp(plain, data, size) == 0);
+        FreeFRIED(plain);
+        FreeFRIED(data);
+    };
+
+    int32_t refSize = 0;
+    uint8_t* ref = encodeAt(40, refSize);
+    REQUIRE(ref != nullptr);
+    FreeFRIED(ref);
+
+    for (int threads : {1, 3}) {
+        // size: fits, and one quantizer step finer does not
+        for (int32_t target : {refSize, refSize * 3 / 2, refSize / 2}) {
+            int q = 0;
+            int32_t size = 0;
+            double psnr = 0.0;
+            encodeTarget(target, 0.0, threads, q, size, psnr);
+            CHECK(size <= target);
+            if (q > 0) {
+                int32_t finerSize = 0;
+                uint8_t* finer = encodeAt(q - 1, finerSize);
+                CHECK(finerSize > target);
+                FreeFRIED(finer);
+            }
+        }
+
+        // psnr: reached, and one quantizer step coarser does not
+        for (double target : {32.0, 38.0, 44.0}) {
+            int q = 0;
+            int32_t size = 0;
+            double psnr = 0.0;
+            encodeTarget(0, target, threads, q, size, psnr);
+            CHECK(psnr >= target);
+            if (q < 127) {
+                int32_t coarserSize = 0;
+                uint8_t* coarser = encodeAt(q + 1, coarserSize);
+                CHECK(psnrAt(coarser, coarserSize) < target);
+                FreeFRIED(coarser);
+            }
+        }
+    }
+
+    // both targets: the psnr result when it fits, otherwise the size result
+    int qPSNR = 0, qBoth = 0, qSize = 0;
+    int32_t sizePSNR = 0, size = 0;
+    double psnr = 0.0;
+    encodeTarget(0, 38.0, 1, qPSNR, sizePSNR, psnr);
+    encodeTarget(sizePSNR + 100, 38.0, 1, qBoth, size, psnr);
+    CHECK(qBoth == qPSNR);
+    encodeTarget(sizePSNR / 2, 0.0, 1, qSize, size, psnr);
+    encodeTarget(sizePSNR / 2, 38.0, 1, qBoth, size, psnr);
+    CHECK(qBoth == qSize);
+
+    // unreachable targets give the nearest quantizer
+    encodeTarget(10, 0.0, 1, qSize, size, psnr);
+    CHECK(qSize == 127);
+    encodeTarget(0, 200.0, 1, qPSNR, size, psnr);
+    CHECK(qPSNR == 0);
+
+    // streaming encodes can't look ahead
+    FRIED_EncodeParams params;
+    FRIED_InitEncodeParams(&params, 0, 31);
+    params.TargetSize = refSize;
+    FRIED_Encoder* enc = FRIED_NewEncoder();
+    std::vector<uint8_t> file;
+    CHECK_FALSE(FRIED_EncoderBegin(enc, width, height, &params, writeToVector, &file));
+    FRIED_DestroyEncoder(enc);
+}
+
+TEST_CASE("FRIED separate Y, chroma and alpha quantizers") {
+    const int width = 333, height = 211;
+    auto image = makeTestImage(width, height, 4);
+    const size_t chanOffset = sizeof(FRIED::FileHeader);
+    auto quantizer = [&](const uint8_t* data, int ch) {
+        FRIED::ChannelHeader header;
+        memcpy(&header, data + chanOffset + ch * sizeof(header), sizeof(header));
+        return static_cast<int>(header.Quantizer);
+    };
+
+    FRIED_EncodeParams params;
+    FRIED_InitEncodeParams(&params, FRIED_SAVEALPHA, 31);
+    CHECK(params.ChromaQuality == -1);
+    CHECK(params.AlphaQuality == -1);
+
+    // -1 and the Y quantizer both give the old single-quantizer file
+    int32_t plainSize = 0;
+    uint8_t* plain = SaveFRIED(image.data(), width, height, FRIED_SAVEALPHA, 31, plainSize);
+    REQUIRE(plain != nullptr);
+    params.ChromaQuality = 31;
+    params.AlphaQuality = 31;
+    int32_t size = 0;
+    uint8_t* data = SaveFRIEDEx(image.data(), width, height, &params, size);
+    REQUIRE(data != nullptr);
+    CHECK(size == plainSize);
+    CHECK(memcmp(data, plain, size) == 0);
+    FreeFRIED(data);
+
+    // coarser chroma and alpha: smaller, Y unchanged, the others coarser
+    params.ChromaQuality = 70;
+    params.AlphaQuality = 100;
+    data = SaveFRIEDEx(image.data(), width, height, &params, size);
+    REQUIRE(data != nullptr);
+    CHECK(size < plainSize);
+    CHECK(quantizer(data, 0) == 31);
+    CHECK(quantizer(data, 1) == 70);
+    CHECK(quantizer(data, 2) == 70);
+    CHECK(quantizer(data, 3) == 100);
+
+    int32_t w = 0, h = 0, outSize = 0;
+    uint8_t *decoded = nullptr, *plainDecoded = nullptr;
+    REQUIRE(LoadFRIED(data, size, w, h, outSize, decoded));
+    REQUIRE(LoadFRIED(plain, plainSize, w, h, outSize, plainDecoded));
+    double alphaError = 0.0, plainAlphaError = 0.0;
+    for (size_t i = 3; i < image.size(); i += 4) {
+        alphaError += std::abs(decoded[i] - image[i]);
+        plainAlphaError += std::abs(plainDecoded[i] - image[i]);
+    }
+    CHECK(alphaError > plainAlphaError);
+    FreeFRIED(decoded);
+    FreeFRIED(plainDecoded);
+    FreeFRIED(data);
+    FreeFRIED(plain);
+
+    // grayscale files have no chroma channels
+    params.Flags = FRIED_GRAYSCALE | FRIED_SAVEALPHA;
+    data = SaveFRIEDEx(image.data(), width, height, &params, size);
+    REQUIRE(data != nullptr);
+    CHECK(quantizer(data, 0) == 31);
+    CHECK(quantizer(data, 1) == 100);
+    FreeFRIED(data);
+
+    // rate control moves all quantizers together, clamped to 0..127
+    params.Flags = FRIED_SAVEALPHA;
+    params.TargetSize = plainSize / 3;
+    data = SaveFRIEDEx(image.data(), width, height, &params, size);
+    REQUIRE(data != nullptr);
+    CHECK(size <= params.TargetSize);
+    int q = quantizer(data, 0);
+    CHECK(quantizer(data, 1) == std::min(q + 39, 127));
+    CHECK(quantizer(data, 3) == std::min(q + 69, 127));
+    FreeFRIED(data);
+    params.TargetSize = 0;
+
+    // so do plain encodes: past 127 is 127, and the file still loads
+    params.ChromaQuality = 255;
+    params.AlphaQuality = 300;
+    data = SaveFRIEDEx(image.data(), width, height, &params, size);
+    REQUIRE(data != nullptr);
+    CHECK(quantizer(data, 1) == 127);
+    CHECK(quantizer(data, 2) == 127);
+    CHECK(quantizer(data, 3) == 127);
+    REQUIRE(LoadFRIED(data, size, w, h, outSize, decoded));
+    FreeFRIED(decoded);
+    FreeFRIED(data);
+    params.ChromaQuality = 70;
+    params.AlphaQuality = 100;
+
+    // the file and batch entry points pass the quantizers on
+    int pw, ph, pc;
+    unsigned char* pixels = stbi_load("tests/test_image.png", &pw, &ph, &pc, 4);
+    REQUIRE(pixels != nullptr);
+    params.Flags = FRIED_DEFAULT | FRIED_SAVEALPHA;
+    uint8_t* expected = SaveFRIEDEx(pixels, pw, ph, &params, size);
+    REQUIRE(expected != nullptr);
+    std::vector<uint8_t> expectedFile(expected, expected + size);
+    FreeFRIED(expected);
+    stbi_image_free(pixels);
+
+    REQUIRE(fried_encode_ex("tests/test_image.png", "tests/test_quantizers.fried", &params));
+    CHECK(readWholeFile("tests/test_quantizers.fried") == expectedFile);
+
+    fried_batch_job job = {};
+    job.inputPath = "tests/test_image.png";
+    CHECK(fried_encode_batch_ex(&job, 1, &params, 2) == 1);
+    REQUIRE(job.outputData != nullptr);
+    CHECK(std::vector<uint8_t>(job.outputData, job.outputData + job.outputSize) == expectedFile);
+    FreeFRIED(job.outputData);
+}
+
+// smooth color gradients with some noise; makeTestImage's per-channel
+// wraparounds are hard chroma edges that 4:2:0 cannot keep
+static std::vector<uint8_t> makeSmoothImage(int width, int height) {
+    std::vector<uint8_t> image(static_cast<size_t>(width) * height * 4);
+    uint32_t seed = 1;
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            for (int c = 0; c < 4; c++) {
+                seed = seed * 1664525u + 1013904223u;
+                double wave = std::sin(x * 0.0075 * (c + 1) + y * 0.005 * (3 - c));
+                image[(static_cast<size_t>(y) * width + x) * 4 + c] = static_cast<uint8_t>(120 + 100 * wave + (seed >> 29));
+            }
+        }
+    }
+
+    return image;
+}
+
+TEST_CASE("FRIED 4:2:0 chroma subsampling") {
+    const int subFlags = FRIED_SAVEALPHA | FRIED_CHROMASUBSAMPLE;
+    auto subsample = [&](const uint8_t* data, int ch) {
+        FRIED::ChannelHeader header;
+        memcpy(&header, data + sizeof(FRIED::FileHeader) + ch * sizeof(header), sizeof(header));
+        return static_cast<int>(header.Subsample);
+    };
+
+    // odd sizes, a single pixel, several chunks
+    struct { int width, height, flags; } cases[] = {
+        { 333, 211, FRIED_SAVEALPHA },
+        { 1, 1, FRIED_DEFAULT },
+        { 33, 17, FRIED_SAVEALPHA },
+        { 1100, 211, FRIED_DEFAULT },
+    };
+
+    for (auto& c : cases) {
+        const size_t pixels = static_cast<size_t>(c.width) * c.height;
+        auto image = makeSmoothImage(c.width, c.height);
+
+        int32_t plainSize = 0, size = 0;
+        uint8_t* plain = SaveFRIED(image.data(), c.width, c.height, c.flags, 31, plainSize);
+        uint8_t* data = SaveFRIED(image.data(), c.width, c.height, c.flags | FRIED_CHROMASUBSAMPLE, 31, size);
+        REQUIRE(plain != nullptr);
+        REQUIRE(data != nullptr);
+        if (pixels > 64)
+            CHECK(size < plainSize);
+        CHECK(memcmp(data, FRIED_FILE_VERSION, 8) == 0);
+        CHECK(subsample(data, 0) == 0);
+        CHECK(subsample(data, 1) == 1);
+        CHECK(subsample(data, 2) == 1);
+        if (c.flags & FRIED_SAVEALPHA)
+            CHECK(subsample(data, 3) == 0);
+
+        int32_t w = 0, h = 0, outSize = 0;
+        uint8_t *decoded = nullptr, *plainDecoded = nullptr;
+        REQUIRE(LoadFRIED(data, size, w, h, outSize, decoded));
+        REQUIRE(LoadFRIED(plain, plainSize, w, h, outSize, plainDecoded));
+        CHECK(w == c.width);
+        CHECK(h == c.height);
+        CHECK(imagePSNR(image.data(), decoded, pixels) > imagePSNR(image.data(), plainDecoded, pixels) - 4.5);
+
+        // alpha is coded as before
+        for (size_t i = 3; i < pixels * 4; i += 4)
+            CHECK(decoded[i] == plainDecoded[i]);
+
+        // threads, band-parallel and chunk-parallel
+        FRIED_EncodeParams eparams;
+        FRIED_InitEncodeParams(&eparams, c.flags | FRIED_CHROMASUBSAMPLE, 31);
+        eparams.Threads = 3;
+        int32_t threadedSize = 0;
+        uint8_t* threaded = SaveFRIEDEx(image.data(), c.width, c.height, &eparams, threadedSize);
+        REQUIRE(threadedSize == size);
+        CHECK(memcmp(threaded, data, size) == 0);
+        FreeFRIED(threaded);
+
+        FRIED_DecodeParams dparams;
+        FRIED_InitDecodeParams(&dparams);
+        dparams.Threads = 3;
+        uint8_t* threadedDecoded = nullptr;
+        REQUIRE(LoadFRIEDEx(data, size, &dparams, w, h, outSize, threadedDecoded));
+        CHECK(memcmp(threadedDecoded, decoded, outSize) == 0);
+        FreeFRIED(threadedDecoded);
+
+        // streaming encode, in uneven batches
+        std::vector<uint8_t> file;
+        eparams.Threads = 1;
+        FRIED_Encoder* enc = FRIED_CreateEncoder(c.width, c.height, &eparams, writeToVector, &file);
+        REQUIRE(enc != nullptr);
+        for (int row = 0, batch = 1; row < c.height; row += batch, batch += 2)
+            CHECK(FRIED_EncoderPushRows(enc, image.data() + static_cast<size_t>(row) * c.width * 4, std::min(batch, c.height - row), 0));
+        CHECK(FRIED_FinishEncoder(enc) == size);
+        FRIED_DestroyEncoder(enc);
+        REQUIRE(file.size() == static_cast<size_t>(size));
+        CHECK(memcmp(file.data(), data, size) == 0);
+
+        // streaming decode
+        dparams.Threads = 2;
+        int32_t bpp = 0;
+        FRIED_Decoder* dec = FRIED_CreateDecoder(data, size, &dparams, w, h, bpp);
+        REQUIRE(dec != nullptr);
+        std::vector<uint8_t> rows(pixels * 4);
+        for (int row = 0, batch = 1; row < c.height; row += batch, batch += 3)
+            CHECK(FRIED_DecoderReadRows(dec, rows.data() + static_cast<size_t>(row) * c.width * 4, batch, 0) == std::min(batch, c.height - row));
+        FRIED_DestroyDecoder(dec);
+        CHECK(memcmp(rows.data(), decoded, pixels * 4) == 0);
+
+        // scaled decodes: the right size, close to the plain file's
+        for (int scale : {4, 16}) {
+            dparams.Scale = scale;
+            int32_t sw = 0, sh = 0, plainW = 0, plainH = 0, scaledSize = 0;
+            uint8_t *scaled = nullptr, *plainScaled = nullptr;
+            REQUIRE(LoadFRIEDEx(data, size, &dparams, sw, sh, scaledSize, scaled));
+            REQUIRE(LoadFRIEDEx(plain, plainSize, &dparams, plainW, plainH, scaledSize, plainScaled));
+            CHECK(sw == (c.width + scale - 1) / scale);
+            CHECK(sh == (c.height + scale - 1) / scale);
+            CHECK(sw == plainW);
+            CHECK(sh == plainH);
+            CHECK(imagePSNR(plainScaled, scaled, static_cast<size_t>(sw) * sh) > 28.0);
+            FreeFRIED(scaled);
+            FreeFRIED(plainScaled);
+        }
+
+        // the size bound holds
+        std::vector<uint8_t> bounded(static_cast<size_t>(FRIED_MaxEncodedSize(c.width, c.height, c.flags | FRIED_CHROMASUBSAMPLE)));
+        CHECK(SaveFRIEDTo(image.data(), c.width, c.height, &eparams, bounded.data(), static_cast<int32_t>(bounded.size())) == size);
+
+        FreeFRIED(decoded);
+        FreeFRIED(plainDecoded);
+        FreeFRIED(data);
+        FreeFRIED(plain);
+    }
+
+    const int width = 1100, height = 211;
+    auto image = makeTestImage(width, height, 4);
+    int32_t size = 0;
+    uint8_t* data = SaveFRIED(image.data(), width, height, subFlags, 31, size);
+    REQUIRE(data != nullptr);
+
+    // regions, including ones at the chroma plane's edges and seams
+    int32_t xout = 0, yout = 0, fullSize = 0;
+    uint8_t* full = nullptr;
+    REQUIRE(LoadFRIED(data, size, xout, yout, fullSize, full));
+
+    const int regions[][4] = {
+        {0, 0, 256, 211}, {511, 13, 5, 20}, {1023, 31, 77, 180}, {700, 100, 1, 1},
+        {1099, 210, 1, 1}, {0, 0, width, height},
+    };
+
+    for (auto& r : regions) {
+        int32_t outSize = 0;
+        uint8_t* region = nullptr;
+        REQUIRE(LoadFRIEDRegion(data, size, r[0], r[1], r[2], r[3], outSize, region));
+        REQUIRE(outSize == r[2] * r[3] * 4);
+
+        for (int y = 0; y < r[3]; y++)
+            CHECK(memcmp(region + y * r[2] * 4, full + ((r[1] + y) * width + r[0]) * 4, r[2] * 4) == 0);
+
+        FreeFRIED(region);
+    }
+    FreeFRIED(full);
+
+    // statistics list the channels and stripes of both planes
+    FRIED_Stats stats = {};
+    FRIED_EncodeParams params;
+    FRIED_InitEncodeParams(&params, subFlags, 31);
+    params.Stats = &stats;
+    int32_t statsSize = 0;
+    uint8_t* statsData = SaveFRIEDEx(image.data(), width, height, &params, statsSize);
+    REQUIRE(statsData != nullptr);
+    CHECK(stats.Channels == 4);
+    CHECK(stats.ChannelType[1] == FRIED::CHANNEL_CO);
+    CHECK(stats.ChannelType[3] == FRIED::CHANNEL_ALPHA);
+    CHECK(stats.Stripes == 224 / 16 + 128 / 16);
+    FreeFRIED(statsData);
+    params.Stats = nullptr;
+
+    // rate control
+    params.TargetSize = size / 2;
+    int32_t rcSize = 0;
+    uint8_t* rc = SaveFRIEDEx(image.data(), width, height, &params, rcSize);
+    REQUIRE(rc != nullptr);
+    CHECK(rcSize <= params.TargetSize);
+    CHECK(rcSize > params.TargetSize * 8 / 10);
+    CHECK(subsample(rc, 1) == 1);
+    FreeFRIED(rc);
+    FreeFRIED(data);
+
+    // grayscale images have no chroma to subsample
+    auto gray = makeTestImage(70, 95, 2);
+    int32_t graySize = 0, graySubSize = 0;
+    uint8_t* grayPlain = SaveFRIED(gray.data(), 70, 95, FRIED_GRAYSCALE | FRIED_SAVEALPHA, 31, graySize);
+    uint8_t* graySub = SaveFRIED(gray.data(), 70, 95, FRIED_GRAYSCALE | FRIED_SAVEALPHA | FRIED_CHROMASUBSAMPLE, 31, graySubSize);
+    REQUIRE(graySubSize == graySize);
+    CHECK(memcmp(graySub, grayPlain, graySize) == 0);
+    FreeFRIED(graySub);
+    FreeFRIED(grayPlain);
+}
+
+// the BGRA image src in layout, rows pitch bytes apart
+static std::vector<uint8_t> toLayout(const std::vector<uint8_t>& src, int width, int height, int layout, int pitch) {
+    // byte order of b, g, r and alpha (-1: not stored, gray layouts store b), bytes per pixel
+    static const int order[][5] = {
+        {0, 1, 2, 3, 4}, {0, 1, 2, 3, 4}, {2, 1, 0, 3, 4}, {0, 1, 2, -1, 4},
+        {2, 1, 0, -1, 3}, {0, 1, 2, -1, 3}, {0, -1, -1, -1, 1}, {0, -1, -1, 1, 2},
+    };
+    const int* o = order[layout];
+    std::vector<uint8_t> image(static_cast<size_t>(pitch) * height, 0xcd);
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            const uint8_t* s = &src[(static_cast<size_t>(y) * width + x) * 4];
+            uint8_t* d = &image[static_cast<size_t>(y) * pitch + x * o[4]];
+            for (int c = 0; c < 4; c++)
+                if (o[c] >= 0)
+                    d[o[c]] = s[c];
+        }
+    }
+
+    return image;
+}
+
+TEST_CASE("FRIED source layouts and row pitch") {
+    const int width = 150, height = 77;
+    auto image = makeTestImage(width, height, 4);
+
+    // as the gray layouts see it: b=g=r
+    auto grayish = image;
+    for (size_t i = 0; i < grayish.size(); i += 4)
+        grayish[i + 1] = grayish[i + 2] = grayish[i];
+
+    // as grayscale coding sees it: gray = (r+2g+b)/4, alpha
+    std::vector<uint8_t> gray(static_cast<size_t>(width) * height * 2);
+    for (size_t i = 0; i < gray.size() / 2; i++) {
+        gray[i * 2] = static_cast<uint8_t>((image[i * 4] + 2 * image[i * 4 + 1] + image[i * 4 + 2] + 2) >> 2);
+        gray[i * 2 + 1] = image[i * 4 + 3];
+    }
+
+    auto encode = [&](const uint8_t* src, int flags, int layout, int pitch, int threads = 1) {
+        FRIED_EncodeParams params;
+        FRIED_InitEncodeParams(&params, flags, 31);
+        params.Layout = layout;
+        params.Pitch = pitch;
+        params.Threads = threads;
+        int32_t size = 0;
+        uint8_t* data = SaveFRIEDEx(src, width, height, &params, size);
+        std::vector<uint8_t> file(data, data + (data ? size : 0));
+        FreeFRIED(data);
+        return file;
+    };
+
+    const int layouts[] = {
+        FRIED_PIXEL_BGRA, FRIED_PIXEL_RGBA, FRIED_PIXEL_BGRX, FRIED_PIXEL_RGB24,
+        FRIED_PIXEL_BGR24, FRIED_PIXEL_Y8, FRIED_PIXEL_YA8,
+    };
+
+    for (int layout : layouts) {
+        const bool alpha = layout == FRIED_PIXEL_BGRA || layout == FRIED_PIXEL_RGBA || layout == FRIED_PIXEL_YA8;
+        const bool grayLayout = layout == FRIED_PIXEL_Y8 || layout == FRIED_PIXEL_YA8;
+        const int bytes = layout == FRIED_PIXEL_Y8 ? 1 : layout == FRIED_PIXEL_YA8 ? 2 : (layout == FRIED_PIXEL_RGB24 || layout == FRIED_PIXEL_BGR24) ? 3 : 4;
+        const int pitch = width * bytes + 13;
+        const int savedFlags = alpha ? FRIED_SAVEALPHA : FRIED_DEFAULT; // no alpha to save without it
+        auto source = toLayout(image, width, height, layout, pitch);
+
+        // color, plain and subsampled: the same file as from the equivalent BGRA image
+        for (int extra : {0, FRIED_CHROMASUBSAMPLE}) {
+            auto reference = encode(grayLayout ? grayish.data() : image.data(), savedFlags | extra, FRIED_PIXEL_DEFAULT, 0);
+            auto file = encode(source.data(), FRIED_SAVEALPHA | extra, layout, pitch);
+            REQUIRE(!reference.empty());
+            CHECK(file == reference);
+            CHECK(encode(source.data(), FRIED_SAVEALPHA | extra, layout, pitch, 3) == reference);
+
+            // streaming, with the pitch given to FRIED_EncoderPushRows
+            FRIED_EncodeParams params;
+            FRIED_InitEncodeParams(&params, FRIED_SAVEALPHA | extra, 31);
+            params.Layout = layout;
+            std::vector<uint8_t> streamed;
+            FRIED_Encoder* enc = FRIED_CreateEncoder(width, height, &params, writeToVector, &streamed);
+            REQUIRE(enc != nullptr);
+            CHECK(FRIED_EncoderPushRows(enc, source.data(), 40, pitch));
+            CHECK(FRIED_EncoderPushRows(enc, source.data() + 40 * pitch, height - 40, pitch));
+            CHECK(FRIED_FinishEncoder(enc) == static_cast<int32_t>(reference.size()));
+            FRIED_DestroyEncoder(enc);
+            CHECK(streamed == reference);
+        }
+
+        // grayscale
+        if (!grayLayout) {
+            auto reference = encode(gray.data(), FRIED_GRAYSCALE | savedFlags, FRIED_PIXEL_DEFAULT, 0);
+            CHECK(encode(source.data(), FRIED_GRAYSCALE | FRIED_SAVEALPHA, layout, pitch) == reference);
+        }
+    }
+
+    // bottom-up rows: the image starts at the last row in memory, the pitch is negative
+    const int pitch = width * 3;
+    auto source = toLayout(image, width, height, FRIED_PIXEL_RGB24, pitch);
+    std::vector<uint8_t> flipped(source.size());
+    for (int y = 0; y < height; y++)
+        memcpy(&flipped[static_cast<size_t>(height - 1 - y) * pitch], &source[static_cast<size_t>(y) * pitch], pitch);
+    CHECK(encode(flipped.data() + static_cast<size_t>(height - 1) * pitch, FRIED_DEFAULT, FRIED_PIXEL_RGB24, -pitch) ==
+          encode(source.data(), FRIED_DEFAULT, FRIED_PIXEL_RGB24, 0));
+
+    // rate control measures PSNR on the converted rows
+    FRIED_EncodeParams params;
+    FRIED_InitEncodeParams(&params, FRIED_DEFAULT, 31);
+    params.TargetPSNR = 38.0;
+    int32_t rcSize = 0, refSize = 0;
+    uint8_t* rc = SaveFRIEDEx(image.data(), width, height, &params, refSize);
+    params.Layout = FRIED_PIXEL_RGB24;
+    uint8_t* rcLayout = SaveFRIEDEx(source.data(), width, height, &params, rcSize);
+    REQUIRE(rc != nullptr);
+    REQUIRE(rcLayout != nullptr);
+    REQUIRE(rcSize == refSize);
+    CHECK(memcmp(rc, rcLayout, rcSize) == 0);
+    FreeFRIED(rc);
+    FreeFRIED(rcLayout);
+
+    // gray without alpha is a single-channel file
+    auto y8 = toLayout(image, width, height, FRIED_PIXEL_Y8, width);
+    auto file = encode(y8.data(), FRIED_GRAYSCALE | FRIED_SAVEALPHA, FRIED_PIXEL_Y8, 0);
+    FRIED::FileHeader header;
+    memcpy(&header, file.data(), sizeof(header));
+    CHECK(header.Channels == 1);
+
+    int32_t w = 0, h = 0, outSize = 0;
+    uint8_t* decoded = nullptr;
+    REQUIRE(LoadFRIED(file.data(), static_cast<int32_t>(file.size()), w, h, outSize, decoded));
+    REQUIRE(outSize == width * height * 2);
+    double error = 0.0;
+    for (int i = 0; i < width * height; i++) {
+        error += std::abs(decoded[i * 2] - y8[i]);
+        CHECK(decoded[i * 2 + 1] == 255);
+    }
+    CHECK(error / (width * height) < 4.0);
+    FreeFRIED(decoded);
+
+    // unknown layouts fail
+    CHECK(encode(image.data(), FRIED_DEFAULT, FRIED_PIXEL_COUNT, 0).empty());
+    CHECK(encode(image.data(), FRIED_DEFAULT, -1, 0).empty());
+    params.TargetPSNR = 0.0;
+    params.Layout = FRIED_PIXEL_COUNT;
+    std::vector<uint8_t> unused;
+    CHECK(FRIED_CreateEncoder(width, height, &params, writeToVector, &unused) == nullptr);
+}
+
+TEST_CASE("FRIED decode into caller memory") {
+    const int width = 150, height = 77;
+    auto image = makeTestImage(width, height, 4);
+    auto grayImage = makeTestImage(width, height, 2);
+
+    struct { const uint8_t* image; int flags; int scale; int threads; } cases[] = {
+        { image.data(), FRIED_SAVEALPHA, 1, 1 },
+        { image.data(), FRIED_DEFAULT, 1, 3 },
+        { image.data(), FRIED_SAVEALPHA | FRIED_CHROMASUBSAMPLE, 1, 2 },
+        { image.data(), FRIED_SAVEALPHA, 4, 1 },
+        { grayImage.data(), FRIED_GRAYSCALE | FRIED_SAVEALPHA, 1, 1 },
+        { grayImage.data(), FRIED_GRAYSCALE, 16, 1 },
+    };
+
+    FRIED_Decoder* dec = FRIED_NewDecoder();
+    for (auto& c : cases) {
+        int32_t size = 0;
+        uint8_t* data = SaveFRIED(c.image, width, height, c.flags, 31, size);
+        REQUIRE(data != nullptr);
+
+        FRIED_DecodeParams params;
+        FRIED_InitDecodeParams(&params);
+        params.Scale = c.scale;
+        params.Threads = c.threads;
+
+        int32_t w = 0, h = 0, outSize = 0;
+        uint8_t* reference = nullptr;
+        REQUIRE(LoadFRIEDEx(data, size, &params, w, h, outSize, reference));
+
+        int32_t infoW = 0, infoH = 0, bpp = 0;
+        REQUIRE(FRIED_GetInfo(data, size, c.scale, infoW, infoH, bpp));
+        CHECK(infoW == w);
+        CHECK(infoH == h);
+        CHECK(outSize == w * h * bpp);
+
+        const int rowBytes = w * bpp;
+        const int pitch = rowBytes + 20;
+        const int64_t capacity = static_cast<int64_t>(h - 1) * pitch + rowBytes;
+
+        for (bool bottomUp : {false, true}) {
+            std::vector<uint8_t> dst(capacity + 16, 0xab);
+            int32_t xout = 0, yout = 0;
+            REQUIRE(FRIED_DecoderLoadInto(dec, data, size, dst.data(), pitch, capacity, bottomUp, &params, xout, yout));
+            CHECK(xout == w);
+            CHECK(yout == h);
+
+            for (int y = 0; y < h; y++) {
+                const uint8_t* row = &dst[static_cast<size_t>(bottomUp ? h - 1 - y : y) * pitch];
+                CHECK(memcmp(row, reference + static_cast<size_t>(y) * rowBytes, rowBytes) == 0);
+                if (y < h - 1)
+                    CHECK(row[rowBytes] == 0xab); // the gap between rows stays as it is
+            }
+            CHECK(dst[capacity] == 0xab);
+        }
+
+        // tightly packed, exactly large enough
+        std::vector<uint8_t> packed(outSize);
+        int32_t xout = 0, yout = 0;
+        REQUIRE(LoadFRIEDInto(data, size, packed.data(), 0, outSize, false, &params, xout, yout));
+        CHECK(memcmp(packed.data(), reference, outSize) == 0);
+
+        // too small, overlapping rows, no buffer
+        CHECK_FALSE(LoadFRIEDInto(data, size, packed.data(), 0, outSize - 1, false, &params, xout, yout));
+        CHECK_FALSE(LoadFRIEDInto(data, size, packed.data(), rowBytes - 1, outSize, false, &params, xout, yout));
+        CHECK_FALSE(LoadFRIEDInto(data, size, nullptr, 0, outSize, false, &params, xout, yout));
+        CHECK(xout == 0);
+
+        FreeFRIED(reference);
+        FreeFRIED(data);
+    }
+
+    // default parameters
+    int32_t size = 0;
+    uint8_t* data = SaveFRIED(image.data(), width, height, FRIED_SAVEALPHA, 31, size);
+    std::vector<uint8_t> dst(static_cast<size_t>(width) * height * 4);
+    int32_t xout = 0, yout = 0, w = 0, h = 0, outSize = 0;
+    uint8_t* reference = nullptr;
+    REQUIRE(LoadFRIED(data, size, w, h, outSize, reference));
+    REQUIRE(LoadFRIEDInto(data, size, dst.data(), 0, static_cast<int64_t>(dst.size()), false, nullptr, xout, yout));
+    CHECK(memcmp(dst.data(), reference, outSize) == 0);
+    CHECK_FALSE(FRIED_GetInfo(data, size, 2, xout, yout, w));
+    FreeFRIED(reference);
+    FreeFRIED(data);
+
+    FRIED_DestroyDecoder(dec);
+}
+
+TEST_CASE("FRIED lossless mode is bit-exact") {
+    // odd sizes, several chunks; noise and the extreme values of every channel
+    struct { int width, height, flags; bool extremes; } cases[] = {
+        { 333, 211, FRIED_SAVEALPHA, false },
+        { 1100, 37, FRIED_DEFAULT, false },
+        { 61, 45, FRIED_SAVEALPHA, true },
+        { 70, 95, FRIED_GRAYSCALE | FRIED_SAVEALPHA, false },
+        { 257, 19, FRIED_GRAYSCALE, true },
+    };
+
+    for (auto& c : cases) {
+        const int bpp = (c.flags & FRIED_GRAYSCALE) ? 2 : 4;
+        auto image = makeTestImage(c.width, c.height, bpp);
+        for (size_t i = 0; i < image.size(); i++) {
+            if (c.extremes)
+                image[i] = ((i / bpp + i / (c.width * bpp)) & 1) ? 255 : 0;
+            if (!(c.flags & FRIED_SAVEALPHA) && i % bpp == static_cast<size_t>(bpp - 1))
+                image[i] = 255; // what comes back without alpha
+        }
+
+        const int flags = c.flags | FRIED_LOSSLESS;
+        FRIED_EncodeParams eparams;
+        FRIED_InitEncodeParams(&eparams, flags, 31);
+        eparams.Threads = 3;
+        int32_t size = 0;
+        uint8_t* data = SaveFRIEDEx(image.data(), c.width, c.height, &eparams, size);
+        REQUIRE(data != nullptr);
+
+        // every channel unquantized
+        FRIED::FileHeader header;
+        memcpy(&header, data, sizeof(header));
+        CHECK(memcmp(header.Signature, FRIED_FILE_VERSION, 8) == 0);
+        for (int ch = 0; ch < header.Channels; ch++) {
+            FRIED::ChannelHeader chan;
+            memcpy(&chan, data + sizeof(header) + ch * sizeof(chan), sizeof(chan));
+            CHECK(chan.Quantizer == FRIED::QUANTIZER_LOSSLESS);
+            CHECK(chan.Subsample == 0);
+        }
+
+        // the quantizers, rate control and subsampling don't change anything
+        auto same = [&](const FRIED_EncodeParams& params) {
+            int32_t otherSize = 0;
+            uint8_t* other = SaveFRIEDEx(image.data(), c.width, c.height, &params, otherSize);
+            bool equal = other && otherSize == size && memcmp(other, data, size) == 0;
+            FreeFRIED(other);
+            return equal;
+        };
+        FRIED_EncodeParams params;
+        FRIED_InitEncodeParams(&params, flags | FRIED_CHROMASUBSAMPLE, 90);
+        params.ChromaQuality = 120;
+        params.AlphaQuality = 7;
+        CHECK(same(params));
+        params.TargetSize = size / 4;
+        CHECK(same(params));
+        params.TargetSize = 0;
+        params.TargetPSNR = 30.0;
+        CHECK(same(params));
+
+        // streaming encoder
+        FRIED_InitEncodeParams(&params, flags, 31);
+        std::vector<uint8_t> streamed;
+        FRIED_Encoder* enc = FRIED_CreateEncoder(c.width, c.height, &params, writeToVector, &streamed);
+        REQUIRE(enc != nullptr);
+        const int half = c.height / 2;
+        CHECK(FRIED_EncoderPushRows(enc, image.data(), half, 0));
+        CHECK(FRIED_EncoderPushRows(enc, image.data() + static_cast<size_t>(half) * c.width * bpp, c.height - half, 0));
+        CHECK(FRIED_FinishEncoder(enc) == size);
+        FRIED_DestroyEncoder(enc);
+        CHECK(streamed == std::vector<uint8_t>(data, data + size));
+
+        // full decodes, single and multi-threaded
+        for (int threads : {1, 3}) {
+            FRIED_DecodeParams dparams;
+            FRIED_InitDecodeParams(&dparams);
+            dparams.Threads = threads;
+            int32_t w = 0, h = 0, outSize = 0;
+            uint8_t* decoded = nullptr;
+            REQUIRE(LoadFRIEDEx(data, size, &dparams, w, h, outSize, decoded));
+            REQUIRE(outSize == static_cast<int32_t>(image.size()));
+            CHECK(memcmp(decoded, image.data(), outSize) == 0);
+            FreeFRIED(decoded);
+        }
+
+        // streaming decode
+        const int rowBytes = c.width * bpp;
+        struct Collect { std::vector<uint8_t> pixels; int rowBytes; } collect = { {}, rowBytes };
+        auto func = [](void* user, int32_t, const uint8_t* pixels) {
+            auto& col = *static_cast<Collect*>(user);
+            col.pixels.insert(col.pixels.end(), pixels, pixels + col.rowBytes);
+            return true;
+        };
+        FRIED_DecodeParams dparams;
+        FRIED_InitDecodeParams(&dparams);
+        CHECK(FRIED_DecodeRows(data, size, &dparams, func, &collect));
+        CHECK(collect.pixels == image);
+
+        // a region
+        const int rx = c.width / 3, ry = c.height / 4, rw = c.width / 2, rh = c.height / 2;
+        int32_t regionSize = 0;
+        uint8_t* region = nullptr;
+        REQUIRE(LoadFRIEDRegion(data, size, rx, ry, rw, rh, regionSize, region));
+        REQUIRE(regionSize == rw * rh * bpp);
+        for (int y = 0; y < rh; y++)
+            CHECK(memcmp(region + y * rw * bpp, &image[(static_cast<size_t>(ry + y) * c.width + rx) * bpp], rw * bpp) == 0);
+        FreeFRIED(region);
+
+        // 1/4 scale: close to the 4x4 block averages
+        dparams.Scale = 4;
+        int32_t sw = 0, sh = 0, scaledSize = 0;
+        uint8_t* scaled = nullptr;
+        REQUIRE(LoadFRIEDEx(data, size, &dparams, sw, sh, scaledSize, scaled));
+        double error = 0.0;
+        int count = 0;
+        for (int y = 0; y < c.height / 4; y++) {
+            for (int x = 0; x < c.width / 4; x++) {
+                for (int ch = 0; ch < bpp; ch++) {
+                    int sum = 0;
+                    for (int i = 0; i < 16; i++)
+                        sum += image[(static_cast<size_t>(y * 4 + i / 4) * c.width + x * 4 + i % 4) * bpp + ch];
+                    error += std::abs(scaled[(y * sw + x) * bpp + ch] - sum / 16.0);
+                    count++;
+                }
+            }
+        }
+        CHECK(error / count < 1.5);
+        FreeFRIED(scaled);
+
+        FreeFRIED(data);
+    }
+
+    // flat images with one coloured macroblock: the macroblock dcs right of
+    // the last nonzero one must come back as they were
+    for (int mb = 0; mb < 4; mb++) {
+        const int width = 64, height = 16;
+        std::vector<uint8_t> flat(static_cast<size_t>(width) * height * 4);
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                uint8_t* p = &flat[(static_cast<size_t>(y) * width + x) * 4];
+                p[0] = (x / 16 == mb) ? 255 : 0;
+                p[1] = p[2] = 0;
+                p[3] = 255;
+            }
+        }
+
+        int32_t size = 0;
+        uint8_t* data = SaveFRIED(flat.data(), width, height, FRIED_LOSSLESS, 0, size);
+        REQUIRE(data != nullptr);
+        int32_t w = 0, h = 0, outSize = 0;
+        uint8_t* decoded = nullptr;
+        REQUIRE(LoadFRIED(data, size, w, h, outSize, decoded));
+        REQUIRE(outSize == static_cast<int32_t>(flat.size()));
+        CHECK(memcmp(decoded, flat.data(), outSize) == 0);
+        FreeFRIED(decoded);
+        FreeFRIED(data);
+    }
+
+    // quantizers past 127 without FRIED_LOSSLESS are 127, never the lossless marker
+    {
+        const int width = 61, height = 45;
+        auto image = makeTestImage(width, height, 4);
+        int32_t size = 0, coarseSize = 0;
+        uint8_t* data = SaveFRIED(image.data(), width, height, FRIED_SAVEALPHA, 255, size);
+        uint8_t* coarse = SaveFRIED(image.data(), width, height, FRIED_SAVEALPHA, 127, coarseSize);
+        REQUIRE(data != nullptr);
+        REQUIRE(coarse != nullptr);
+        REQUIRE(size == coarseSize);
+        CHECK(memcmp(data, coarse, size) == 0);
+        FreeFRIED(coarse);
+        FreeFRIED(data);
+    }
+
+    // RGB24 sources code the same pixels as their BGRA equivalent
+    const int width = 150, height = 77;
+    auto image = makeTestImage(width, height, 4);
+    for (size_t i = 3; i < image.size(); i += 4)
+        image[i] = 255;
+    auto rgb = toLayout(image, width, height, FRIED_PIXEL_RGB24, width * 3);
+    FRIED_EncodeParams params;
+    FRIED_InitEncodeParams(&params, FRIED_LOSSLESS, 31);
+    params.Layout = FRIED_PIXEL_RGB24;
+    int32_t size = 0;
+    uint8_t* data = SaveFRIEDEx(rgb.data(), width, height, &params, size);
+    REQUIRE(data != nullptr);
+    int32_t w = 0, h = 0, outSize = 0;
+    uint8_t* decoded = nullptr;
+    REQUIRE(LoadFRIED(data, size, w, h, outSize, decoded));
+    REQUIRE(outSize == static_cast<int32_t>(image.size()));
+    CHECK(memcmp(decoded, image.data(), outSize) == 0);
+    FreeFRIED(decoded);
+    FreeFRIED(data);
+}
+
+TEST_CASE("FRIED progressive files decode like interleaved ones and preview early") {
+    // several chunks, subsampled, gray and lossless files
+    struct { int width, height, flags; } cases[] = {
+        { 333, 211, FRIED_SAVEALPHA },
+        { 1100, 67, FRIED_DEFAULT },
+        { 333, 211, FRIED_SAVEALPHA | FRIED_CHROMASUBSAMPLE },
+        { 70, 95, FRIED_GRAYSCALE | FRIED_SAVEALPHA },
+        { 257, 19, FRIED_LOSSLESS | FRIED_SAVEALPHA },
+    };
+
+    for (auto& c : cases) {
+        const int bpp = (c.flags & FRIED_GRAYSCALE) ? 2 : 4;
+        auto image = (bpp == 4) ? makeSmoothImage(c.width, c.height) : makeTestImage(c.width, c.height, bpp);
+
+        // same image, different layout
+        FRIED_EncodeParams eparams;
+        FRIED_InitEncodeParams(&eparams, c.flags, 31);
+        int32_t plainSize = 0;
+        uint8_t* plain = SaveFRIEDEx(image.data(), c.width, c.height, &eparams, plainSize);
+        REQUIRE(plain != nullptr);
+        eparams.Flags |= FRIED_PROGRESSIVE;
+        eparams.Threads = 3;
+        int32_t size = 0;
+        uint8_t* data = SaveFRIEDEx(image.data(), c.width, c.height, &eparams, size);
+        REQUIRE(data != nullptr);
+        CHECK(size <= FRIED_MaxEncodedSize(c.width, c.height, eparams.Flags));
+
+        FRIED::FileHeader header;
+        memcpy(&header, data, sizeof(header));
+        CHECK(header.Layers == 2);
+        memcpy(&header, plain, sizeof(header));
+        CHECK(header.Layers == 1);
+
+        // serial encode and streaming encoder
+        eparams.Threads = 1;
+        int32_t serialSize = 0;
+        uint8_t* serial = SaveFRIEDEx(image.data(), c.width, c.height, &eparams, serialSize);
+        REQUIRE(serialSize == size);
+        CHECK(memcmp(serial, data, size) == 0);
+        FreeFRIED(serial);
+
+        std::vector<uint8_t> streamed;
+        FRIED_Encoder* enc = FRIED_CreateEncoder(c.width, c.height, &eparams, writeToVector, &streamed);
+        REQUIRE(enc != nullptr);
+        const int half = c.height / 2;
+        CHECK(FRIED_EncoderPushRows(enc, image.data(), half, 0));
+        CHECK(FRIED_EncoderPushRows(enc, image.data() + static_cast<size_t>(half) * c.width * bpp, c.height - half, 0));
+        CHECK(FRIED_FinishEncoder(enc) == size);
+        FRIED_DestroyEncoder(enc);
+        CHECK(streamed == std::vector<uint8_t>(data, data + size));
+
+        // full and scaled decodes, single and multi-threaded, give the interleaved file's pixels
+        auto decode = [&](const uint8_t* file, int32_t fileSize, int scale, int threads, bool preview, std::vector<uint8_t>& out) {
+            FRIED_DecodeParams dparams;
+            FRIED_InitDecodeParams(&dparams);
+            dparams.Scale = scale;
+            dparams.Threads = threads;
+            dparams.Preview = preview;
+            int32_t w = 0, h = 0, outSize = 0;
+            uint8_t* decoded = nullptr;
+            if (!LoadFRIEDEx(file, fileSize, &dparams, w, h, outSize, decoded))
+                return false;
+            out.assign(decoded, decoded + outSize);
+            FreeFRIED(decoded);
+            return true;
+        };
+        std::vector<uint8_t> reference, decoded;
+        for (int scale : {1, 4, 16}) {
+            REQUIRE(decode(plain, plainSize, scale, 1, false, reference));
+            for (int threads : {1, 3}) {
+                REQUIRE(decode(data, size, scale, threads, false, decoded));
+                CHECK(decoded == reference);
+            }
+        }
+        REQUIRE(decode(plain, plainSize, 1, 1, false, reference));
+        if (c.flags & FRIED_LOSSLESS)
+            CHECK(reference == image);
+
+        // streaming decode and a region
+        const int rowBytes = c.width * bpp;
+        struct Collect { std::vector<uint8_t> pixels; int rowBytes; } collect = { {}, rowBytes };
+        auto func = [](void* user, int32_t, const uint8_t* pixels) {
+            auto& col = *static_cast<Collect*>(user);
+            col.pixels.insert(col.pixels.end(), pixels, pixels + col.rowBytes);
+            return true;
+        };
+        FRIED_DecodeParams dparams;
+        FRIED_InitDecodeParams(&dparams);
+        CHECK_FALSE(dparams.Preview);
+        CHECK(FRIED_DecodeRows(data, size, &dparams, func, &collect));
+        CHECK(collect.pixels == reference);
+
+        const int rx = c.width / 3, ry = c.height / 4, rw = c.width / 2, rh = c.height / 2;
+        int32_t regionSize = 0, plainRegionSize = 0;
+        uint8_t *region = nullptr, *plainRegion = nullptr;
+        REQUIRE(LoadFRIEDRegion(data, size, rx, ry, rw, rh, regionSize, region));
+        REQUIRE(LoadFRIEDRegion(plain, plainSize, rx, ry, rw, rh, plainRegionSize, plainRegion));
+        REQUIRE(regionSize == plainRegionSize);
+        CHECK(memcmp(region, plainRegion, regionSize) == 0);
+        FreeFRIED(region);
+        FreeFRIED(plainRegion);
+
+        // the macroblock layer is all a preview needs
+        int32_t previewBytes = 0, fullRows = 0;
+        CHECK_FALSE(FRIED_GetProgress(plain, plainSize, previewBytes, fullRows));
+        REQUIRE(FRIED_GetProgress(data, size, previewBytes, fullRows));
+        CHECK(fullRows == c.height);
+        CHECK(previewBytes > static_cast<int32_t>(sizeof(header)));
+        CHECK(previewBytes < size);
+        if (&c == &cases[0])
+            MESSAGE("macroblock layer: " << previewBytes << " of " << size << " bytes");
+
+        int32_t headerBytes = static_cast<int32_t>(sizeof(header)), unused = 0;
+        CHECK_FALSE(FRIED_GetProgress(data, headerBytes, unused, unused));
+
+        for (int32_t cut : {previewBytes - 1, previewBytes, previewBytes + (size - previewBytes) / 3, size - (size - previewBytes) / 4, size - 1}) {
+            int32_t cutPreview = 0, rows = 0;
+            REQUIRE(FRIED_GetProgress(data, cut, cutPreview, rows));
+            CHECK(cutPreview == previewBytes);
+            CHECK(rows <= c.height);
+
+            // incomplete files only decode as previews, from the macroblock layer on
+            CHECK_FALSE(decode(data, cut, 1, 1, false, decoded));
+            if (cut < previewBytes) {
+                CHECK_FALSE(decode(data, cut, 1, 1, true, decoded));
+                CHECK_FALSE(decode(data, cut, 4, 1, true, decoded));
+                CHECK(rows == 0);
+                continue;
+            }
+
+            // thumbnails are complete, previews are right in the rows that have arrived
+            std::vector<uint8_t> scaledRef;
+            REQUIRE(decode(plain, plainSize, 16, 1, false, scaledRef));
+            REQUIRE(decode(data, cut, 16, 1, true, decoded));
+            CHECK(decoded == scaledRef);
+
+            for (int threads : {1, 3}) {
+                REQUIRE(decode(data, cut, 1, threads, true, decoded));
+                REQUIRE(decoded.size() == reference.size());
+                CHECK(memcmp(decoded.data(), reference.data(), static_cast<size_t>(rows) * rowBytes) == 0);
+            }
+
+            dparams.Preview = true;
+            collect.pixels.clear();
+            CHECK(FRIED_DecodeRows(data, cut, &dparams, func, &collect));
+            CHECK(collect.pixels == decoded);
+            dparams.Preview = false;
+
+            // a preview from the macroblock layer alone is blurry, but close
+            if (cut == previewBytes && !(c.flags & FRIED_LOSSLESS)) {
+                double error = 0.0;
+                for (size_t i = 0; i < decoded.size(); i++)
+                    error += std::abs(decoded[i] - reference[i]);
+                CHECK(error / decoded.size() < 24.0);
+            }
+        }
+
+        FreeFRIED(data);
+        FreeFRIED(plain);
+    }
+
+    // rate control codes the progressive layout too
+    const int width = 333, height = 211;
+    auto image = makeSmoothImage(width, height);
+    FRIED_EncodeParams params;
+    FRIED_InitEncodeParams(&params, FRIED_PROGRESSIVE, 31);
+    params.TargetSize = 20000;
+    int32_t size = 0;
+    uint8_t* data = SaveFRIEDEx(image.data(), width, height, &params, size);
+    REQUIRE(data != nullptr);
+    CHECK(size <= params.TargetSize);
+    int32_t previewBytes = 0, fullRows = 0, w = 0, h = 0, outSize = 0;
+    CHECK(FRIED_GetProgress(data, size, previewBytes, fullRows));
+    CHECK(fullRows == height);
+    uint8_t* decoded = nullptr;
+    REQUIRE(LoadFRIED(data, size, w, h, outSize, decoded));
+    FreeFRIED(decoded);
+    FreeFRIED(data);
+}
+
+TEST_CASE("FRIED streaming decode matches LoadFRIED") {
+    struct { int width, height, flags, threads; } cases[] = {
+        { 333, 211, FRIED_SAVEALPHA, 1 },
+        { 1100, 64, FRIED_DEFAULT, 3 },
+        { 70, 95, FRIED_GRAYSCALE | FRIED_SAVEALPHA, 1 },
+    };
+
+    for (auto& c : cases) {
+        int bpp = (c.flags & FRIED_GRAYSCALE) ? 2 : 4;
+        auto image = makeTestImage(c.width, c.height, bpp);
+
+        int32_t size = 0;
+        uint8_t* data = SaveFRIED(image.data(), c.width, c.height, c.flags, 31, size);
+        REQUIRE(data != nullptr);
+
+        int32_t w = 0, h = 0, outSize = 0;
+        uint8_t* expected = nullptr;
+        REQUIRE(LoadFRIED(data, size, w, h, outSize, expected));
+
+        FRIED_DecodeParams params;
+        FRIED_InitDecodeParams(&params);
+        params.Threads = c.threads;
+
+        // pull in uneven batches into a padded buffer
+        int32_t sw = 0, sh = 0, sbpp = 0;
+        FRIED_Decoder* dec = FRIED_CreateDecoder(data, size, &params, sw, sh, sbpp);
+        REQUIRE(dec != nullptr);
+        CHECK(sw == w);
+        CHECK(sh == h);
+        CHECK(sbpp == bpp);
+
+        int pitch = w * bpp + 8;
+        std::vector<uint8_t> rows(static_cast<size_t>(h) * pitch);
+        int row = 0;
+        for (int batch = 1; row < h; batch += 5) {
+            int32_t n = FRIED_DecoderReadRows(dec, rows.data() + row * pitch, batch, pitch);
+            REQUIRE(n > 0);
+            row += n;
+        }
+        CHECK(row == h);
+        CHECK(FRIED_DecoderReadRows(dec, rows.data(), 1, pitch) == 0);
+        FRIED_DestroyDecoder(dec);
+
+        bool same = true;
+        for (int y = 0; y < h; y++)
+            same = same && memcmp(rows.data() + y * pitch, expected + y * w * bpp, w * bpp) == 0;
+        CHECK(same);
+
+        // row callback
+        struct Collect { std::vector<uint8_t> pixels; int rowBytes, next; } collect = { {}, w * bpp, 0 };
+        auto func = [](void* user, int32_t r, const uint8_t* pixels) {
+            auto& col = *static_cast<Collect*>(user);
+            if (r != col.next++)
+                return false;
+            col.pixels.insert(col.pixels.end(), pixels, pixels + col.rowBytes);
+            return true;
+        };
+        CHECK(FRIED_DecodeRows(data, size, &params, func, &collect));
+        REQUIRE(collect.pixels.size() == static_cast<size_t>(outSize));
+        CHECK(memcmp(collect.pixels.data(), expected, outSize) == 0);
+
+        // truncated data fails somewhere along the way
+        dec = FRIED_CreateDecoder(data, size / 2, &params, sw, sh, sbpp);
+        REQUIRE(dec != nullptr);
+        int32_t n;
+        while ((n = FRIED_DecoderReadRows(dec, rows.data(), 16, pitch)) > 0) {
+        }
+        CHECK(n == -1);
+        FRIED_DestroyDecoder(dec);
+
+        FreeFRIED(expected);
+        FreeFRIED(data);
+    }
+}
+
+TEST_CASE("FRIED reusable encoder/decoder objects") {
+    // big, small, big again, with a change of channel count in between
+    struct { int width, height, flags, threads; } cases[] = {
+        { 1100, 90, FRIED_SAVEALPHA, 3 },
+        { 45, 17, FRIED_GRAYSCALE | FRIED_SAVEALPHA, 1 },
+        { 333, 211, FRIED_DEFAULT, 2 },
+        { 1100, 90, FRIED_SAVEALPHA, 1 },
+    };
+
+    FRIED_Encoder* enc = FRIED_NewEncoder();
+    FRIED_Decoder* dec = FRIED_NewDecoder();
+    REQUIRE(enc != nullptr);
+    REQUIRE(dec != nullptr);
+
+    for (auto& c : cases) {
+        int bpp = (c.flags & FRIED_GRAYSCALE) ? 2 : 4;
+        auto image = makeTestImage(c.width, c.height, bpp);
+
+        int32_t expectedSize = 0;
+        uint8_t* expected = SaveFRIED(image.data(), c.width, c.height, c.flags, 31, expectedSize);
+        REQUIRE(expected != nullptr);
+
+        FRIED_EncodeParams eparams;
+        FRIED_InitEncodeParams(&eparams, c.flags, 31);
+        eparams.Threads = c.threads;
+        int32_t size = 0;
+        const uint8_t* data = FRIED_EncoderSave(enc, image.data(), c.width, c.height, &eparams, size);
+        REQUIRE(data != nullptr);
+        REQUIRE(size == expectedSize);
+        CHECK(memcmp(data, expected, size) == 0);
+
+        int32_t w = 0, h = 0, outSize = 0;
+        uint8_t* pixels = nullptr;
+        REQUIRE(LoadFRIED(expected, expectedSize, w, h, outSize, pixels));
+
+        FRIED_DecodeParams dparams;
+        FRIED_InitDecodeParams(&dparams);
+        dparams.Threads = c.threads;
+        int32_t dw = 0, dh = 0, dsize = 0;
+        const uint8_t* decoded = FRIED_DecoderLoad(dec, expected, expectedSize, &dparams, dw, dh, dsize);
+        REQUIRE(decoded != nullptr);
+        CHECK(dw == w);
+        CHECK(dh == h);
+        REQUIRE(dsize == outSize);
+        CHECK(memcmp(decoded, pixels, outSize) == 0);
+
+        // streaming on the same objects
+        std::vector<uint8_t> file;
+        REQUIRE(FRIED_EncoderBegin(enc, c.width, c.height, &eparams, writeToVector, &file));
+        CHECK(FRIED_EncoderPushRows(enc, image.data(), c.height, 0));
+        CHECK(FRIED_FinishEncoder(enc) == expectedSize);
+        REQUIRE(file.size() == static_cast<size_t>(expectedSize));
+        CHECK(memcmp(file.data(), expected, expectedSize) == 0);
+
+        int32_t sbpp = 0;
+        REQUIRE(FRIED_DecoderBegin(dec, expected, expectedSize, &dparams, dw, dh, sbpp));
+        std::vector<uint8_t> rows(outSize);
+        CHECK(FRIED_DecoderReadRows(dec, rows.data(), h, 0) == h);
+        CHECK(memcmp(rows.data(), pixels, outSize) == 0);
+
+        FreeFRIED(pixels);
+        FreeFRIED(expected);
+    }
+
+    FRIED_DestroyEncoder(enc);
+    FRIED_DestroyDecoder(dec);
+}
+
+TEST_CASE("FRIED threaded decode matches serial decode") {
+    const int width = 1700, height = 70; // several chunks per stripe
+    auto image = makeTestImage(width, height, 4);
+
+    int32_t size = 0;
+    uint8_t* data = SaveFRIED(image.data(), width, height, FRIED_SAVEALPHA, 31, size);
+    REQUIRE(data != nullptr);
+
+    int32_t xout = 0, yout = 0, serialSize = 0;
+    uint8_t* serial = nullptr;
+    REQUIRE(LoadFRIED(data, size, xout, yout, serialSize, serial));
+
+    for (int threads : {2, 4, 0}) {
+        FRIED_DecodeParams params;
+        FRIED_InitDecodeParams(&params);
+        params.Threads = threads;
+
+        int32_t outSize = 0;
+        uint8_t* decoded = nullptr;
+        REQUIRE(LoadFRIEDEx(data, size, &params, xout, yout, outSize, decoded));
+        CHECK(xout == width);
+        CHECK(yout == height);
+        CHECK(outSize == serialSize);
+        CHECK(memcmp(decoded, serial, serialSize) == 0);
+        FreeFRIED(decoded);
+    }
+
+    FreeFRIED(serial);
+    FreeFRIED(data);
+}
+
+TEST_CASE("FRIED band-parallel decode via stripe index") {
+    const int width = 1100, height = 211;
+    auto image = makeTestImage(width, height, 4);
+
+    int32_t size = 0;
+    uint8_t* data = SaveFRIED(image.data(), width, height, FRIED_SAVEALPHA, 31, size);
+    REQUIRE(data != nullptr);
+    CHECK(memcmp(data, FRIED_FILE_VERSION, 8) == 0);
+
+    int32_t xout = 0, yout = 0, serialSize = 0;
+    uint8_t* serial = nullptr;
+    REQUIRE(LoadFRIED(data, size, xout, yout, serialSize, serial));
+
+    // band seams at every possible stripe boundary (14 stripes)
+    for (int threads : {2, 3, 5, 14, 64}) {
+        FRIED_DecodeParams params;
+        FRIED_InitDecodeParams(&params);
+        params.Threads = threads;
+
+        int32_t outSize = 0;
+        uint8_t* decoded = nullptr;
+        REQUIRE(LoadFRIEDEx(data, size, &params, xout, yout, outSize, decoded));
+        CHECK(outSize == serialSize);
+        CHECK(memcmp(decoded, serial, serialSize) == 0);
+        FreeFRIED(decoded);
+    }
+
+    FreeFRIED(serial);
+    FreeFRIED(data);
+}
+
+TEST_CASE("FRIED encode/decode statistics") {
+    const int width = 1100, height = 211; // 3 chunks, 14 stripes
+    const int nstripes = 14, nchunks = 3, nchans = 4;
+    auto image = makeTestImage(width, height, 4);
+
+    for (int threads : {1, 3}) {
+        std::vector<int32_t> encStripes(nstripes), decStripes(nstripes);
+        FRIED_Stats encStats = {};
+        encStats.StripeBytes = encStripes.data();
+        encStats.MaxStripes = nstripes;
+
+        FRIED_EncodeParams encParams;
+        FRIED_InitEncodeParams(&encParams, FRIED_SAVEALPHA, 31);
+        encParams.Threads = threads;
+        encParams.Stats = &encStats;
+
+        int32_t size = 0;
+        uint8_t* data = SaveFRIEDEx(image.data(), width, height, &encParams, size);
+        REQUIRE(data != nullptr);
+
+        FRIED_Stats decStats = {};
+        decStats.StripeBytes = decStripes.data();
+        decStats.MaxStripes = nstripes;
+
+        FRIED_DecodeParams decParams;
+        FRIED_InitDecodeParams(&decParams);
+        decParams.Threads = threads;
+        decParams.Stats = &decStats;
+
+        int32_t xout = 0, yout = 0, outSize = 0;
+        uint8_t* decoded = nullptr;
+        REQUIRE(LoadFRIEDEx(data, size, &decParams, xout, yout, outSize, decoded));
+
+        for (const FRIED_Stats* stats : {&encStats, &decStats}) {
+            CHECK(stats->Channels == nchans);
+            CHECK(stats->Stripes == nstripes);
+            CHECK(stats->ChannelType[0] == FRIED::CHANNEL_Y);
+            CHECK(stats->ChannelType[3] == FRIED::CHANNEL_ALPHA);
+        }
+
+        if (encStats.Collected) {
+            CHECK(decStats.Collected);
+
+            // every stripe of the file, counted once
+            int32_t headerSize = sizeof(FRIED::FileHeader) + nchans * sizeof(FRIED::ChannelHeader) + nstripes * sizeof(int32_t);
+            int64_t stripeTotal = 0;
+            for (int i = 0; i < nstripes; i++) {
+                CHECK(encStripes[i] == decStripes[i]);
+                stripeTotal += encStripes[i];
+            }
+            CHECK(stripeTotal == size - headerSize);
+
+            int64_t histTotal = 0;
+            for (int i = 0; i < 17; i++) {
+                CHECK(encStats.EncSizeHistogram[i] == decStats.EncSizeHistogram[i]);
+                histTotal += encStats.EncSizeHistogram[i];
+            }
+            CHECK(histTotal == int64_t(nstripes) * nchunks * nchans);
+
+            // the rest of the stripes are chunk lengths (2 bytes) and encsizes (1-2 bytes)
+            int64_t chanTotal = 0;
+            for (int ch = 0; ch < nchans; ch++) {
+                CHECK(encStats.ChannelBytes[ch] == decStats.ChannelBytes[ch]);
+                CHECK(encStats.ChannelCoeffs[ch] == decStats.ChannelCoeffs[ch]);
+                CHECK(encStats.ChannelNonzero[ch] == decStats.ChannelNonzero[ch]);
+                CHECK(encStats.ChannelNonzero[ch] <= encStats.ChannelCoeffs[ch]);
+                chanTotal += encStats.ChannelBytes[ch];
+            }
+            CHECK(chanTotal + int64_t(nstripes) * nchunks * (2 + nchans) <= stripeTotal);
+            CHECK(chanTotal + int64_t(nstripes) * nchunks * (2 + 2 * nchans) >= stripeTotal);
+            CHECK(encStats.ChannelCoeffs[0] == int64_t(nstripes) * 1120 * 16); // padded width
+            CHECK(encStats.EntropyTime > 0.0);
+            CHECK(decStats.EntropyTime > 0.0);
+        } else {
+            CHECK_FALSE(decStats.Collected);
+            CHECK(encStats.EntropyTime == 0.0);
+            CHECK(encStats.ChannelBytes[0] == 0);
+            CHECK(encStripes[0] == 0);
+        }
+
+        FreeFRIED(decoded);
+        FreeFRIED(data);
+    }
+}
+
+TEST_CASE("FRIED region decode matches full decode") {
+    const int width = 1100, height = 211;
+    auto image = makeTestImage(width, height, 4);
+
+    int32_t size = 0;
+    uint8_t* data = SaveFRIED(image.data(), width, height, FRIED_SAVEALPHA, 31, size);
+    REQUIRE(data != nullptr);
+
+    int32_t xout = 0, yout = 0, fullSize = 0;
+    uint8_t* full = nullptr;
+    REQUIRE(LoadFRIED(data, size, xout, yout, fullSize, full));
+
+    // x, y, w, h: corners, chunk and stripe seams, a single pixel, the whole image
+    const int regions[][4] = {
+        {0, 0, 256, 256 - 45}, {510, 14, 5, 20}, {1023, 31, 77, 180}, {700, 100, 1, 1},
+        {0, 195, 1100, 16}, {511, 0, 2, 211}, {0, 0, width, height},
+    };
+
+    for (auto& r : regions) {
+        int32_t outSize = 0;
+        uint8_t* region = nullptr;
+        REQUIRE(LoadFRIEDRegion(data, size, r[0], r[1], r[2], r[3], outSize, region));
+        REQUIRE(outSize == r[2] * r[3] * 4);
+
+        for (int y = 0; y < r[3]; y++)
+            CHECK(memcmp(region + y * r[2] * 4, full + ((r[1] + y) * width + r[0]) * 4, r[2] * 4) == 0);
+
+        FreeFRIED(region);
+    }
+
+    int32_t outSize = 0;
+    uint8_t* region = nullptr;
+    CHECK_FALSE(LoadFRIEDRegion(data, size, width - 10, 0, 11, 1, outSize, region));
+    CHECK_FALSE(LoadFRIEDRegion(data, size, 0, 0, 0, 1, outSize, region));
+
+    FreeFRIED(full);
+    FreeFRIED(data);
+}
+
+// makeTestImage(40, 24, 4) saved by the FRIED002 encoder with FRIED_SAVEALPHA, quality 64
+static const uint8_t fried002Image[] = {
+    0x46, 0x52, 0x49, 0x45, 0x44, 0x30, 0x30, 0x32, 0x28, 0x00, 0x00, 0x00,
+    0x18, 0x00, 0x00, 0x00, 0x40, 0x00, 0x00, 0x00, 0x04, 0x01, 0x40, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x40, 0x40, 0x00, 0x00,
+    0x00, 0x00, 0x04, 0x00, 0x00, 0x03, 0x40, 0x80, 0x00, 0x00, 0x00, 0x00,
+    0x08, 0x00, 0x00, 0x04, 0x40, 0xc0, 0x00, 0x00, 0x00, 0x00, 0x0c, 0x00,
+    0x00, 0x35, 0x00, 0x5c, 0xff, 0xff, 0xff, 0xa8, 0xe1, 0x20, 0x88, 0x00,
+    0x97, 0xd0, 0x00, 0x24, 0x04, 0x80, 0x00, 0x02, 0xb1, 0x13, 0xc9, 0x29,
+    0x0a, 0x80, 0x00, 0xe6, 0x44, 0x20, 0x2b, 0x42, 0x00, 0x04, 0x3c, 0x50,
+    0x78, 0x00, 0x00, 0x0a, 0xff, 0xff, 0xff, 0xb0, 0x50, 0xc0, 0x00, 0xc3,
+    0x1d, 0x00, 0x00, 0xa8, 0x88, 0x00, 0x2f, 0x00, 0x5a, 0xff, 0xff, 0xfd,
+    0x86, 0xd0, 0x00, 0x80, 0x09, 0x7a, 0x00, 0x01, 0x50, 0x00, 0x02, 0xb1,
+    0xd2, 0x4f, 0x28, 0x00, 0x1d, 0x80, 0x04, 0x74, 0x43, 0x80, 0x00, 0x1a,
+    0xff, 0xff, 0xff, 0xd8, 0xa8, 0x60, 0x00, 0x61, 0x8e, 0x80, 0x08, 0x00,
+    0x1f, 0x24, 0x00, 0x03, 0x70,
+};
+
+TEST_CASE("FRIED002 files decode like current files") {
+    const int width = 40, height = 24;
+    auto image = makeTestImage(width, height, 4);
+
+    // same coefficients, different stream layout
+    int32_t size = 0;
+    uint8_t* data = SaveFRIED(image.data(), width, height, FRIED_SAVEALPHA, 64, size);
+    REQUIRE(data != nullptr);
+
+    for (int scale : {1, 4, 16}) {
+        FRIED_DecodeParams params;
+        FRIED_InitDecodeParams(&params);
+        params.Scale = scale;
+
+        int32_t xout = 0, yout = 0, outSize = 0, oldXout = 0, oldYout = 0, oldSize = 0;
+        uint8_t* decoded = nullptr;
+        uint8_t* old = nullptr;
+        REQUIRE(LoadFRIEDEx(data, size, &params, xout, yout, outSize, decoded));
+        REQUIRE(LoadFRIEDEx(fried002Image, sizeof(fried002Image), &params, oldXout, oldYout, oldSize, old));
+        CHECK(oldXout == xout);
+        CHECK(oldYout == yout);
+        REQUIRE(oldSize == outSize);
+        CHECK(memcmp(old, decoded, outSize) == 0);
+        FreeFRIED(old);
+        FreeFRIED(decoded);
+    }
+
+    FreeFRIED(data);
+}
+
+TEST_CASE("FRIED scaled decode from macroblock coefficients") {
+    const int width = 333, height = 211;
+    auto image = makeTestImage(width, height, 4);
+
+    int32_t size = 0;
+    uint8_t* data = SaveFRIED(image.data(), width, height, FRIED_SAVEALPHA, 31, size);
+    REQUIRE(data != nullptr);
+
+    int32_t xout = 0, yout = 0, fullSize = 0;
+    uint8_t* full = nullptr;
+    REQUIRE(LoadFRIED(data, size, xout, yout, fullSize, full));
+
+    for (int scale : {4, 16}) {
+        FRIED_DecodeParams params;
+        FRIED_InitDecodeParams(&params);
+        params.Scale = scale;
+
+        int32_t sx = 0, sy = 0, outSize = 0;
+        uint8_t* scaled = nullptr;
+        REQUIRE(LoadFRIEDEx(data, size, &params, sx, sy, outSize, scaled));
+        CHECK(sx == (width + scale - 1) / scale);
+        CHECK(sy == (height + scale - 1) / scale);
+        REQUIRE(outSize == sx * sy * 4);
+
+        // pixels should be close to the box filtered full decode (the
+        // partially covered blocks at the right and bottom edge aren't)
+        double sumDiff = 0;
+        int count = 0;
+
+        for (int y = 0; y < height / scale; y++) {
+            for (int x = 0; x < width / scale; x++) {
+                for (int c = 0; c < 4; c++) {
+                    int sum = 0;
+                    for (int yy = 0; yy < scale; yy++)
+                        for (int xx = 0; xx < scale; xx++)
+                            sum += full[((y * scale + yy) * width + x * scale + xx) * 4 + c];
+
+                    sumDiff += std::abs(sum / (scale * scale) - scaled[(y * sx + x) * 4 + c]);
+                    count++;
+                }
+            }
+        }
+
+        MESSAGE("scale 1/" << scale << " average difference: " << sumDiff / count);
+        CHECK(sumDiff / count < 4.0);
+        FreeFRIED(scaled);
+    }
+
+    // flat images come out exact
+    std::vector<uint8_t> flat(64 * 48 * 4);
+    for (size_t i = 0; i < flat.size(); i += 4) {
+        flat[i + 0] = 200;
+        flat[i + 1] = 100;
+        flat[i + 2] = 50;
+        flat[i + 3] = 255;
+    }
+
+    int32_t flatSize = 0;
+    uint8_t* flatData = SaveFRIED(flat.data(), 64, 48, FRIED_SAVEALPHA, 0, flatSize);
+    REQUIRE(flatData != nullptr);
+
+    for (int scale : {4, 16}) {
+        FRIED_DecodeParams params;
+        FRIED_InitDecodeParams(&params);
+        params.Scale = scale;
+
+        int32_t sx = 0, sy = 0, outSize = 0;
+        uint8_t* scaled = nullptr;
+        REQUIRE(LoadFRIEDEx(flatData, flatSize, &params, sx, sy, outSize, scaled));
+        REQUIRE(outSize == (64 / scale) * (48 / scale) * 4);
+        CHECK(memcmp(scaled, flat.data(), outSize) == 0);
+        FreeFRIED(scaled);
+    }
+
+    FRIED_DecodeParams params;
+    FRIED_InitDecodeParams(&params);
+    params.Scale = 2;
+
+    int32_t outSize = 0;
+    uint8_t* scaled = nullptr;
+    CHECK_FALSE(LoadFRIEDEx(data, size, &params, xout, yout, outSize, scaled));
+
+    FreeFRIED(flatData);
+    FreeFRIED(full);
+    FreeFRIED(data);
+}
+
+// coefficients with long zero runs, small values and a few big ones
+static std::vector<int32_t> makeTestCoeffs() {
+    std::vector<int32_t> x(20000);
+    uint32_t seed = 3;
+    for (size_t i = 0; i < x.size(); i++) {
+        seed = seed * 1664525u + 1013904223u;
+        uint32_t r = seed >> 16;
+        if ((i / 1000) % 3 == 0)
+            x[i] = (r % 64 == 0) ? static_cast<int32_t>(r % 9) - 4 : 0;
+        else if ((i / 1000) % 3 == 1)
+            x[i] = static_cast<int32_t>(r % 41) - 20;
+        else
+            x[i] = (r % 8 == 0) ? static_cast<int32_t>(r) - 32768 : static_cast<int32_t>(r % 3) - 1;
+    }
+    return x;
+}
+
+TEST_CASE("FRIED rlgr encoder output is unchanged") {
+    // sizes and FNV-1a hashes of the output of the original bytewise encoder
+    struct { int32_t xminit, bytes; uint32_t hash; } expected[] = {
+        { 0, 66930, 0x4035aa09u },
+        { 5, 66929, 0x246f8ce0u },
+        { 94, 66934, 0x4935fb1fu },
+        { 625, 66940, 0xcbffc102u },
+    };
+    auto x = makeTestCoeffs();
+    const int32_t n = static_cast<int32_t>(x.size());
+
+    for (auto& e : expected) {
+        std::vector<uint8_t> buf(x.size() * 8);
+        int32_t bytes = FRIED::rlgrenc(buf.data(), static_cast<int32_t>(buf.size()), x.data(), n, e.xminit);
+
+        uint32_t hash = 2166136261u;
+        for (int32_t i = 0; i < bytes; i++) {
+            hash ^= buf[i];
+            hash *= 16777619u;
+        }
+
+        CHECK(bytes == e.bytes);
+        CHECK(hash == e.hash);
+
+        std::vector<int16_t> decoded(x.size());
+        FRIED::rlgrdec(buf.data(), bytes, decoded.data(), n, e.xminit);
+        CHECK(std::equal(x.begin(), x.end(), decoded.begin()));
+
+        // a short buffer gets a prefix of the stream and nothing past its end
+        std::vector<uint8_t> small(1024, 0xcd);
+        int32_t cut = FRIED::rlgrenc(small.data(), 1001, x.data(), n, e.xminit);
+        CHECK(cut == 1001);
+        CHECK(memcmp(small.data(), buf.data(), cut) == 0);
+        CHECK(small[cut] == 0xcd);
+    }
+}
+
+TEST_CASE("FRIED rlgr decoder stays inside truncated input") {
+    auto x = makeTestCoeffs();
+    const int32_t n = static_cast<int32_t>(x.size());
+    std::vector<uint8_t> buf(x.size() * 8);
+    int32_t bytes = FRIED::rlgrenc(buf.data(), static_cast<int32_t>(buf.size()), x.data(), n, 5);
+
+    // the decoder reads zeros past the end, so cut and garbage streams
+    // (exact-size copies, for address sanitizer builds) still terminate
+    for (int32_t len : {0, 1, 7, 9, 1001, bytes - 1}) {
+        std::vector<uint8_t> cut(buf.begin(), buf.begin() + len);
+        std::vector<int16_t> decoded(x.size());
+        int32_t read = FRIED::rlgrdec(cut.data(), len, decoded.data(), n, 5);
+        CHECK(read >= 0);
+    }
+
+    for (uint8_t fill : {0x00, 0x55, 0xff}) {
+        std::vector<uint8_t> garbage(333, fill);
+        std::vector<int16_t> decoded(x.size());
+        FRIED::rlgrdec(garbage.data(), 333, decoded.data(), n, 94);
+    }
+
+    // a complete stream reports its exact length
+    std::vector<int16_t> decoded(x.size());
+    CHECK(FRIED::rlgrdec(buf.data(), bytes, decoded.data(), n, 5) == bytes);
+}
+
+TEST_CASE("FRIED simd transforms match plain C") {
+    // random rows of every 16-bit value, widths that leave remainders for
+    // each vector size
+    uint32_t seed = 7;
+    for (int width : {4, 28, 32, 60, 64, 92, 132, 516}) {
+        std::vector<int16_t> rows(width * 4), simd, plain;
+        for (auto& v : rows) {
+            seed = seed * 1664525u + 1013904223u;
+            v = static_cast<int16_t>(seed >> 16);
+        }
+
+        for (int kernel = 0; kernel < 3; kernel++) {
+            for (int pass = 0; pass < 2; pass++) {
+                auto& out = pass ? plain : simd;
+                out = rows;
+                FRIED::SetCpuFeatureMask(pass ? 0 : ~0);
+
+                int16_t* p = out.data();
+                if (kernel == 0)
+                    FRIED::indct42D_row(p, p + width, p + 2 * width, p + 3 * width, width);
+                else if (kernel == 1)
+                    FRIED::lbt4post4x4_row(p, p + width, p + 2 * width, p + 3 * width, width);
+                else
+                    FRIED::indct42D_lossless_row(p, p + width, p + 2 * width, p + 3 * width, width);
+            }
+
+            CHECK(simd == plain);
+        }
+    }
+
+    FRIED::SetCpuFeatureMask(~0);
+}
+
+TEST_CASE("FRIED simd color conversion matches plain C") {
+    typedef void (*DirFunc)(int32_t, int32_t, const uint8_t*, int32_t*);
+    typedef void (*InvFunc)(int32_t, int32_t, const int16_t*, uint8_t*);
+    const DirFunc dir[4] = { FRIED::gray_x_convert_dir, FRIED::gray_alpha_convert_dir,
+                             FRIED::color_x_convert_dir, FRIED::color_alpha_convert_dir };
+    const InvFunc inv[4] = { FRIED::gray_x_convert_inv, FRIED::gray_alpha_convert_inv,
+                             FRIED::color_x_convert_inv, FRIED::color_alpha_convert_inv };
+    const int32_t masks[] = { ~0, FRIED::CPU_SSE2 };
+
+    // random bytes and coefficients of every 16-bit value (so the clamping
+    // and the lifting steps get values far outside the pixel range)
+    uint32_t seed = 11;
+    for (int cols : {1, 7, 8, 15, 16, 33, 100}) {
+        const int colsPad = cols + 3;
+        std::vector<uint8_t> pixels(cols * 4);
+        std::vector<int16_t> coeffs(colsPad * 4);
+        for (auto& v : pixels) {
+            seed = seed * 1664525u + 1013904223u;
+            v = static_cast<uint8_t>(seed >> 24);
+        }
+        for (auto& v : coeffs) {
+            seed = seed * 1664525u + 1013904223u;
+            v = static_cast<int16_t>(seed >> 16);
+        }
+
+        for (int setup = 0; setup < 4; setup++) {
+            bool color = setup >= 2, alpha = (setup & 1) != 0;
+            std::vector<int32_t> plainDir(colsPad * 4, -1);
+            std::vector<uint8_t> plainInv(cols * 4, 0), plainLossless(cols * 4, 0);
+
+            FRIED::SetCpuFeatureMask(0);
+            dir[setup](cols, colsPad, pixels.data(), plainDir.data());
+            inv[setup](cols, colsPad, coeffs.data(), plainInv.data());
+            FRIED::lossless_convert_inv(cols, colsPad, coeffs.data(), plainLossless.data(), color, alpha);
+
+            for (int32_t mask : masks) {
+                std::vector<int32_t> simdDir(colsPad * 4, -1);
+                std::vector<uint8_t> simdInv(cols * 4, 0), simdLossless(cols * 4, 0);
+
+                FRIED::SetCpuFeatureMask(mask);
+                dir[setup](cols, colsPad, pixels.data(), simdDir.data());
+                inv[setup](cols, colsPad, coeffs.data(), simdInv.data());
+                FRIED::lossless_convert_inv(cols, colsPad, coeffs.data(), simdLossless.data(), color, alpha);
+
+                CHECK(simdDir == plainDir);
+                CHECK(simdInv == plainInv);
+                CHECK(simdLossless == plainLossless);
+            }
+        }
+    }
+
+    FRIED::SetCpuFeatureMask(~0);
+}
+
+TEST_CASE("FRIED simd decode is bit-exact at all quality levels") {
+    const int width = 333, height = 75;
+    auto image = makeTestImage(width, height, 4);
+
+    for (int quality = 0; quality < 128; quality++) {
+        int32_t size = 0;
+        uint8_t* data = SaveFRIED(image.data(), width, height, FRIED_SAVEALPHA, static_cast<uint8_t>(quality), size);
+        REQUIRE(data != nullptr);
+
+        int32_t xout = 0, yout = 0, simdSize = 0, plainSize = 0;
+        uint8_t* simd = nullptr;
+        uint8_t* plain = nullptr;
+
+        FRIED::SetCpuFeatureMask(~0);
+        REQUIRE(LoadFRIED(data, size, xout, yout, simdSize, simd));
+        FRIED::SetCpuFeatureMask(0);
+        REQUIRE(LoadFRIED(data, size, xout, yout, plainSize, plain));
+        FRIED::SetCpuFeatureMask(~0);
+
+        REQUIRE(simdSize == plainSize);
+        CHECK(memcmp(simd, plain, simdSize) == 0);
+
+        FreeFRIED(plain);
+        FreeFRIED(simd);
+        FreeFRIED(data);
+    }
+
+    // lossless files decode to the source either way
+    for (int flags : { FRIED_LOSSLESS | FRIED_SAVEALPHA, FRIED_LOSSLESS | FRIED_GRAYSCALE | FRIED_SAVEALPHA }) {
+        int bpp = (flags & FRIED_GRAYSCALE) ? 2 : 4;
+        auto source = makeTestImage(width, height, bpp);
+        int32_t size = 0;
+        uint8_t* data = SaveFRIED(source.data(), width, height, flags, 0, size);
+        REQUIRE(data != nullptr);
+
+        for (int32_t mask : { ~0, static_cast<int32_t>(FRIED::CPU_SSE2), 0 }) {
+            int32_t xout = 0, yout = 0, outSize = 0;
+            uint8_t* pixels = nullptr;
+
+            FRIED::SetCpuFeatureMask(mask);
+            REQUIRE(LoadFRIED(data, size, xout, yout, outSize, pixels));
+            REQUIRE(outSize == width * height * bpp);
+            CHECK(memcmp(pixels, source.data(), outSize) == 0);
+            FreeFRIED(pixels);
+        }
+
+        FRIED::SetCpuFeatureMask(~0);
+        FreeFRIED(data);
+    }
+}
+
+TEST_CASE("FRIED simd coefficient shuffle is bit-exact at all widths") {
+    // macroblock counts below, at and above the 8 the dc gather works on
+    const int widths[] = { 16, 100, 128, 129, 255, 256, 600 };
+    const int32_t masks[] = { ~0, FRIED::CPU_SSE2 };
+
+    for (int width : widths) {
+        const int height = 40;
+        auto image = makeTestImage(width, height, 4);
+        int32_t size = 0;
+        uint8_t* data = SaveFRIED(image.data(), width, height, FRIED_SAVEALPHA, 20, size);
+        REQUIRE(data != nullptr);
+
+        int32_t xout = 0, yout = 0, plainSize = 0;
+        uint8_t* plain = nullptr;
+        FRIED::SetCpuFeatureMask(0);
+        REQUIRE(LoadFRIED(data, size, xout, yout, plainSize, plain));
+
+        for (int32_t mask : masks) {
+            int32_t simdSize = 0;
+            uint8_t* simd = nullptr;
+
+            FRIED::SetCpuFeatureMask(mask);
+            REQUIRE(LoadFRIED(data, size, xout, yout, simdSize, simd));
+            REQUIRE(simdSize == plainSize);
+            CHECK(memcmp(simd, plain, simdSize) == 0);
+            FreeFRIED(simd);
+        }
+
+        FRIED::SetCpuFeatureMask(~0);
+        FreeFRIED(plain);
+        FreeFRIED(data);
+    }
+}
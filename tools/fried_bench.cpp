@@ -0,0 +1,403 @@
+
+// fried_bench: throughput of the single codec stages on one chunk of
+// synthetic data, of SaveFRIEDEx/LoadFRIEDEx on whole images, and of
+// lossless files against PNG (stb_image) on the same images, as JSON.
+#include "fried/fried.hpp"
+#include "fried/fried_internal.hpp"
+#include "fried/simd.hpp"
+#include "stb_image.h"
+#include "stb_image_write.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+struct Options {
+    double minTime = 0.25;        // seconds per measurement
+    int32_t threads = 1;          // SaveFRIEDEx/LoadFRIEDEx threads
+    bool quick = false;           // fewer image sizes and quality levels
+    bool noSimd = false;          // plain C kernels only
+    const char* output = nullptr; // JSON file (default: stdout)
+    std::vector<const char*> corpus;
+};
+
+// fastest pass of run() over at least minTime seconds and 3 passes.
+// prepare() restores the input of in-place stages and isn't timed.
+static double bestTime(double minTime, const std::function<void()>& prepare, const std::function<void()>& run) {
+    double best = 1e30, total = 0.0;
+    for (int passes = 0; passes < 3 || total < minTime; passes++) {
+        prepare();
+        auto start = Clock::now();
+        run();
+        double t = std::chrono::duration<double>(Clock::now() - start).count();
+        best = std::min(best, t);
+        total += t;
+    }
+    return best;
+}
+
+static std::string jsonString(const std::string& s) {
+    std::string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\')
+            out += '\\';
+        if (static_cast<unsigned char>(c) >= 0x20)
+            out += c;
+    }
+    return out + "\"";
+}
+
+// like the test images: gradients plus a little noise, or just noise
+static std::vector<uint8_t> makeImage(int width, int height, bool noise) {
+    std::vector<uint8_t> image(static_cast<size_t>(width) * height * 4);
+    uint32_t seed = 1;
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            for (int c = 0; c < 4; c++) {
+                seed = seed * 1664525u + 1013904223u;
+                int value = noise ? static_cast<int>(seed >> 24) : (x * (c + 1) + y * (3 - c)) / 2 + static_cast<int>(seed >> 28);
+                image[(static_cast<size_t>(y) * width + x) * 4 + c] = static_cast<uint8_t>(value & 0xff);
+            }
+        }
+    }
+
+    return image;
+}
+
+struct StageResult {
+    std::string name;
+    double seconds;
+    int64_t pixels, bytes;       // per pass; bytes is the stage's input size
+};
+
+// every stage works on one chunk of the Y channel: 16 rows of chunkWidth,
+// with data from the previous stage, so the coefficient statistics are those
+// of a real (synthetic) image.
+static std::vector<StageResult> benchStages(const Options& opt) {
+    const int32_t cw = 512, rows = 16, npix = cw * rows, qs = 31;
+    std::vector<StageResult> results;
+    auto add = [&](const char* name, int64_t bytes, const std::function<void()>& prepare, const std::function<void()>& run) {
+        results.push_back({ name, bestTime(opt.minTime, prepare, run), npix, bytes });
+    };
+    auto none = [] {};
+
+    std::vector<uint8_t> image = makeImage(cw, rows, false);
+
+    // color conversion: 4 planes of cw per row
+    std::vector<int32_t> planes(static_cast<size_t>(rows) * 4 * cw);
+    add("color_convert_dir", npix * 4, none, [&] {
+        for (int32_t r = 0; r < rows; r++)
+            FRIED::color_alpha_convert_dir(cw, cw, &image[r * cw * 4], &planes[r * 4 * cw]);
+    });
+
+    // the Y plane as a chunk (16 rows of cw)
+    std::vector<int32_t> pixels(npix), work(npix);
+    for (int32_t r = 0; r < rows; r++)
+        memcpy(&pixels[r * cw], &planes[r * 4 * cw], cw * sizeof(int32_t));
+
+    auto row = [&](std::vector<int32_t>& v, int32_t r) { return &v[r * cw]; };
+    auto restore = [&] { work = pixels; };
+
+    add("lbt4pre4x4", npix * 4, restore, [&] {
+        for (int32_t r = 0; r < rows; r += 4)
+            for (int32_t col = 0; col < cw - 4; col += 4)
+                FRIED::lbt4pre4x4(row(work, r) + col + 2, row(work, r + 1) + col + 2, row(work, r + 2) + col + 2, row(work, r + 3) + col + 2);
+    });
+
+    add("ndct42D", npix * 4, restore, [&] {
+        for (int32_t r = 0; r < rows; r += 4)
+            for (int32_t col = 0; col < cw; col += 4)
+                FRIED::ndct42D(row(work, r) + col, row(work, r + 1) + col, row(work, r + 2) + col, row(work, r + 3) + col);
+    });
+
+    std::vector<int32_t> blocks = work;
+    add("ndct42D_MB", npix * 4, [&] { work = blocks; }, [&] {
+        for (int32_t col = 0; col < cw; col += 16)
+            FRIED::ndct42D_MB(row(work, 0) + col, row(work, 4) + col, row(work, 8) + col, row(work, 12) + col);
+    });
+
+    std::vector<int32_t> transformed = work, reordered(npix);
+    add("reorder", npix * 4, none, [&] { FRIED::reorder(reordered.data(), transformed.data(), cw); });
+
+    std::vector<int32_t> quantized(npix);
+    int32_t encsize = 0;
+    add("newQuantize", npix * 4, [&] { quantized = reordered; }, [&] { encsize = FRIED::newQuantize(qs, quantized.data(), npix, cw); });
+    encsize = (encsize + 7) & ~7;
+
+    // both coefficient streams, like encodeStripe
+    std::vector<uint8_t> bits(npix * 8);
+    int32_t mbBytes = 0, acBytes = 0;
+    add("rlgrenc", npix * 4, none, [&] {
+        mbBytes = FRIED::rlgrenc(bits.data(), static_cast<int32_t>(bits.size()), quantized.data(), std::min(encsize, cw), 625 >> (qs >> 3));
+        acBytes = encsize > cw ? FRIED::rlgrenc(bits.data() + mbBytes, static_cast<int32_t>(bits.size()) - mbBytes, quantized.data() + cw, encsize - cw, 94 >> (qs >> 3)) : 0;
+    });
+
+    std::vector<int16_t> coeffs(npix);
+    add("rlgrdec", mbBytes + acBytes, [&] { std::fill(coeffs.begin(), coeffs.end(), 0); }, [&] {
+        FRIED::rlgrdec(bits.data(), mbBytes, coeffs.data(), std::min(encsize, cw), 625 >> (qs >> 3));
+        if (encsize > cw)
+            FRIED::rlgrdec(bits.data() + mbBytes, acBytes, coeffs.data() + cw, encsize - cw, 94 >> (qs >> 3));
+    });
+
+    std::vector<int16_t> decoded = coeffs, dequantized(npix);
+    add("newDequantize", npix * 2, [&] { dequantized = decoded; }, [&] { FRIED::newDequantize(qs, dequantized.data(), encsize, cw); });
+
+    std::vector<int16_t> stripe(npix);
+    int16_t* srp[16];
+    for (int32_t r = 0; r < rows; r++)
+        srp[r] = &stripe[r * cw];
+    add("inv_reorder", npix * 2, none, [&] { FRIED::inv_reorder(srp, 0, dequantized.data(), cw); });
+
+    std::vector<int16_t> spatial = stripe, iwork(npix);
+    auto irow = [&](int32_t r) { return &iwork[r * cw]; };
+    add("indct42D_MB", npix * 2, [&] { iwork = spatial; }, [&] {
+        for (int32_t col = 0; col < cw; col += 16)
+            FRIED::indct42D_MB(irow(0) + col, irow(4) + col, irow(8) + col, irow(12) + col);
+    });
+
+    spatial = iwork;
+    add("indct42D_row", npix * 2, [&] { iwork = spatial; }, [&] {
+        for (int32_t r = 0; r < rows; r += 4)
+            FRIED::indct42D_row(irow(r), irow(r + 1), irow(r + 2), irow(r + 3), cw);
+    });
+
+    spatial = iwork;
+    add("lbt4post4x4_row", npix * 2, [&] { iwork = spatial; }, [&] {
+        for (int32_t r = 0; r < rows; r += 4)
+            FRIED::lbt4post4x4_row(irow(r) + 2, irow(r + 1) + 2, irow(r + 2) + 2, irow(r + 3) + 2, cw - 4);
+    });
+
+    add("indct42D_lossless_row", npix * 2, [&] { iwork = spatial; }, [&] {
+        for (int32_t r = 0; r < rows; r += 4)
+            FRIED::indct42D_lossless_row(irow(r), irow(r + 1), irow(r + 2), irow(r + 3), cw);
+    });
+
+    // 4 planes of int16 back to pixels
+    std::vector<int16_t> iplanes(static_cast<size_t>(rows) * 4 * cw);
+    for (size_t i = 0; i < iplanes.size(); i++)
+        iplanes[i] = static_cast<int16_t>(planes[i]);
+    std::vector<uint8_t> out(static_cast<size_t>(npix) * 4);
+    add("color_convert_inv", npix * 4 * 2, none, [&] {
+        for (int32_t r = 0; r < rows; r++)
+            FRIED::color_alpha_convert_inv(cw, cw, &iplanes[r * 4 * cw], &out[r * cw * 4]);
+    });
+    add("lossless_convert_inv", npix * 4 * 2, none, [&] {
+        for (int32_t r = 0; r < rows; r++)
+            FRIED::lossless_convert_inv(cw, cw, &iplanes[r * 4 * cw], &out[r * cw * 4], true, true);
+    });
+
+    return results;
+}
+
+struct CodecResult {
+    std::string image;
+    int width, height, quality;
+    int32_t size;
+    double encodeSeconds, decodeSeconds;
+};
+
+static void benchCodec(const Options& opt, const std::string& name, const uint8_t* image, int width, int height, std::vector<CodecResult>& results) {
+    std::vector<int> qualities = opt.quick ? std::vector<int>{ 31 } : std::vector<int>{ 0, 15, 31, 63, 127 };
+
+    for (int quality : qualities) {
+        FRIED_EncodeParams eparams;
+        FRIED_InitEncodeParams(&eparams, FRIED_SAVEALPHA, static_cast<uint8_t>(quality));
+        eparams.Threads = opt.threads;
+        FRIED_DecodeParams dparams;
+        FRIED_InitDecodeParams(&dparams);
+        dparams.Threads = opt.threads;
+
+        uint8_t* data = nullptr;
+        int32_t size = 0;
+        double encode = bestTime(opt.minTime, [&] { FreeFRIED(data); data = nullptr; }, [&] {
+            data = SaveFRIEDEx(image, width, height, &eparams, size);
+        });
+        if (!data) {
+            fprintf(stderr, "encoding %s at quality %d failed\n", name.c_str(), quality);
+            continue;
+        }
+
+        uint8_t* pixels = nullptr;
+        int32_t xout, yout, outSize;
+        double decode = bestTime(opt.minTime, [&] { FreeFRIED(pixels); pixels = nullptr; }, [&] {
+            LoadFRIEDEx(data, size, &dparams, xout, yout, outSize, pixels);
+        });
+        FreeFRIED(pixels);
+        FreeFRIED(data);
+
+        results.push_back({ name, width, height, quality, size, encode, decode });
+    }
+}
+
+struct LosslessResult {
+    std::string image;
+    int width, height;
+    int32_t size, pngSize;
+    double encodeSeconds, decodeSeconds, pngDecodeSeconds;
+};
+
+static void appendBytes(void* context, void* data, int size) {
+    std::vector<uint8_t>* out = static_cast<std::vector<uint8_t>*>(context);
+    out->insert(out->end(), static_cast<uint8_t*>(data), static_cast<uint8_t*>(data) + size);
+}
+
+// FRIED_LOSSLESS against PNG. the PNG is written by stb_image_write, so its
+// size isn't what a good PNG encoder gets; only the decode time is compared.
+static void benchLossless(const Options& opt, const std::string& name, const uint8_t* image, int width, int height, std::vector<LosslessResult>& results) {
+    FRIED_EncodeParams eparams;
+    FRIED_InitEncodeParams(&eparams, FRIED_SAVEALPHA | FRIED_LOSSLESS, 0);
+    eparams.Threads = opt.threads;
+    FRIED_DecodeParams dparams;
+    FRIED_InitDecodeParams(&dparams);
+    dparams.Threads = opt.threads;
+
+    uint8_t* data = nullptr;
+    int32_t size = 0;
+    double encode = bestTime(opt.minTime, [&] { FreeFRIED(data); data = nullptr; }, [&] {
+        data = SaveFRIEDEx(image, width, height, &eparams, size);
+    });
+    if (!data) {
+        fprintf(stderr, "lossless encoding of %s failed\n", name.c_str());
+        return;
+    }
+
+    uint8_t* pixels = nullptr;
+    int32_t xout, yout, outSize;
+    double decode = bestTime(opt.minTime, [&] { FreeFRIED(pixels); pixels = nullptr; }, [&] {
+        LoadFRIEDEx(data, size, &dparams, xout, yout, outSize, pixels);
+    });
+    if (!pixels || memcmp(pixels, image, static_cast<size_t>(width) * height * 4) != 0)
+        fprintf(stderr, "lossless decoding of %s isn't exact\n", name.c_str());
+    FreeFRIED(pixels);
+    FreeFRIED(data);
+
+    std::vector<uint8_t> png;
+    stbi_write_png_to_func(appendBytes, &png, width, height, 4, image, width * 4);
+    uint8_t* pngPixels = nullptr;
+    double pngDecode = bestTime(opt.minTime, [&] { stbi_image_free(pngPixels); pngPixels = nullptr; }, [&] {
+        int w, h, channels;
+        pngPixels = stbi_load_from_memory(png.data(), static_cast<int>(png.size()), &w, &h, &channels, 4);
+    });
+    stbi_image_free(pngPixels);
+
+    results.push_back({ name, width, height, size, static_cast<int32_t>(png.size()), encode, decode, pngDecode });
+}
+
+static void writeJson(FILE* f, const Options& opt, const std::vector<StageResult>& stages, const std::vector<CodecResult>& codec, const std::vector<LosslessResult>& lossless) {
+    fprintf(f, "{\n");
+    fprintf(f, "  \"format\": %s,\n", jsonString(FRIED_FILE_VERSION).c_str());
+    fprintf(f, "  \"cpu_features\": %d,\n", FRIED::CpuFeatures());
+    fprintf(f, "  \"threads\": %d,\n", opt.threads);
+    fprintf(f, "  \"stages\": [\n");
+    for (size_t i = 0; i < stages.size(); i++) {
+        const StageResult& s = stages[i];
+        fprintf(f, "    { \"name\": %s, \"pixels\": %lld, \"bytes\": %lld, \"seconds\": %.9f, \"mpix_per_s\": %.2f, \"mb_per_s\": %.2f }%s\n",
+            jsonString(s.name).c_str(), static_cast<long long>(s.pixels), static_cast<long long>(s.bytes), s.seconds,
+            s.pixels / s.seconds * 1e-6, s.bytes / s.seconds * 1e-6, i + 1 < stages.size() ? "," : "");
+    }
+    fprintf(f, "  ],\n");
+    fprintf(f, "  \"codec\": [\n");
+    for (size_t i = 0; i < codec.size(); i++) {
+        const CodecResult& c = codec[i];
+        double mpix = c.width * static_cast<double>(c.height) * 1e-6;
+        fprintf(f, "    { \"image\": %s, \"width\": %d, \"height\": %d, \"quality\": %d, \"size\": %d, \"bits_per_pixel\": %.4f, "
+                   "\"encode_seconds\": %.6f, \"encode_mpix_per_s\": %.2f, \"encode_mb_per_s\": %.2f, "
+                   "\"decode_seconds\": %.6f, \"decode_mpix_per_s\": %.2f, \"decode_mb_per_s\": %.2f }%s\n",
+            jsonString(c.image).c_str(), c.width, c.height, c.quality, c.size, c.size * 8.0 / (mpix * 1e6),
+            c.encodeSeconds, mpix / c.encodeSeconds, mpix * 4 / c.encodeSeconds,
+            c.decodeSeconds, mpix / c.decodeSeconds, mpix * 4 / c.decodeSeconds, i + 1 < codec.size() ? "," : "");
+    }
+    fprintf(f, "  ],\n");
+    fprintf(f, "  \"lossless\": [\n");
+    for (size_t i = 0; i < lossless.size(); i++) {
+        const LosslessResult& l = lossless[i];
+        double mpix = l.width * static_cast<double>(l.height) * 1e-6;
+        fprintf(f, "    { \"image\": %s, \"width\": %d, \"height\": %d, \"size\": %d, \"png_size\": %d, "
+                   "\"encode_seconds\": %.6f, \"decode_seconds\": %.6f, \"decode_mpix_per_s\": %.2f, "
+                   "\"png_decode_seconds\": %.6f, \"png_decode_mpix_per_s\": %.2f, \"decode_speedup_vs_png\": %.3f }%s\n",
+            jsonString(l.image).c_str(), l.width, l.height, l.size, l.pngSize,
+            l.encodeSeconds, l.decodeSeconds, mpix / l.decodeSeconds,
+            l.pngDecodeSeconds, mpix / l.pngDecodeSeconds, l.pngDecodeSeconds / l.decodeSeconds, i + 1 < lossless.size() ? "," : "");
+    }
+    fprintf(f, "  ]\n");
+    fprintf(f, "}\n");
+}
+
+}
+
+int main(int argc, char** argv) {
+    Options opt;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--time" && i + 1 < argc)
+            opt.minTime = atof(argv[++i]);
+        else if (arg == "--threads" && i + 1 < argc)
+            opt.threads = atoi(argv[++i]);
+        else if (arg == "-o" && i + 1 < argc)
+            opt.output = argv[++i];
+        else if (arg == "--quick")
+            opt.quick = true;
+        else if (arg == "--no-simd")
+            opt.noSimd = true;
+        else if (arg[0] == '-') {
+            fprintf(stderr, "Usage: %s [--time seconds] [--threads n] [--quick] [--no-simd] [-o result.json] [images...]\n", argv[0]);
+            return 1;
+        } else
+            opt.corpus.push_back(argv[i]);
+    }
+
+    if (opt.noSimd)
+        FRIED::SetCpuFeatureMask(0);
+
+    std::vector<StageResult> stages = benchStages(opt);
+
+    // synthetic images, then the corpus
+    std::vector<CodecResult> codec;
+    std::vector<LosslessResult> lossless;
+    struct { int width, height; } sizes[] = { { 256, 256 }, { 1024, 1024 }, { 4096, 2048 } };
+    for (auto& s : sizes) {
+        if (opt.quick && s.width > 1024)
+            continue;
+
+        for (bool noise : { false, true }) {
+            std::vector<uint8_t> image = makeImage(s.width, s.height, noise);
+            const char* name = noise ? "synthetic-noise" : "synthetic-gradient";
+            benchCodec(opt, name, image.data(), s.width, s.height, codec);
+            benchLossless(opt, name, image.data(), s.width, s.height, lossless);
+        }
+    }
+
+    for (const char* path : opt.corpus) {
+        int width, height, channels;
+        uint8_t* image = stbi_load(path, &width, &height, &channels, 4);
+        if (!image) {
+            fprintf(stderr, "Failed to load image: %s\n", path);
+            continue;
+        }
+
+        benchCodec(opt, path, image, width, height, codec);
+        benchLossless(opt, path, image, width, height, lossless);
+        stbi_image_free(image);
+    }
+
+    FILE* f = opt.output ? fopen(opt.output, "w") : stdout;
+    if (!f) {
+        fprintf(stderr, "Failed to write output: %s\n", opt.output);
+        return 1;
+    }
+
+    writeJson(f, opt, stages, codec, lossless);
+    if (f != stdout)
+        fclose(f);
+    return 0;
+}
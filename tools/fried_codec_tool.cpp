@@ -1,8 +1,148 @@
 #include "fried/externalApi.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+static std::string lowerExtension(const fs::path& path) {
+    std::string ext = path.extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return ext;
+}
+
+static bool isImageFile(const fs::path& path) {
+    std::string ext = lowerExtension(path);
+    for (const char* known : { ".png", ".jpg", ".jpeg", ".bmp", ".tga", ".psd", ".gif", ".pnm", ".ppm", ".pgm" })
+        if (ext == known)
+            return true;
+    return false;
+}
+
+static bool isFriedFile(const fs::path& path) {
+    return lowerExtension(path) == ".fried";
+}
+
+// converts every matching file below inputDir to the same place below outputDir
+static int runBatch(bool encode, const fs::path& inputDir, const fs::path& outputDir, int32_t threads, const FRIED_EncodeParams& params) {
+    std::error_code ec;
+    if (!fs::is_directory(inputDir, ec)) {
+        std::cerr << "Not a directory: " << inputDir.string() << "\n";
+        return 1;
+    }
+
+    std::vector<std::string> inputs, outputs;
+    for (fs::recursive_directory_iterator it(inputDir, ec), end; !ec && it != end; it.increment(ec)) {
+        // per-file problems show up as failed jobs, they don't stop the scan
+        std::error_code fileEc;
+        const fs::path& path = it->path();
+        if (!it->is_regular_file(fileEc) || !(encode ? isImageFile(path) : isFriedFile(path)))
+            continue;
+
+        fs::path target = outputDir / fs::relative(path, inputDir, fileEc);
+        target.replace_extension(encode ? ".fried" : ".png");
+        fs::create_directories(target.parent_path(), fileEc);
+        inputs.push_back(path.string());
+        outputs.push_back(target.string());
+    }
+
+    if (ec) {
+        std::cerr << "Failed to scan " << inputDir.string() << ": " << ec.message() << "\n";
+        return 1;
+    }
+
+    std::vector<fried_batch_job> jobs(inputs.size());
+    for (size_t i = 0; i < jobs.size(); i++) {
+        jobs[i] = fried_batch_job();
+        jobs[i].inputPath = inputs[i].c_str();
+        jobs[i].outputPath = outputs[i].c_str();
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    int32_t count = static_cast<int32_t>(jobs.size());
+    int32_t done = encode ? fried_encode_batch_ex(jobs.data(), count, &params, threads)
+                          : fried_decode_batch(jobs.data(), count, threads);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    for (const fried_batch_job& job : jobs)
+        if (!job.ok)
+            std::cerr << "Failed: " << job.inputPath << "\n";
+
+    std::cout << done << " of " << count << " files converted in " << seconds << " s\n";
+    return done == count ? 0 : 1;
+}
+
+// sets the per-channel quantizer of option -c (Co/Cg) or -a (alpha). value
+// must be a whole number from 0 to 127.
+static bool channelQualityOption(const std::string& opt, const char* value, FRIED_EncodeParams& params) {
+    char* end = nullptr;
+    long q = strtol(value, &end, 10);
+    if (end == value || *end || q < 0 || q > 127)
+        return false;
+
+    (opt == "-c" ? params.ChromaQuality : params.AlphaQuality) = static_cast<int32_t>(q);
+    return true;
+}
+
+// parses the encode option argv[i] (-s, -l, -p, or -c/-a followed by a
+// value, which i is moved to) into params. prints an error and returns false
+// for anything else.
+static bool encodeOption(int argc, char** argv, int& i, FRIED_EncodeParams& params) {
+    std::string opt = argv[i];
+    if (opt == "-s")
+        params.Flags |= FRIED_CHROMASUBSAMPLE;
+    else if (opt == "-l")
+        params.Flags |= FRIED_LOSSLESS;
+    else if (opt == "-p")
+        params.Flags |= FRIED_PROGRESSIVE;
+    else if ((opt == "-c" || opt == "-a") && i + 1 < argc) {
+        if (!channelQualityOption(opt, argv[++i], params)) {
+            std::cerr << "Invalid quantizer for " << opt << ": " << argv[i] << " (0 to 127)\n";
+            return false;
+        }
+    }
+    else {
+        std::cerr << "Invalid option: " << opt << "\n";
+        return false;
+    }
+    return true;
+}
 
 int main(int argc, char** argv) {
-    if (argc > 5 || argc < 4) {
-        std::cerr << "Usage: " << argv[0] << " [encode|decode] input output [compression if encode]\n";
+    FRIED_EncodeParams params;
+    FRIED_InitEncodeParams(&params, FRIED_DEFAULT | FRIED_SAVEALPHA, 31); // same as fried_encode
+
+    if (argc >= 2 && std::string(argv[1]) == "batch") {
+        if (argc < 5) {
+            std::cerr << "Usage: " << argv[0] << " batch [encode|decode] inputDir outputDir [-j threads] [-q compression] [-c chroma] [-a alpha] [-s] [-l] [-p]\n";
+            return 1;
+        }
+
+        std::string mode = argv[2];
+        if (mode != "encode" && mode != "decode") {
+            std::cerr << "Invalid mode: " << mode << "\n";
+            return 1;
+        }
+
+        int32_t threads = 0; // one per core
+        for (int i = 5; i < argc; i++) {
+            std::string opt = argv[i];
+            if (opt == "-j" && i + 1 < argc)
+                threads = atoi(argv[++i]);
+            else if (opt == "-q" && i + 1 < argc)
+                params.Quality = static_cast<uint8_t>(atoi(argv[++i]));
+            else if (!encodeOption(argc, argv, i, params))
+                return 1;
+        }
+
+        return runBatch(mode == "encode", argv[3], argv[4], threads, params);
+    }
+
+    if (argc < 4) {
+        std::cerr << "Usage: " << argv[0] << " [encode|decode] input output [compression [-c chroma] [-a alpha] [-s] [-l] [-p] if encode]\n";
+        std::cerr << "       " << argv[0] << " batch [encode|decode] inputDir outputDir [-j threads] [-q compression] [-c chroma] [-a alpha] [-s] [-l] [-p]\n";
         return 1;
     }
 
@@ -10,14 +150,22 @@ int main(int argc, char** argv) {
     const char* inputPath = argv[2];
     const char* outputPath = argv[3];
     if (mode == "encode") {
-        if (argc != 5){
-            std::cerr << "Usage: " << argv[0] << " encode input output compression\n";
+        if (argc < 5){
+            std::cerr << "Usage: " << argv[0] << " encode input output compression [-c chroma] [-a alpha] [-s] [-l] [-p]\n";
             return 1;
         }
         const char* compression = argv[4];
-        const int_fast32_t quality = atoi(compression);
-        return fried_encode(inputPath, outputPath, quality) ? 0 : 1;
+        params.Quality = static_cast<uint8_t>(atoi(compression));
+        for (int i = 5; i < argc; i++) {
+            if (!encodeOption(argc, argv, i, params))
+                return 1;
+        }
+        return fried_encode_ex(inputPath, outputPath, &params) ? 0 : 1;
     } else if (mode == "decode") {
+        if (argc != 4) {
+            std::cerr << "Usage: " << argv[0] << " decode input output\n";
+            return 1;
+        }
         return fried_decode(inputPath, outputPath) ? 0 : 1;
     } else {
         std::cerr << "Invalid mode: " << mode << "\n";